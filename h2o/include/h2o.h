@@ -50,10 +50,13 @@ extern "C" {
 #include <time.h>
 #include <openssl/ssl.h>
 #include "h2o/filecache.h"
+#include "h2o/fileio.h"
+#include "h2o/happy_eyeballs.h"
 #include "h2o/hostinfo.h"
 #include "h2o/memcached.h"
 #include "h2o/linklist.h"
 #include "h2o/http1client.h"
+#include "h2o/http2client.h"
 #include "h2o/memory.h"
 #include "h2o/multithread.h"
 #include "h2o/rand.h"
@@ -77,6 +80,11 @@ extern "C" {
 #define H2O_USE_BROTLI 0
 #endif
 
+#ifndef H2O_USE_ZSTD
+/* set by the build system when libzstd is found */
+#define H2O_USE_ZSTD 0
+#endif
+
 #ifndef H2O_MAX_HEADERS
 #define H2O_MAX_HEADERS 100
 #endif
@@ -102,10 +110,28 @@ extern "C" {
 #define H2O_DEFAULT_HTTP1_UPGRADE_TO_HTTP2 1
 #define H2O_DEFAULT_HTTP2_IDLE_TIMEOUT_IN_SECS 10
 #define H2O_DEFAULT_HTTP2_IDLE_TIMEOUT (H2O_DEFAULT_HTTP2_IDLE_TIMEOUT_IN_SECS * 1000)
+#define H2O_DEFAULT_OVERLOAD_RETRY_AFTER 1 /* in seconds */
+#define H2O_DEFAULT_FILECACHE_REVALIDATE_INTERVAL_IN_SECS 1
+#define H2O_DEFAULT_FILECACHE_REVALIDATE_INTERVAL (H2O_DEFAULT_FILECACHE_REVALIDATE_INTERVAL_IN_SECS * 1000)
+#define H2O_DEFAULT_FILECACHE_CONTENT_MAX_OBJECT_SIZE (64 * 1024)
+#define H2O_DEFAULT_FILECACHE_CONTENT_DURATION_IN_SECS 3600
+#define H2O_DEFAULT_FILECACHE_CONTENT_DURATION (H2O_DEFAULT_FILECACHE_CONTENT_DURATION_IN_SECS * 1000)
+#define H2O_FILECACHE_DIR_DURATION (3600 * 1000) /* in milliseconds */
+#define H2O_COMPRESS_GZIP_MAX_QUALITY 9
+#define H2O_COMPRESS_BROTLI_MAX_QUALITY 11
+#define H2O_COMPRESS_ZSTD_MAX_QUALITY 19
+#define H2O_DEFAULT_COMPRESS_CACHE_MAX_OBJECT_SIZE (256 * 1024)
+#define H2O_COMPRESS_CACHE_DURATION (3600 * 1000) /* in milliseconds */
 #define H2O_DEFAULT_PROXY_IO_TIMEOUT_IN_SECS 30
 #define H2O_DEFAULT_PROXY_IO_TIMEOUT (H2O_DEFAULT_PROXY_IO_TIMEOUT_IN_SECS * 1000)
 #define H2O_DEFAULT_PROXY_WEBSOCKET_TIMEOUT_IN_SECS 300
 #define H2O_DEFAULT_PROXY_WEBSOCKET_TIMEOUT (H2O_DEFAULT_PROXY_WEBSOCKET_TIMEOUT_IN_SECS * 1000)
+#define H2O_DEFAULT_PROXY_HEALTH_CHECK_INTERVAL 5000
+#define H2O_DEFAULT_PROXY_EJECTION_TIME 10000
+#define H2O_DEFAULT_PROXY_SLOW_START 10000
+#define H2O_DEFAULT_PROXY_PREWARM_CONNECT_RATE 10
+#define H2O_DEFAULT_PROXY_SSL_SESSION_CACHE_CAPACITY 4096
+#define H2O_DEFAULT_PROXY_SSL_SESSION_CACHE_DURATION 86400000 /* 24 hours */
 
 typedef struct st_h2o_conn_t h2o_conn_t;
 typedef struct st_h2o_context_t h2o_context_t;
@@ -400,6 +426,22 @@ struct st_h2o_globalconf_t {
         int emit_x_forwarded_headers;
     } proxy;
 
+    struct {
+        /**
+         * a thread is considered overloaded while the delay of its timers exceeds the value (in milliseconds, or 0 if disabled)
+         */
+        uint64_t max_loop_lag;
+        /**
+         * a thread is considered overloaded while the average time spent for handling the events notified at once exceeds the
+         * value (in milliseconds, or 0 if disabled)
+         */
+        uint64_t max_queue_delay;
+        /**
+         * value of the retry-after header sent with the 503 responses while being overloaded (in seconds)
+         */
+        unsigned retry_after;
+    } overload;
+
     /**
      * mimemap
      */
@@ -411,8 +453,82 @@ struct st_h2o_globalconf_t {
     struct {
         /* capacity of the filecache */
         size_t capacity;
+        /**
+         * time the entries persist (in milliseconds); if zero, the cache is cleared once every iteration of the event loop
+         */
+        uint64_t ttl;
+        /**
+         * interval of revalidating the entries using stat(2) when inotify cannot be used (in milliseconds)
+         */
+        uint64_t revalidate_interval;
+        /**
+         * cache of the content of small files, shared among the threads
+         */
+        struct {
+            /**
+             * total size of the files being cached (in bytes), or zero if disabled
+             */
+            size_t capacity;
+            /**
+             * maximum size of the files to be cached
+             */
+            size_t max_object_size;
+            /**
+             * time the entries persist (in milliseconds)
+             */
+            uint64_t duration;
+            /**
+             * the cache (or NULL if disabled); keys are the paths of the files, and the values are validated against the result of
+             * fstat(2) retained by the filecache of each context
+             */
+            h2o_cache_t *cache;
+        } content;
+        /**
+         * cache of the index files being resolved and the directory listings being rendered, shared among the threads
+         */
+        struct {
+            /**
+             * total size of the entries (in bytes), or zero if disabled
+             */
+            size_t capacity;
+            /**
+             * the cache (or NULL if disabled); the entries are validated against the result of stat(2) of the directories
+             */
+            h2o_cache_t *cache;
+        } dir;
     } filecache;
 
+    struct {
+        /**
+         * cache of the compressed responses, shared among the threads
+         */
+        struct {
+            /**
+             * total size of the compressed responses being cached (in bytes), or zero if disabled
+             */
+            size_t capacity;
+            /**
+             * maximum size of the responses to be cached (before and after compression)
+             */
+            size_t max_object_size;
+            /**
+             * the cache (or NULL if disabled); keys are built from the encoding, the quality, and either the URL and the strong
+             * etag or the hash of the uncompressed body
+             */
+            h2o_cache_t *cache;
+        } cache;
+    } compress;
+
+    /**
+     * precompression of static files
+     */
+    struct {
+        /**
+         * directory in which the compressed files are stored (or NULL if not configured)
+         */
+        char *dir;
+    } precompress;
+
     /* status */
     h2o_status_callbacks_t statuses;
 
@@ -530,6 +646,8 @@ struct st_h2o_context_t {
      */
     struct {
         h2o_multithread_receiver_t hostinfo_getaddr;
+        h2o_multithread_receiver_t fileio;
+        h2o_multithread_receiver_t compress;
     } receivers;
     /**
      * open file cache
@@ -598,8 +716,93 @@ struct st_h2o_context_t {
          * timeout handler used by the default client context
          */
         h2o_timeout_t io_timeout;
+        struct {
+            /**
+             * number of requests resent to the upstream after the connection was closed before receiving a response
+             */
+            uint64_t retries;
+            /**
+             * number of requests that would have been resent but were not, due to the retry budget being exhausted
+             */
+            uint64_t retries_suppressed;
+        } events;
+        /**
+         * retry budget being consumed (see lib/core/proxy.c)
+         */
+        size_t _retry_debt;
     } proxy;
 
+    struct {
+        /**
+         * smoothed delay of the timers (in milliseconds); always measured, since the compression level is adjusted by the value
+         */
+        uint64_t loop_lag;
+        /**
+         * set while the thread is overloaded; new connections and requests are shed until the load decreases
+         */
+        int is_overloaded;
+        struct {
+            /**
+             * number of times the thread has become overloaded
+             */
+            uint64_t episodes;
+            /**
+             * number of requests rejected due to the thread being overloaded
+             */
+            uint64_t shed_requests;
+        } events;
+        /**
+         * timeout entry used for measuring the load (see lib/core/context.c)
+         */
+        h2o_timeout_entry_t _probe;
+#if H2O_USE_LIBUV
+        /**
+         * time spent for handling the I/O events in each iteration of the loop; recorded by the check handle only when
+         * overload-max-queue-delay is set, since libuv does not measure it by itself
+         */
+        h2o_sliding_counter_t _exec_time_counter;
+        uv_check_t _exec_time_check;
+#endif
+    } overload;
+
+    struct {
+        /**
+         * number of responses compressed using each quality level (see lib/handler/compress.c)
+         */
+        struct {
+            uint64_t gzip[H2O_COMPRESS_GZIP_MAX_QUALITY + 1];
+            uint64_t brotli[H2O_COMPRESS_BROTLI_MAX_QUALITY + 1];
+            uint64_t zstd[H2O_COMPRESS_ZSTD_MAX_QUALITY + 1];
+        } quality_histogram;
+        struct {
+            /**
+             * number of responses sent from the cache of compressed responses
+             */
+            uint64_t hits;
+            /**
+             * number of compressed responses stored to the cache
+             */
+            uint64_t stores;
+        } cache;
+        /**
+         * number of chunks compressed by the pool of threads (see compress-offload)
+         */
+        uint64_t offloads;
+    } compress;
+
+    struct {
+        struct {
+            /**
+             * number of responses sent from the content cache (see lib/handler/file.c)
+             */
+            uint64_t hits;
+            /**
+             * number of files stored to the content cache
+             */
+            uint64_t stores;
+        } content_cache;
+    } file;
+
     /**
      * pointer to per-module configs
      */
@@ -801,6 +1004,13 @@ struct st_h2o_conn_t {
      * callbacks
      */
     const h2o_conn_callbacks_t *callbacks;
+    /**
+     * numeric representation of the peer address cached by h2o_conn_get_numeric_peername (internal)
+     */
+    struct {
+        size_t len; /* 0 if not yet stringified, SIZE_MAX if unavailable */
+        char buf[sizeof("ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255")];
+    } _numeric_peername;
 };
 
 /**
@@ -816,6 +1026,10 @@ typedef struct st_h2o_req_overrides_t {
      * specific client context (or NULL)
      */
     h2o_http1client_ctx_t *client_ctx;
+    /**
+     * if non-NULL, the request is forwarded using HTTP/2 over the connections maintained by the pool
+     */
+    h2o_http2client_pool_t *http2client_pool;
     /**
      * socketpool to be used when connecting to upstream (or NULL)
      */
@@ -844,6 +1058,10 @@ typedef struct st_h2o_req_overrides_t {
      * whether if the PROXY header should be sent
      */
     unsigned use_proxy_protocol : 1;
+    /**
+     * whether if idempotent requests should be resent when the pooled connection is found closed before receiving a response
+     */
+    unsigned retry_idempotent : 1;
 } h2o_req_overrides_t;
 
 /**
@@ -1122,6 +1340,11 @@ size_t h2o_stringify_protocol_version(char *dst, int version);
  * builds the proxy header defined by the PROXY PROTOCOL
  */
 size_t h2o_stringify_proxy_header(h2o_conn_t *conn, char *buf);
+/**
+ * returns the numeric representation of the peer address (buf should be NI_MAXHOST in length), or SIZE_MAX if unavailable. The
+ * result is cached within the connection.
+ */
+size_t h2o_conn_get_numeric_peername(h2o_conn_t *conn, char *buf);
 #define H2O_PROXY_HEADER_MAX_LENGTH                                                                                                \
     (sizeof("PROXY TCP6 ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff 65535 65535\r\n") - 1)
 /**
@@ -1137,6 +1360,7 @@ h2o_iovec_vector_t h2o_extract_push_path_from_link_header(h2o_mem_pool_t *pool,
 int h2o_get_compressible_types(const h2o_headers_t *headers);
 #define H2O_COMPRESSIBLE_GZIP 1
 #define H2O_COMPRESSIBLE_BROTLI 2
+#define H2O_COMPRESSIBLE_ZSTD 4
 /**
  * builds destination URL or path, by contatenating the prefix and path_info of the request
  */
@@ -1350,6 +1574,10 @@ void h2o_context_dispose_pathconf_context(h2o_context_t *ctx, h2o_pathconf_t *pa
  */
 static struct timeval *h2o_get_timestamp(h2o_context_t *ctx, h2o_mem_pool_t *pool, h2o_timestamp_t *ts);
 void h2o_context_update_timestamp_cache(h2o_context_t *ctx);
+/**
+ * returns if the thread is overloaded, in which case new connections and requests should be shed
+ */
+static int h2o_context_is_overloaded(h2o_context_t *ctx);
 /**
  * returns per-module context set
  */
@@ -1556,18 +1784,41 @@ typedef struct st_h2o_compress_context_t {
 
 typedef struct st_h2o_compress_args_t {
     size_t min_size;
+    /**
+     * when `min_quality` is not -1, the quality is chosen for each response between `min_quality` and `quality`, depending on the
+     * load of the event loop, the size and the type of the response
+     */
     struct {
-        int quality; /* -1 if disabled */
+        int quality;     /* -1 if disabled */
+        int min_quality; /* -1 if not adaptive */
     } gzip;
     struct {
-        int quality; /* -1 if disabled */
+        int quality;     /* -1 if disabled */
+        int min_quality; /* -1 if not adaptive */
     } brotli;
+    struct {
+        int quality;     /* -1 if disabled */
+        int min_quality; /* -1 if not adaptive */
+    } zstd;
+    /**
+     * if the compressor should be run by the thread pool instead of the event loop
+     */
+    int offload;
 } h2o_compress_args_t;
 
 /**
- * registers the gzip/brotli encoding output filter (added by default, for now)
+ * maximum number of threads used for running the compressors being offloaded
+ */
+extern size_t h2o_compress_max_threads;
+
+/**
+ * registers the gzip/brotli/zstd encoding output filter (added by default, for now)
  */
 void h2o_compress_register(h2o_pathconf_t *pathconf, h2o_compress_args_t *args);
+/**
+ * function that receives the output of the compressors run by the thread pool
+ */
+void h2o_compress_receiver(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages);
 /**
  * instantiates the gzip compressor
  */
@@ -1577,7 +1828,11 @@ h2o_compress_context_t *h2o_compress_gzip_open(h2o_mem_pool_t *pool, int quality
  */
 h2o_compress_context_t *h2o_compress_brotli_open(h2o_mem_pool_t *pool, int quality, size_t estimated_cotent_length);
 /**
- * registers the configurator for the gzip/brotli output filter
+ * instantiates the zstd compressor (only available if H2O_USE_ZSTD is set)
+ */
+h2o_compress_context_t *h2o_compress_zstd_open(h2o_mem_pool_t *pool, int quality);
+/**
+ * registers the configurator for the gzip/brotli/zstd output filter
  */
 void h2o_compress_register_configurator(h2o_globalconf_t *conf);
 
@@ -1591,6 +1846,36 @@ void h2o_throttle_resp_register(h2o_pathconf_t *pathconf);
  */
 void h2o_throttle_resp_register_configurator(h2o_globalconf_t *conf);
 
+/* lib/handler/concurrency_limit.c */
+
+typedef struct st_h2o_concurrency_limit_config_t {
+    /**
+     * maximum number of requests being handled at once
+     */
+    size_t max_requests;
+    /**
+     * maximum number of requests waiting for a slot; requests exceeding the limit are rejected with 503
+     */
+    size_t max_queue_length;
+    /**
+     * maximum time (in milliseconds) a request waits for a slot before being rejected with 503
+     */
+    uint64_t max_queue_wait;
+    /**
+     * if the limit is shared by all the threads (otherwise the limit is applied to each thread)
+     */
+    int process_wide;
+} h2o_concurrency_limit_config_t;
+
+/**
+ * registers a handler that limits the number of requests being passed to the handlers registered earlier to the path
+ */
+void h2o_concurrency_limit_register(h2o_pathconf_t *pathconf, h2o_concurrency_limit_config_t *config);
+/**
+ * configurator
+ */
+void h2o_concurrency_limit_register_configurator(h2o_globalconf_t *conf);
+
 /* lib/errordoc.c */
 
 typedef struct st_h2o_errordoc_t {
@@ -1631,20 +1916,52 @@ void h2o_expires_register_configurator(h2o_globalconf_t *conf);
 /* lib/fastcgi.c */
 
 typedef struct st_h2o_fastcgi_handler_t h2o_fastcgi_handler_t;
+typedef struct st_h2o_fastcgi_workers_t h2o_fastcgi_workers_t;
 
 #define H2O_DEFAULT_FASTCGI_IO_TIMEOUT 30000
+#define H2O_DEFAULT_FASTCGI_MULTIPLEX_MAX_REQUESTS 32
+#define H2O_DEFAULT_FASTCGI_MULTIPLEX_IDLE_TIMEOUT 10000 /* used when keepalive_timeout is zero */
+#define H2O_DEFAULT_FASTCGI_WORKERS_IDLE_TIMEOUT 10000
+#define H2O_DEFAULT_FASTCGI_WORKERS_MAX_QUEUED 1024
 
 typedef struct st_h2o_fastcgi_config_vars_t {
     uint64_t io_timeout;
     uint64_t keepalive_timeout; /* 0 to disable */
     h2o_iovec_t document_root;  /* .base=NULL if not set */
     int send_delegated_uri;     /* whether to send the rewritten HTTP_HOST & REQUEST_URI by delegation, or the original */
+    struct {
+        int enabled;         /* whether to send multiple requests over one connection, if the application supports FCGI_MPXS_CONNS */
+        size_t max_requests; /* maximum number of requests in flight per connection */
+    } multiplex;
     struct {
         void (*dispose)(h2o_fastcgi_handler_t *handler, void *data);
         void *data;
     } callbacks;
 } h2o_fastcgi_config_vars_t;
 
+typedef struct st_h2o_fastcgi_workers_config_t {
+    size_t min_workers;
+    size_t max_workers;
+    uint64_t idle_timeout;  /* workers above min_workers are terminated after being idle for given milliseconds */
+    size_t max_queued;      /* maximum number of requests waiting for a worker to become available */
+    uint64_t queue_timeout; /* maximum milliseconds a request waits for a worker (or 0 to use io_timeout) */
+} h2o_fastcgi_workers_config_t;
+
+typedef struct st_h2o_fastcgi_workers_status_t {
+    h2o_iovec_t path;
+    size_t min_workers;
+    size_t max_workers;
+    size_t num_running;
+    size_t num_busy;
+    size_t num_queued;
+    uint64_t num_spawned;
+    uint64_t num_terminated;
+    uint64_t num_requests;
+    uint64_t num_queue_rejected;
+    uint64_t num_queue_timeouts;
+    uint64_t latency; /* moving average of the milliseconds a worker spends for handling a request */
+} h2o_fastcgi_workers_status_t;
+
 /**
  * registers the fastcgi handler to the context
  */
@@ -1659,6 +1976,24 @@ h2o_fastcgi_handler_t *h2o_fastcgi_register_by_address(h2o_pathconf_t *pathconf,
  * registers the fastcgi handler to the context
  */
 h2o_fastcgi_handler_t *h2o_fastcgi_register_by_spawnproc(h2o_pathconf_t *pathconf, char **argv, h2o_fastcgi_config_vars_t *vars);
+/**
+ * creates a pool of worker processes. The i-th worker is spawned by running `argv` with `listen_fds[i]` mapped to stdin and the
+ * read side of a pipe mapped to fd 5, and is expected to exit when the pipe is closed (see share/h2o/kill-on-close).
+ * `listen_fds` should contain `config->max_workers` listening sockets, the ownership of which is transferred to the pool.
+ * `min_workers` processes are spawned immediately.
+ * @return the pool, or NULL if failed to spawn the workers
+ */
+h2o_fastcgi_workers_t *h2o_fastcgi_workers_create(char **argv, int *listen_fds, h2o_fastcgi_workers_config_t *config);
+/**
+ * registers the fastcgi handler that dispatches the requests to the pool of worker processes (the handler takes the ownership of
+ * the pool)
+ */
+h2o_fastcgi_handler_t *h2o_fastcgi_register_by_workers(h2o_pathconf_t *pathconf, h2o_fastcgi_workers_t *workers,
+                                                       h2o_fastcgi_config_vars_t *vars);
+/**
+ * iterates through the pools of worker processes, calling the callback with a snapshot of the state
+ */
+void h2o_fastcgi_foreach_workers(void (*cb)(h2o_fastcgi_workers_status_t *status, void *data), void *data);
 /**
  * registers the configurator
  */
@@ -1666,7 +2001,14 @@ void h2o_fastcgi_register_configurator(h2o_globalconf_t *conf);
 
 /* lib/file.c */
 
-enum { H2O_FILE_FLAG_NO_ETAG = 0x1, H2O_FILE_FLAG_DIR_LISTING = 0x2, H2O_FILE_FLAG_SEND_COMPRESSED = 0x4 };
+enum {
+    H2O_FILE_FLAG_NO_ETAG = 0x1,
+    H2O_FILE_FLAG_DIR_LISTING = 0x2,
+    H2O_FILE_FLAG_SEND_COMPRESSED = 0x4,
+    H2O_FILE_FLAG_ASYNC_IO = 0x8, /* opens and reads the files using the file I/O threads (see h2o/fileio.h) */
+    H2O_FILE_FLAG_PRECOMPRESS = 0x10, /* compresses the files in background, and serves the result (see globalconf.precompress) */
+    H2O_FILE_FLAG_MMAP = 0x20         /* sends the files from the mappings shared by the requests (see h2o_filecache_get_mapping) */
+};
 
 typedef struct st_h2o_file_handler_t h2o_file_handler_t;
 
@@ -1741,12 +2083,23 @@ typedef struct st_h2o_proxy_config_vars_t {
     uint64_t io_timeout;
     unsigned preserve_host : 1;
     unsigned use_proxy_protocol : 1;
+    unsigned use_http2 : 1; /* multiplex the requests over HTTP/2 connections (requires keepalive_timeout to be non-zero) */
+    unsigned retry_idempotent : 1;
     uint64_t keepalive_timeout; /* in milliseconds; set to zero to disable keepalive */
     struct {
         int enabled;
         uint64_t timeout;
     } websocket;
     SSL_CTX *ssl_ctx; /* optional */
+    struct {
+        char *path; /* path to which the active health checks are sent (or NULL if not being used) */
+        uint64_t interval; /* in milliseconds */
+        h2o_socketpool_health_config_t config;
+    } health_check;
+    struct {
+        size_t min_idle;       /* number of idle connections each thread keeps open (0 to disable) */
+        unsigned connect_rate; /* max. number of connections each thread establishes per second for keeping them idle */
+    } prewarm;
 } h2o_proxy_config_vars_t;
 
 /**
@@ -1830,6 +2183,7 @@ inline h2o_conn_t *h2o_create_connection(size_t sz, h2o_context_t *ctx, h2o_host
 	conn->id = InterlockedIncrement(&h2o_connection_id);
 #endif
     conn->callbacks = callbacks;
+    conn->_numeric_peername.len = 0;
 
     return conn;
 }
@@ -1918,6 +2272,11 @@ inline struct timeval *h2o_get_timestamp(h2o_context_t *ctx, h2o_mem_pool_t *poo
     return &ctx->_timestamp_cache.tv_at;
 }
 
+inline int h2o_context_is_overloaded(h2o_context_t *ctx)
+{
+    return ctx->overload.is_overloaded;
+}
+
 inline void *h2o_context_get_handler_context(h2o_context_t *ctx, h2o_handler_t *handler)
 {
     return ctx->_module_configs[handler->_config_slot];
@@ -66,6 +66,14 @@ enum {
  * creates a new cache
  */
 h2o_cache_t *h2o_cache_create(int flags, size_t capacity, uint64_t duration, void (*destroy_cb)(h2o_iovec_t value));
+/**
+ * returns the capacity given to h2o_cache_create
+ */
+size_t h2o_cache_get_capacity(h2o_cache_t *cache);
+/**
+ * returns the duration given to h2o_cache_create
+ */
+uint64_t h2o_cache_get_duration(h2o_cache_t *cache);
 /**
  * destroys a cache
  */
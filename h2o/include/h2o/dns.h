@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef h2o__dns_h
+#define h2o__dns_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _MSC_VER
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include "h2o/memory.h"
+#include "h2o/socket.h"
+
+/**
+ * the stub resolver runs on top of libuv (UDP handles and timers); other bindings use the getaddrinfo threads
+ */
+#ifndef H2O_USE_DNS_RESOLVER
+#if H2O_USE_LIBUV
+#define H2O_USE_DNS_RESOLVER 1
+#else
+#define H2O_USE_DNS_RESOLVER 0
+#endif
+#endif
+
+#define H2O_DNS_MAX_NAMESERVERS 3
+#define H2O_DNS_DEFAULT_TIMEOUT 5000
+#define H2O_DNS_DEFAULT_ATTEMPTS 2
+
+typedef struct st_h2o_dns_query_t h2o_dns_query_t;
+
+/**
+ * callback called when a query completes. `ai` (if not NULL) is allocated as a single chunk, and is owned by the callee (i.e. it
+ * should be released by calling free(3))
+ */
+typedef void (*h2o_dns_resolve_cb)(h2o_dns_query_t *query, const char *errstr, struct addrinfo *ai, void *data);
+
+typedef struct st_h2o_dns_hosts_entry_t {
+    char *name;
+    int family;
+    union {
+        struct in_addr v4;
+        struct in6_addr v6;
+    } addr;
+} h2o_dns_hosts_entry_t;
+
+/**
+ * resolver configuration, usually loaded from /etc/resolv.conf and /etc/hosts. The object is read-only once loaded, and can be
+ * shared among threads.
+ */
+typedef struct st_h2o_dns_config_t {
+    struct {
+        struct sockaddr_storage addr;
+        socklen_t len;
+    } nameservers[H2O_DNS_MAX_NAMESERVERS];
+    size_t num_nameservers;
+    /**
+     * timeout of each attempt (in milliseconds)
+     */
+    uint64_t timeout;
+    /**
+     * number of times each nameserver is tried
+     */
+    unsigned attempts;
+    unsigned ndots;
+    /**
+     * if search domains are configured (names that would be subject to the search list are not handled by the stub resolver)
+     */
+    int has_search;
+    /**
+     * address families configured on the host (used for handling AI_ADDRCONFIG)
+     */
+    struct {
+        unsigned char ipv4 : 1;
+        unsigned char ipv6 : 1;
+    } addrconfig;
+    H2O_VECTOR(h2o_dns_hosts_entry_t) hosts;
+    /**
+     * identity of the files the configuration was loaded from, at the time of loading (see h2o_dns_config_is_modified)
+     */
+    struct {
+        const char *path;
+        ino_t ino;
+        off_t size;
+        time_t mtime;
+    } _files[2];
+} h2o_dns_config_t;
+
+extern const char *h2o_dns_error_not_found;
+extern const char *h2o_dns_error_no_address;
+extern const char *h2o_dns_error_server_failure;
+extern const char *h2o_dns_error_timeout;
+
+/**
+ * initializes the configuration with the default values (without any nameserver)
+ */
+void h2o_dns_config_init(h2o_dns_config_t *config);
+/**
+ * disposes the configuration
+ */
+void h2o_dns_config_dispose(h2o_dns_config_t *config);
+/**
+ * parses the content of resolv.conf(5)
+ */
+void h2o_dns_config_parse_resolv_conf(h2o_dns_config_t *config, h2o_iovec_t src);
+/**
+ * parses the content of hosts(5)
+ */
+void h2o_dns_config_parse_hosts(h2o_dns_config_t *config, h2o_iovec_t src);
+/**
+ * loads the configuration of the system
+ * @return 0 if successful, or -1 if the stub resolver cannot be used (e.g. resolv.conf does not exist)
+ */
+int h2o_dns_config_load(h2o_dns_config_t *config);
+/**
+ * returns if any of the files the configuration was loaded from has been modified, created, or removed since then
+ */
+int h2o_dns_config_is_modified(const h2o_dns_config_t *config);
+/**
+ * returns if a lookup can be handled by the stub resolver (see h2o_dns_resolve), or if it should be delegated to getaddrinfo
+ * @param port upon success, the port number converted from `serv` is stored
+ */
+int h2o_dns_can_resolve(const h2o_dns_config_t *config, const char *name, const char *serv, const struct addrinfo *hints,
+                        uint16_t *port);
+/**
+ * resolves a name by consulting the hosts file and then the nameservers, without blocking the event loop. The callback is always
+ * called asynchronously, unless the query is cancelled.
+ * @param config configuration; it must outlive the query
+ */
+h2o_dns_query_t *h2o_dns_resolve(h2o_loop_t *loop, const h2o_dns_config_t *config, const char *name, uint16_t port,
+                                 const struct addrinfo *hints, h2o_dns_resolve_cb cb, void *data);
+/**
+ * cancels a query
+ */
+void h2o_dns_cancel(h2o_dns_query_t *query);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
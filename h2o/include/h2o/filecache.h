@@ -23,6 +23,7 @@
 #define h2o__filecache_h
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <time.h>
 #include "h2o/linklist.h"
@@ -35,6 +36,14 @@ typedef struct st_h2o_filecache_ref_t {
     int fd;
     size_t _refcnt;
     h2o_linklist_t _lru;
+    uint64_t _expires_at;
+    uint64_t _revalidate_at;
+    struct st_h2o_filecache_watch_t *_watch;
+    struct {
+        char *base; /* NULL if not mapped */
+        size_t len;
+        int slot; /* index of the table of mappings consulted by the SIGBUS handler */
+    } _mmap;
     union {
         struct {
 #ifndef _MSC_VER
@@ -63,10 +72,45 @@ typedef struct st_h2o_filecache_t h2o_filecache_t;
 h2o_filecache_t *h2o_filecache_create(size_t capacity);
 void h2o_filecache_destroy(h2o_filecache_t *cache);
 void h2o_filecache_clear(h2o_filecache_t *cache);
+/**
+ * lets the entries persist across the calls to h2o_filecache_update for `ttl` milliseconds. The entries are invalidated when the
+ * files are modified, by using inotify if available, or by revalidating the entries using stat(2) once every
+ * `revalidate_interval` milliseconds
+ */
+void h2o_filecache_set_ttl(h2o_filecache_t *cache, uint64_t ttl, uint64_t revalidate_interval);
+/**
+ * should be called once every iteration of the event loop; clears the cache if TTL is not set, or evicts the expired entries
+ */
+void h2o_filecache_update(h2o_filecache_t *cache, uint64_t now);
+/**
+ * returns if a valid entry exists for given path
+ */
+int h2o_filecache_is_cached(h2o_filecache_t *cache, const char *path);
+/**
+ * removes the entry from the cache if it is still being cached, so that the file is opened again by the next lookup. The
+ * references being held remain usable until they are closed.
+ */
+void h2o_filecache_invalidate(h2o_filecache_t *cache, h2o_filecache_ref_t *ref);
 
 h2o_filecache_ref_t *h2o_filecache_open_file(h2o_filecache_t *cache, const char *path, int oflag);
+/**
+ * registers a file that has been opened outside of the cache (e.g. by using h2o_fileio_submit); `fd` is -1 and `open_err` is the
+ * error if the open failed. The ownership of `fd` is transferred to the cache.
+ */
+h2o_filecache_ref_t *h2o_filecache_open_file_with_fd(h2o_filecache_t *cache, const char *path, int fd, int open_err);
 void h2o_filecache_close_file(h2o_filecache_ref_t *ref);
 struct tm *h2o_filecache_get_last_modified(h2o_filecache_ref_t *ref, char *outbuf);
 size_t h2o_filecache_get_etag(h2o_filecache_ref_t *ref, char *outbuf);
+/**
+ * maps the entire file read-only, returning the mapping, or {NULL, 0} if failed (or if the file is empty). The mapping is shared by
+ * the users of the entry and is unmapped when the last reference is closed. If the file gets truncated while being mapped, the
+ * pages beyond the new end of the file are replaced by zero-filled pages when being accessed, instead of the process being killed
+ * by SIGBUS; see h2o_filecache_mapping_is_truncated.
+ */
+h2o_iovec_t h2o_filecache_get_mapping(h2o_filecache_ref_t *ref);
+/**
+ * returns if the file has been found truncated while accessing the mapping
+ */
+int h2o_filecache_mapping_is_truncated(h2o_filecache_ref_t *ref);
 
 #endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef h2o__fileio_h
+#define h2o__fileio_h
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "h2o/multithread.h"
+
+/**
+ * blocking file operations (open, pread) run by a pool of threads shared by the process, so that a slow disk does not stall the
+ * event loops; the results are delivered to the receiver of the context that has submitted the request
+ */
+typedef struct st_h2o_fileio_req_t h2o_fileio_req_t;
+
+typedef void (*h2o_fileio_cb)(h2o_fileio_req_t *req);
+
+typedef enum en_h2o_fileio_op_t { H2O_FILEIO_OP_OPEN, H2O_FILEIO_OP_PREAD } h2o_fileio_op_t;
+
+struct st_h2o_fileio_req_t {
+    h2o_fileio_op_t op;
+    /**
+     * arguments; the memory being referred to MUST remain valid until the callback is called
+     */
+    union {
+        struct {
+            const char *path;
+            int oflag;
+        } open;
+        struct {
+            int fd;
+            void *buf;
+            size_t len;
+            off_t off;
+        } pread;
+    };
+    /**
+     * result; the file descriptor or the number of bytes read, or -1 with `err` being set on failure
+     */
+    ssize_t ret;
+    int err;
+    h2o_fileio_cb cb;
+    void *data;
+    /* internal */
+    h2o_multithread_receiver_t *_receiver;
+    h2o_linklist_t _pending;
+    h2o_multithread_message_t _message;
+    uint64_t _submitted_at;
+};
+
+typedef struct st_h2o_fileio_stats_t {
+    size_t num_threads;
+    size_t num_queued;   /* number of requests waiting for a thread */
+    size_t num_inflight; /* number of requests being run */
+    uint64_t num_completed;
+    uint64_t latency_sum; /* sum of the time spent for completing the requests, including the time in the queue (in microseconds) */
+    uint64_t latency_max;
+} h2o_fileio_stats_t;
+
+extern size_t h2o_fileio_max_threads;
+
+/**
+ * submits a request; the callback is always called (from the loop of the receiver), and there is no way to cancel the request
+ */
+void h2o_fileio_submit(h2o_fileio_req_t *req, h2o_multithread_receiver_t *receiver);
+/**
+ * function that receives and dispatches the results
+ */
+void h2o_fileio_receiver(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages);
+/**
+ * returns the statistics of the thread pool
+ */
+void h2o_fileio_get_stats(h2o_fileio_stats_t *stats);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef h2o__happy_eyeballs_h
+#define h2o__happy_eyeballs_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#ifndef _MSC_VER
+#include <netdb.h>
+#endif
+#include "h2o/socket.h"
+
+/**
+ * the default delay (in milliseconds) between the connection attempts, as recommended by RFC 8305
+ */
+#define H2O_HAPPY_EYEBALLS_DEFAULT_DELAY 250
+
+typedef struct st_h2o_happy_eyeballs_t h2o_happy_eyeballs_t;
+
+/**
+ * called when one of the attempts succeeds (`sock` is non-NULL), or when all of them fail
+ */
+typedef void (*h2o_happy_eyeballs_cb)(h2o_socket_t *sock, const char *errstr, void *data);
+
+/**
+ * delay (in milliseconds) before starting the next connection attempt while the previous ones are in flight. Zero disables racing;
+ * the next address is tried only after the previous attempt fails.
+ */
+extern uint64_t h2o_happy_eyeballs_delay;
+
+/**
+ * connects to one of the addresses, racing the attempts as specified in RFC 8305. The addresses are tried alternating between the
+ * address families, starting from the family of the first entry. Within each family, the starting point is chosen at random so
+ * that the load is distributed among the addresses. The first attempt to succeed wins, and the others are cancelled.
+ * @param res list of addresses (copied, and can be released once the function returns)
+ */
+h2o_happy_eyeballs_t *h2o_happy_eyeballs_connect(h2o_loop_t *loop, struct addrinfo *res, h2o_happy_eyeballs_cb cb, void *data);
+/**
+ * cancels the attempts in flight. The callback is not called.
+ */
+void h2o_happy_eyeballs_cancel(h2o_happy_eyeballs_t *he);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
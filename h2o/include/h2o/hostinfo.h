@@ -22,6 +22,7 @@
 #ifndef h2o__hostinfo_h
 #define h2o__hostinfo_h
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #ifndef _MSC_VER
@@ -41,7 +42,42 @@ typedef struct st_h2o_hostinfo_getaddr_req_t h2o_hostinfo_getaddr_req_t;
 
 typedef void (*h2o_hostinfo_getaddr_cb)(h2o_hostinfo_getaddr_req_t *req, const char *errstr, struct addrinfo *res, void *cbdata);
 
+typedef struct st_h2o_hostinfo_cache_stats_t {
+    uint64_t hits;
+    uint64_t stale_hits;
+    uint64_t misses;
+    uint64_t coalesced; /* number of lookups that shared the result of a lookup in flight */
+    uint64_t failed_revalidations;
+    size_t num_entries;
+} h2o_hostinfo_cache_stats_t;
+
 extern size_t h2o_hostinfo_max_threads;
+/**
+ * duration (in milliseconds) to cache successful lookups (zero to disable caching)
+ */
+extern uint64_t h2o_hostinfo_cache_ttl;
+/**
+ * duration (in milliseconds) to cache failed lookups (zero to disable caching)
+ */
+extern uint64_t h2o_hostinfo_cache_negative_ttl;
+/**
+ * duration (in milliseconds) during which an expired answer is returned while it is being revalidated
+ */
+extern uint64_t h2o_hostinfo_cache_stale_ttl;
+/**
+ * maximum number of entries retained by the cache
+ */
+extern size_t h2o_hostinfo_cache_capacity;
+/**
+ * if names should be resolved by the stub resolver running on the event loop (see h2o/dns.h) when possible, instead of calling
+ * getaddrinfo in the lookup threads
+ */
+extern int h2o_hostinfo_use_stub_resolver;
+/**
+ * minimum interval (in milliseconds) between the checks for modifications of /etc/resolv.conf and /etc/hosts; the stub resolver
+ * reloads its configuration when they are modified
+ */
+extern uint64_t h2o_hostinfo_resolver_check_interval;
 
 /**
  * dispatches a (possibly) asynchronous hostname lookup
@@ -49,10 +85,6 @@ extern size_t h2o_hostinfo_max_threads;
 h2o_hostinfo_getaddr_req_t *h2o_hostinfo_getaddr(h2o_multithread_receiver_t *receiver, h2o_iovec_t name, h2o_iovec_t serv,
                                                  int family, int socktype, int protocol, int flags, h2o_hostinfo_getaddr_cb cb,
                                                  void *cbdata);
-/**
- *
- */
-void h2o__hostinfo_getaddr_dispatch(h2o_hostinfo_getaddr_req_t *req);
 /**
  * cancels the request
  */
@@ -63,6 +95,15 @@ void h2o_hostinfo_getaddr_cancel(h2o_hostinfo_getaddr_req_t *req);
  */
 void h2o_hostinfo_getaddr_receiver(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages);
 
+/**
+ * returns the statistics of the name resolution cache
+ */
+void h2o_hostinfo_get_cache_stats(h2o_hostinfo_cache_stats_t *stats);
+/**
+ * discards the cached answers (lookups in flight are not affected)
+ */
+void h2o_hostinfo_clear_cache(void);
+
 /**
  * select one entry at random from the response
  */
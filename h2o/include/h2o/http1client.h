@@ -71,6 +71,11 @@ struct st_h2o_http1client_t {
     h2o_socket_t *sock;
     void *data;
     h2o_http1client_informational_cb informational_cb;
+    /**
+     * set prior to the head callback being invoked with an error, if the connection was closed or reset before any part of the
+     * response was received (in which case it is safe to resend an idempotent request)
+     */
+    unsigned closed_before_response : 1;
 };
 
 extern const char *const h2o_http1client_error_is_eos;
@@ -79,6 +84,12 @@ void h2o_http1client_connect(h2o_http1client_t **client, void *data, h2o_http1cl
                              int is_ssl, h2o_http1client_connect_cb cb);
 void h2o_http1client_connect_with_pool(h2o_http1client_t **client, void *data, h2o_http1client_ctx_t *ctx,
                                        h2o_socketpool_t *sockpool, h2o_http1client_connect_cb cb);
+/**
+ * same as h2o_http1client_connect_with_pool, except that a new connection is always established (the connection is returned to the
+ * pool once the response is received)
+ */
+void h2o_http1client_connect_new_with_pool(h2o_http1client_t **client, void *data, h2o_http1client_ctx_t *ctx,
+                                           h2o_socketpool_t *sockpool, h2o_http1client_connect_cb cb);
 void h2o_http1client_cancel(h2o_http1client_t *client);
 h2o_socket_t *h2o_http1client_steal_socket(h2o_http1client_t *client);
 
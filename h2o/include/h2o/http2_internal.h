@@ -48,6 +48,7 @@ typedef struct st_h2o_hpack_header_table_t {
     size_t hpack_size;
     size_t hpack_capacity;     /* the value set by SETTINGS_HEADER_TABLE_SIZE _and_ dynamic table size update */
     size_t hpack_max_capacity; /* the value set by SETTINGS_HEADER_TABLE_SIZE */
+    int hpack_capacity_update_pending; /* (encoder) set if hpack_capacity has been reduced but not yet signalled to the peer */
 } h2o_hpack_header_table_t;
 
 typedef struct st_h2o_hpack_header_table_entry_t {
@@ -62,12 +63,31 @@ typedef struct st_h2o_hpack_header_table_entry_t {
 #define H2O_HPACK_PARSE_HEADERS_AUTHORITY_EXISTS 8
 
 void h2o_hpack_dispose_header_table(h2o_hpack_header_table_t *header_table);
+/**
+ * applies SETTINGS_HEADER_TABLE_SIZE sent by the peer to the table used for encoding the headers
+ */
+void h2o_hpack_apply_header_table_size(h2o_hpack_header_table_t *header_table, uint32_t header_table_size);
 int h2o_hpack_parse_headers(h2o_req_t *req, h2o_hpack_header_table_t *header_table, const uint8_t *src, size_t len,
                             int *pseudo_header_exists_map, size_t *content_length, h2o_cache_digests_t **digests,
                             const char **err_desc);
+/**
+ * parses the headers of a response, returning zero on success or an HTTP/2 error code. The value of the `:status` pseudo header is
+ * stored in `*status`. The content-length header is returned via `*content_length` (SIZE_MAX if absent) instead of being added to
+ * `headers`.
+ */
+int h2o_hpack_parse_response_headers(h2o_mem_pool_t *pool, int *status, h2o_headers_t *headers,
+                                     h2o_hpack_header_table_t *header_table, const uint8_t *src, size_t len, size_t *content_length,
+                                     const char **err_desc);
 size_t h2o_hpack_encode_string(uint8_t *dst, const char *s, size_t len);
 void h2o_hpack_flatten_request(h2o_buffer_t **buf, h2o_hpack_header_table_t *header_table, uint32_t stream_id,
                                size_t max_frame_size, h2o_req_t *req, uint32_t parent_stream_id);
+/**
+ * flattens a request as a HEADERS frame (followed by CONTINUATION frames if necessary) being sent on the given stream
+ */
+void h2o_hpack_flatten_request_headers(h2o_buffer_t **buf, h2o_hpack_header_table_t *header_table, uint32_t stream_id,
+                                       size_t max_frame_size, h2o_iovec_t method, const h2o_url_scheme_t *scheme,
+                                       h2o_iovec_t authority, h2o_iovec_t path, const h2o_header_t *headers, size_t num_headers,
+                                       int is_end_stream);
 void h2o_hpack_flatten_response(h2o_buffer_t **buf, h2o_hpack_header_table_t *header_table, uint32_t stream_id,
                                 size_t max_frame_size, h2o_res_t *res, h2o_timestamp_t *ts, const h2o_iovec_t *server_name,
                                 size_t content_length);
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef h2o__http2client_h
+#define h2o__http2client_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "h2o/linklist.h"
+#include "h2o/memory.h"
+#include "h2o/socket.h"
+#include "h2o/socketpool.h"
+#include "h2o/timeout.h"
+#include "h2o/url.h"
+
+struct st_h2o_header_t;
+typedef struct st_h2o_http2client_t h2o_http2client_t;
+
+typedef int (*h2o_http2client_body_cb)(h2o_http2client_t *client, const char *errstr);
+typedef h2o_http2client_body_cb (*h2o_http2client_head_cb)(h2o_http2client_t *client, const char *errstr, int status,
+                                                           struct st_h2o_header_t *headers, size_t num_headers,
+                                                           size_t content_length);
+
+/**
+ * a per-thread set of HTTP/2 connections to a single upstream, over which the requests are multiplexed
+ */
+typedef struct st_h2o_http2client_pool_t {
+    h2o_loop_t *loop;
+    h2o_multithread_receiver_t *getaddr_receiver;
+    h2o_timeout_t *io_timeout;
+    SSL_CTX *ssl_ctx; /* used if the socketpool is TLS-enabled; should offer "h2" using ALPN */
+    /**
+     * socketpool used for establishing the connections (the connections are never returned to the socketpool)
+     */
+    h2o_socketpool_t *sockpool;
+    /**
+     * idle connections are closed once the timeout expires
+     */
+    h2o_timeout_t keepalive_timeout;
+    h2o_linklist_t _conns;
+} h2o_http2client_pool_t;
+
+typedef struct st_h2o_http2client_req_t {
+    h2o_iovec_t method;
+    const h2o_url_scheme_t *scheme;
+    h2o_iovec_t authority;
+    h2o_iovec_t path;
+    struct st_h2o_header_t *headers;
+    size_t num_headers;
+    h2o_iovec_t body; /* base is NULL if the request has no body */
+} h2o_http2client_req_t;
+
+struct st_h2o_http2client_t {
+    h2o_http2client_pool_t *pool;
+    void *data;
+    /**
+     * response body received so far; the user may consume the data at any moment
+     */
+    h2o_buffer_t *buf;
+};
+
+extern const char *const h2o_http2client_error_is_eos;
+
+void h2o_http2client_pool_init(h2o_http2client_pool_t *pool, h2o_loop_t *loop, h2o_multithread_receiver_t *getaddr_receiver,
+                               h2o_timeout_t *io_timeout, SSL_CTX *ssl_ctx, h2o_socketpool_t *sockpool, uint64_t keepalive_timeout);
+/**
+ * closes all the connections; the requests must have been completed or cancelled before calling the function
+ */
+void h2o_http2client_pool_dispose(h2o_http2client_pool_t *pool);
+/**
+ * sends a request using one of the connections, establishing a new connection if all the existing ones are saturated. The values
+ * being referred to by `req` must be retained until the response headers are received, and the response headers are allocated
+ * from `mem_pool`. The callback is invoked with `errstr` set to h2o_http2client_error_is_eos if the response has no body.
+ */
+void h2o_http2client_request(h2o_http2client_t **client, void *data, h2o_http2client_pool_t *pool, h2o_http2client_req_t *req,
+                             h2o_mem_pool_t *mem_pool, h2o_http2client_head_cb cb);
+void h2o_http2client_cancel(h2o_http2client_t *client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -75,6 +75,10 @@ h2o_multithread_queue_t *h2o_multithread_create_queue(h2o_loop_t *loop);
  * destroys the queue
  */
 void h2o_multithread_destroy_queue(h2o_multithread_queue_t *queue);
+/**
+ * returns the loop to which the queue is bound
+ */
+h2o_loop_t *h2o_multithread_get_loop(h2o_multithread_queue_t *queue);
 /**
  * registers a receiver for specific type of message
  */
@@ -35,6 +35,7 @@ extern "C" {
 #pragma comment(lib, "Ws2_32.lib")
 #endif
 #include <openssl/ssl.h>
+#include "h2o/cache.h"
 #include "h2o/memory.h"
 #include "h2o/string_.h"
 
@@ -304,6 +305,19 @@ void h2o_socket_ssl_async_resumption_init(h2o_socket_ssl_resumption_get_async_cb
  * setups the SSL context to use the async resumption
  */
 void h2o_socket_ssl_async_resumption_setup_ctx(SSL_CTX *ctx);
+/**
+ * creates a cache for storing the client-side sessions (including session tickets) that can be shared among threads
+ */
+h2o_cache_t *h2o_socket_ssl_new_session_cache(size_t capacity, uint64_t duration);
+/**
+ * attaches the session cache to a client-side SSL context (should be called at configuration time). The cache is destroyed
+ * together with the context, or when another cache is attached.
+ */
+void h2o_socket_ssl_set_session_cache(SSL_CTX *ssl_ctx, h2o_cache_t *cache);
+/**
+ * returns the session cache attached to the context, or NULL if none
+ */
+h2o_cache_t *h2o_socket_ssl_get_session_cache(SSL_CTX *ssl_ctx);
 /**
  * returns the name of the protocol selected using either NPN or ALPN (ALPN has the precedence).
  * @param sock the socket
@@ -40,6 +40,37 @@ extern "C" {
 
 typedef enum en_h2o_socketpool_type_t { H2O_SOCKETPOOL_TYPE_NAMED, H2O_SOCKETPOOL_TYPE_SOCKADDR } h2o_socketpool_type_t;
 
+typedef enum en_h2o_socketpool_health_state_t {
+    H2O_SOCKETPOOL_HEALTHY,
+    H2O_SOCKETPOOL_UNHEALTHY, /* ejected; connect requests fail immediately */
+    H2O_SOCKETPOOL_SLOW_START /* re-admitted; the share of connect requests being let through increases over time */
+} h2o_socketpool_health_state_t;
+
+typedef struct st_h2o_socketpool_health_config_t {
+    /**
+     * number of consecutive connect / I/O errors that ejects the upstream (0 to disable passive ejection)
+     */
+    unsigned max_failures;
+    /**
+     * in milliseconds; how long a passively ejected upstream stays ejected unless it is being actively checked
+     */
+    uint64_t ejection_time;
+    /**
+     * in milliseconds; period during which the traffic is ramped up after an ejected upstream is re-admitted (0 to disable)
+     */
+    uint64_t slow_start;
+} h2o_socketpool_health_config_t;
+
+typedef struct st_h2o_socketpool_health_t {
+    h2o_socketpool_health_state_t state;
+    size_t consecutive_failures;
+    uint64_t state_changed_at;
+    uint64_t num_ejections;
+    uint64_t num_rejected;
+    uint64_t num_probes;
+    uint64_t num_probe_failures;
+} h2o_socketpool_health_t;
+
 typedef struct st_h2o_socketpool_t {
 
     /* read-only vars */
@@ -74,12 +105,48 @@ typedef struct st_h2o_socketpool_t {
 		uv_mutex_t mutex;
 #endif
         h2o_linklist_t sockets; /* guarded by the mutex; list of struct pool_entry_t defined in socket/pool.c */
+        h2o_socketpool_health_t health; /* guarded by the mutex */
+        size_t num_warmers; /* number of warmers attached to the pool (synchronous operations should be used) */
+        size_t num_warming; /* connections being established by the warmers (synchronous operations should be used) */
     } _shared;
+
+    /* health checking (inactive unless h2o_socketpool_enable_health_check is called) */
+    struct {
+        int enabled;
+        int is_actively_checked;
+        h2o_socketpool_health_config_t config;
+        h2o_linklist_t _link; /* link in the list of pools being reported through h2o_socketpool_foreach_health */
+    } health;
 } h2o_socketpool_t;
 
+#define H2O_SOCKETPOOL_WARMER_INTERVAL 100 /* in milliseconds */
+
+/**
+ * a per-thread object that keeps a minimum number of idle connections in the socket pool, by establishing new connections ahead
+ * of them being needed and replacing the ones that are about to expire
+ */
+typedef struct st_h2o_socketpool_warmer_t {
+    h2o_socketpool_t *pool;
+    h2o_loop_t *loop;
+    h2o_multithread_receiver_t *getaddr_receiver;
+    SSL_CTX *ssl_ctx; /* if non-NULL and the pool is TLS-enabled, the TLS handshake is performed as well */
+    size_t min_idle;
+    unsigned connect_rate; /* max. number of connections being established per second */
+    h2o_timeout_t _interval;
+    h2o_timeout_entry_t _interval_entry;
+    size_t _tokens;
+    uint64_t _tokens_refilled_at;
+    h2o_linklist_t _warming;
+} h2o_socketpool_warmer_t;
+
 typedef struct st_h2o_socketpool_connect_request_t h2o_socketpool_connect_request_t;
 
 typedef void (*h2o_socketpool_connect_cb)(h2o_socket_t *sock, const char *errstr, void *data);
+
+/**
+ * error reported to the connect callback when the upstream is ejected
+ */
+extern const char *const h2o_socketpool_error_unhealthy;
 /**
  * initializes a socket loop
  */
@@ -101,14 +168,53 @@ void h2o_socketpool_set_timeout(h2o_socketpool_t *pool, h2o_loop_t *loop, uint64
  */
 void h2o_socketpool_connect(h2o_socketpool_connect_request_t **req, h2o_socketpool_t *pool, h2o_loop_t *loop,
                             h2o_multithread_receiver_t *getaddr_receiver, h2o_socketpool_connect_cb cb, void *data);
+/**
+ * establishes a new connection to the peer, bypassing the pooled connections
+ */
+void h2o_socketpool_connect_new(h2o_socketpool_connect_request_t **req, h2o_socketpool_t *pool, h2o_loop_t *loop,
+                                h2o_multithread_receiver_t *getaddr_receiver, h2o_socketpool_connect_cb cb, void *data);
 /**
  * cancels a connect request
  */
 void h2o_socketpool_cancel_connect(h2o_socketpool_connect_request_t *req);
+/**
+ * returns if the socket passed to the connect callback was taken from the pool (i.e. has been idle), rather than newly connected
+ */
+int h2o_socketpool_is_reused(h2o_socket_t *sock);
 /**
  * returns an idling socket to the socket pool
  */
 int h2o_socketpool_return(h2o_socketpool_t *pool, h2o_socket_t *sock);
+/**
+ * starts tracking the health of the upstream. Once ejected, connect requests are failed immediately with
+ * `h2o_socketpool_error_unhealthy` until the upstream is re-admitted.
+ * @param is_actively_checked if set, an ejected upstream is re-admitted only when h2o_socketpool_report_probe reports it as healthy
+ */
+void h2o_socketpool_enable_health_check(h2o_socketpool_t *pool, h2o_socketpool_health_config_t *config, int is_actively_checked);
+/**
+ * reports the outcome of a request sent through a connection obtained from the pool
+ */
+void h2o_socketpool_report_success(h2o_socketpool_t *pool);
+void h2o_socketpool_report_failure(h2o_socketpool_t *pool, uint64_t now);
+/**
+ * reports the outcome of an active health check
+ */
+void h2o_socketpool_report_probe(h2o_socketpool_t *pool, int is_healthy, uint64_t now);
+/**
+ * calls the callback for each pool of which the health is being tracked, passing a snapshot of its health
+ */
+void h2o_socketpool_foreach_health(void (*cb)(h2o_socketpool_t *pool, h2o_socketpool_health_t *health, void *data), void *data);
+/**
+ * starts keeping `min_idle` connections per warmer idle in the pool. Should be called once per thread after calling
+ * h2o_socketpool_set_timeout.
+ */
+void h2o_socketpool_warmer_start(h2o_socketpool_warmer_t *warmer, h2o_socketpool_t *pool, h2o_loop_t *loop,
+                                 h2o_multithread_receiver_t *getaddr_receiver, SSL_CTX *ssl_ctx, size_t min_idle,
+                                 unsigned connect_rate);
+/**
+ * stops the warmer, discarding the connections being established
+ */
+void h2o_socketpool_warmer_stop(h2o_socketpool_warmer_t *warmer);
 /**
  * determines if a socket belongs to the socket pool
  */
@@ -76,9 +76,9 @@ static void unlock_cache(h2o_cache_t *cache)
 {
     if ((cache->flags & H2O_CACHE_FLAG_MULTITHREADED) != 0)
 #ifndef _MSC_VER
-		pthread_mutex_lock(&cache->mutex);
+        pthread_mutex_unlock(&cache->mutex);
 #else
-		uv_mutex_lock(&cache->mutex);
+		uv_mutex_unlock(&cache->mutex);
 #endif
 }
 
@@ -147,6 +147,16 @@ h2o_cache_t *h2o_cache_create(int flags, size_t capacity, uint64_t duration, voi
     return cache;
 }
 
+size_t h2o_cache_get_capacity(h2o_cache_t *cache)
+{
+    return cache->capacity;
+}
+
+uint64_t h2o_cache_get_duration(h2o_cache_t *cache)
+{
+    return cache->duration;
+}
+
 void h2o_cache_destroy(h2o_cache_t *cache)
 {
     h2o_cache_clear(cache);
@@ -0,0 +1,979 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/rand.h>
+#include "h2o/dns.h"
+#include "h2o/string_.h"
+
+const char *h2o_dns_error_not_found = "name not found";
+const char *h2o_dns_error_no_address = "no address associated with the name";
+const char *h2o_dns_error_server_failure = "nameserver failure";
+const char *h2o_dns_error_timeout = "name resolution timeout";
+
+#define RESOLV_CONF_PATH "/etc/resolv.conf"
+#define HOSTS_PATH "/etc/hosts"
+
+void h2o_dns_config_init(h2o_dns_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->timeout = H2O_DNS_DEFAULT_TIMEOUT;
+    config->attempts = H2O_DNS_DEFAULT_ATTEMPTS;
+    config->ndots = 1;
+}
+
+void h2o_dns_config_dispose(h2o_dns_config_t *config)
+{
+    size_t i;
+
+    for (i = 0; i != config->hosts.size; ++i)
+        free(config->hosts.entries[i].name);
+    free(config->hosts.entries);
+    memset(config, 0, sizeof(*config));
+}
+
+static h2o_iovec_t next_token(const char **p, const char *end)
+{
+    const char *start;
+
+    while (*p != end && (**p == ' ' || **p == '\t'))
+        ++*p;
+    start = *p;
+    while (*p != end && !(**p == ' ' || **p == '\t'))
+        ++*p;
+    return h2o_iovec_init(start, *p - start);
+}
+
+static h2o_iovec_t next_line(const char **p, const char *end)
+{
+    const char *start = *p, *eol;
+
+    while (*p != end && **p != '\n')
+        ++*p;
+    eol = *p;
+    if (*p != end)
+        ++*p;
+    /* strip comments and CR */
+    const char *q;
+    for (q = start; q != eol; ++q) {
+        if (*q == '#' || *q == ';' || *q == '\r') {
+            eol = q;
+            break;
+        }
+    }
+    return h2o_iovec_init(start, eol - start);
+}
+
+static int parse_address(h2o_iovec_t token, int *family, void *addr)
+{
+    char buf[INET6_ADDRSTRLEN + 1];
+
+    if (token.len == 0 || token.len >= sizeof(buf))
+        return -1;
+    memcpy(buf, token.base, token.len);
+    buf[token.len] = '\0';
+    if (uv_inet_pton(AF_INET, buf, addr) == 0) {
+        *family = AF_INET;
+        return 0;
+    }
+    if (uv_inet_pton(AF_INET6, buf, addr) == 0) {
+        *family = AF_INET6;
+        return 0;
+    }
+    return -1;
+}
+
+static unsigned parse_option_value(h2o_iovec_t token, size_t prefix_len, unsigned max)
+{
+    size_t v = h2o_strtosize(token.base + prefix_len, token.len - prefix_len);
+    if (v == SIZE_MAX)
+        return 0;
+    return v < max ? (unsigned)v : max;
+}
+
+void h2o_dns_config_parse_resolv_conf(h2o_dns_config_t *config, h2o_iovec_t src)
+{
+    const char *p = src.base, *end = src.base + src.len;
+
+    while (p != end) {
+        h2o_iovec_t line = next_line(&p, end);
+        const char *lp = line.base, *lend = line.base + line.len;
+        h2o_iovec_t directive = next_token(&lp, lend), token;
+        if (h2o_memis(directive.base, directive.len, H2O_STRLIT("nameserver"))) {
+            union {
+                struct in_addr v4;
+                struct in6_addr v6;
+            } addr;
+            int family;
+            token = next_token(&lp, lend);
+            if (config->num_nameservers == H2O_DNS_MAX_NAMESERVERS || parse_address(token, &family, &addr) != 0)
+                continue;
+            struct sockaddr_storage *ss = &config->nameservers[config->num_nameservers].addr;
+            memset(ss, 0, sizeof(*ss));
+            if (family == AF_INET) {
+                struct sockaddr_in *sin = (void *)ss;
+                sin->sin_family = AF_INET;
+                sin->sin_port = htons(53);
+                sin->sin_addr = addr.v4;
+                config->nameservers[config->num_nameservers].len = sizeof(*sin);
+            } else {
+                struct sockaddr_in6 *sin6 = (void *)ss;
+                sin6->sin6_family = AF_INET6;
+                sin6->sin6_port = htons(53);
+                sin6->sin6_addr = addr.v6;
+                config->nameservers[config->num_nameservers].len = sizeof(*sin6);
+            }
+            ++config->num_nameservers;
+        } else if (h2o_memis(directive.base, directive.len, H2O_STRLIT("search")) ||
+                   h2o_memis(directive.base, directive.len, H2O_STRLIT("domain"))) {
+            if (next_token(&lp, lend).len != 0)
+                config->has_search = 1;
+        } else if (h2o_memis(directive.base, directive.len, H2O_STRLIT("options"))) {
+            while ((token = next_token(&lp, lend)).len != 0) {
+                if (token.len > 8 && memcmp(token.base, "timeout:", 8) == 0) {
+                    unsigned secs = parse_option_value(token, 8, 30);
+                    if (secs != 0)
+                        config->timeout = secs * 1000;
+                } else if (token.len > 9 && memcmp(token.base, "attempts:", 9) == 0) {
+                    unsigned attempts = parse_option_value(token, 9, 5);
+                    if (attempts != 0)
+                        config->attempts = attempts;
+                } else if (token.len > 6 && memcmp(token.base, "ndots:", 6) == 0) {
+                    config->ndots = parse_option_value(token, 6, 15);
+                }
+            }
+        }
+    }
+}
+
+void h2o_dns_config_parse_hosts(h2o_dns_config_t *config, h2o_iovec_t src)
+{
+    const char *p = src.base, *end = src.base + src.len;
+
+    while (p != end) {
+        h2o_iovec_t line = next_line(&p, end), token;
+        const char *lp = line.base, *lend = line.base + line.len;
+        h2o_dns_hosts_entry_t entry;
+        if (parse_address(next_token(&lp, lend), &entry.family, &entry.addr) != 0)
+            continue;
+        while ((token = next_token(&lp, lend)).len != 0) {
+            h2o_vector_reserve(NULL, &config->hosts, config->hosts.size + 1);
+            config->hosts.entries[config->hosts.size] = entry;
+            config->hosts.entries[config->hosts.size].name = h2o_strdup(NULL, token.base, token.len).base;
+            h2o_strtolower(config->hosts.entries[config->hosts.size].name, token.len);
+            ++config->hosts.size;
+        }
+    }
+}
+
+static int read_file(const char *path, void (*parse)(h2o_dns_config_t *, h2o_iovec_t), h2o_dns_config_t *config, size_t file_index)
+{
+    FILE *fp;
+    char *buf = NULL;
+    size_t len = 0, capacity = 0, rret;
+    struct stat st;
+
+    config->_files[file_index].path = path;
+    if ((fp = fopen(path, "rb")) == NULL)
+        return -1;
+    if (fstat(fileno(fp), &st) == 0) {
+        config->_files[file_index].ino = st.st_ino;
+        config->_files[file_index].size = st.st_size;
+        config->_files[file_index].mtime = st.st_mtime;
+    }
+    do {
+        if (len == capacity) {
+            capacity = capacity == 0 ? 4096 : capacity * 2;
+            buf = h2o_mem_realloc(buf, capacity);
+        }
+        rret = fread(buf + len, 1, capacity - len, fp);
+        len += rret;
+    } while (rret != 0);
+    fclose(fp);
+
+    parse(config, h2o_iovec_init(buf, len));
+    free(buf);
+    return 0;
+}
+
+static int load_files(h2o_dns_config_t *config, const char *resolv_conf_path, const char *hosts_path)
+{
+    uv_interface_address_t *ifaddrs;
+    int num_ifaddrs, i;
+
+    h2o_dns_config_init(config);
+
+    if (read_file(resolv_conf_path, h2o_dns_config_parse_resolv_conf, config, 0) != 0)
+        return -1;
+    if (config->num_nameservers == 0) {
+        /* same as the libc resolver; use the nameserver on the local machine */
+        struct sockaddr_in *sin = (void *)&config->nameservers[0].addr;
+        uv_ip4_addr("127.0.0.1", 53, sin);
+        config->nameservers[0].len = sizeof(*sin);
+        config->num_nameservers = 1;
+    }
+    read_file(hosts_path, h2o_dns_config_parse_hosts, config, 1);
+
+    /* detect the address families configured (loopback addresses are not counted, as is the case with AI_ADDRCONFIG) */
+    if (uv_interface_addresses(&ifaddrs, &num_ifaddrs) == 0) {
+        for (i = 0; i != num_ifaddrs; ++i) {
+            if (ifaddrs[i].is_internal)
+                continue;
+            if (ifaddrs[i].address.address4.sin_family == AF_INET)
+                config->addrconfig.ipv4 = 1;
+            else if (ifaddrs[i].address.address6.sin6_family == AF_INET6)
+                config->addrconfig.ipv6 = 1;
+        }
+        uv_free_interface_addresses(ifaddrs, num_ifaddrs);
+    }
+
+    return 0;
+}
+
+int h2o_dns_config_load(h2o_dns_config_t *config)
+{
+    return load_files(config, RESOLV_CONF_PATH, HOSTS_PATH);
+}
+
+int h2o_dns_config_is_modified(const h2o_dns_config_t *config)
+{
+    size_t i;
+
+    for (i = 0; i != sizeof(config->_files) / sizeof(config->_files[0]); ++i) {
+        struct stat st;
+        if (config->_files[i].path == NULL)
+            continue;
+        if (stat(config->_files[i].path, &st) != 0)
+            memset(&st, 0, sizeof(st));
+        if (st.st_ino != config->_files[i].ino || st.st_size != config->_files[i].size || st.st_mtime != config->_files[i].mtime)
+            return 1;
+    }
+    return 0;
+}
+
+#if H2O_USE_DNS_RESOLVER
+
+#define DNS_HEADER_SIZE 12
+#define DNS_MAX_NAME_LEN 253
+#define DNS_MAX_QUESTION_SIZE (DNS_MAX_NAME_LEN + 2 + 4)
+#define DNS_MAX_UDP_PAYLOAD 512
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_TC 0x0200
+#define DNS_FLAG_RD 0x0100
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_NXDOMAIN 3
+#define MAX_ADDRS_PER_TRANSACTION 16
+
+/**
+ * a query for one record type (A or AAAA) of a name
+ */
+struct st_h2o_dns_transaction_t {
+    h2o_dns_query_t *query;
+    uint16_t qtype;
+    uint16_t id;
+    unsigned num_sent;
+    uv_udp_t *udp4;
+    uv_udp_t *udp6;
+    h2o_socket_t *tcp;
+    int is_complete;
+    const char *errstr;
+    size_t num_addrs;
+    uint8_t addrs[MAX_ADDRS_PER_TRANSACTION][16];
+    /* the query packet prefixed by the length (used when sending over TCP) */
+    size_t packet_len;
+    uint8_t packet[2 + DNS_HEADER_SIZE + DNS_MAX_QUESTION_SIZE];
+    uint8_t recvbuf[DNS_MAX_UDP_PAYLOAD];
+};
+
+struct st_h2o_dns_query_t {
+    h2o_loop_t *loop;
+    const h2o_dns_config_t *config;
+    h2o_dns_resolve_cb cb;
+    void *data;
+    uint16_t port;
+    int socktype;
+    int protocol;
+    uv_timer_t *timer;
+    size_t num_transactions;
+    size_t num_pending;
+    struct st_h2o_dns_transaction_t transactions[2];
+    /* the answer determined without sending a query (i.e. numeric addresses and the hosts file) */
+    struct {
+        const char *errstr;
+        struct addrinfo *ai;
+    } immediate;
+};
+
+static uint16_t new_query_id(void)
+{
+    /* the transaction id (along with the source port being randomized by the kernel) is what prevents spoofed answers from being
+     * stored to the cache shared by the process; use the CSPRNG */
+    uint16_t id;
+
+    if (RAND_bytes((unsigned char *)&id, sizeof(id)) != 1)
+        h2o_fatal("failed to generate a DNS query id");
+    return id;
+}
+
+static struct addrinfo *build_addrinfo(h2o_dns_query_t *query, int family, const uint8_t (*addrs)[16], size_t num_addrs,
+                                       struct addrinfo *next)
+{
+    /* prepends the addresses to `next`; the chain is allocated as a single chunk so that it can be released by a call to free */
+    size_t i, num_next = 0, sz = 0;
+    struct addrinfo *ai, *head, **slot;
+    char *p;
+
+    for (ai = next; ai != NULL; ai = ai->ai_next) {
+        ++num_next;
+        sz += sizeof(*ai) + ai->ai_addrlen;
+    }
+    sz += num_addrs * (sizeof(*ai) + (family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)));
+    if (sz == 0)
+        return NULL;
+    p = h2o_mem_alloc(sz);
+
+    slot = &head;
+    for (i = 0; i != num_addrs; ++i) {
+        ai = (void *)p;
+        p += sizeof(*ai);
+        memset(ai, 0, sizeof(*ai));
+        ai->ai_family = family;
+        ai->ai_socktype = query->socktype;
+        ai->ai_protocol = query->protocol;
+        ai->ai_addr = (void *)p;
+        if (family == AF_INET) {
+            struct sockaddr_in *sin = (void *)p;
+            memset(sin, 0, sizeof(*sin));
+            sin->sin_family = AF_INET;
+            sin->sin_port = htons(query->port);
+            memcpy(&sin->sin_addr, addrs[i], 4);
+            ai->ai_addrlen = sizeof(*sin);
+        } else {
+            struct sockaddr_in6 *sin6 = (void *)p;
+            memset(sin6, 0, sizeof(*sin6));
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_port = htons(query->port);
+            memcpy(&sin6->sin6_addr, addrs[i], 16);
+            ai->ai_addrlen = sizeof(*sin6);
+        }
+        p += ai->ai_addrlen;
+        *slot = ai;
+        slot = &ai->ai_next;
+    }
+    for (ai = next; ai != NULL; ai = ai->ai_next) {
+        struct addrinfo *copy = (void *)p;
+        p += sizeof(*copy);
+        *copy = *ai;
+        copy->ai_addr = (void *)p;
+        memcpy(copy->ai_addr, ai->ai_addr, ai->ai_addrlen);
+        p += ai->ai_addrlen;
+        *slot = copy;
+        slot = &copy->ai_next;
+    }
+    *slot = NULL;
+
+    free(next);
+    return head;
+}
+
+static void close_transaction(struct st_h2o_dns_transaction_t *tx)
+{
+    if (tx->udp4 != NULL) {
+        uv_close((uv_handle_t *)tx->udp4, (uv_close_cb)free);
+        tx->udp4 = NULL;
+    }
+    if (tx->udp6 != NULL) {
+        uv_close((uv_handle_t *)tx->udp6, (uv_close_cb)free);
+        tx->udp6 = NULL;
+    }
+    if (tx->tcp != NULL) {
+        h2o_socket_close(tx->tcp);
+        tx->tcp = NULL;
+    }
+}
+
+static void dispose_query(h2o_dns_query_t *query)
+{
+    size_t i;
+
+    for (i = 0; i != query->num_transactions; ++i)
+        close_transaction(query->transactions + i);
+    uv_close((uv_handle_t *)query->timer, (uv_close_cb)free);
+    free(query->immediate.ai);
+    free(query);
+}
+
+static void complete_query(h2o_dns_query_t *query)
+{
+    const char *errstr = NULL;
+    struct addrinfo *ai = NULL;
+
+    if (query->num_transactions == 0) {
+        errstr = query->immediate.errstr;
+        ai = query->immediate.ai;
+        query->immediate.ai = NULL;
+    } else {
+        /* the answer is built in the order of the transactions (AAAA first), while errors of A records are preferred */
+        size_t i = query->num_transactions;
+        do {
+            struct st_h2o_dns_transaction_t *tx = query->transactions + --i;
+            ai = build_addrinfo(query, tx->qtype == DNS_TYPE_A ? AF_INET : AF_INET6, (const uint8_t(*)[16])tx->addrs, tx->num_addrs,
+                                ai);
+            if (errstr == NULL || errstr == h2o_dns_error_no_address)
+                errstr = tx->errstr;
+        } while (i != 0);
+        if (ai != NULL)
+            errstr = NULL;
+        else if (errstr == NULL)
+            errstr = h2o_dns_error_no_address;
+    }
+
+    query->cb(query, errstr, ai, query->data);
+    dispose_query(query);
+}
+
+static void complete_transaction(struct st_h2o_dns_transaction_t *tx, const char *errstr)
+{
+    h2o_dns_query_t *query = tx->query;
+
+    assert(!tx->is_complete);
+    tx->is_complete = 1;
+    tx->errstr = errstr;
+    close_transaction(tx);
+
+    if (--query->num_pending == 0)
+        complete_query(query);
+}
+
+static void on_udp_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf)
+{
+    struct st_h2o_dns_transaction_t *tx = handle->data;
+    *buf = uv_buf_init((char *)tx->recvbuf, sizeof(tx->recvbuf));
+}
+
+static void on_udp_send_complete(uv_udp_send_t *req, int status)
+{
+    free(req);
+}
+
+static int send_udp(struct st_h2o_dns_transaction_t *tx, const struct sockaddr *addr);
+static void start_tcp(struct st_h2o_dns_transaction_t *tx, const struct sockaddr *addr, socklen_t addrlen);
+
+static void send_next(struct st_h2o_dns_transaction_t *tx, const char *errstr_if_exhausted)
+{
+    const h2o_dns_config_t *config = tx->query->config;
+
+    if (tx->tcp != NULL) {
+        h2o_socket_close(tx->tcp);
+        tx->tcp = NULL;
+    }
+
+    /* rotate through the nameservers, until each of them is tried for the number of attempts being configured */
+    while (tx->num_sent < config->attempts * config->num_nameservers) {
+        const struct sockaddr *addr = (const void *)&config->nameservers[tx->num_sent++ % config->num_nameservers].addr;
+        if (send_udp(tx, addr) == 0)
+            return;
+    }
+    complete_transaction(tx, errstr_if_exhausted);
+}
+
+static int is_nameserver(const h2o_dns_config_t *config, const struct sockaddr *addr)
+{
+    size_t i;
+
+    for (i = 0; i != config->num_nameservers; ++i) {
+        const struct sockaddr *ns = (const void *)&config->nameservers[i].addr;
+        if (ns->sa_family != addr->sa_family)
+            continue;
+        if (ns->sa_family == AF_INET) {
+            const struct sockaddr_in *x = (const void *)ns, *y = (const void *)addr;
+            if (x->sin_port == y->sin_port && memcmp(&x->sin_addr, &y->sin_addr, sizeof(x->sin_addr)) == 0)
+                return 1;
+        } else {
+            const struct sockaddr_in6 *x = (const void *)ns, *y = (const void *)addr;
+            if (x->sin6_port == y->sin6_port && memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static int skip_name(const uint8_t *src, size_t len, size_t *pos)
+{
+    while (*pos < len) {
+        uint8_t l = src[*pos];
+        if ((l & 0xc0) == 0xc0) {
+            /* compression pointer terminates the name */
+            *pos += 2;
+            return *pos <= len ? 0 : -1;
+        } else if ((l & 0xc0) != 0) {
+            return -1;
+        } else if (l == 0) {
+            *pos += 1;
+            return 0;
+        }
+        *pos += 1 + l;
+    }
+    return -1;
+}
+
+static uint16_t decode16(const uint8_t *src)
+{
+    return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+static void encode16(uint8_t *dst, uint16_t v)
+{
+    dst[0] = (uint8_t)(v >> 8);
+    dst[1] = (uint8_t)v;
+}
+
+static int question_matches(struct st_h2o_dns_transaction_t *tx, const uint8_t *src, size_t len)
+{
+    /* compares the echoed question section (names are compared case-insensitively as permitted by RFC 1035) */
+    const uint8_t *expected = tx->packet + 2 + DNS_HEADER_SIZE;
+    size_t expected_len = tx->packet_len - 2 - DNS_HEADER_SIZE, i;
+
+    if (len < DNS_HEADER_SIZE + expected_len)
+        return 0;
+    src += DNS_HEADER_SIZE;
+    for (i = 0; i != expected_len; ++i)
+        if (h2o_tolower(src[i]) != h2o_tolower(expected[i]))
+            return 0;
+    return 1;
+}
+
+/**
+ * handles a response
+ * @return 0 if the response has been consumed, or -1 if it was ignored (i.e. not a response to the transaction)
+ */
+static int handle_response(struct st_h2o_dns_transaction_t *tx, const uint8_t *src, size_t len, const struct sockaddr *server,
+                           socklen_t serverlen, int is_tcp)
+{
+    uint16_t flags, ancount;
+    size_t pos;
+
+    if (len < DNS_HEADER_SIZE || decode16(src) != tx->id)
+        return -1;
+    flags = decode16(src + 2);
+    if ((flags & DNS_FLAG_QR) == 0 || decode16(src + 4) != 1 || !question_matches(tx, src, len))
+        return -1;
+
+    if ((flags & DNS_FLAG_TC) != 0 && !is_tcp) {
+        start_tcp(tx, server, serverlen);
+        return 0;
+    }
+
+    switch (flags & 0xf) {
+    case DNS_RCODE_NOERROR:
+        break;
+    case DNS_RCODE_NXDOMAIN:
+        complete_transaction(tx, h2o_dns_error_not_found);
+        return 0;
+    default:
+        send_next(tx, h2o_dns_error_server_failure);
+        return 0;
+    }
+
+    /* collect the records of the requested type, following CNAMEs is unnecessary since recursive resolvers include the chain */
+    ancount = decode16(src + 6);
+    pos = tx->packet_len - 2;
+    for (; ancount != 0; --ancount) {
+        uint16_t type, klass, rdlen;
+        if (skip_name(src, len, &pos) != 0 || pos + 10 > len)
+            goto Malformed;
+        type = decode16(src + pos);
+        klass = decode16(src + pos + 2);
+        rdlen = decode16(src + pos + 8);
+        pos += 10;
+        if (pos + rdlen > len)
+            goto Malformed;
+        if (type == tx->qtype && klass == DNS_CLASS_IN && rdlen == (type == DNS_TYPE_A ? 4 : 16) &&
+            tx->num_addrs < MAX_ADDRS_PER_TRANSACTION)
+            memcpy(tx->addrs[tx->num_addrs++], src + pos, rdlen);
+        pos += rdlen;
+    }
+
+    complete_transaction(tx, tx->num_addrs != 0 ? NULL : h2o_dns_error_no_address);
+    return 0;
+
+Malformed:
+    tx->num_addrs = 0;
+    send_next(tx, h2o_dns_error_server_failure);
+    return 0;
+}
+
+static void on_udp_recv(uv_udp_t *udp, ssize_t nread, const uv_buf_t *buf, const struct sockaddr *addr, unsigned flags)
+{
+    struct st_h2o_dns_transaction_t *tx = udp->data;
+
+    if (nread <= 0 || addr == NULL || (flags & UV_UDP_PARTIAL) != 0)
+        return;
+    if (!is_nameserver(tx->query->config, addr))
+        return;
+    handle_response(tx, (const uint8_t *)buf->base, nread, addr, addr->sa_family == AF_INET ? sizeof(struct sockaddr_in) :
+                                                                                               sizeof(struct sockaddr_in6),
+                    0);
+}
+
+static int send_udp(struct st_h2o_dns_transaction_t *tx, const struct sockaddr *addr)
+{
+    uv_udp_t **udp = addr->sa_family == AF_INET ? &tx->udp4 : &tx->udp6;
+    struct {
+        uv_udp_send_t req;
+        uint8_t packet[DNS_HEADER_SIZE + DNS_MAX_QUESTION_SIZE];
+    } *send;
+    uv_buf_t buf;
+
+    /* sockets are retained until the transaction completes, so that late responses to earlier attempts are accepted */
+    if (*udp == NULL) {
+        struct sockaddr_storage any;
+        memset(&any, 0, sizeof(any));
+        if (addr->sa_family == AF_INET)
+            uv_ip4_addr("0.0.0.0", 0, (void *)&any);
+        else
+            uv_ip6_addr("::", 0, (void *)&any);
+        *udp = h2o_mem_alloc(sizeof(**udp));
+        uv_udp_init(tx->query->loop, *udp);
+        (*udp)->data = tx;
+        if (uv_udp_bind(*udp, (void *)&any, 0) != 0 || uv_udp_recv_start(*udp, on_udp_alloc, on_udp_recv) != 0) {
+            uv_close((uv_handle_t *)*udp, (uv_close_cb)free);
+            *udp = NULL;
+            return -1;
+        }
+    }
+
+    send = h2o_mem_alloc(sizeof(*send));
+    memcpy(send->packet, tx->packet + 2, tx->packet_len - 2);
+    buf = uv_buf_init((char *)send->packet, (unsigned)(tx->packet_len - 2));
+    if (uv_udp_send(&send->req, *udp, &buf, 1, addr, on_udp_send_complete) != 0) {
+        free(send);
+        return -1;
+    }
+    return 0;
+}
+
+static void on_tcp_read(h2o_socket_t *sock, const char *err)
+{
+    struct st_h2o_dns_transaction_t *tx = sock->data;
+    size_t len;
+
+    if (err != NULL)
+        goto Error;
+    if (sock->input->size < 2)
+        return;
+    len = decode16((const uint8_t *)sock->input->bytes);
+    if (sock->input->size < 2 + len)
+        return;
+    h2o_socket_read_stop(sock);
+    /* the socket is owned by the transaction until the response is handled; the address is unused for responses over TCP */
+    if (handle_response(tx, (const uint8_t *)sock->input->bytes + 2, len, NULL, 0, 1) == 0)
+        return;
+
+Error:
+    send_next(tx, h2o_dns_error_server_failure);
+}
+
+static void on_tcp_write_complete(h2o_socket_t *sock, const char *err)
+{
+    struct st_h2o_dns_transaction_t *tx = sock->data;
+
+    if (err != NULL) {
+        send_next(tx, h2o_dns_error_server_failure);
+        return;
+    }
+    h2o_socket_read_start(sock, on_tcp_read);
+}
+
+static void on_tcp_connect(h2o_socket_t *sock, const char *err)
+{
+    struct st_h2o_dns_transaction_t *tx = sock->data;
+    h2o_iovec_t buf;
+
+    if (err != NULL) {
+        send_next(tx, h2o_dns_error_server_failure);
+        return;
+    }
+    buf = h2o_iovec_init(tx->packet, tx->packet_len);
+    h2o_socket_write(sock, &buf, 1, on_tcp_write_complete);
+}
+
+static void start_tcp(struct st_h2o_dns_transaction_t *tx, const struct sockaddr *addr, socklen_t addrlen)
+{
+    /* the response was truncated; retry the same nameserver over TCP */
+    if (tx->tcp != NULL)
+        return;
+    if ((tx->tcp = h2o_socket_connect(tx->query->loop, (struct sockaddr *)addr, addrlen, on_tcp_connect)) == NULL) {
+        send_next(tx, h2o_dns_error_server_failure);
+        return;
+    }
+    tx->tcp->data = tx;
+}
+
+static void on_timeout(uv_timer_t *timer)
+{
+    h2o_dns_query_t *query = timer->data;
+    size_t i;
+
+    if (query->num_transactions == 0) {
+        complete_query(query);
+        return;
+    }
+
+    /* resend the transactions without answers; the query is destroyed once the last of them gives up */
+    for (i = 0; i != query->num_transactions; ++i) {
+        struct st_h2o_dns_transaction_t *tx = query->transactions + i;
+        if (tx->is_complete)
+            continue;
+        if (query->num_pending == 1) {
+            send_next(tx, h2o_dns_error_timeout);
+            return;
+        }
+        send_next(tx, h2o_dns_error_timeout);
+    }
+}
+
+static int encode_question(uint8_t *dst, const char *name, uint16_t qtype)
+{
+    uint8_t *p = dst;
+    const char *label = name, *dot;
+
+    do {
+        size_t len;
+        if ((dot = strchr(label, '.')) == NULL)
+            dot = label + strlen(label);
+        len = dot - label;
+        if (len == 0) {
+            /* empty label is only permitted at the end (as a trailing dot) */
+            if (*dot != '\0' || label == name)
+                return -1;
+            break;
+        }
+        if (len > 63)
+            return -1;
+        *p++ = (uint8_t)len;
+        memcpy(p, label, len);
+        p += len;
+        label = *dot == '.' ? dot + 1 : dot;
+    } while (*label != '\0');
+    *p++ = 0;
+    encode16(p, qtype);
+    encode16(p + 2, DNS_CLASS_IN);
+    p += 4;
+
+    return (int)(p - dst);
+}
+
+static int init_transaction(h2o_dns_query_t *query, const char *name, uint16_t qtype)
+{
+    struct st_h2o_dns_transaction_t *tx = query->transactions + query->num_transactions;
+    uint8_t *header = tx->packet + 2;
+    int question_len;
+
+    memset(tx, 0, offsetof(struct st_h2o_dns_transaction_t, packet));
+    tx->query = query;
+    tx->qtype = qtype;
+    tx->id = new_query_id();
+    if ((question_len = encode_question(header + DNS_HEADER_SIZE, name, qtype)) < 0)
+        return -1;
+    memset(header, 0, DNS_HEADER_SIZE);
+    encode16(header, tx->id);
+    encode16(header + 2, DNS_FLAG_RD);
+    encode16(header + 4, 1);
+    tx->packet_len = 2 + DNS_HEADER_SIZE + question_len;
+    encode16(tx->packet, (uint16_t)(tx->packet_len - 2));
+
+    ++query->num_transactions;
+    return 0;
+}
+
+static void lookup_hosts(h2o_dns_query_t *query, const char *name, int want_v4, int want_v6)
+{
+    size_t i, num_v4 = 0, num_v6 = 0;
+    uint8_t v4[MAX_ADDRS_PER_TRANSACTION][16], v6[MAX_ADDRS_PER_TRANSACTION][16];
+
+    for (i = 0; i != query->config->hosts.size; ++i) {
+        const h2o_dns_hosts_entry_t *entry = query->config->hosts.entries + i;
+        if (strcmp(entry->name, name) != 0)
+            continue;
+        if (entry->family == AF_INET && want_v4 && num_v4 < MAX_ADDRS_PER_TRANSACTION) {
+            memcpy(v4[num_v4++], &entry->addr.v4, 4);
+        } else if (entry->family == AF_INET6 && want_v6 && num_v6 < MAX_ADDRS_PER_TRANSACTION) {
+            memcpy(v6[num_v6++], &entry->addr.v6, 16);
+        }
+    }
+    query->immediate.ai = build_addrinfo(query, AF_INET, (const uint8_t(*)[16])v4, num_v4, NULL);
+    query->immediate.ai = build_addrinfo(query, AF_INET6, (const uint8_t(*)[16])v6, num_v6, query->immediate.ai);
+}
+
+int h2o_dns_can_resolve(const h2o_dns_config_t *config, const char *name, const char *serv, const struct addrinfo *hints,
+                        uint16_t *port)
+{
+    size_t v, ndots = 0;
+    const char *p;
+
+    if (config->num_nameservers == 0)
+        return 0;
+    if (!(hints->ai_family == AF_UNSPEC || hints->ai_family == AF_INET || hints->ai_family == AF_INET6))
+        return 0;
+    if (hints->ai_socktype == 0 || (hints->ai_flags & ~(AI_ADDRCONFIG | AI_NUMERICSERV)) != 0)
+        return 0;
+    if ((v = h2o_strtosize(serv, strlen(serv))) > 65535)
+        return 0;
+    *port = (uint16_t)v;
+    if (name[0] == '\0' || strlen(name) > DNS_MAX_NAME_LEN)
+        return 0;
+
+    /* names that might be subject to the search list are left to the libc resolver */
+    if (config->has_search) {
+        for (p = name; *p != '\0'; ++p)
+            if (*p == '.')
+                ++ndots;
+        if (ndots < config->ndots && p[-1] != '.')
+            return 0;
+    }
+
+    return 1;
+}
+
+h2o_dns_query_t *h2o_dns_resolve(h2o_loop_t *loop, const h2o_dns_config_t *config, const char *_name, uint16_t port,
+                                 const struct addrinfo *hints, h2o_dns_resolve_cb cb, void *data)
+{
+    h2o_dns_query_t *query = h2o_mem_alloc(sizeof(*query));
+    char name[DNS_MAX_NAME_LEN + 2];
+    uint8_t addr[16];
+    int want_v4, want_v6, family;
+    size_t name_len = strlen(_name);
+
+    query->loop = loop;
+    query->config = config;
+    query->cb = cb;
+    query->data = data;
+    query->port = port;
+    query->socktype = hints->ai_socktype;
+    query->protocol = hints->ai_protocol;
+    query->timer = h2o_mem_alloc(sizeof(*query->timer));
+    uv_timer_init(loop, query->timer);
+    query->timer->data = query;
+    query->num_transactions = 0;
+    query->num_pending = 0;
+    query->immediate.errstr = NULL;
+    query->immediate.ai = NULL;
+
+    want_v4 = hints->ai_family != AF_INET6;
+    want_v6 = hints->ai_family != AF_INET;
+    if ((hints->ai_flags & AI_ADDRCONFIG) != 0 && (config->addrconfig.ipv4 || config->addrconfig.ipv6)) {
+        want_v4 &= config->addrconfig.ipv4;
+        want_v6 &= config->addrconfig.ipv6;
+    }
+
+    /* normalize the name (lowercase, without trailing dot) */
+    if (name_len > DNS_MAX_NAME_LEN + 1) {
+        query->immediate.errstr = h2o_dns_error_not_found;
+        goto Immediate;
+    }
+    memcpy(name, _name, name_len);
+    name[name_len] = '\0';
+    h2o_strtolower(name, name_len);
+    if (name_len > 1 && name[name_len - 1] == '.')
+        name[--name_len] = '\0';
+    if (name_len > DNS_MAX_NAME_LEN) {
+        query->immediate.errstr = h2o_dns_error_not_found;
+        goto Immediate;
+    }
+
+    /* numeric address */
+    if (parse_address(h2o_iovec_init(name, name_len), &family, addr) == 0) {
+        if ((family == AF_INET && hints->ai_family != AF_INET6) || (family == AF_INET6 && hints->ai_family != AF_INET)) {
+            query->immediate.ai = build_addrinfo(query, family, (const uint8_t(*)[16])addr, 1, NULL);
+        } else {
+            query->immediate.errstr = h2o_dns_error_no_address;
+        }
+        goto Immediate;
+    }
+
+    /* the hosts file */
+    lookup_hosts(query, name, want_v4, want_v6);
+    if (query->immediate.ai != NULL)
+        goto Immediate;
+    if (!(want_v4 || want_v6)) {
+        query->immediate.errstr = h2o_dns_error_no_address;
+        goto Immediate;
+    }
+
+    /* send the queries in parallel */
+    if ((want_v6 && init_transaction(query, name, DNS_TYPE_AAAA) != 0) || (want_v4 && init_transaction(query, name, DNS_TYPE_A) != 0)) {
+        query->num_transactions = 0;
+        query->immediate.errstr = h2o_dns_error_not_found;
+        goto Immediate;
+    }
+    query->num_pending = query->num_transactions;
+    uv_timer_start(query->timer, on_timeout, config->timeout, config->timeout);
+    {
+        /* keep the transactions from completing the query synchronously (the callback must be invoked asynchronously) */
+        size_t i;
+        ++query->num_pending;
+        for (i = 0; i != query->num_transactions; ++i)
+            send_next(query->transactions + i, h2o_dns_error_server_failure);
+        if (--query->num_pending == 0) {
+            query->num_transactions = 0;
+            query->immediate.errstr = h2o_dns_error_server_failure;
+            goto Immediate;
+        }
+    }
+    return query;
+
+Immediate:
+    uv_timer_start(query->timer, on_timeout, 0, 0);
+    return query;
+}
+
+void h2o_dns_cancel(h2o_dns_query_t *query)
+{
+    dispose_query(query);
+}
+
+#else
+
+int h2o_dns_can_resolve(const h2o_dns_config_t *config, const char *name, const char *serv, const struct addrinfo *hints,
+                        uint16_t *port)
+{
+    return 0;
+}
+
+h2o_dns_query_t *h2o_dns_resolve(h2o_loop_t *loop, const h2o_dns_config_t *config, const char *name, uint16_t port,
+                                 const struct addrinfo *hints, h2o_dns_resolve_cb cb, void *data)
+{
+    h2o_fatal("stub resolver is not available");
+    return NULL;
+}
+
+void h2o_dns_cancel(h2o_dns_query_t *query)
+{
+}
+
+#endif
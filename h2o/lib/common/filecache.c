@@ -25,10 +25,16 @@
 #include <stddef.h>
 
 #ifndef _MSC_VER
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #else
 #include <io.h>
 #endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include "khash.h"
 #include "h2o/memory.h"
@@ -36,12 +42,169 @@
 
 KHASH_SET_INIT_STR(opencache_set)
 
+/**
+ * maximum number of files being mapped at once (by all the threads); the files are not mapped if the table is full
+ */
+#define MAX_MAPPINGS 4096
+/**
+ * size of the region at the head of the mapping being read ahead when the file is mapped
+ */
+#define MAPPING_WILLNEED_SIZE (2 * 1024 * 1024)
+
+/**
+ * inotify watch of the directory containing the cached files, shared among the entries
+ */
+struct st_h2o_filecache_watch_t {
+    int wd;
+    size_t refcnt;
+    char dir[1];
+};
+
+KHASH_MAP_INIT_INT(filecache_watch_by_wd, struct st_h2o_filecache_watch_t *)
+KHASH_MAP_INIT_STR(filecache_watch_by_dir, struct st_h2o_filecache_watch_t *)
+
 struct st_h2o_filecache_t {
     khash_t(opencache_set) * hash;
-    h2o_linklist_t lru;
+    h2o_linklist_t lru; /* ordered by the time the entries were created (and hence by their expiration time) */
     size_t capacity;
+    uint64_t ttl;
+    uint64_t revalidate_interval;
+    uint64_t now;
+    struct {
+        int fd; /* -1 if not used */
+        int needs_drain;
+        khash_t(filecache_watch_by_wd) * by_wd;
+        khash_t(filecache_watch_by_dir) * by_dir;
+    } inotify;
 };
 
+#ifndef _MSC_VER
+
+/**
+ * table of the regions being mapped, consulted by the SIGBUS handler; the slots are claimed and released using atomic operations
+ * so that the handler can read the table at any moment
+ */
+static struct {
+    char *volatile base;
+    volatile size_t len;
+    volatile sig_atomic_t truncated;
+} mappings[MAX_MAPPINGS];
+static size_t page_size;
+static struct sigaction orig_sigbus_action;
+static pthread_once_t sigbus_handler_once = PTHREAD_ONCE_INIT;
+
+static void on_sigbus(int signo, siginfo_t *info, void *uc)
+{
+    char *addr = info->si_addr;
+    size_t i;
+
+    for (i = 0; i != MAX_MAPPINGS; ++i) {
+        char *base = mappings[i].base;
+        if (base != NULL && base <= addr && addr < base + mappings[i].len) {
+            /* the file has been truncated; replace the page with a zero-filled one so that the access can complete */
+            char *page = (char *)((uintptr_t)addr & ~(uintptr_t)(page_size - 1));
+            mmap(page, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            mappings[i].truncated = 1;
+            return;
+        }
+    }
+
+    /* not caused by the mappings of the cache */
+    if ((orig_sigbus_action.sa_flags & SA_SIGINFO) != 0) {
+        orig_sigbus_action.sa_sigaction(signo, info, uc);
+    } else if (orig_sigbus_action.sa_handler != SIG_DFL && orig_sigbus_action.sa_handler != SIG_IGN) {
+        orig_sigbus_action.sa_handler(signo);
+    } else {
+        /* restore the default action; the signal is raised again when the faulting instruction is retried */
+        signal(SIGBUS, SIG_DFL);
+    }
+}
+
+static void setup_sigbus_handler(void)
+{
+    struct sigaction sa;
+
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_sigbus;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, &orig_sigbus_action);
+}
+
+static void unmap_file(h2o_filecache_ref_t *ref)
+{
+    /* release the slot before unmapping, so that the region would not be confused with a mapping created by a different thread */
+    mappings[ref->_mmap.slot].len = 0;
+    __sync_synchronize();
+    mappings[ref->_mmap.slot].base = NULL;
+    munmap(ref->_mmap.base, ref->_mmap.len);
+    ref->_mmap.base = NULL;
+}
+
+#endif
+
+static void detach_watch(h2o_filecache_t *cache, struct st_h2o_filecache_watch_t *watch)
+{
+#ifdef __linux__
+    khiter_t iter;
+
+    if (--watch->refcnt != 0)
+        return;
+    inotify_rm_watch(cache->inotify.fd, watch->wd);
+    if ((iter = kh_get(filecache_watch_by_wd, cache->inotify.by_wd, watch->wd)) != kh_end(cache->inotify.by_wd))
+        kh_del(filecache_watch_by_wd, cache->inotify.by_wd, iter);
+    if ((iter = kh_get(filecache_watch_by_dir, cache->inotify.by_dir, watch->dir)) != kh_end(cache->inotify.by_dir))
+        kh_del(filecache_watch_by_dir, cache->inotify.by_dir, iter);
+    free(watch);
+#endif
+}
+
+static struct st_h2o_filecache_watch_t *attach_watch(h2o_filecache_t *cache, const char *path)
+{
+#ifdef __linux__
+    struct st_h2o_filecache_watch_t *watch;
+    const char *slash = strrchr(path, '/');
+    size_t dir_len;
+    khiter_t iter;
+    int wd, ret;
+
+    if (cache->inotify.fd == -1 || slash == NULL)
+        return NULL;
+    dir_len = slash == path ? 1 : slash - path;
+
+    /* reuse the watch if the directory is being watched */
+    watch = h2o_mem_alloc(offsetof(struct st_h2o_filecache_watch_t, dir) + dir_len + 1);
+    memcpy(watch->dir, path, dir_len);
+    watch->dir[dir_len] = '\0';
+    if ((iter = kh_get(filecache_watch_by_dir, cache->inotify.by_dir, watch->dir)) != kh_end(cache->inotify.by_dir)) {
+        free(watch);
+        watch = kh_val(cache->inotify.by_dir, iter);
+        ++watch->refcnt;
+        return watch;
+    }
+
+    /* add a new watch; if it fails (e.g. due to fs.inotify.max_user_watches), or if the directory is being watched by using a
+     * different name (e.g. through a symlink), the entry is revalidated by calling stat(2) */
+    if ((wd = inotify_add_watch(cache->inotify.fd, watch->dir, IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE |
+                                                                   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)) ==
+            -1 ||
+        kh_get(filecache_watch_by_wd, cache->inotify.by_wd, wd) != kh_end(cache->inotify.by_wd)) {
+        free(watch);
+        return NULL;
+    }
+    watch->wd = wd;
+    watch->refcnt = 1;
+    iter = kh_put(filecache_watch_by_wd, cache->inotify.by_wd, wd, &ret);
+    kh_val(cache->inotify.by_wd, iter) = watch;
+    iter = kh_put(filecache_watch_by_dir, cache->inotify.by_dir, watch->dir, &ret);
+    kh_val(cache->inotify.by_dir, iter) = watch;
+    return watch;
+#else
+    return NULL;
+#endif
+}
+
 static inline void release_from_cache(h2o_filecache_t *cache, khiter_t iter)
 {
     const char *path = kh_key(cache->hash, iter);
@@ -50,6 +213,10 @@ static inline void release_from_cache(h2o_filecache_t *cache, khiter_t iter)
     /* detach from list */
     kh_del(opencache_set, cache->hash, iter);
     h2o_linklist_unlink(&ref->_lru);
+    if (ref->_watch != NULL) {
+        detach_watch(cache, ref->_watch);
+        ref->_watch = NULL;
+    }
 
     /* and close */
     h2o_filecache_close_file(ref);
@@ -62,6 +229,13 @@ h2o_filecache_t *h2o_filecache_create(size_t capacity)
     cache->hash = kh_init(opencache_set);
     h2o_linklist_init_anchor(&cache->lru);
     cache->capacity = capacity;
+    cache->ttl = 0;
+    cache->revalidate_interval = 0;
+    cache->now = 0;
+    cache->inotify.fd = -1;
+    cache->inotify.needs_drain = 0;
+    cache->inotify.by_wd = kh_init(filecache_watch_by_wd);
+    cache->inotify.by_dir = kh_init(filecache_watch_by_dir);
 
     return cache;
 }
@@ -72,6 +246,11 @@ void h2o_filecache_destroy(h2o_filecache_t *cache)
     assert(kh_size(cache->hash) == 0);
     assert(h2o_linklist_is_empty(&cache->lru));
     kh_destroy(opencache_set, cache->hash);
+    assert(kh_size(cache->inotify.by_wd) == 0);
+    kh_destroy(filecache_watch_by_wd, cache->inotify.by_wd);
+    kh_destroy(filecache_watch_by_dir, cache->inotify.by_dir);
+    if (cache->inotify.fd != -1)
+        close(cache->inotify.fd);
     free(cache);
 }
 
@@ -86,23 +265,155 @@ void h2o_filecache_clear(h2o_filecache_t *cache)
     assert(kh_size(cache->hash) == 0);
 }
 
-h2o_filecache_ref_t *h2o_filecache_open_file(h2o_filecache_t *cache, const char *path, int oflag)
+void h2o_filecache_set_ttl(h2o_filecache_t *cache, uint64_t ttl, uint64_t revalidate_interval)
+{
+    cache->ttl = ttl;
+    cache->revalidate_interval = revalidate_interval;
+#ifdef __linux__
+    if (ttl != 0 && cache->inotify.fd == -1)
+        cache->inotify.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+static void drain_inotify(h2o_filecache_t *cache)
+{
+#ifdef __linux__
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t rret;
+
+    cache->inotify.needs_drain = 0;
+
+    while ((rret = read(cache->inotify.fd, buf, sizeof(buf))) > 0) {
+        const char *p;
+        for (p = buf; p < buf + rret; p += sizeof(struct inotify_event) + ((const struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const void *)p;
+            struct st_h2o_filecache_watch_t *watch;
+            khiter_t iter;
+            if ((ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)) != 0) {
+                /* events might have been lost, or the directory has gone away */
+                h2o_filecache_clear(cache);
+                continue;
+            }
+            if (ev->len == 0 || (iter = kh_get(filecache_watch_by_wd, cache->inotify.by_wd, ev->wd)) == kh_end(cache->inotify.by_wd))
+                continue;
+            watch = kh_val(cache->inotify.by_wd, iter);
+            {
+                size_t dir_len = strlen(watch->dir), name_len = strlen(ev->name);
+                char *path = alloca(dir_len + name_len + 2);
+                memcpy(path, watch->dir, dir_len);
+                if (dir_len != 1)
+                    path[dir_len++] = '/';
+                memcpy(path + dir_len, ev->name, name_len + 1);
+                if ((iter = kh_get(opencache_set, cache->hash, path)) != kh_end(cache->hash))
+                    release_from_cache(cache, iter);
+            }
+        }
+    }
+#endif
+}
+
+void h2o_filecache_update(h2o_filecache_t *cache, uint64_t now)
+{
+    cache->now = now;
+
+    if (cache->ttl == 0) {
+        h2o_filecache_clear(cache);
+        return;
+    }
+
+    if (cache->inotify.fd != -1)
+        cache->inotify.needs_drain = 1;
+
+    /* evict the expired entries */
+    while (!h2o_linklist_is_empty(&cache->lru)) {
+        h2o_filecache_ref_t *ref = H2O_STRUCT_FROM_MEMBER(h2o_filecache_ref_t, _lru, cache->lru.prev);
+        if (now < ref->_expires_at)
+            break;
+        release_from_cache(cache, kh_get(opencache_set, cache->hash, ref->_path));
+    }
+}
+
+/**
+ * returns if the entry is still valid, by checking the expiration time and by revalidating the entry if necessary
+ */
+static int entry_is_valid(h2o_filecache_t *cache, h2o_filecache_ref_t *ref)
+{
+    struct stat st;
+    int stat_ret;
+
+    if (cache->ttl == 0)
+        return 1;
+    if (cache->now >= ref->_expires_at)
+        return 0;
+    if (ref->_watch != NULL || cache->now < ref->_revalidate_at)
+        return 1;
+
+    /* revalidate */
+    stat_ret = stat(ref->_path, &st);
+    if (ref->fd != -1) {
+        if (stat_ret != 0 || st.st_ino != ref->st.st_ino || st.st_size != ref->st.st_size || st.st_mtime != ref->st.st_mtime)
+            return 0;
+    } else {
+        if (stat_ret == 0 || errno != ref->open_err)
+            return 0;
+    }
+    ref->_revalidate_at = cache->now + cache->revalidate_interval;
+    return 1;
+}
+
+int h2o_filecache_is_cached(h2o_filecache_t *cache, const char *path)
+{
+    khiter_t iter;
+
+    if (cache->inotify.needs_drain)
+        drain_inotify(cache);
+    if ((iter = kh_get(opencache_set, cache->hash, path)) == kh_end(cache->hash))
+        return 0;
+    return cache->ttl == 0 || cache->now < H2O_STRUCT_FROM_MEMBER(h2o_filecache_ref_t, _path, kh_key(cache->hash, iter))->_expires_at;
+}
+
+void h2o_filecache_invalidate(h2o_filecache_t *cache, h2o_filecache_ref_t *ref)
 {
-    khiter_t iter = kh_get(opencache_set, cache->hash, path);
+    khiter_t iter;
+
+    if (!h2o_linklist_is_linked(&ref->_lru))
+        return;
+    iter = kh_get(opencache_set, cache->hash, ref->_path);
+    assert(iter != kh_end(cache->hash));
+    release_from_cache(cache, iter);
+}
+
+static h2o_filecache_ref_t *lookup_or_create(h2o_filecache_t *cache, const char *path, int *created)
+{
+    khiter_t iter;
     h2o_filecache_ref_t *ref;
     int dummy;
 
+    /* apply the changes to the files before looking up the cache */
+    if (cache->inotify.needs_drain)
+        drain_inotify(cache);
+
     /* lookup cache, and return the one if found */
-    if (iter != kh_end(cache->hash)) {
+    if ((iter = kh_get(opencache_set, cache->hash, path)) != kh_end(cache->hash)) {
         ref = H2O_STRUCT_FROM_MEMBER(h2o_filecache_ref_t, _path, kh_key(cache->hash, iter));
-        ++ref->_refcnt;
-        goto Exit;
+        if (entry_is_valid(cache, ref)) {
+            ++ref->_refcnt;
+            *created = 0;
+            return ref;
+        }
+        release_from_cache(cache, iter);
     }
 
     /* create a new cache entry */
     ref = h2o_mem_alloc(offsetof(h2o_filecache_ref_t, _path) + strlen(path) + 1);
     ref->_refcnt = 1;
     ref->_lru = (h2o_linklist_t){NULL};
+    ref->_expires_at = cache->now + cache->ttl;
+    ref->_revalidate_at = cache->now + cache->revalidate_interval;
+    ref->_watch = NULL;
+    ref->_mmap.base = NULL;
+    ref->_mmap.len = 0;
+    ref->_mmap.slot = -1;
     strcpy(ref->_path, path);
 
     /* if cache is used, then... */
@@ -118,8 +429,33 @@ h2o_filecache_ref_t *h2o_filecache_open_file(h2o_filecache_t *cache, const char
         ++ref->_refcnt;
         kh_put(opencache_set, cache->hash, ref->_path, &dummy);
         h2o_linklist_insert(cache->lru.next, &ref->_lru);
+        if (cache->ttl != 0)
+            ref->_watch = attach_watch(cache, ref->_path);
     }
 
+    *created = 1;
+    return ref;
+}
+
+static h2o_filecache_ref_t *return_ref(h2o_filecache_ref_t *ref)
+{
+    /* if the cache entry retains an error, return it instead of the reference */
+    if (ref->fd == -1) {
+        errno = ref->open_err;
+        h2o_filecache_close_file(ref);
+        ref = NULL;
+    }
+    return ref;
+}
+
+h2o_filecache_ref_t *h2o_filecache_open_file(h2o_filecache_t *cache, const char *path, int oflag)
+{
+    int created;
+    h2o_filecache_ref_t *ref = lookup_or_create(cache, path, &created);
+
+    if (!created)
+        goto Exit;
+
     /* open the file, or memoize the error */
 //#ifndef _MSC_VER
     if ((ref->fd = open(path, oflag)) != -1 && fstat(ref->fd, &ref->st) == 0) {
@@ -154,13 +490,33 @@ Exit:
 //		ref->_etag.len = 0;
 //	}
 //#endif
-    /* if the cache entry retains an error, return it instead of the reference */
-    if (ref->fd == -1) {
-        errno = ref->open_err;
-        h2o_filecache_close_file(ref);
-        ref = NULL;
+    return return_ref(ref);
+}
+
+h2o_filecache_ref_t *h2o_filecache_open_file_with_fd(h2o_filecache_t *cache, const char *path, int fd, int open_err)
+{
+    int created;
+    h2o_filecache_ref_t *ref = lookup_or_create(cache, path, &created);
+
+    if (!created) {
+        /* the file has been opened by somebody else in the meantime */
+        if (fd != -1)
+            close(fd);
+        return return_ref(ref);
     }
-    return ref;
+
+    if ((ref->fd = fd) != -1 && fstat(ref->fd, &ref->st) == 0) {
+        ref->_last_modified.str[0] = '\0';
+        ref->_etag.len = 0;
+    } else {
+        ref->open_err = fd != -1 ? errno : open_err;
+        if (ref->fd != -1) {
+            close(ref->fd);
+            ref->fd = -1;
+        }
+    }
+
+    return return_ref(ref);
 }
 
 void h2o_filecache_close_file(h2o_filecache_ref_t *ref)
@@ -168,6 +524,10 @@ void h2o_filecache_close_file(h2o_filecache_ref_t *ref)
     if (--ref->_refcnt != 0)
         return;
     assert(!h2o_linklist_is_linked(&ref->_lru));
+#ifndef _MSC_VER
+    if (ref->_mmap.base != NULL)
+        unmap_file(ref);
+#endif
     if (ref->fd != -1) {
         close(ref->fd);
         ref->fd = -1;
@@ -199,3 +559,53 @@ size_t h2o_filecache_get_etag(h2o_filecache_ref_t *ref, char *outbuf)
     memcpy(outbuf, ref->_etag.buf, ref->_etag.len + 1);
     return ref->_etag.len;
 }
+
+h2o_iovec_t h2o_filecache_get_mapping(h2o_filecache_ref_t *ref)
+{
+#ifndef _MSC_VER
+    char *base;
+    size_t len, i;
+
+    assert(ref->fd != -1);
+    if (ref->_mmap.base != NULL)
+        return h2o_iovec_init(ref->_mmap.base, ref->_mmap.len);
+    if (ref->st.st_size == 0)
+        goto Fail;
+
+    pthread_once(&sigbus_handler_once, setup_sigbus_handler);
+
+    len = ref->st.st_size;
+    if ((base = mmap(NULL, len, PROT_READ, MAP_SHARED, ref->fd, 0)) == MAP_FAILED)
+        goto Fail;
+    /* register to the table of mappings */
+    for (i = 0; i != MAX_MAPPINGS; ++i)
+        if (mappings[i].base == NULL && __sync_bool_compare_and_swap(&mappings[i].base, NULL, base))
+            break;
+    if (i == MAX_MAPPINGS) {
+        munmap(base, len);
+        goto Fail;
+    }
+    mappings[i].truncated = 0;
+    mappings[i].len = len;
+    ref->_mmap.base = base;
+    ref->_mmap.len = len;
+    ref->_mmap.slot = (int)i;
+
+    /* the file is likely to be read from the head (or from the offset of the range) to the end */
+    madvise(base, len, MADV_SEQUENTIAL);
+    madvise(base, len < MAPPING_WILLNEED_SIZE ? len : MAPPING_WILLNEED_SIZE, MADV_WILLNEED);
+
+    return h2o_iovec_init(base, len);
+Fail:
+#endif
+    return h2o_iovec_init(NULL, 0);
+}
+
+int h2o_filecache_mapping_is_truncated(h2o_filecache_ref_t *ref)
+{
+#ifndef _MSC_VER
+    if (ref->_mmap.base != NULL)
+        return mappings[ref->_mmap.slot].truncated != 0;
+#endif
+    return 0;
+}
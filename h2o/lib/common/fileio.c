@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <time.h>
+#include <unistd.h>
+#else
+#include <io.h>
+int pread(unsigned int fd, char *buf, size_t count, int offset); /* defined in lib/handler/file.c */
+#endif
+#include "h2o/fileio.h"
+#include "uv.h"
+
+#ifdef _WIN32
+#ifndef UV_MUTEX_INITIALIZER
+#define UV_COND_INITIALIZER {0}
+#define UV_MUTEX_INITIALIZER {(void*)-1,-1,0,0,0,0}
+#endif
+#endif
+
+static struct {
+#ifndef _MSC_VER
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#else
+    uv_mutex_t mutex;
+    uv_cond_t cond;
+#endif
+    h2o_linklist_t pending; /* anchor of h2o_fileio_req_t::_pending */
+    size_t num_threads;
+    size_t num_threads_idle;
+    h2o_fileio_stats_t stats;
+} queue = {UV_MUTEX_INITIALIZER, UV_COND_INITIALIZER, {&queue.pending, &queue.pending}};
+
+size_t h2o_fileio_max_threads = 1;
+
+static uint64_t now_microsec(void)
+{
+#ifndef _MSC_VER
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return uv_hrtime() / 1000;
+#endif
+}
+
+static void lock_queue(void)
+{
+#ifndef _MSC_VER
+    pthread_mutex_lock(&queue.mutex);
+#else
+    uv_mutex_lock(&queue.mutex);
+#endif
+}
+
+static void unlock_queue(void)
+{
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&queue.mutex);
+#else
+    uv_mutex_unlock(&queue.mutex);
+#endif
+}
+
+static void run_req(h2o_fileio_req_t *req)
+{
+    switch (req->op) {
+    case H2O_FILEIO_OP_OPEN:
+        while ((req->ret = open(req->open.path, req->open.oflag)) == -1 && errno == EINTR)
+            ;
+        break;
+    case H2O_FILEIO_OP_PREAD:
+        while ((req->ret = pread(req->pread.fd, req->pread.buf, req->pread.len, req->pread.off)) == -1 && errno == EINTR)
+            ;
+        break;
+    }
+    req->err = req->ret == -1 ? errno : 0;
+}
+
+static void *fileio_thread_main(void *_unused)
+{
+    lock_queue();
+
+    while (1) {
+        --queue.num_threads_idle;
+        while (!h2o_linklist_is_empty(&queue.pending)) {
+            h2o_fileio_req_t *req = H2O_STRUCT_FROM_MEMBER(h2o_fileio_req_t, _pending, queue.pending.next);
+            uint64_t latency;
+            h2o_linklist_unlink(&req->_pending);
+            --queue.stats.num_queued;
+            ++queue.stats.num_inflight;
+            unlock_queue();
+            run_req(req);
+            latency = now_microsec() - req->_submitted_at;
+            lock_queue();
+            --queue.stats.num_inflight;
+            ++queue.stats.num_completed;
+            queue.stats.latency_sum += latency;
+            if (queue.stats.latency_max < latency)
+                queue.stats.latency_max = latency;
+            h2o_multithread_send_message(req->_receiver, &req->_message);
+        }
+        ++queue.num_threads_idle;
+#ifndef _MSC_VER
+        pthread_cond_wait(&queue.cond, &queue.mutex);
+#else
+        uv_cond_wait(&queue.cond, &queue.mutex);
+#endif
+    }
+
+    h2o_fatal("unreachable");
+    return NULL;
+}
+
+static void create_fileio_thread(void)
+{
+#ifndef _MSC_VER
+    pthread_t tid;
+    pthread_attr_t attr;
+#else
+    uv_thread_t tid;
+#endif
+    int ret;
+
+#ifndef _MSC_VER
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, 1);
+    pthread_attr_setstacksize(&attr, 100 * 1024);
+    if ((ret = pthread_create(&tid, &attr, fileio_thread_main, NULL)) != 0) {
+#else
+    if ((ret = uv_thread_create(&tid, fileio_thread_main, NULL)) != 0) {
+#endif
+        if (queue.num_threads == 0) {
+            fprintf(stderr, "failed to start first thread for file I/O:%s\n", strerror(ret));
+            abort();
+        } else {
+            perror("pthread_create(for file I/O)");
+        }
+        return;
+    }
+
+    ++queue.num_threads;
+    ++queue.num_threads_idle;
+}
+
+void h2o_fileio_submit(h2o_fileio_req_t *req, h2o_multithread_receiver_t *receiver)
+{
+    req->ret = -1;
+    req->err = 0;
+    req->_receiver = receiver;
+    req->_pending = (h2o_linklist_t){NULL};
+    req->_message = (h2o_multithread_message_t){{NULL}};
+    req->_submitted_at = now_microsec();
+
+    lock_queue();
+
+    h2o_linklist_insert(&queue.pending, &req->_pending);
+    ++queue.stats.num_queued;
+    if (queue.num_threads_idle == 0 && queue.num_threads < h2o_fileio_max_threads)
+        create_fileio_thread();
+
+#ifndef _MSC_VER
+    pthread_cond_signal(&queue.cond);
+#else
+    uv_cond_signal(&queue.cond);
+#endif
+    unlock_queue();
+}
+
+void h2o_fileio_receiver(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages)
+{
+    while (!h2o_linklist_is_empty(messages)) {
+        h2o_fileio_req_t *req = H2O_STRUCT_FROM_MEMBER(h2o_fileio_req_t, _message.link, messages->next);
+        h2o_linklist_unlink(&req->_message.link);
+        req->cb(req);
+    }
+}
+
+void h2o_fileio_get_stats(h2o_fileio_stats_t *stats)
+{
+    lock_queue();
+    *stats = queue.stats;
+    stats->num_threads = queue.num_threads;
+    unlock_queue();
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "h2o/happy_eyeballs.h"
+#include "h2o/timeout.h"
+
+struct st_h2o_happy_eyeballs_attempt_t {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    h2o_socket_t *sock;
+};
+
+struct st_h2o_happy_eyeballs_t {
+    h2o_loop_t *loop;
+    h2o_happy_eyeballs_cb cb;
+    void *data;
+    size_t num_attempts;
+    size_t num_started;
+    size_t num_inflight;
+#if H2O_USE_LIBUV
+    uv_timer_t *timer; /* closed asynchronously, and is therefore allocated separately */
+#else
+    struct st_h2o_happy_eyeballs_timeouts_t *timeouts;
+    h2o_timeout_entry_t timeout_entry;
+#endif
+    struct st_h2o_happy_eyeballs_attempt_t attempts[1];
+};
+
+#if !H2O_USE_LIBUV
+/**
+ * the timeouts are bound to a loop and to a duration; they are shared by the attempts running on the same loop
+ */
+struct st_h2o_happy_eyeballs_timeouts_t {
+    h2o_loop_t *loop;
+    h2o_timeout_t delay;
+    h2o_timeout_t zero; /* used for moving on without waiting for the delay */
+};
+
+static __thread H2O_VECTOR(struct st_h2o_happy_eyeballs_timeouts_t *) loop_timeouts;
+#endif
+
+uint64_t h2o_happy_eyeballs_delay = H2O_HAPPY_EYEBALLS_DEFAULT_DELAY;
+
+static void start_next(h2o_happy_eyeballs_t *he, int can_report);
+
+#if H2O_USE_LIBUV
+
+static void on_delay(uv_timer_t *timer)
+{
+    start_next(timer->data, 1);
+}
+
+static void init_timer(h2o_happy_eyeballs_t *he)
+{
+    he->timer = h2o_mem_alloc(sizeof(*he->timer));
+    uv_timer_init(he->loop, he->timer);
+    he->timer->data = he;
+}
+
+static void start_timer(h2o_happy_eyeballs_t *he, uint64_t delay)
+{
+    uv_timer_start(he->timer, on_delay, delay, 0);
+}
+
+static void stop_timer(h2o_happy_eyeballs_t *he)
+{
+    uv_timer_stop(he->timer);
+}
+
+static void dispose_timer(h2o_happy_eyeballs_t *he)
+{
+    uv_close((uv_handle_t *)he->timer, (uv_close_cb)free);
+}
+
+#else
+
+static void on_delay(h2o_timeout_entry_t *entry)
+{
+    start_next(H2O_STRUCT_FROM_MEMBER(h2o_happy_eyeballs_t, timeout_entry, entry), 1);
+}
+
+static struct st_h2o_happy_eyeballs_timeouts_t *get_timeouts(h2o_loop_t *loop)
+{
+    struct st_h2o_happy_eyeballs_timeouts_t *timeouts;
+    size_t i;
+
+    for (i = 0; i != loop_timeouts.size; ++i) {
+        timeouts = loop_timeouts.entries[i];
+        if (timeouts->loop == loop && timeouts->delay.timeout == h2o_happy_eyeballs_delay)
+            return timeouts;
+    }
+
+    timeouts = h2o_mem_alloc(sizeof(*timeouts));
+    timeouts->loop = loop;
+    h2o_timeout_init(loop, &timeouts->delay, h2o_happy_eyeballs_delay);
+    h2o_timeout_init(loop, &timeouts->zero, 0);
+    h2o_vector_reserve(NULL, &loop_timeouts, loop_timeouts.size + 1);
+    loop_timeouts.entries[loop_timeouts.size++] = timeouts;
+    return timeouts;
+}
+
+static void init_timer(h2o_happy_eyeballs_t *he)
+{
+    he->timeouts = get_timeouts(he->loop);
+    he->timeout_entry = (h2o_timeout_entry_t){0, on_delay};
+}
+
+static void start_timer(h2o_happy_eyeballs_t *he, uint64_t delay)
+{
+    h2o_timeout_unlink(&he->timeout_entry);
+    h2o_timeout_link(he->loop, delay == 0 ? &he->timeouts->zero : &he->timeouts->delay, &he->timeout_entry);
+}
+
+static void stop_timer(h2o_happy_eyeballs_t *he)
+{
+    h2o_timeout_unlink(&he->timeout_entry);
+}
+
+static void dispose_timer(h2o_happy_eyeballs_t *he)
+{
+    h2o_timeout_unlink(&he->timeout_entry);
+}
+
+#endif
+
+static void dispose(h2o_happy_eyeballs_t *he, h2o_socket_t *winner)
+{
+    size_t i;
+
+    for (i = 0; i != he->num_started; ++i) {
+        h2o_socket_t *sock = he->attempts[i].sock;
+        if (sock != NULL && sock != winner)
+            h2o_socket_close(sock);
+    }
+    dispose_timer(he);
+    free(he);
+}
+
+static void on_connect(h2o_socket_t *sock, const char *err)
+{
+    h2o_happy_eyeballs_t *he = sock->data;
+    h2o_happy_eyeballs_cb cb;
+    void *data;
+    size_t i;
+
+    for (i = 0; i != he->num_started; ++i)
+        if (he->attempts[i].sock == sock)
+            break;
+    assert(i != he->num_started);
+
+    if (err != NULL) {
+        h2o_socket_close(sock);
+        he->attempts[i].sock = NULL;
+        --he->num_inflight;
+        /* move on to the next address immediately, instead of waiting for the delay to elapse */
+        stop_timer(he);
+        start_next(he, 1);
+        return;
+    }
+
+    cb = he->cb;
+    data = he->data;
+    sock->data = NULL;
+    dispose(he, sock);
+    cb(sock, NULL, data);
+}
+
+static void start_next(h2o_happy_eyeballs_t *he, int can_report)
+{
+    while (he->num_started < he->num_attempts) {
+        struct st_h2o_happy_eyeballs_attempt_t *attempt = he->attempts + he->num_started++;
+        if ((attempt->sock = h2o_socket_connect(he->loop, (void *)&attempt->addr, attempt->addrlen, on_connect)) == NULL)
+            continue;
+        attempt->sock->data = he;
+        ++he->num_inflight;
+        if (he->num_started < he->num_attempts && h2o_happy_eyeballs_delay != 0)
+            start_timer(he, h2o_happy_eyeballs_delay);
+        return;
+    }
+
+    if (he->num_inflight == 0) {
+        if (can_report) {
+            h2o_happy_eyeballs_cb cb = he->cb;
+            void *data = he->data;
+            dispose(he, NULL);
+            cb(NULL, "connection failed", data);
+        } else {
+            /* report the failure asynchronously, since the caller has not yet received the handle */
+            start_timer(he, 0);
+        }
+    }
+}
+
+static size_t interleave(struct st_h2o_happy_eyeballs_attempt_t *attempts, struct addrinfo *res)
+{
+    struct addrinfo *ai, *families[2][64];
+    size_t num[2] = {0, 0}, offset[2], i, j, n = 0;
+    int first_family = res->ai_family;
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        size_t f = ai->ai_family == first_family ? 0 : 1;
+        if (num[f] < sizeof(families[f]) / sizeof(families[f][0]) && ai->ai_addrlen <= sizeof(attempts[0].addr))
+            families[f][num[f]++] = ai;
+    }
+
+    /* alternate between the families, starting at random positions */
+    for (j = 0; j != 2; ++j)
+        offset[j] = num[j] != 0 ? rand() % num[j] : 0;
+    for (i = 0; i < num[0] || i < num[1]; ++i) {
+        for (j = 0; j != 2; ++j) {
+            if (i < num[j]) {
+                ai = families[j][(offset[j] + i) % num[j]];
+                memcpy(&attempts[n].addr, ai->ai_addr, ai->ai_addrlen);
+                attempts[n].addrlen = (socklen_t)ai->ai_addrlen;
+                attempts[n].sock = NULL;
+                ++n;
+            }
+        }
+    }
+
+    return n;
+}
+
+h2o_happy_eyeballs_t *h2o_happy_eyeballs_connect(h2o_loop_t *loop, struct addrinfo *res, h2o_happy_eyeballs_cb cb, void *data)
+{
+    h2o_happy_eyeballs_t *he;
+    struct addrinfo *ai;
+    size_t num_addrs = 0;
+
+    for (ai = res; ai != NULL; ai = ai->ai_next)
+        ++num_addrs;
+    assert(num_addrs != 0);
+
+    he = h2o_mem_alloc(offsetof(h2o_happy_eyeballs_t, attempts) + sizeof(he->attempts[0]) * num_addrs);
+    he->loop = loop;
+    he->cb = cb;
+    he->data = data;
+    he->num_attempts = interleave(he->attempts, res);
+    he->num_started = 0;
+    he->num_inflight = 0;
+    init_timer(he);
+
+    start_next(he, 0);
+    return he;
+}
+
+void h2o_happy_eyeballs_cancel(h2o_happy_eyeballs_t *he)
+{
+    dispose(he, NULL);
+}
@@ -19,6 +19,13 @@
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
  * IN THE SOFTWARE.
  */
+#include <assert.h>
+#include <stdio.h>
+#ifndef _MSC_VER
+#include <time.h>
+#endif
+#include "khash.h"
+#include "h2o/dns.h"
 #include "h2o/hostinfo.h"
 #include "uv.h"
 
@@ -26,21 +33,35 @@ struct st_h2o_hostinfo_getaddr_req_t {
     h2o_multithread_receiver_t *_receiver;
     h2o_hostinfo_getaddr_cb _cb;
     void *cbdata;
-    h2o_linklist_t _pending;
-    union {
-        struct {
-            char *name;
-            char *serv;
-            struct addrinfo hints;
-        } _in;
-        struct {
-            h2o_multithread_message_t message;
-            const char *errstr;
-            struct addrinfo *ai;
-        } _out;
-    };
+    h2o_linklist_t _pending; /* linked to cache_entry_t::waiters while the lookup is in flight */
+    struct {
+        h2o_multithread_message_t message;
+        const char *errstr;
+        struct addrinfo *ai;
+    } _out;
+};
+
+/**
+ * an entry of the name resolution cache, which also serves as the unit of work of the lookup threads
+ */
+struct cache_entry_t {
+    char *key;
+    char *name;
+    char *serv;
+    struct addrinfo hints;
+    h2o_linklist_t _pending; /* linked to queue.pending while waiting for a lookup thread */
+    h2o_linklist_t _lru;
+    h2o_linklist_t waiters; /* anchor of h2o_hostinfo_getaddr_req_t::_pending */
+    int is_resolving;
+    h2o_dns_config_t *_resolver_config; /* reference to the configuration used by the stub lookup in flight */
+    /* the answer; `ai` is a copy allocated as a single chunk (see dup_addrinfo) */
+    const char *errstr;
+    struct addrinfo *ai;
+    uint64_t expire_at;
 };
 
+KHASH_MAP_INIT_STR(hostinfo_cache, struct cache_entry_t *)
+
 #ifdef _WIN32
 #ifndef UV_MUTEX_INITIALIZER
 #define UV_COND_INITIALIZER {0}
@@ -57,28 +78,157 @@ static struct {
 	uv_mutex_t mutex;
 	uv_cond_t cond;
 #endif
-    h2o_linklist_t pending; /* anchor of h2o_hostinfo_getaddr_req_t::_pending */
+    h2o_linklist_t pending; /* anchor of cache_entry_t::_pending */
     size_t num_threads;
     size_t num_threads_idle;
-} queue = {UV_MUTEX_INITIALIZER, UV_COND_INITIALIZER, {&queue.pending, &queue.pending}, 0, 0};
+    /* the cache (guarded by the mutex as well) */
+    khash_t(hostinfo_cache) * entries;
+    h2o_linklist_t lru; /* anchor of cache_entry_t::_lru, least recently used first */
+    h2o_hostinfo_cache_stats_t stats;
+    /* configuration of the stub resolver, loaded on first use and reloaded when the files are modified */
+    struct {
+        h2o_dns_config_t *config; /* refcounted; NULL if the stub resolver cannot be used */
+        uint64_t checked_at;
+        int loaded;
+        int is_refreshing; /* set while a thread is (re)loading the configuration without holding the mutex */
+    } resolver;
+} queue = {UV_MUTEX_INITIALIZER, UV_COND_INITIALIZER, {&queue.pending, &queue.pending}, 0, 0, NULL, {&queue.lru, &queue.lru}};
 
 size_t h2o_hostinfo_max_threads = 1;
+uint64_t h2o_hostinfo_cache_ttl = 60000;
+uint64_t h2o_hostinfo_cache_negative_ttl = 5000;
+uint64_t h2o_hostinfo_cache_stale_ttl = 60000;
+size_t h2o_hostinfo_cache_capacity = 1024;
+int h2o_hostinfo_use_stub_resolver = 1;
+uint64_t h2o_hostinfo_resolver_check_interval = 5000;
 
-static void lookup_and_respond(h2o_hostinfo_getaddr_req_t *req)
+static uint64_t now_millisec(void)
 {
-    struct addrinfo *res;
+#ifndef _MSC_VER
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	return uv_hrtime() / 1000000;
+#endif
+}
 
-    int ret = getaddrinfo(req->_in.name, req->_in.serv, &req->_in.hints, &res);
+static struct addrinfo *dup_addrinfo(struct addrinfo *src)
+{
+    struct addrinfo *ai, *dst, **slot;
+    size_t sz = 0;
+    char *p;
+
+    if (src == NULL)
+        return NULL;
+
+    for (ai = src; ai != NULL; ai = ai->ai_next)
+        sz += sizeof(*ai) + ai->ai_addrlen;
+    p = h2o_mem_alloc(sz);
+
+    for (ai = src, slot = &dst; ai != NULL; ai = ai->ai_next) {
+        struct addrinfo *copy = (void *)p;
+        p += sizeof(*copy);
+        *copy = *ai;
+        copy->ai_canonname = NULL;
+        copy->ai_addr = (void *)p;
+        memcpy(copy->ai_addr, ai->ai_addr, ai->ai_addrlen);
+        p += ai->ai_addrlen;
+        *slot = copy;
+        slot = &copy->ai_next;
+    }
+    *slot = NULL;
+
+    return dst;
+}
+
+static void respond(h2o_hostinfo_getaddr_req_t *req, const char *errstr, struct addrinfo *ai)
+{
     req->_out.message = (h2o_multithread_message_t){{NULL}};
+    req->_out.errstr = errstr;
+    req->_out.ai = dup_addrinfo(ai);
+    h2o_multithread_send_message(req->_receiver, &req->_out.message);
+}
+
+static void free_entry(struct cache_entry_t *entry)
+{
+    /* caller should lock the mutex */
+    khiter_t iter = kh_get(hostinfo_cache, queue.entries, entry->key);
+    assert(iter != kh_end(queue.entries));
+    kh_del(hostinfo_cache, queue.entries, iter);
+    h2o_linklist_unlink(&entry->_lru);
+    free(entry->ai);
+    free(entry->key);
+    free(entry);
+}
+
+static void evict_entries(size_t capacity)
+{
+    /* caller should lock the mutex; entries being resolved are retained since there may be requests waiting for them */
+    h2o_linklist_t *node = queue.lru.next;
+    while (kh_size(queue.entries) > capacity && node != &queue.lru) {
+        struct cache_entry_t *entry = H2O_STRUCT_FROM_MEMBER(struct cache_entry_t, _lru, node);
+        node = node->next;
+        if (!entry->is_resolving)
+            free_entry(entry);
+    }
+}
+
+static void on_resolved(struct cache_entry_t *entry, const char *errstr, struct addrinfo *ai)
+{
+    /* caller should lock the mutex */
+    uint64_t now = now_millisec(), ttl = errstr == NULL ? h2o_hostinfo_cache_ttl : h2o_hostinfo_cache_negative_ttl;
+
+    entry->is_resolving = 0;
+
+    while (!h2o_linklist_is_empty(&entry->waiters)) {
+        h2o_hostinfo_getaddr_req_t *req = H2O_STRUCT_FROM_MEMBER(h2o_hostinfo_getaddr_req_t, _pending, entry->waiters.next);
+        h2o_linklist_unlink(&req->_pending);
+        respond(req, errstr, ai);
+    }
+
+    /* retain the stale answer if revalidation failed */
+    if (errstr != NULL && entry->ai != NULL && now < entry->expire_at + h2o_hostinfo_cache_stale_ttl) {
+        ++queue.stats.failed_revalidations;
+        return;
+    }
+
+    if (ttl == 0) {
+        free(ai);
+        free_entry(entry);
+        return;
+    }
+    free(entry->ai);
+    entry->errstr = errstr;
+    entry->ai = ai;
+    entry->expire_at = now + ttl;
+}
+
+static void lookup_and_respond(struct cache_entry_t *entry)
+{
+    struct addrinfo *res, *ai = NULL;
+    const char *errstr = NULL;
+
+    /* the properties of the entry being used here are immutable while being resolved */
+    int ret = getaddrinfo(entry->name, entry->serv, &entry->hints, &res);
     if (ret != 0) {
-        req->_out.errstr = gai_strerror(ret);
-        req->_out.ai = NULL;
+        errstr = gai_strerror(ret);
     } else {
-        req->_out.errstr = NULL;
-        req->_out.ai = res;
+        ai = dup_addrinfo(res);
+        freeaddrinfo(res);
     }
 
-    h2o_multithread_send_message(req->_receiver, &req->_out.message);
+#ifndef _MSC_VER
+    pthread_mutex_lock(&queue.mutex);
+#else
+	uv_mutex_lock(&queue.mutex);
+#endif
+    on_resolved(entry, errstr, ai);
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&queue.mutex);
+#else
+	uv_mutex_unlock(&queue.mutex);
+#endif
 }
 
 static void *lookup_thread_main(void *_unused)
@@ -92,14 +242,14 @@ static void *lookup_thread_main(void *_unused)
     while (1) {
         --queue.num_threads_idle;
         while (!h2o_linklist_is_empty(&queue.pending)) {
-            h2o_hostinfo_getaddr_req_t *req = H2O_STRUCT_FROM_MEMBER(h2o_hostinfo_getaddr_req_t, _pending, queue.pending.next);
-            h2o_linklist_unlink(&req->_pending);
+            struct cache_entry_t *entry = H2O_STRUCT_FROM_MEMBER(struct cache_entry_t, _pending, queue.pending.next);
+            h2o_linklist_unlink(&entry->_pending);
 #ifndef _MSC_VER
             pthread_mutex_unlock(&queue.mutex);
 #else
 			uv_mutex_unlock(&queue.mutex);
 #endif
-            lookup_and_respond(req);
+            lookup_and_respond(entry);
 #ifndef _MSC_VER
             pthread_mutex_lock(&queue.mutex);
 #else
@@ -150,51 +300,243 @@ static void create_lookup_thread(void)
     ++queue.num_threads_idle;
 }
 
+#if H2O_USE_DNS_RESOLVER
+
+static void on_stub_resolved(h2o_dns_query_t *query, const char *errstr, struct addrinfo *ai, void *data)
+{
+    struct cache_entry_t *entry = data;
+    h2o_dns_config_t *config = entry->_resolver_config;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&queue.mutex);
+#else
+	uv_mutex_lock(&queue.mutex);
+#endif
+    entry->_resolver_config = NULL;
+    on_resolved(entry, errstr, ai);
+    h2o_mem_release_shared(config);
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&queue.mutex);
+#else
+	uv_mutex_unlock(&queue.mutex);
+#endif
+}
+
+static void dispose_resolver_config(void *_config)
+{
+    h2o_dns_config_dispose(_config);
+}
+
+static void refresh_resolver_config(void)
+{
+    /* caller should NOT lock the mutex; the files are stat'ed and parsed without holding it so that the lookups are not blocked by
+     * the I/O, and the mutex is locked only for claiming the check and for swapping in the result. The old configuration is
+     * retained by the lookups in flight until they complete. */
+    uint64_t now = now_millisec();
+    h2o_dns_config_t *config = NULL;
+    int reload;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&queue.mutex);
+#else
+	uv_mutex_lock(&queue.mutex);
+#endif
+    if (queue.resolver.is_refreshing ||
+        (queue.resolver.loaded && now - queue.resolver.checked_at < h2o_hostinfo_resolver_check_interval)) {
+#ifndef _MSC_VER
+        pthread_mutex_unlock(&queue.mutex);
+#else
+		uv_mutex_unlock(&queue.mutex);
+#endif
+        return;
+    }
+    queue.resolver.is_refreshing = 1;
+    queue.resolver.checked_at = now;
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&queue.mutex);
+#else
+	uv_mutex_unlock(&queue.mutex);
+#endif
+
+    /* the configuration is replaced only by the thread that has set `is_refreshing`, and therefore can be inspected here */
+    reload = !queue.resolver.loaded || queue.resolver.config == NULL || h2o_dns_config_is_modified(queue.resolver.config);
+    if (reload) {
+        config = h2o_mem_alloc_shared(NULL, sizeof(*config), dispose_resolver_config);
+        if (h2o_dns_config_load(config) != 0) {
+            h2o_mem_release_shared(config);
+            config = NULL;
+        }
+    }
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&queue.mutex);
+#else
+	uv_mutex_lock(&queue.mutex);
+#endif
+    if (reload) {
+        if (queue.resolver.config != NULL)
+            h2o_mem_release_shared(queue.resolver.config);
+        queue.resolver.config = config;
+        queue.resolver.loaded = 1;
+    }
+    queue.resolver.is_refreshing = 0;
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&queue.mutex);
+#else
+	uv_mutex_unlock(&queue.mutex);
+#endif
+}
+
+static int dispatch_stub_lookup(struct cache_entry_t *entry, h2o_multithread_receiver_t *receiver)
+{
+    /* caller should lock the mutex; the query runs on the loop of the caller, which is also where the callback gets invoked */
+    uint16_t port;
+
+    if (!h2o_hostinfo_use_stub_resolver)
+        return -1;
+    if (queue.resolver.config == NULL || !h2o_dns_can_resolve(queue.resolver.config, entry->name, entry->serv, &entry->hints, &port))
+        return -1;
+
+    h2o_mem_addref_shared(queue.resolver.config);
+    entry->_resolver_config = queue.resolver.config;
+    h2o_dns_resolve(h2o_multithread_get_loop(receiver->queue), queue.resolver.config, entry->name, port, &entry->hints,
+                    on_stub_resolved, entry);
+    return 0;
+}
+
+#endif
+
+static void dispatch_lookup(struct cache_entry_t *entry, h2o_multithread_receiver_t *receiver)
+{
+    /* caller should lock the mutex */
+    assert(!entry->is_resolving);
+    entry->is_resolving = 1;
+
+#if H2O_USE_DNS_RESOLVER
+    if (dispatch_stub_lookup(entry, receiver) == 0)
+        return;
+#endif
+
+    h2o_linklist_insert(&queue.pending, &entry->_pending);
+
+    if (queue.num_threads_idle == 0 && queue.num_threads < h2o_hostinfo_max_threads)
+        create_lookup_thread();
+#ifndef _MSC_VER
+    pthread_cond_signal(&queue.cond);
+#else
+	uv_cond_signal(&queue.cond);
+#endif
+}
+
+static struct cache_entry_t *create_entry(char *key, h2o_iovec_t name, h2o_iovec_t serv, int family, int socktype, int protocol,
+                                          int flags)
+{
+    /* caller should lock the mutex */
+    struct cache_entry_t *entry = h2o_mem_alloc(sizeof(*entry) + name.len + 1 + serv.len + 1);
+    khiter_t iter;
+    int r;
+
+    entry->key = key;
+    entry->name = (char *)entry + sizeof(*entry);
+    memcpy(entry->name, name.base, name.len);
+    entry->name[name.len] = '\0';
+    entry->serv = entry->name + name.len + 1;
+    memcpy(entry->serv, serv.base, serv.len);
+    entry->serv[serv.len] = '\0';
+    memset(&entry->hints, 0, sizeof(entry->hints));
+    entry->hints.ai_family = family;
+    entry->hints.ai_socktype = socktype;
+    entry->hints.ai_protocol = protocol;
+    entry->hints.ai_flags = flags;
+    entry->_pending = (h2o_linklist_t){NULL};
+    entry->_lru = (h2o_linklist_t){NULL};
+    entry->_resolver_config = NULL;
+    h2o_linklist_init_anchor(&entry->waiters);
+    entry->is_resolving = 0;
+    entry->errstr = NULL;
+    entry->ai = NULL;
+    entry->expire_at = 0;
+
+    if (queue.entries == NULL)
+        queue.entries = kh_init(hostinfo_cache);
+    iter = kh_put(hostinfo_cache, queue.entries, entry->key, &r);
+    assert(r != 0);
+    kh_val(queue.entries, iter) = entry;
+    h2o_linklist_insert(&queue.lru, &entry->_lru);
+
+    return entry;
+}
+
 h2o_hostinfo_getaddr_req_t *h2o_hostinfo_getaddr(h2o_multithread_receiver_t *receiver, h2o_iovec_t name, h2o_iovec_t serv,
                                                  int family, int socktype, int protocol, int flags, h2o_hostinfo_getaddr_cb cb,
                                                  void *cbdata)
 {
-    h2o_hostinfo_getaddr_req_t *req = h2o_mem_alloc(sizeof(*req) + name.len + 1 + serv.len + 1);
+    h2o_hostinfo_getaddr_req_t *req = h2o_mem_alloc(sizeof(*req));
+    struct cache_entry_t *entry = NULL;
+    char *key;
+    khiter_t iter;
+    uint64_t now;
+
     req->_receiver = receiver;
     req->_cb = cb;
     req->cbdata = cbdata;
     req->_pending = (h2o_linklist_t){NULL};
-    req->_in.name = (char *)req + sizeof(*req);
-    memcpy(req->_in.name, name.base, name.len);
-    req->_in.name[name.len] = '\0';
-    req->_in.serv = req->_in.name + name.len + 1;
-    memcpy(req->_in.serv, serv.base, serv.len);
-    req->_in.serv[serv.len] = '\0';
-    memset(&req->_in.hints, 0, sizeof(req->_in.hints));
-    req->_in.hints.ai_family = family;
-    req->_in.hints.ai_socktype = socktype;
-    req->_in.hints.ai_protocol = protocol;
-    req->_in.hints.ai_flags = flags;
-
-    h2o__hostinfo_getaddr_dispatch(req);
 
-    return req;
-}
+    /* build the key (the name is placed last, since it is the only part that might contain a comma) */
+    key = h2o_mem_alloc(sizeof("-2147483648,") * 4 + serv.len + 1 + name.len + 1);
+    sprintf(key, "%d,%d,%d,%d,%.*s,%.*s", family, socktype, protocol, flags, (int)serv.len, serv.base, (int)name.len, name.base);
+
+#if H2O_USE_DNS_RESOLVER
+    if (h2o_hostinfo_use_stub_resolver)
+        refresh_resolver_config();
+#endif
 
-void h2o__hostinfo_getaddr_dispatch(h2o_hostinfo_getaddr_req_t *req)
-{
 #ifndef _MSC_VER
     pthread_mutex_lock(&queue.mutex);
 #else
 	uv_mutex_lock(&queue.mutex);
 #endif
 
-    h2o_linklist_insert(&queue.pending, &req->_pending);
+    now = now_millisec();
+    if (queue.entries != NULL && (iter = kh_get(hostinfo_cache, queue.entries, key)) != kh_end(queue.entries)) {
+        entry = kh_val(queue.entries, iter);
+        free(key);
+        h2o_linklist_unlink(&entry->_lru);
+        h2o_linklist_insert(&queue.lru, &entry->_lru);
+        if ((entry->ai != NULL || entry->errstr != NULL) && now < entry->expire_at) {
+            /* fresh */
+            ++queue.stats.hits;
+            respond(req, entry->errstr, entry->ai);
+            goto Exit;
+        } else if (entry->ai != NULL && now < entry->expire_at + h2o_hostinfo_cache_stale_ttl) {
+            /* stale; return the cached answer while revalidating */
+            ++queue.stats.stale_hits;
+            respond(req, NULL, entry->ai);
+            if (!entry->is_resolving)
+                dispatch_lookup(entry, receiver);
+            goto Exit;
+        } else if (entry->is_resolving) {
+            /* share the result of the lookup in flight */
+            ++queue.stats.coalesced;
+            h2o_linklist_insert(&entry->waiters, &req->_pending);
+            goto Exit;
+        }
+    } else {
+        entry = create_entry(key, name, serv, family, socktype, protocol, flags);
+    }
 
-    if (queue.num_threads_idle == 0 && queue.num_threads < h2o_hostinfo_max_threads)
-        create_lookup_thread();
+    ++queue.stats.misses;
+    h2o_linklist_insert(&entry->waiters, &req->_pending);
+    dispatch_lookup(entry, receiver);
+    evict_entries(h2o_hostinfo_cache_capacity);
+
+Exit:
 #ifndef _MSC_VER
-    pthread_cond_signal(&queue.cond);
     pthread_mutex_unlock(&queue.mutex);
 #else
-	uv_cond_signal(&queue.cond);
 	uv_mutex_unlock(&queue.mutex);
 #endif
+    return req;
 }
 
 void h2o_hostinfo_getaddr_cancel(h2o_hostinfo_getaddr_req_t *req)
@@ -206,6 +548,7 @@ void h2o_hostinfo_getaddr_cancel(h2o_hostinfo_getaddr_req_t *req)
 	uv_mutex_lock(&queue.mutex);
 #endif
 
+    /* unlink from the entry being resolved (the lookup continues, since others may be interested in the result) */
     if (h2o_linklist_is_linked(&req->_pending)) {
         h2o_linklist_unlink(&req->_pending);
         should_free = 1;
@@ -231,12 +574,43 @@ void h2o_hostinfo_getaddr_receiver(h2o_multithread_receiver_t *receiver, h2o_lin
             req->_cb = NULL;
             cb(req, req->_out.errstr, req->_out.ai, req->cbdata);
         }
-        if (req->_out.ai != NULL)
-            freeaddrinfo(req->_out.ai);
+        free(req->_out.ai);
         free(req);
     }
 }
 
+void h2o_hostinfo_get_cache_stats(h2o_hostinfo_cache_stats_t *stats)
+{
+#ifndef _MSC_VER
+    pthread_mutex_lock(&queue.mutex);
+#else
+	uv_mutex_lock(&queue.mutex);
+#endif
+    *stats = queue.stats;
+    stats->num_entries = queue.entries != NULL ? kh_size(queue.entries) : 0;
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&queue.mutex);
+#else
+	uv_mutex_unlock(&queue.mutex);
+#endif
+}
+
+void h2o_hostinfo_clear_cache(void)
+{
+#ifndef _MSC_VER
+    pthread_mutex_lock(&queue.mutex);
+#else
+	uv_mutex_lock(&queue.mutex);
+#endif
+    if (queue.entries != NULL)
+        evict_entries(0);
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&queue.mutex);
+#else
+	uv_mutex_unlock(&queue.mutex);
+#endif
+}
+
 static const char *fetch_aton_digit(const char *p, const char *end, unsigned char *value)
 {
     size_t ndigits = 0;
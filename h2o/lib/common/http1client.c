@@ -31,6 +31,7 @@
 #endif
 #include "picohttpparser.h"
 #include "h2o/string_.h"
+#include "h2o/happy_eyeballs.h"
 #include "h2o/hostinfo.h"
 #include "h2o/http1client.h"
 #include "h2o/url.h"
@@ -45,7 +46,10 @@ struct st_h2o_http1client_private_t {
     h2o_timeout_entry_t _timeout;
     int _method_is_head;
     h2o_hostinfo_getaddr_req_t *_getaddr_req;
+    h2o_happy_eyeballs_t *_eyeballs;
     int _can_keepalive;
+    int _received_response; /* set once any part of the response (including 1xx) is received */
+    int _is_reused;         /* set if the connection was taken from the socket pool */
     union {
         struct {
             size_t bytesleft;
@@ -63,6 +67,10 @@ static void close_client(struct st_h2o_http1client_private_t *client)
         h2o_hostinfo_getaddr_cancel(client->_getaddr_req);
         client->_getaddr_req = NULL;
     }
+    if (client->_eyeballs != NULL) {
+        h2o_happy_eyeballs_cancel(client->_eyeballs);
+        client->_eyeballs = NULL;
+    }
     if (client->super.ssl.server_name != NULL)
         free(client->super.ssl.server_name);
     if (client->super.sock != NULL) {
@@ -218,9 +226,17 @@ static void on_body_chunked(h2o_socket_t *sock, const char *err)
     h2o_timeout_link(client->super.ctx->loop, client->super.ctx->io_timeout, &client->_timeout);
 }
 
+static void report_failure(struct st_h2o_http1client_private_t *client, const char *errstr)
+{
+    /* errors on reused connections are not counted, since they are usually due to the upstream closing the idle connection */
+    if (client->super.sockpool.pool != NULL && errstr != h2o_socketpool_error_unhealthy && !client->_is_reused)
+        h2o_socketpool_report_failure(client->super.sockpool.pool, h2o_now(client->super.ctx->loop));
+}
+
 static void on_error_before_head(struct st_h2o_http1client_private_t *client, const char *errstr)
 {
     assert(!client->_can_keepalive);
+    report_failure(client, errstr);
     client->_cb.on_head(&client->super, errstr, 0, 0, h2o_iovec_init(NULL, 0), NULL, 0);
     close_client(client);
 }
@@ -237,9 +253,11 @@ static void on_head(h2o_socket_t *sock, const char *err)
     h2o_timeout_unlink(&client->_timeout);
 
     if (err != NULL) {
+        client->super.closed_before_response = !client->_received_response && sock->input->size == 0;
         on_error_before_head(client, "I/O error (head)");
         return;
     }
+    client->_received_response = 1;
 
     /* parse response */
     num_headers = sizeof(headers) / sizeof(headers[0]);
@@ -271,6 +289,9 @@ static void on_head(h2o_socket_t *sock, const char *err)
         return;
     }
 
+    if (client->super.sockpool.pool != NULL)
+        h2o_socketpool_report_success(client->super.sockpool.pool);
+
     /* parse the headers */
     reader = on_body_until_close;
     client->_can_keepalive = minor_version >= 1;
@@ -346,6 +367,7 @@ static void on_send_request(h2o_socket_t *sock, const char *err)
     h2o_timeout_unlink(&client->_timeout);
 
     if (err != NULL) {
+        client->super.closed_before_response = 1;
         on_error_before_head(client, "I/O error (send request)");
         return;
     }
@@ -364,6 +386,7 @@ static void on_send_timeout(h2o_timeout_entry_t *entry)
 static void on_connect_error(struct st_h2o_http1client_private_t *client, const char *errstr)
 {
     assert(errstr != NULL);
+    report_failure(client, errstr);
     client->_cb.on_connect(&client->super, errstr, NULL, NULL, NULL);
     close_client(client);
 }
@@ -435,6 +458,7 @@ static void on_pool_connect(h2o_socket_t *sock, const char *errstr, void *data)
     }
 
     client->super.sock = sock;
+    client->_is_reused = h2o_socketpool_is_reused(sock);
     sock->data = client;
     on_connect(sock, NULL);
 }
@@ -454,6 +478,23 @@ static void start_connect(struct st_h2o_http1client_private_t *client, struct so
     client->super.sock->data = client;
 }
 
+static void on_eyeballs_connect(h2o_socket_t *sock, const char *errstr, void *_client)
+{
+    struct st_h2o_http1client_private_t *client = _client;
+
+    client->_eyeballs = NULL;
+
+    if (sock == NULL) {
+        h2o_timeout_unlink(&client->_timeout);
+        on_connect_error(client, errstr);
+        return;
+    }
+
+    client->super.sock = sock;
+    sock->data = client;
+    on_connect(sock, NULL);
+}
+
 static void on_getaddr(h2o_hostinfo_getaddr_req_t *getaddr_req, const char *errstr, struct addrinfo *res, void *_client)
 {
     struct st_h2o_http1client_private_t *client = _client;
@@ -466,9 +507,8 @@ static void on_getaddr(h2o_hostinfo_getaddr_req_t *getaddr_req, const char *errs
         return;
     }
 
-    /* start connecting */
-    struct addrinfo *selected = h2o_hostinfo_select_one(res);
-    start_connect(client, selected->ai_addr, selected->ai_addrlen);
+    /* start connecting, racing the addresses */
+    client->_eyeballs = h2o_happy_eyeballs_connect(client->super.ctx->loop, res, on_eyeballs_connect, client);
 }
 
 static struct st_h2o_http1client_private_t *create_client(h2o_http1client_t **_client, void *data, h2o_http1client_ctx_t *ctx,
@@ -545,6 +585,18 @@ void h2o_http1client_connect_with_pool(h2o_http1client_t **_client, void *data,
                            client);
 }
 
+void h2o_http1client_connect_new_with_pool(h2o_http1client_t **_client, void *data, h2o_http1client_ctx_t *ctx,
+                                           h2o_socketpool_t *sockpool, h2o_http1client_connect_cb cb)
+{
+    struct st_h2o_http1client_private_t *client =
+        create_client(_client, data, ctx, sockpool->is_ssl ? sockpool->peer.host : h2o_iovec_init(NULL, 0), cb);
+    client->super.sockpool.pool = sockpool;
+    client->_timeout.cb = on_connect_timeout;
+    h2o_timeout_link(ctx->loop, ctx->io_timeout, &client->_timeout);
+    h2o_socketpool_connect_new(&client->super.sockpool.connect_req, sockpool, ctx->loop, ctx->getaddr_receiver, on_pool_connect,
+                               client);
+}
+
 void h2o_http1client_cancel(h2o_http1client_t *_client)
 {
     struct st_h2o_http1client_private_t *client = (void *)_client;
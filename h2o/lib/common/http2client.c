@@ -0,0 +1,1061 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include "khash.h"
+#include "h2o.h"
+#include "h2o/http2.h"
+#include "h2o/http2_internal.h"
+#include "h2o/http2client.h"
+
+/* the number of streams that can be opened before the server tells us the limit, as recommended by RFC 7540 6.5.2 */
+#define INITIAL_MAX_CONCURRENT_STREAMS 100
+
+typedef enum en_h2o_http2client_stream_state_t {
+    STREAM_STATE_PENDING,   /* waiting for the connection to become ready, or for a stream slot to become available */
+    STREAM_STATE_HEAD,      /* request sent (or being sent), waiting for the response headers */
+    STREAM_STATE_BODY       /* receiving the response body */
+} h2o_http2client_stream_state_t;
+
+typedef enum en_h2o_http2client_conn_state_t {
+    CONN_STATE_CONNECTING,
+    CONN_STATE_OPEN,
+    CONN_STATE_HALF_CLOSED, /* GOAWAY has been received; no more streams can be opened */
+    CONN_STATE_IS_CLOSING
+} h2o_http2client_conn_state_t;
+
+struct st_h2o_http2client_conn_t;
+
+struct st_h2o_http2client_private_t {
+    h2o_http2client_t super;
+    struct st_h2o_http2client_conn_t *conn;
+    uint32_t stream_id; /* zero while the stream is pending */
+    h2o_http2client_stream_state_t state;
+    union {
+        h2o_http2client_head_cb on_head;
+        h2o_http2client_body_cb on_body;
+    } _cb;
+    h2o_http2client_req_t _req;
+    h2o_mem_pool_t *_mem_pool;
+    size_t _body_bytes_sent;
+    h2o_http2_window_t _output_window;
+    h2o_http2_window_t _input_window;
+    h2o_linklist_t _link; /* link in conn->_pending or conn->_blocked */
+    h2o_timeout_entry_t _timeout;
+};
+
+KHASH_MAP_INIT_INT64(h2o_http2client_stream_t, struct st_h2o_http2client_private_t *)
+
+struct st_h2o_http2client_conn_t {
+    h2o_http2client_pool_t *pool;
+    h2o_linklist_t _link; /* link in pool->_conns */
+    h2o_socket_t *sock;
+    h2o_socketpool_connect_request_t *_connect_req;
+    h2o_http2client_conn_state_t state;
+    h2o_http2_settings_t peer_settings;
+    khash_t(h2o_http2client_stream_t) * streams;
+    uint32_t max_open_stream_id;
+    h2o_linklist_t _pending; /* requests waiting for a stream to be opened */
+    size_t _num_pending;
+    h2o_linklist_t _blocked; /* streams with request body being blocked by flow control */
+    int _is_reading;
+    ssize_t (*_read_expect)(struct st_h2o_http2client_conn_t *conn, const uint8_t *src, size_t len, const char **err_desc);
+    h2o_hpack_header_table_t _input_header_table;
+    h2o_hpack_header_table_t _output_header_table;
+    h2o_http2_window_t _input_window;
+    struct {
+        uint32_t stream_id;
+        int is_end_stream;
+        h2o_buffer_t *buf;
+    } _headers_unparsed; /* for temporary storing HEADERS|CONTINUATION frames without END_HEADERS flag set */
+    struct {
+        h2o_buffer_t *buf;
+        h2o_buffer_t *buf_in_flight;
+        h2o_http2_window_t window;
+    } _write;
+    h2o_timeout_entry_t _timeout; /* connect timeout while connecting, otherwise the keepalive timeout */
+};
+
+#ifndef _MSC_VER
+static const h2o_iovec_t CONNECTION_PREFACE = {H2O_STRLIT("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+                                                          "\x00\x00\x0c"     /* frame size */
+                                                          "\x04"             /* settings frame */
+                                                          "\x00"             /* no flags */
+                                                          "\x00\x00\x00\x00" /* stream id */
+                                                          "\x00\x02"
+                                                          "\x00\x00\x00\x00" /* enable_push = 0 */
+                                                          "\x00\x04"
+                                                          "\x01\x00\x00\x00" /* initial_window_size = 16777216 */
+                                                          "\x00\x00\x04"     /* frame size */
+                                                          "\x08"             /* window_update frame */
+                                                          "\x00"             /* no flags */
+                                                          "\x00\x00\x00\x00" /* stream id */
+                                                          "\x00\xff\x00\x01" /* increment connection window to 16777216 */
+                                                          )};
+static __thread h2o_buffer_prototype_t wbuf_buffer_prototype = {{16}, {H2O_HTTP2_DEFAULT_OUTBUF_SIZE}};
+#else
+static const h2o_iovec_t CONNECTION_PREFACE = { H2O_MY_STRLIT("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+                                                          "\x00\x00\x0c"     /* frame size */
+                                                          "\x04"             /* settings frame */
+                                                          "\x00"             /* no flags */
+                                                          "\x00\x00\x00\x00" /* stream id */
+                                                          "\x00\x02"
+                                                          "\x00\x00\x00\x00" /* enable_push = 0 */
+                                                          "\x00\x04"
+                                                          "\x01\x00\x00\x00" /* initial_window_size = 16777216 */
+                                                          "\x00\x00\x04"     /* frame size */
+                                                          "\x08"             /* window_update frame */
+                                                          "\x00"             /* no flags */
+                                                          "\x00\x00\x00\x00" /* stream id */
+                                                          "\x00\xff\x00\x01" /* increment connection window to 16777216 */
+                                                          ) };
+static h2o_buffer_prototype_t wbuf_buffer_prototype = { { 16 },{ H2O_HTTP2_DEFAULT_OUTBUF_SIZE } };
+#endif
+
+const char *const h2o_http2client_error_is_eos = "end of stream";
+
+static void close_connection(struct st_h2o_http2client_conn_t *conn, const char *errstr);
+static ssize_t expect_default(struct st_h2o_http2client_conn_t *conn, const uint8_t *src, size_t len, const char **err_desc);
+
+static struct st_h2o_http2client_private_t *get_stream(struct st_h2o_http2client_conn_t *conn, uint32_t stream_id)
+{
+    khiter_t iter = kh_get(h2o_http2client_stream_t, conn->streams, stream_id);
+    if (iter != kh_end(conn->streams))
+        return kh_val(conn->streams, iter);
+    return NULL;
+}
+
+static void on_write_complete(h2o_socket_t *sock, const char *err);
+
+static void do_emit_writereq(struct st_h2o_http2client_conn_t *conn)
+{
+    assert(conn->_write.buf_in_flight == NULL);
+
+    if (conn->_write.buf->size == 0)
+        return;
+
+#ifndef _MSC_VER
+    h2o_iovec_t buf = {conn->_write.buf->bytes, conn->_write.buf->size};
+#else
+    h2o_iovec_t buf = { conn->_write.buf->size , conn->_write.buf->bytes };
+#endif
+    h2o_socket_write(conn->sock, &buf, 1, on_write_complete);
+    conn->_write.buf_in_flight = conn->_write.buf;
+    h2o_buffer_init(&conn->_write.buf, &wbuf_buffer_prototype);
+}
+
+static void request_write(struct st_h2o_http2client_conn_t *conn)
+{
+    /* writes are coalesced until the input is processed, or until the connection becomes ready */
+    if (conn->state == CONN_STATE_CONNECTING || conn->_is_reading || conn->_write.buf_in_flight != NULL)
+        return;
+    do_emit_writereq(conn);
+}
+
+static void on_write_complete(h2o_socket_t *sock, const char *err)
+{
+    struct st_h2o_http2client_conn_t *conn = sock->data;
+
+    assert(conn->_write.buf_in_flight != NULL);
+
+    if (err != NULL) {
+        close_connection(conn, "I/O error");
+        return;
+    }
+
+    h2o_buffer_dispose(&conn->_write.buf_in_flight);
+    request_write(conn);
+}
+
+static void on_keepalive_timeout(h2o_timeout_entry_t *entry)
+{
+    struct st_h2o_http2client_conn_t *conn = H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_conn_t, _timeout, entry);
+    close_connection(conn, NULL);
+}
+
+static void call_error_cb(struct st_h2o_http2client_private_t *stream, const char *errstr)
+{
+    if (stream->state == STREAM_STATE_BODY) {
+        stream->_cb.on_body(&stream->super, errstr);
+    } else {
+        stream->_cb.on_head(&stream->super, errstr, 0, NULL, 0, SIZE_MAX);
+    }
+}
+
+static void start_pending_streams(struct st_h2o_http2client_conn_t *conn);
+
+static void close_stream(struct st_h2o_http2client_private_t *stream)
+{
+    struct st_h2o_http2client_conn_t *conn = stream->conn;
+
+    if (stream->stream_id != 0) {
+        khiter_t iter = kh_get(h2o_http2client_stream_t, conn->streams, stream->stream_id);
+        assert(iter != kh_end(conn->streams));
+        kh_del(h2o_http2client_stream_t, conn->streams, iter);
+    } else {
+        --conn->_num_pending;
+    }
+    if (h2o_linklist_is_linked(&stream->_link))
+        h2o_linklist_unlink(&stream->_link);
+    if (h2o_timeout_is_linked(&stream->_timeout))
+        h2o_timeout_unlink(&stream->_timeout);
+    h2o_buffer_dispose(&stream->super.buf);
+    free(stream);
+
+    /* reuse the slot, or close / start idling the connection if it has become unused */
+    if (conn->state == CONN_STATE_IS_CLOSING)
+        return;
+    start_pending_streams(conn);
+    if (kh_size(conn->streams) != 0 || conn->_num_pending != 0)
+        return;
+    switch (conn->state) {
+    case CONN_STATE_OPEN:
+        conn->_timeout.cb = on_keepalive_timeout;
+        h2o_timeout_link(conn->pool->loop, &conn->pool->keepalive_timeout, &conn->_timeout);
+        break;
+    case CONN_STATE_HALF_CLOSED:
+        /* when called from within the read callback, the connection is closed once all the input is processed */
+        if (!conn->_is_reading)
+            close_connection(conn, NULL);
+        break;
+    default:
+        break;
+    }
+}
+
+static void reset_stream(struct st_h2o_http2client_private_t *stream, int errnum)
+{
+    struct st_h2o_http2client_conn_t *conn = stream->conn;
+
+    h2o_http2__encode_rst_stream_frame(&conn->_write.buf, stream->stream_id, -errnum);
+    request_write(conn);
+    close_stream(stream);
+}
+
+static void on_stream_timeout(h2o_timeout_entry_t *entry)
+{
+    struct st_h2o_http2client_private_t *stream =
+        H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_private_t, _timeout, entry);
+
+    if (stream->state != STREAM_STATE_BODY)
+        h2o_socketpool_report_failure(stream->conn->pool->sockpool, h2o_now(stream->conn->pool->loop));
+    call_error_cb(stream, "I/O timeout");
+    reset_stream(stream, H2O_HTTP2_ERROR_CANCEL);
+}
+
+static void update_stream_timeout(struct st_h2o_http2client_private_t *stream)
+{
+    if (h2o_timeout_is_linked(&stream->_timeout))
+        h2o_timeout_unlink(&stream->_timeout);
+    h2o_timeout_link(stream->conn->pool->loop, stream->conn->pool->io_timeout, &stream->_timeout);
+}
+
+static void send_request_body(struct st_h2o_http2client_private_t *stream)
+{
+    struct st_h2o_http2client_conn_t *conn = stream->conn;
+
+    while (stream->_body_bytes_sent != stream->_req.body.len) {
+        size_t len = stream->_req.body.len - stream->_body_bytes_sent;
+        ssize_t window = h2o_http2_window_get_window(&stream->_output_window);
+        if (window > h2o_http2_window_get_window(&conn->_write.window))
+            window = h2o_http2_window_get_window(&conn->_write.window);
+        if (window <= 0) {
+            if (!h2o_linklist_is_linked(&stream->_link))
+                h2o_linklist_insert(&conn->_blocked, &stream->_link);
+            return;
+        }
+        if (len > (size_t)window)
+            len = window;
+        if (len > conn->peer_settings.max_frame_size)
+            len = conn->peer_settings.max_frame_size;
+        int is_end_stream = stream->_body_bytes_sent + len == stream->_req.body.len;
+        h2o_iovec_t dst = h2o_buffer_reserve(&conn->_write.buf, H2O_HTTP2_FRAME_HEADER_SIZE + len);
+        h2o_http2_encode_frame_header((void *)dst.base, len, H2O_HTTP2_FRAME_TYPE_DATA,
+                                      is_end_stream ? H2O_HTTP2_FRAME_FLAG_END_STREAM : 0, stream->stream_id);
+        memcpy(dst.base + H2O_HTTP2_FRAME_HEADER_SIZE, stream->_req.body.base + stream->_body_bytes_sent, len);
+        conn->_write.buf->size += H2O_HTTP2_FRAME_HEADER_SIZE + len;
+        stream->_body_bytes_sent += len;
+        h2o_http2_window_consume_window(&stream->_output_window, len);
+        h2o_http2_window_consume_window(&conn->_write.window, len);
+    }
+}
+
+static void resume_blocked_streams(struct st_h2o_http2client_conn_t *conn)
+{
+    h2o_linklist_t blocked;
+
+    /* move the list, since the streams that are still blocked are reinserted */
+    h2o_linklist_init_anchor(&blocked);
+    h2o_linklist_insert_list(&blocked, &conn->_blocked);
+    while (!h2o_linklist_is_empty(&blocked)) {
+        struct st_h2o_http2client_private_t *stream =
+            H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_private_t, _link, blocked.next);
+        h2o_linklist_unlink(&stream->_link);
+        send_request_body(stream);
+    }
+    request_write(conn);
+}
+
+static void start_stream(struct st_h2o_http2client_conn_t *conn, struct st_h2o_http2client_private_t *stream)
+{
+    int r;
+    khiter_t iter;
+
+    stream->stream_id = conn->max_open_stream_id == 0 ? 1 : conn->max_open_stream_id + 2;
+    conn->max_open_stream_id = stream->stream_id;
+    iter = kh_put(h2o_http2client_stream_t, conn->streams, stream->stream_id, &r);
+    assert(iter != kh_end(conn->streams));
+    kh_val(conn->streams, iter) = stream;
+    stream->state = STREAM_STATE_HEAD;
+    h2o_http2_window_init(&stream->_output_window, &conn->peer_settings);
+    h2o_http2_window_init(&stream->_input_window, &H2O_HTTP2_SETTINGS_HOST);
+
+    h2o_hpack_flatten_request_headers(&conn->_write.buf, &conn->_output_header_table, stream->stream_id,
+                                      conn->peer_settings.max_frame_size, stream->_req.method, stream->_req.scheme,
+                                      stream->_req.authority, stream->_req.path, stream->_req.headers, stream->_req.num_headers,
+                                      stream->_req.body.len == 0);
+    send_request_body(stream);
+    update_stream_timeout(stream);
+    request_write(conn);
+}
+
+static void redispatch(h2o_http2client_pool_t *pool, struct st_h2o_http2client_private_t *stream);
+
+static void retire_connection(struct st_h2o_http2client_conn_t *conn)
+{
+    /* stop opening new streams, and send the pending requests using other connections */
+    conn->state = CONN_STATE_HALF_CLOSED;
+    if (h2o_linklist_is_linked(&conn->_link))
+        h2o_linklist_unlink(&conn->_link);
+    while (!h2o_linklist_is_empty(&conn->_pending)) {
+        struct st_h2o_http2client_private_t *stream =
+            H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_private_t, _link, conn->_pending.next);
+        h2o_linklist_unlink(&stream->_link);
+        --conn->_num_pending;
+        redispatch(conn->pool, stream);
+    }
+}
+
+static void start_pending_streams(struct st_h2o_http2client_conn_t *conn)
+{
+    while (conn->state == CONN_STATE_OPEN && !h2o_linklist_is_empty(&conn->_pending) &&
+           kh_size(conn->streams) < conn->peer_settings.max_concurrent_streams) {
+        /* stream ids cannot be reused; stop using the connection once they are exhausted */
+        if (conn->max_open_stream_id >= 0x7ffffffd) {
+            retire_connection(conn);
+            break;
+        }
+        struct st_h2o_http2client_private_t *stream =
+            H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_private_t, _link, conn->_pending.next);
+        h2o_linklist_unlink(&stream->_link);
+        --conn->_num_pending;
+        start_stream(conn, stream);
+    }
+}
+
+static void update_input_window(struct st_h2o_http2client_conn_t *conn, uint32_t stream_id, h2o_http2_window_t *window,
+                                size_t consumed)
+{
+    h2o_http2_window_consume_window(window, consumed);
+    if (h2o_http2_window_get_window(window) * 2 < H2O_HTTP2_SETTINGS_HOST.initial_window_size) {
+        int32_t delta = (int32_t)(H2O_HTTP2_SETTINGS_HOST.initial_window_size - h2o_http2_window_get_window(window));
+        h2o_http2_encode_window_update_frame(&conn->_write.buf, stream_id, delta);
+        request_write(conn);
+        h2o_http2_window_update(window, delta);
+    }
+}
+
+static int handle_data_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    h2o_http2_data_payload_t payload;
+    struct st_h2o_http2client_private_t *stream;
+    int ret;
+
+    if ((ret = h2o_http2_decode_data_payload(&payload, frame, err_desc)) != 0)
+        return ret;
+
+    if ((ssize_t)frame->length > h2o_http2_window_get_window(&conn->_input_window)) {
+        *err_desc = "flow control window exceeded";
+        return H2O_HTTP2_ERROR_FLOW_CONTROL;
+    }
+    update_input_window(conn, 0, &conn->_input_window, frame->length);
+
+    if ((stream = get_stream(conn, frame->stream_id)) == NULL) {
+        if (frame->stream_id <= conn->max_open_stream_id)
+            return 0; /* the stream has already been closed */
+        *err_desc = "invalid DATA frame";
+        return H2O_HTTP2_ERROR_PROTOCOL;
+    }
+    if (stream->state != STREAM_STATE_BODY) {
+        call_error_cb(stream, "invalid response from upstream");
+        reset_stream(stream, H2O_HTTP2_ERROR_PROTOCOL);
+        return 0;
+    }
+    if ((ssize_t)frame->length > h2o_http2_window_get_window(&stream->_input_window)) {
+        call_error_cb(stream, "invalid response from upstream");
+        reset_stream(stream, H2O_HTTP2_ERROR_FLOW_CONTROL);
+        return 0;
+    }
+
+    h2o_iovec_t buf = h2o_buffer_reserve(&stream->super.buf, payload.length);
+    memcpy(buf.base, payload.data, payload.length);
+    stream->super.buf->size += payload.length;
+
+    if ((frame->flags & H2O_HTTP2_FRAME_FLAG_END_STREAM) != 0) {
+        stream->_cb.on_body(&stream->super, h2o_http2client_error_is_eos);
+        close_stream(stream);
+        return 0;
+    }
+
+    update_input_window(conn, stream->stream_id, &stream->_input_window, frame->length);
+    update_stream_timeout(stream);
+    if (stream->_cb.on_body(&stream->super, NULL) != 0)
+        reset_stream(stream, H2O_HTTP2_ERROR_CANCEL);
+
+    return 0;
+}
+
+static int on_response_headers(struct st_h2o_http2client_conn_t *conn, uint32_t stream_id, const uint8_t *src, size_t len,
+                               int is_end_stream, const char **err_desc)
+{
+    struct st_h2o_http2client_private_t *stream = get_stream(conn, stream_id);
+    h2o_headers_t headers = {NULL};
+    int status, ret;
+    size_t content_length;
+    const char *hdr_err = NULL;
+
+    if (stream == NULL || stream->state == STREAM_STATE_BODY) {
+        h2o_mem_pool_t pool;
+        if (stream == NULL && stream_id > conn->max_open_stream_id) {
+            *err_desc = "unexpected stream id in HEADERS frame";
+            return H2O_HTTP2_ERROR_PROTOCOL;
+        }
+        /* closed stream or trailers (that are ignored); decode the headers anyway to keep the HPACK state in sync */
+        h2o_mem_init_pool(&pool);
+        ret = h2o_hpack_parse_response_headers(&pool, &status, &headers, &conn->_input_header_table, src, len, &content_length,
+                                               &hdr_err);
+        h2o_mem_clear_pool(&pool);
+        if (ret == H2O_HTTP2_ERROR_COMPRESSION) {
+            *err_desc = hdr_err;
+            return ret;
+        }
+        if (stream != NULL) {
+            if (!is_end_stream) {
+                call_error_cb(stream, "invalid response from upstream");
+                reset_stream(stream, H2O_HTTP2_ERROR_PROTOCOL);
+            } else {
+                stream->_cb.on_body(&stream->super, h2o_http2client_error_is_eos);
+                close_stream(stream);
+            }
+        }
+        return 0;
+    }
+
+    if ((ret = h2o_hpack_parse_response_headers(stream->_mem_pool, &status, &headers, &conn->_input_header_table, src, len,
+                                                &content_length, &hdr_err)) != 0) {
+        if (ret == H2O_HTTP2_ERROR_COMPRESSION) {
+            *err_desc = hdr_err;
+            return ret;
+        }
+        call_error_cb(stream, "invalid response from upstream");
+        reset_stream(stream, H2O_HTTP2_ERROR_PROTOCOL);
+        return 0;
+    }
+
+    /* informational responses are skipped */
+    if (100 <= status && status <= 199) {
+        if (is_end_stream) {
+            call_error_cb(stream, "invalid response from upstream");
+            reset_stream(stream, H2O_HTTP2_ERROR_PROTOCOL);
+        } else {
+            update_stream_timeout(stream);
+        }
+        return 0;
+    }
+
+    h2o_socketpool_report_success(conn->pool->sockpool);
+
+    stream->state = STREAM_STATE_BODY;
+    stream->_cb.on_body = stream->_cb.on_head(&stream->super, is_end_stream ? h2o_http2client_error_is_eos : NULL, status,
+                                              headers.entries, headers.size, content_length);
+    if (is_end_stream) {
+        close_stream(stream);
+    } else if (stream->_cb.on_body == NULL) {
+        reset_stream(stream, H2O_HTTP2_ERROR_CANCEL);
+    } else {
+        update_stream_timeout(stream);
+    }
+
+    return 0;
+}
+
+static ssize_t expect_continuation_of_headers(struct st_h2o_http2client_conn_t *conn, const uint8_t *src, size_t len,
+                                              const char **err_desc)
+{
+    h2o_http2_frame_t frame;
+    ssize_t ret;
+
+    if ((ret = h2o_http2_decode_frame(&frame, src, len, &H2O_HTTP2_SETTINGS_HOST, err_desc)) < 0)
+        return ret;
+    if (frame.type != H2O_HTTP2_FRAME_TYPE_CONTINUATION || frame.stream_id != conn->_headers_unparsed.stream_id) {
+        *err_desc = "expected CONTINUATION frame";
+        return H2O_HTTP2_ERROR_PROTOCOL;
+    }
+
+    h2o_buffer_reserve(&conn->_headers_unparsed.buf, frame.length);
+    memcpy(conn->_headers_unparsed.buf->bytes + conn->_headers_unparsed.buf->size, frame.payload, frame.length);
+    conn->_headers_unparsed.buf->size += frame.length;
+    if (conn->_headers_unparsed.buf->size > H2O_MAX_REQLEN) {
+        *err_desc = "response headers too large";
+        return H2O_HTTP2_ERROR_ENHANCE_YOUR_CALM;
+    }
+
+    if ((frame.flags & H2O_HTTP2_FRAME_FLAG_END_HEADERS) != 0) {
+        int hret;
+        conn->_read_expect = expect_default;
+        hret = on_response_headers(conn, conn->_headers_unparsed.stream_id, (const uint8_t *)conn->_headers_unparsed.buf->bytes,
+                                   conn->_headers_unparsed.buf->size, conn->_headers_unparsed.is_end_stream, err_desc);
+        h2o_buffer_dispose(&conn->_headers_unparsed.buf);
+        if (hret != 0)
+            ret = hret;
+    }
+
+    return ret;
+}
+
+static int handle_headers_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    h2o_http2_headers_payload_t payload;
+    int ret;
+
+    if ((ret = h2o_http2_decode_headers_payload(&payload, frame, err_desc)) != 0)
+        return ret;
+
+    if ((frame->flags & H2O_HTTP2_FRAME_FLAG_END_HEADERS) == 0) {
+        /* request is not complete, store in buffer */
+        conn->_read_expect = expect_continuation_of_headers;
+        conn->_headers_unparsed.stream_id = frame->stream_id;
+        conn->_headers_unparsed.is_end_stream = (frame->flags & H2O_HTTP2_FRAME_FLAG_END_STREAM) != 0;
+        h2o_buffer_init(&conn->_headers_unparsed.buf, &h2o_socket_buffer_prototype);
+        h2o_buffer_reserve(&conn->_headers_unparsed.buf, payload.headers_len);
+        memcpy(conn->_headers_unparsed.buf->bytes, payload.headers, payload.headers_len);
+        conn->_headers_unparsed.buf->size = payload.headers_len;
+        return 0;
+    }
+
+    return on_response_headers(conn, frame->stream_id, payload.headers, payload.headers_len,
+                               (frame->flags & H2O_HTTP2_FRAME_FLAG_END_STREAM) != 0, err_desc);
+}
+
+static int handle_priority_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    h2o_http2_priority_t payload;
+
+    /* the client does not prioritize the request bodies being sent */
+    return h2o_http2_decode_priority_payload(&payload, frame, err_desc);
+}
+
+static int handle_rst_stream_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    h2o_http2_rst_stream_payload_t payload;
+    struct st_h2o_http2client_private_t *stream;
+    int ret;
+
+    if ((ret = h2o_http2_decode_rst_stream_payload(&payload, frame, err_desc)) != 0)
+        return ret;
+    if (frame->stream_id > conn->max_open_stream_id) {
+        *err_desc = "unexpected stream id in RST_STREAM frame";
+        return H2O_HTTP2_ERROR_PROTOCOL;
+    }
+
+    if ((stream = get_stream(conn, frame->stream_id)) != NULL) {
+        call_error_cb(stream, "upstream reset the stream");
+        close_stream(stream);
+    }
+
+    return 0;
+}
+
+static int handle_settings_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    if (frame->stream_id != 0) {
+        *err_desc = "invalid stream id in SETTINGS frame";
+        return H2O_HTTP2_ERROR_PROTOCOL;
+    }
+
+    if ((frame->flags & H2O_HTTP2_FRAME_FLAG_ACK) != 0) {
+        if (frame->length != 0) {
+            *err_desc = "invalid SETTINGS frame (+ACK)";
+            return H2O_HTTP2_ERROR_FRAME_SIZE;
+        }
+    } else {
+        uint32_t prev_initial_window_size = conn->peer_settings.initial_window_size;
+        int ret = h2o_http2_update_peer_settings(&conn->peer_settings, frame->payload, frame->length, err_desc);
+        if (ret != 0)
+            return ret;
+        h2o_hpack_apply_header_table_size(&conn->_output_header_table, conn->peer_settings.header_table_size);
+        { /* schedule ack */
+            h2o_iovec_t header_buf = h2o_buffer_reserve(&conn->_write.buf, H2O_HTTP2_FRAME_HEADER_SIZE);
+            h2o_http2_encode_frame_header((void *)header_buf.base, 0, H2O_HTTP2_FRAME_TYPE_SETTINGS, H2O_HTTP2_FRAME_FLAG_ACK, 0);
+            conn->_write.buf->size += H2O_HTTP2_FRAME_HEADER_SIZE;
+            request_write(conn);
+        }
+        /* apply the change to window size (to all the streams but not the connection, see 6.9.2 of draft-15) */
+        if (prev_initial_window_size != conn->peer_settings.initial_window_size) {
+            ssize_t delta = (ssize_t)conn->peer_settings.initial_window_size - prev_initial_window_size;
+            struct st_h2o_http2client_private_t *stream;
+            kh_foreach_value(conn->streams, stream, { h2o_http2_window_update(&stream->_output_window, delta); });
+            resume_blocked_streams(conn);
+        }
+        /* the limit of concurrent streams might have been raised */
+        start_pending_streams(conn);
+    }
+
+    return 0;
+}
+
+static int handle_push_promise_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    *err_desc = "received PUSH_PROMISE frame while push is disabled";
+    return H2O_HTTP2_ERROR_PROTOCOL;
+}
+
+static int handle_ping_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    h2o_http2_ping_payload_t payload;
+    int ret;
+
+    if ((ret = h2o_http2_decode_ping_payload(&payload, frame, err_desc)) != 0)
+        return ret;
+
+    if ((frame->flags & H2O_HTTP2_FRAME_FLAG_ACK) == 0) {
+        h2o_http2_encode_ping_frame(&conn->_write.buf, 1, payload.data);
+        request_write(conn);
+    }
+
+    return 0;
+}
+
+static int handle_goaway_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    h2o_http2_goaway_payload_t payload;
+    struct st_h2o_http2client_private_t *stream;
+    h2o_linklist_t unprocessed;
+    int ret;
+
+    if ((ret = h2o_http2_decode_goaway_payload(&payload, frame, err_desc)) != 0)
+        return ret;
+
+    retire_connection(conn);
+
+    /* streams that were not processed by the server are closed */
+    h2o_linklist_init_anchor(&unprocessed);
+    kh_foreach_value(conn->streams, stream, {
+        if (stream->stream_id > payload.last_stream_id) {
+            if (h2o_linklist_is_linked(&stream->_link))
+                h2o_linklist_unlink(&stream->_link);
+            h2o_linklist_insert(&unprocessed, &stream->_link);
+        }
+    });
+    while (!h2o_linklist_is_empty(&unprocessed)) {
+        stream = H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_private_t, _link, unprocessed.next);
+        h2o_linklist_unlink(&stream->_link);
+        call_error_cb(stream, "upstream connection closed");
+        close_stream(stream);
+    }
+
+    return 0;
+}
+
+static int handle_window_update_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame, const char **err_desc)
+{
+    h2o_http2_window_update_payload_t payload;
+    int ret, err_is_stream_level;
+
+    if ((ret = h2o_http2_decode_window_update_payload(&payload, frame, err_desc, &err_is_stream_level)) != 0) {
+        if (err_is_stream_level) {
+            struct st_h2o_http2client_private_t *stream = get_stream(conn, frame->stream_id);
+            if (stream != NULL) {
+                call_error_cb(stream, "invalid response from upstream");
+                reset_stream(stream, ret);
+            }
+            return 0;
+        } else {
+            return ret;
+        }
+    }
+
+    if (frame->stream_id == 0) {
+        if (h2o_http2_window_update(&conn->_write.window, payload.window_size_increment) != 0) {
+            *err_desc = "flow control window overflow";
+            return H2O_HTTP2_ERROR_FLOW_CONTROL;
+        }
+    } else {
+        struct st_h2o_http2client_private_t *stream = get_stream(conn, frame->stream_id);
+        if (stream != NULL && h2o_http2_window_update(&stream->_output_window, payload.window_size_increment) != 0) {
+            call_error_cb(stream, "invalid response from upstream");
+            reset_stream(stream, H2O_HTTP2_ERROR_FLOW_CONTROL);
+            return 0;
+        }
+    }
+
+    resume_blocked_streams(conn);
+
+    return 0;
+}
+
+static int handle_invalid_continuation_frame(struct st_h2o_http2client_conn_t *conn, h2o_http2_frame_t *frame,
+                                             const char **err_desc)
+{
+    *err_desc = "received invalid CONTINUATION frame";
+    return H2O_HTTP2_ERROR_PROTOCOL;
+}
+
+static ssize_t expect_default(struct st_h2o_http2client_conn_t *conn, const uint8_t *src, size_t len, const char **err_desc)
+{
+    h2o_http2_frame_t frame;
+    ssize_t ret;
+    static int (*FRAME_HANDLERS[])(struct st_h2o_http2client_conn_t * conn, h2o_http2_frame_t * frame, const char **err_desc) = {
+        handle_data_frame,                /* DATA */
+        handle_headers_frame,             /* HEADERS */
+        handle_priority_frame,            /* PRIORITY */
+        handle_rst_stream_frame,          /* RST_STREAM */
+        handle_settings_frame,            /* SETTINGS */
+        handle_push_promise_frame,        /* PUSH_PROMISE */
+        handle_ping_frame,                /* PING */
+        handle_goaway_frame,              /* GOAWAY */
+        handle_window_update_frame,       /* WINDOW_UPDATE */
+        handle_invalid_continuation_frame /* CONTINUATION */
+    };
+
+    if ((ret = h2o_http2_decode_frame(&frame, src, len, &H2O_HTTP2_SETTINGS_HOST, err_desc)) < 0)
+        return ret;
+
+    if (frame.type < sizeof(FRAME_HANDLERS) / sizeof(FRAME_HANDLERS[0])) {
+        int hret = FRAME_HANDLERS[frame.type](conn, &frame, err_desc);
+        if (hret != 0)
+            ret = hret;
+    } else {
+        /* frames of unknown types are ignored (RFC 7540 4.1) */
+    }
+
+    return ret;
+}
+
+static ssize_t expect_server_preface(struct st_h2o_http2client_conn_t *conn, const uint8_t *src, size_t len,
+                                     const char **err_desc)
+{
+    h2o_http2_frame_t frame;
+    ssize_t ret;
+    int hret;
+
+    if ((ret = h2o_http2_decode_frame(&frame, src, len, &H2O_HTTP2_SETTINGS_HOST, err_desc)) < 0)
+        return ret;
+    if (frame.type != H2O_HTTP2_FRAME_TYPE_SETTINGS || (frame.flags & H2O_HTTP2_FRAME_FLAG_ACK) != 0) {
+        *err_desc = "expected SETTINGS frame";
+        return H2O_HTTP2_ERROR_PROTOCOL_CLOSE_IMMEDIATELY;
+    }
+
+    conn->_read_expect = expect_default;
+    if ((hret = handle_settings_frame(conn, &frame, err_desc)) != 0)
+        return hret;
+    return ret;
+}
+
+static void on_read(h2o_socket_t *sock, const char *err)
+{
+    struct st_h2o_http2client_conn_t *conn = sock->data;
+
+    if (err != NULL) {
+        close_connection(conn, "upstream connection closed");
+        return;
+    }
+
+    conn->_is_reading = 1;
+    while (conn->sock->input->size != 0) {
+        const char *err_desc = NULL;
+        ssize_t ret = conn->_read_expect(conn, (uint8_t *)conn->sock->input->bytes, conn->sock->input->size, &err_desc);
+        if (ret == H2O_HTTP2_ERROR_INCOMPLETE) {
+            break;
+        } else if (ret < 0) {
+            /* the connection is closed without sending GOAWAY; the streams in flight are failed */
+            close_connection(conn, err_desc != NULL ? err_desc : "upstream protocol error");
+            return;
+        }
+        h2o_buffer_consume(&conn->sock->input, ret);
+    }
+    conn->_is_reading = 0;
+
+    if (conn->state == CONN_STATE_HALF_CLOSED && kh_size(conn->streams) == 0 && conn->_num_pending == 0) {
+        close_connection(conn, NULL);
+        return;
+    }
+    request_write(conn);
+}
+
+static void on_connect_error(struct st_h2o_http2client_conn_t *conn, const char *errstr)
+{
+    if (errstr != h2o_socketpool_error_unhealthy)
+        h2o_socketpool_report_failure(conn->pool->sockpool, h2o_now(conn->pool->loop));
+    close_connection(conn, errstr);
+}
+
+static void on_connection_ready(struct st_h2o_http2client_conn_t *conn)
+{
+    h2o_timeout_unlink(&conn->_timeout);
+    conn->state = CONN_STATE_OPEN;
+
+    { /* send the preface */
+        h2o_iovec_t vec = h2o_buffer_reserve(&conn->_write.buf, CONNECTION_PREFACE.len);
+        memcpy(vec.base, CONNECTION_PREFACE.base, CONNECTION_PREFACE.len);
+        conn->_write.buf->size += CONNECTION_PREFACE.len;
+    }
+    start_pending_streams(conn);
+    if (kh_size(conn->streams) == 0) {
+        /* all the requests have been cancelled while connecting */
+        conn->_timeout.cb = on_keepalive_timeout;
+        h2o_timeout_link(conn->pool->loop, &conn->pool->keepalive_timeout, &conn->_timeout);
+    }
+    h2o_socket_read_start(conn->sock, on_read);
+    request_write(conn);
+}
+
+static void on_handshake_complete(h2o_socket_t *sock, const char *err)
+{
+    struct st_h2o_http2client_conn_t *conn = sock->data;
+
+    if (err == NULL) {
+        /* success */
+    } else if (err == h2o_socket_error_ssl_cert_name_mismatch && (conn->pool->ssl_ctx->verify_mode & SSL_VERIFY_PEER) == 0) {
+        /* peer verification skipped */
+    } else {
+        on_connect_error(conn, err);
+        return;
+    }
+
+    h2o_iovec_t proto = h2o_socket_ssl_get_selected_protocol(sock);
+    if (!h2o_memis(proto.base, proto.len, H2O_STRLIT("h2"))) {
+        on_connect_error(conn, "upstream does not support HTTP/2");
+        return;
+    }
+
+    on_connection_ready(conn);
+}
+
+static void on_pool_connect(h2o_socket_t *sock, const char *errstr, void *data)
+{
+    struct st_h2o_http2client_conn_t *conn = data;
+
+    conn->_connect_req = NULL;
+
+    if (sock == NULL) {
+        assert(errstr != NULL);
+        on_connect_error(conn, errstr);
+        return;
+    }
+
+    conn->sock = sock;
+    sock->data = conn;
+    if (conn->pool->sockpool->is_ssl) {
+        h2o_socket_ssl_handshake(sock, conn->pool->ssl_ctx, conn->pool->sockpool->peer.host.base, on_handshake_complete);
+        return;
+    }
+
+    on_connection_ready(conn);
+}
+
+static void on_connect_timeout(h2o_timeout_entry_t *entry)
+{
+    struct st_h2o_http2client_conn_t *conn = H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_conn_t, _timeout, entry);
+    on_connect_error(conn, "connection timeout");
+}
+
+static struct st_h2o_http2client_conn_t *create_connection(h2o_http2client_pool_t *pool)
+{
+    struct st_h2o_http2client_conn_t *conn = h2o_mem_alloc(sizeof(*conn));
+
+    memset(conn, 0, sizeof(*conn));
+    conn->pool = pool;
+    conn->state = CONN_STATE_CONNECTING;
+    conn->peer_settings = H2O_HTTP2_SETTINGS_DEFAULT;
+    conn->peer_settings.max_concurrent_streams = INITIAL_MAX_CONCURRENT_STREAMS;
+    conn->streams = kh_init(h2o_http2client_stream_t);
+    h2o_linklist_init_anchor(&conn->_pending);
+    h2o_linklist_init_anchor(&conn->_blocked);
+    conn->_read_expect = expect_server_preface;
+    conn->_input_header_table.hpack_capacity = conn->_input_header_table.hpack_max_capacity =
+        H2O_HTTP2_SETTINGS_HOST.header_table_size;
+    conn->_output_header_table.hpack_capacity = H2O_HTTP2_SETTINGS_DEFAULT.header_table_size;
+    h2o_http2_window_init(&conn->_input_window, &H2O_HTTP2_SETTINGS_HOST);
+    h2o_http2_window_init(&conn->_write.window, &H2O_HTTP2_SETTINGS_DEFAULT);
+    h2o_buffer_init(&conn->_write.buf, &wbuf_buffer_prototype);
+    h2o_linklist_insert(&pool->_conns, &conn->_link);
+
+    return conn;
+}
+
+static void start_connect(struct st_h2o_http2client_conn_t *conn)
+{
+    h2o_http2client_pool_t *pool = conn->pool;
+
+    conn->_timeout.cb = on_connect_timeout;
+    h2o_timeout_link(pool->loop, pool->io_timeout, &conn->_timeout);
+    /* note: the callback might be called synchronously */
+    h2o_socketpool_connect(&conn->_connect_req, pool->sockpool, pool->loop, pool->getaddr_receiver, on_pool_connect, conn);
+}
+
+static void close_connection(struct st_h2o_http2client_conn_t *conn, const char *errstr)
+{
+    struct st_h2o_http2client_private_t *stream;
+
+    conn->state = CONN_STATE_IS_CLOSING;
+    if (h2o_linklist_is_linked(&conn->_link))
+        h2o_linklist_unlink(&conn->_link);
+    if (conn->_connect_req != NULL) {
+        h2o_socketpool_cancel_connect(conn->_connect_req);
+        conn->_connect_req = NULL;
+    }
+    if (h2o_timeout_is_linked(&conn->_timeout))
+        h2o_timeout_unlink(&conn->_timeout);
+
+    /* fail the requests */
+    while (!h2o_linklist_is_empty(&conn->_pending)) {
+        stream = H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_private_t, _link, conn->_pending.next);
+        call_error_cb(stream, errstr);
+        close_stream(stream);
+    }
+    while (kh_size(conn->streams) != 0) {
+        khiter_t iter;
+        for (iter = kh_begin(conn->streams); !kh_exist(conn->streams, iter); ++iter)
+            ;
+        stream = kh_val(conn->streams, iter);
+        call_error_cb(stream, errstr);
+        close_stream(stream);
+    }
+
+    /* dispose the connection */
+    if (conn->sock != NULL)
+        h2o_socket_close(conn->sock);
+    kh_destroy(h2o_http2client_stream_t, conn->streams);
+    h2o_hpack_dispose_header_table(&conn->_input_header_table);
+    h2o_hpack_dispose_header_table(&conn->_output_header_table);
+    if (conn->_headers_unparsed.buf != NULL)
+        h2o_buffer_dispose(&conn->_headers_unparsed.buf);
+    h2o_buffer_dispose(&conn->_write.buf);
+    if (conn->_write.buf_in_flight != NULL)
+        h2o_buffer_dispose(&conn->_write.buf_in_flight);
+    free(conn);
+}
+
+static void dispatch(h2o_http2client_pool_t *pool, struct st_h2o_http2client_private_t *stream, int *needs_connect)
+{
+    struct st_h2o_http2client_conn_t *conn = NULL;
+    h2o_linklist_t *node;
+
+    /* use the first connection with a free slot, or establish a new one if all of them are saturated */
+    for (node = pool->_conns.next; node != &pool->_conns; node = node->next) {
+        struct st_h2o_http2client_conn_t *c = H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_conn_t, _link, node);
+        if (c->state <= CONN_STATE_OPEN && kh_size(c->streams) + c->_num_pending < c->peer_settings.max_concurrent_streams) {
+            conn = c;
+            break;
+        }
+    }
+    if (conn == NULL) {
+        conn = create_connection(pool);
+        *needs_connect = 1;
+    }
+
+    stream->conn = conn;
+    stream->stream_id = 0;
+    stream->state = STREAM_STATE_PENDING;
+    h2o_linklist_insert(&conn->_pending, &stream->_link);
+    ++conn->_num_pending;
+    if (conn->state == CONN_STATE_OPEN) {
+        if (h2o_timeout_is_linked(&conn->_timeout))
+            h2o_timeout_unlink(&conn->_timeout);
+        start_pending_streams(conn);
+    }
+}
+
+static void redispatch(h2o_http2client_pool_t *pool, struct st_h2o_http2client_private_t *stream)
+{
+    int needs_connect = 0;
+
+    dispatch(pool, stream, &needs_connect);
+    if (needs_connect)
+        start_connect(stream->conn);
+}
+
+void h2o_http2client_pool_init(h2o_http2client_pool_t *pool, h2o_loop_t *loop, h2o_multithread_receiver_t *getaddr_receiver,
+                               h2o_timeout_t *io_timeout, SSL_CTX *ssl_ctx, h2o_socketpool_t *sockpool, uint64_t keepalive_timeout)
+{
+    pool->loop = loop;
+    pool->getaddr_receiver = getaddr_receiver;
+    pool->io_timeout = io_timeout;
+    pool->ssl_ctx = ssl_ctx;
+    pool->sockpool = sockpool;
+    h2o_timeout_init(loop, &pool->keepalive_timeout, keepalive_timeout);
+    h2o_linklist_init_anchor(&pool->_conns);
+}
+
+void h2o_http2client_pool_dispose(h2o_http2client_pool_t *pool)
+{
+    while (!h2o_linklist_is_empty(&pool->_conns)) {
+        struct st_h2o_http2client_conn_t *conn =
+            H2O_STRUCT_FROM_MEMBER(struct st_h2o_http2client_conn_t, _link, pool->_conns.next);
+        close_connection(conn, "connection pool disposed");
+    }
+    h2o_timeout_dispose(pool->loop, &pool->keepalive_timeout);
+}
+
+void h2o_http2client_request(h2o_http2client_t **_client, void *data, h2o_http2client_pool_t *pool, h2o_http2client_req_t *req,
+                             h2o_mem_pool_t *mem_pool, h2o_http2client_head_cb cb)
+{
+    struct st_h2o_http2client_private_t *stream = h2o_mem_alloc(sizeof(*stream));
+    int needs_connect = 0;
+
+    memset(stream, 0, sizeof(*stream));
+    stream->super.pool = pool;
+    stream->super.data = data;
+    h2o_buffer_init(&stream->super.buf, &h2o_socket_buffer_prototype);
+    stream->_cb.on_head = cb;
+    stream->_req = *req;
+    stream->_mem_pool = mem_pool;
+    stream->_timeout.cb = on_stream_timeout;
+    if (_client != NULL)
+        *_client = &stream->super;
+
+    dispatch(pool, stream, &needs_connect);
+    if (needs_connect)
+        start_connect(stream->conn);
+}
+
+void h2o_http2client_cancel(h2o_http2client_t *client)
+{
+    struct st_h2o_http2client_private_t *stream = (void *)client;
+
+    if (stream->stream_id != 0) {
+        reset_stream(stream, H2O_HTTP2_ERROR_CANCEL);
+    } else {
+        close_stream(stream);
+    }
+}
@@ -161,6 +161,15 @@ void h2o_multithread_destroy_queue(h2o_multithread_queue_t *queue)
 #endif
 }
 
+h2o_loop_t *h2o_multithread_get_loop(h2o_multithread_queue_t *queue)
+{
+#if H2O_USE_LIBUV
+    return queue->async.loop;
+#else
+    return h2o_socket_get_loop(queue->async.read);
+#endif
+}
+
 void h2o_multithread_register_receiver(h2o_multithread_queue_t *queue, h2o_multithread_receiver_t *receiver,
                                        h2o_multithread_receiver_cb cb)
 {
@@ -76,6 +76,9 @@ struct st_h2o_socket_ssl_t {
             } server;
             struct {
                 char *server_name;
+                h2o_cache_t *session_cache;
+                h2o_iovec_t session_cache_key;
+                h2o_cache_hashcode_t session_cache_key_hash;
             } client;
         };
     } handshake;
@@ -274,8 +277,10 @@ static void clear_output_buffer(struct st_h2o_socket_ssl_t *ssl)
 
 static void destroy_ssl(struct st_h2o_socket_ssl_t *ssl)
 {
-    if (!ssl->ssl->server)
+    if (!ssl->ssl->server) {
         free(ssl->handshake.client.server_name);
+        free(ssl->handshake.client.session_cache_key.base);
+    }
     SSL_free(ssl->ssl);
     ssl->ssl = NULL;
     h2o_buffer_dispose(&ssl->input.encrypted);
@@ -820,8 +825,69 @@ static void on_async_resumption_remove(SSL_CTX *ssl_ctx, SSL_SESSION *session)
     resumption_remove(session_id);
 }
 
+static void on_session_cache_entry_destroy(h2o_iovec_t value)
+{
+    SSL_SESSION_free((SSL_SESSION *)value.base);
+}
+
+static int session_cache_ex_index = -1;
+
+static void on_session_cache_ctx_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+    if (ptr != NULL)
+        h2o_cache_destroy(ptr);
+}
+
+h2o_cache_t *h2o_socket_ssl_new_session_cache(size_t capacity, uint64_t duration)
+{
+    return h2o_cache_create(H2O_CACHE_FLAG_MULTITHREADED, capacity, duration, on_session_cache_entry_destroy);
+}
+
+void h2o_socket_ssl_set_session_cache(SSL_CTX *ssl_ctx, h2o_cache_t *cache)
+{
+    if (session_cache_ex_index == -1)
+        session_cache_ex_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, on_session_cache_ctx_free);
+    h2o_cache_t *old = SSL_CTX_get_ex_data(ssl_ctx, session_cache_ex_index);
+    SSL_CTX_set_ex_data(ssl_ctx, session_cache_ex_index, cache);
+    if (old != NULL)
+        h2o_cache_destroy(old);
+}
+
+h2o_cache_t *h2o_socket_ssl_get_session_cache(SSL_CTX *ssl_ctx)
+{
+    if (session_cache_ex_index == -1)
+        return NULL;
+    return SSL_CTX_get_ex_data(ssl_ctx, session_cache_ex_index);
+}
+
+static const char *verify_server_name(h2o_socket_t *sock)
+{
+    X509 *cert = SSL_get_peer_certificate(sock->ssl->ssl);
+    const char *err = NULL;
+
+    if (cert == NULL)
+        return h2o_socket_error_ssl_no_cert;
+    switch (validate_hostname(sock->ssl->handshake.client.server_name, cert)) {
+    case MatchFound:
+        /* ok */
+        break;
+    case MatchNotFound:
+        err = h2o_socket_error_ssl_cert_name_mismatch;
+        break;
+    default:
+        err = h2o_socket_error_ssl_cert_invalid;
+        break;
+    }
+    X509_free(cert);
+    return err;
+}
+
 static void on_handshake_complete(h2o_socket_t *sock, const char *err)
 {
+    /* the peer is verified here so that the check is applied regardless of whether the last flight had to be flushed */
+    if (err == NULL && !sock->ssl->ssl->server)
+        err = verify_server_name(sock);
+
     if (err == NULL) {
         switch (SSL_get_current_cipher(sock->ssl->ssl)->id) {
         case TLS1_CK_RSA_WITH_AES_128_GCM_SHA256:
@@ -845,6 +911,14 @@ static void on_handshake_complete(h2o_socket_t *sock, const char *err)
             sock->ssl->record_overhead = 32; /* sufficiently large number that can hold most payloads */
             break;
         }
+        /* remember the session for resuming the next connection to the same upstream */
+        if (!sock->ssl->ssl->server && sock->ssl->handshake.client.session_cache != NULL && !SSL_session_reused(sock->ssl->ssl)) {
+            SSL_SESSION *session = SSL_get1_session(sock->ssl->ssl);
+            if (session != NULL)
+                h2o_cache_set(sock->ssl->handshake.client.session_cache, h2o_now(h2o_socket_get_loop(sock)),
+                              sock->ssl->handshake.client.session_cache_key, sock->ssl->handshake.client.session_cache_key_hash,
+                              h2o_iovec_init(session, 1));
+        }
     }
 
     h2o_socket_cb handshake_cb = sock->ssl->handshake.cb;
@@ -928,28 +1002,8 @@ Redo:
         h2o_socket_read_stop(sock);
         flush_pending_ssl(sock, ret == 1 ? on_handshake_complete : proceed_handshake);
     } else {
-        if (ret == 1) {
-            if (!sock->ssl->ssl->server) {
-                X509 *cert = SSL_get_peer_certificate(sock->ssl->ssl);
-                if (cert != NULL) {
-                    switch (validate_hostname(sock->ssl->handshake.client.server_name, cert)) {
-                    case MatchFound:
-                        /* ok */
-                        break;
-                    case MatchNotFound:
-                        err = h2o_socket_error_ssl_cert_name_mismatch;
-                        break;
-                    default:
-                        err = h2o_socket_error_ssl_cert_invalid;
-                        break;
-                    }
-                    X509_free(cert);
-                } else {
-                    err = h2o_socket_error_ssl_no_cert;
-                }
-            }
+        if (ret == 1)
             goto Complete;
-        }
         if (sock->ssl->input.encrypted->size != 0)
             goto Redo;
         h2o_socket_read_start(sock, proceed_handshake);
@@ -989,6 +1043,26 @@ void h2o_socket_ssl_handshake(h2o_socket_t *sock, SSL_CTX *ssl_ctx, const char *
     } else {
         sock->ssl->handshake.client.server_name = h2o_strdup(NULL, server_name, SIZE_MAX).base;
         SSL_set_tlsext_host_name(sock->ssl->ssl, sock->ssl->handshake.client.server_name);
+        h2o_cache_t *session_cache = h2o_socket_ssl_get_session_cache(ssl_ctx);
+        if (session_cache != NULL) {
+            struct sockaddr_storage ss;
+            int32_t port;
+            if (h2o_socket_getpeername(sock, (void *)&ss) != 0 && (port = h2o_socket_getport((void *)&ss)) != -1) {
+                /* sessions are keyed by the server name and the port, since the same name may be served by different endpoints */
+                h2o_iovec_t key;
+                key.base = h2o_mem_alloc(strlen(server_name) + sizeof(":" H2O_UINT16_LONGEST_STR));
+                key.len = sprintf(key.base, "%s:%" PRIu16, server_name, (uint16_t)port);
+                sock->ssl->handshake.client.session_cache = session_cache;
+                sock->ssl->handshake.client.session_cache_key = key;
+                sock->ssl->handshake.client.session_cache_key_hash = h2o_cache_calchash(key.base, key.len);
+                h2o_cache_ref_t *ref = h2o_cache_fetch(session_cache, h2o_now(h2o_socket_get_loop(sock)), key,
+                                                       sock->ssl->handshake.client.session_cache_key_hash);
+                if (ref != NULL) {
+                    SSL_set_session(sock->ssl->ssl, (SSL_SESSION *)ref->value.base);
+                    h2o_cache_release(session_cache, ref);
+                }
+            }
+        }
         proceed_handshake(sock, 0);
     }
 }
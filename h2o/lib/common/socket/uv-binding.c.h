@@ -209,6 +209,11 @@ static void on_connect(uv_connect_t *conn, int status)
 {
     struct st_h2o_uv_socket_t *sock = H2O_STRUCT_FROM_MEMBER(struct st_h2o_uv_socket_t, _creq, conn);
     h2o_socket_cb cb = sock->super._cb.write;
+
+    /* the socket has been closed while connecting; as is the case with evloop, the callback is not called */
+    if (status == UV_ECANCELED)
+        return;
+
     sock->super._cb.write = NULL;
     cb(&sock->super, status == 0 ? NULL : h2o_socket_error_conn_fail);
 }
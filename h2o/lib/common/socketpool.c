@@ -30,12 +30,19 @@
 #endif
 #include <stdlib.h>
 #include <sys/types.h>
+#include "h2o/happy_eyeballs.h"
 #include "h2o/hostinfo.h"
 #include "h2o/linklist.h"
 #include "h2o/socketpool.h"
 #include "h2o/string_.h"
 #include "h2o/timeout.h"
 
+#ifdef _WIN32
+#ifndef UV_MUTEX_INITIALIZER
+#define UV_MUTEX_INITIALIZER {(void*)-1,-1,0,0,0,0}
+#endif
+#endif
+
 struct pool_entry_t {
     h2o_socket_export_t sockinfo;
     h2o_linklist_t link;
@@ -48,9 +55,26 @@ struct st_h2o_socketpool_connect_request_t {
     h2o_socketpool_t *pool;
     h2o_loop_t *loop;
     h2o_hostinfo_getaddr_req_t *getaddr_req;
+    h2o_happy_eyeballs_t *eyeballs;
     h2o_socket_t *sock;
 };
 
+const char *const h2o_socketpool_error_unhealthy = "upstream is unhealthy";
+
+/* list of the pools being health-checked, used for reporting the status */
+static struct {
+#ifndef _MSC_VER
+    pthread_mutex_t mutex;
+#else
+    uv_mutex_t mutex;
+#endif
+    h2o_linklist_t pools;
+#ifndef _MSC_VER
+} health_registry = {PTHREAD_MUTEX_INITIALIZER, {&health_registry.pools, &health_registry.pools}};
+#else
+} health_registry = {UV_MUTEX_INITIALIZER, {&health_registry.pools, &health_registry.pools}};
+#endif
+
 static void destroy_detached(struct pool_entry_t *entry)
 {
     h2o_socket_dispose_export(&entry->sockinfo);
@@ -162,6 +186,18 @@ void h2o_socketpool_init_by_hostport(h2o_socketpool_t *pool, h2o_iovec_t host, u
 
 void h2o_socketpool_dispose(h2o_socketpool_t *pool)
 {
+    if (pool->health.enabled) {
+#ifndef _MSC_VER
+        pthread_mutex_lock(&health_registry.mutex);
+        h2o_linklist_unlink(&pool->health._link);
+        pthread_mutex_unlock(&health_registry.mutex);
+#else
+        uv_mutex_lock(&health_registry.mutex);
+        h2o_linklist_unlink(&pool->health._link);
+        uv_mutex_unlock(&health_registry.mutex);
+#endif
+    }
+
 #ifndef _MSC_VER
     pthread_mutex_lock(&pool->_shared.mutex);
 #else
@@ -209,6 +245,178 @@ void h2o_socketpool_set_timeout(h2o_socketpool_t *pool, h2o_loop_t *loop, uint64
     h2o_timeout_link(loop, &pool->_interval_cb.timeout, &pool->_interval_cb.entry);
 }
 
+void h2o_socketpool_enable_health_check(h2o_socketpool_t *pool, h2o_socketpool_health_config_t *config, int is_actively_checked)
+{
+    assert(!pool->health.enabled);
+
+    pool->health.enabled = 1;
+    pool->health.is_actively_checked = is_actively_checked;
+    pool->health.config = *config;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&health_registry.mutex);
+    h2o_linklist_insert(&health_registry.pools, &pool->health._link);
+    pthread_mutex_unlock(&health_registry.mutex);
+#else
+    uv_mutex_lock(&health_registry.mutex);
+    h2o_linklist_insert(&health_registry.pools, &pool->health._link);
+    uv_mutex_unlock(&health_registry.mutex);
+#endif
+}
+
+static void set_health_state(h2o_socketpool_t *pool, h2o_socketpool_health_state_t state, uint64_t now)
+{
+    /* caller should lock the mutex */
+    if (state == H2O_SOCKETPOOL_UNHEALTHY && pool->_shared.health.state != H2O_SOCKETPOOL_UNHEALTHY)
+        ++pool->_shared.health.num_ejections;
+    pool->_shared.health.state = state;
+    pool->_shared.health.state_changed_at = now;
+}
+
+static void readmit(h2o_socketpool_t *pool, uint64_t now)
+{
+    /* caller should lock the mutex */
+    set_health_state(pool, pool->health.config.slow_start != 0 ? H2O_SOCKETPOOL_SLOW_START : H2O_SOCKETPOOL_HEALTHY, now);
+}
+
+static int admit_connect(h2o_socketpool_t *pool, uint64_t now)
+{
+    /* caller should lock the mutex */
+    h2o_socketpool_health_t *health = &pool->_shared.health;
+    uint64_t elapsed;
+
+    if (!pool->health.enabled)
+        return 1;
+
+    switch (health->state) {
+    case H2O_SOCKETPOOL_HEALTHY:
+        return 1;
+    case H2O_SOCKETPOOL_UNHEALTHY:
+        if (pool->health.is_actively_checked || now - health->state_changed_at < pool->health.config.ejection_time)
+            goto Reject;
+        /* give the upstream another chance; a single failure ejects it again */
+        health->consecutive_failures = pool->health.config.max_failures != 0 ? pool->health.config.max_failures - 1 : 0;
+        readmit(pool, now);
+        break;
+    case H2O_SOCKETPOOL_SLOW_START:
+        break;
+    }
+
+    /* slow start; let through a share of the requests that grows linearly from 10% to 100% */
+    elapsed = now - health->state_changed_at;
+    if (elapsed >= pool->health.config.slow_start) {
+        set_health_state(pool, H2O_SOCKETPOOL_HEALTHY, now);
+        return 1;
+    }
+    if ((uint64_t)(rand() % 1000) < 100 + elapsed * 900 / pool->health.config.slow_start)
+        return 1;
+
+Reject:
+    ++health->num_rejected;
+    return 0;
+}
+
+void h2o_socketpool_report_success(h2o_socketpool_t *pool)
+{
+    if (!pool->health.enabled)
+        return;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&pool->_shared.mutex);
+    pool->_shared.health.consecutive_failures = 0;
+    pthread_mutex_unlock(&pool->_shared.mutex);
+#else
+    uv_mutex_lock(&pool->_shared.mutex);
+    pool->_shared.health.consecutive_failures = 0;
+    uv_mutex_unlock(&pool->_shared.mutex);
+#endif
+}
+
+void h2o_socketpool_report_failure(h2o_socketpool_t *pool, uint64_t now)
+{
+    h2o_socketpool_health_t *health = &pool->_shared.health;
+
+    if (!pool->health.enabled)
+        return;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&pool->_shared.mutex);
+#else
+    uv_mutex_lock(&pool->_shared.mutex);
+#endif
+    ++health->consecutive_failures;
+    if (pool->health.config.max_failures != 0 && health->consecutive_failures >= pool->health.config.max_failures &&
+        health->state != H2O_SOCKETPOOL_UNHEALTHY)
+        set_health_state(pool, H2O_SOCKETPOOL_UNHEALTHY, now);
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&pool->_shared.mutex);
+#else
+    uv_mutex_unlock(&pool->_shared.mutex);
+#endif
+}
+
+void h2o_socketpool_report_probe(h2o_socketpool_t *pool, int is_healthy, uint64_t now)
+{
+    h2o_socketpool_health_t *health = &pool->_shared.health;
+
+    assert(pool->health.enabled);
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&pool->_shared.mutex);
+#else
+    uv_mutex_lock(&pool->_shared.mutex);
+#endif
+    ++health->num_probes;
+    if (is_healthy) {
+        if (health->state == H2O_SOCKETPOOL_UNHEALTHY) {
+            health->consecutive_failures = 0;
+            readmit(pool, now);
+        }
+    } else {
+        ++health->num_probe_failures;
+        if (health->state != H2O_SOCKETPOOL_UNHEALTHY)
+            set_health_state(pool, H2O_SOCKETPOOL_UNHEALTHY, now);
+    }
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&pool->_shared.mutex);
+#else
+    uv_mutex_unlock(&pool->_shared.mutex);
+#endif
+}
+
+void h2o_socketpool_foreach_health(void (*cb)(h2o_socketpool_t *pool, h2o_socketpool_health_t *health, void *data), void *data)
+{
+    h2o_linklist_t *node;
+    h2o_socketpool_health_t health;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&health_registry.mutex);
+#else
+    uv_mutex_lock(&health_registry.mutex);
+#endif
+    for (node = health_registry.pools.next; node != &health_registry.pools; node = node->next) {
+        h2o_socketpool_t *pool = H2O_STRUCT_FROM_MEMBER(h2o_socketpool_t, health._link, node);
+#ifndef _MSC_VER
+        pthread_mutex_lock(&pool->_shared.mutex);
+        health = pool->_shared.health;
+        pthread_mutex_unlock(&pool->_shared.mutex);
+#else
+        uv_mutex_lock(&pool->_shared.mutex);
+        health = pool->_shared.health;
+        uv_mutex_unlock(&pool->_shared.mutex);
+#endif
+        cb(pool, &health, data);
+    }
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&health_registry.mutex);
+#else
+    uv_mutex_unlock(&health_registry.mutex);
+#endif
+}
+
+static void connect_new(h2o_socketpool_connect_request_t **_req, h2o_socketpool_t *pool, h2o_loop_t *loop,
+                        h2o_multithread_receiver_t *getaddr_receiver, h2o_socketpool_connect_cb cb, void *data);
+
 static void call_connect_cb(h2o_socketpool_connect_request_t *req, const char *errstr)
 {
     h2o_socketpool_connect_cb cb = req->cb;
@@ -244,6 +452,17 @@ static void on_close(void *data)
 #endif
 }
 
+static void on_close_reused(void *data)
+{
+    /* same as on_close; the callback being different is what distinguishes the sockets taken from the pool */
+    on_close(data);
+}
+
+int h2o_socketpool_is_reused(h2o_socket_t *sock)
+{
+    return sock->on_close.cb == on_close_reused;
+}
+
 static void start_connect(h2o_socketpool_connect_request_t *req, struct sockaddr *addr, socklen_t addrlen)
 {
     req->sock = h2o_socket_connect(req->loop, addr, addrlen, on_connect);
@@ -261,6 +480,29 @@ static void start_connect(h2o_socketpool_connect_request_t *req, struct sockaddr
     req->sock->on_close.data = req->pool;
 }
 
+static void on_eyeballs_connect(h2o_socket_t *sock, const char *errstr, void *_req)
+{
+    h2o_socketpool_connect_request_t *req = _req;
+
+    req->eyeballs = NULL;
+
+    if (sock == NULL) {
+#ifndef _MSC_VER
+        __sync_sub_and_fetch(&req->pool->_shared.count, 1);
+#else
+		InterlockedDecrement(&req->pool->_shared.count);
+#endif
+        call_connect_cb(req, errstr);
+        return;
+    }
+
+    req->sock = sock;
+    sock->data = req;
+    sock->on_close.cb = on_close;
+    sock->on_close.data = req->pool;
+    call_connect_cb(req, NULL);
+}
+
 static void on_getaddr(h2o_hostinfo_getaddr_req_t *getaddr_req, const char *errstr, struct addrinfo *res, void *_req)
 {
     h2o_socketpool_connect_request_t *req = _req;
@@ -278,8 +520,7 @@ static void on_getaddr(h2o_hostinfo_getaddr_req_t *getaddr_req, const char *errs
         return;
     }
 
-    struct addrinfo *selected = h2o_hostinfo_select_one(res);
-    start_connect(req, selected->ai_addr, selected->ai_addrlen);
+    req->eyeballs = h2o_happy_eyeballs_connect(req->loop, res, on_eyeballs_connect, req);
 }
 
 void h2o_socketpool_connect(h2o_socketpool_connect_request_t **_req, h2o_socketpool_t *pool, h2o_loop_t *loop,
@@ -296,6 +537,16 @@ void h2o_socketpool_connect(h2o_socketpool_connect_request_t **_req, h2o_socketp
 #else
 	uv_mutex_lock(&pool->_shared.mutex);
 #endif
+    if (!admit_connect(pool, h2o_now(loop))) {
+        /* fail immediately instead of having the request wait for a dead upstream */
+#ifndef _MSC_VER
+        pthread_mutex_unlock(&pool->_shared.mutex);
+#else
+        uv_mutex_unlock(&pool->_shared.mutex);
+#endif
+        cb(NULL, h2o_socketpool_error_unhealthy, data);
+        return;
+    }
     destroy_expired(pool);
     while (1) {
         if (h2o_linklist_is_empty(&pool->_shared.sockets))
@@ -315,7 +566,7 @@ void h2o_socketpool_connect(h2o_socketpool_connect_request_t **_req, h2o_socketp
             /* yes! return it */
             h2o_socket_t *sock = h2o_socket_import(loop, &entry->sockinfo);
             free(entry);
-            sock->on_close.cb = on_close;
+            sock->on_close.cb = on_close_reused;
             sock->on_close.data = pool;
             cb(sock, NULL, data);
             return;
@@ -354,6 +605,12 @@ void h2o_socketpool_connect(h2o_socketpool_connect_request_t **_req, h2o_socketp
 	uv_mutex_unlock(&pool->_shared.mutex);
 #endif
     /* FIXME repsect `capacity` */
+    connect_new(_req, pool, loop, getaddr_receiver, cb, data);
+}
+
+static void connect_new(h2o_socketpool_connect_request_t **_req, h2o_socketpool_t *pool, h2o_loop_t *loop,
+                        h2o_multithread_receiver_t *getaddr_receiver, h2o_socketpool_connect_cb cb, void *data)
+{
 #ifndef _MSC_VER
     __sync_add_and_fetch(&pool->_shared.count, 1);
 #else
@@ -379,12 +636,46 @@ void h2o_socketpool_connect(h2o_socketpool_connect_request_t **_req, h2o_socketp
     }
 }
 
+void h2o_socketpool_connect_new(h2o_socketpool_connect_request_t **_req, h2o_socketpool_t *pool, h2o_loop_t *loop,
+                                h2o_multithread_receiver_t *getaddr_receiver, h2o_socketpool_connect_cb cb, void *data)
+{
+    int admitted;
+
+    if (_req != NULL)
+        *_req = NULL;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&pool->_shared.mutex);
+    admitted = admit_connect(pool, h2o_now(loop));
+    pthread_mutex_unlock(&pool->_shared.mutex);
+#else
+    uv_mutex_lock(&pool->_shared.mutex);
+    admitted = admit_connect(pool, h2o_now(loop));
+    uv_mutex_unlock(&pool->_shared.mutex);
+#endif
+    if (!admitted) {
+        cb(NULL, h2o_socketpool_error_unhealthy, data);
+        return;
+    }
+
+    connect_new(_req, pool, loop, getaddr_receiver, cb, data);
+}
+
 void h2o_socketpool_cancel_connect(h2o_socketpool_connect_request_t *req)
 {
     if (req->getaddr_req != NULL) {
         h2o_hostinfo_getaddr_cancel(req->getaddr_req);
         req->getaddr_req = NULL;
     }
+    if (req->eyeballs != NULL) {
+        h2o_happy_eyeballs_cancel(req->eyeballs);
+        req->eyeballs = NULL;
+#ifndef _MSC_VER
+        __sync_sub_and_fetch(&req->pool->_shared.count, 1);
+#else
+		InterlockedDecrement(&req->pool->_shared.count);
+#endif
+    }
     if (req->sock != NULL)
         h2o_socket_close(req->sock);
     free(req);
@@ -424,3 +715,195 @@ int h2o_socketpool_return(h2o_socketpool_t *pool, h2o_socket_t *sock)
 
     return 0;
 }
+
+struct st_h2o_socketpool_warming_t {
+    h2o_socketpool_warmer_t *warmer;
+    h2o_linklist_t link;
+    h2o_socketpool_connect_request_t *connect_req; /* non-NULL while connecting */
+    h2o_socket_t *sock;                           /* non-NULL while performing the TLS handshake */
+};
+
+static size_t count_fresh_idle(h2o_socketpool_t *pool, uint64_t fresh_after, size_t max)
+{
+    /* caller should lock the mutex; the sockets are ordered by the time they were returned, the newest being the last */
+    h2o_linklist_t *node;
+    size_t count = 0;
+
+    for (node = pool->_shared.sockets.prev; node != &pool->_shared.sockets && count < max; node = node->prev) {
+        struct pool_entry_t *entry = H2O_STRUCT_FROM_MEMBER(struct pool_entry_t, link, node);
+        if (entry->added_at <= fresh_after)
+            break;
+        ++count;
+    }
+    return count;
+}
+
+static void finish_warming(struct st_h2o_socketpool_warming_t *warming)
+{
+    h2o_socketpool_t *pool = warming->warmer->pool;
+
+    h2o_linklist_unlink(&warming->link);
+    free(warming);
+#ifndef _MSC_VER
+    __sync_sub_and_fetch(&pool->_shared.num_warming, 1);
+#else
+    InterlockedDecrement(&pool->_shared.num_warming);
+#endif
+}
+
+static void on_warm_handshake(h2o_socket_t *sock, const char *err)
+{
+    struct st_h2o_socketpool_warming_t *warming = sock->data;
+    h2o_socketpool_t *pool = warming->warmer->pool;
+
+    warming->sock = NULL;
+    finish_warming(warming);
+
+    if (err != NULL) {
+        h2o_socketpool_report_failure(pool, h2o_now(h2o_socket_get_loop(sock)));
+        h2o_socket_close(sock);
+        return;
+    }
+    h2o_socketpool_return(pool, sock);
+}
+
+static void on_warm_connect(h2o_socket_t *sock, const char *errstr, void *data)
+{
+    struct st_h2o_socketpool_warming_t *warming = data;
+    h2o_socketpool_warmer_t *warmer = warming->warmer;
+
+    warming->connect_req = NULL;
+
+    if (sock == NULL) {
+        h2o_socketpool_report_failure(warmer->pool, h2o_now(warmer->loop));
+        finish_warming(warming);
+        return;
+    }
+
+    if (warmer->pool->is_ssl && warmer->ssl_ctx != NULL) {
+        /* complete the handshake as well, so that the first request would not have to wait for it */
+        warming->sock = sock;
+        sock->data = warming;
+        h2o_socket_ssl_handshake(sock, warmer->ssl_ctx, warmer->pool->peer.host.base, on_warm_handshake);
+        return;
+    }
+
+    finish_warming(warming);
+    h2o_socketpool_return(warmer->pool, sock);
+}
+
+static size_t refill_connect_tokens(h2o_socketpool_warmer_t *warmer, uint64_t now)
+{
+    uint64_t elapsed = now - warmer->_tokens_refilled_at, refill = elapsed * warmer->connect_rate / 1000;
+
+    if (refill != 0) {
+        /* advance the clock by the time it took to earn the tokens, so that fractions are carried over */
+        warmer->_tokens_refilled_at += refill * 1000 / warmer->connect_rate;
+        warmer->_tokens += refill;
+    }
+    /* allow a burst of at most one second worth of connections */
+    if (warmer->_tokens >= warmer->connect_rate) {
+        warmer->_tokens = warmer->connect_rate;
+        warmer->_tokens_refilled_at = now;
+    }
+    return warmer->_tokens;
+}
+
+static void on_warmer_interval(h2o_timeout_entry_t *entry)
+{
+    h2o_socketpool_warmer_t *warmer = H2O_STRUCT_FROM_MEMBER(h2o_socketpool_warmer_t, _interval_entry, entry);
+    h2o_socketpool_t *pool = warmer->pool;
+    uint64_t now = h2o_now(warmer->loop), fresh_after = 0;
+    size_t target = warmer->min_idle * pool->_shared.num_warmers, num_fresh, num_warming, num_connects;
+    int is_unhealthy;
+
+    h2o_timeout_link(warmer->loop, &warmer->_interval, &warmer->_interval_entry);
+
+    /* connections that are about to be reaped are not counted, so that they are replaced before being closed */
+    if (pool->timeout != UINT64_MAX) {
+        uint64_t margin = pool->timeout / 4 < 1000 ? pool->timeout / 4 : 1000;
+        if (now > pool->timeout - margin)
+            fresh_after = now - (pool->timeout - margin);
+    }
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&pool->_shared.mutex);
+#else
+    uv_mutex_lock(&pool->_shared.mutex);
+#endif
+    is_unhealthy = pool->health.enabled && pool->_shared.health.state == H2O_SOCKETPOOL_UNHEALTHY;
+    num_fresh = count_fresh_idle(pool, fresh_after, target);
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&pool->_shared.mutex);
+#else
+    uv_mutex_unlock(&pool->_shared.mutex);
+#endif
+
+    /* do not hammer an upstream that is known to be down */
+    if (is_unhealthy)
+        return;
+
+    num_warming = pool->_shared.num_warming;
+    if (num_fresh + num_warming >= target)
+        return;
+    num_connects = target - num_fresh - num_warming;
+    if (num_connects > refill_connect_tokens(warmer, now))
+        num_connects = warmer->_tokens;
+    warmer->_tokens -= num_connects;
+
+    for (; num_connects != 0; --num_connects) {
+        struct st_h2o_socketpool_warming_t *warming = h2o_mem_alloc(sizeof(*warming));
+        *warming = (struct st_h2o_socketpool_warming_t){warmer};
+        h2o_linklist_insert(&warmer->_warming, &warming->link);
+#ifndef _MSC_VER
+        __sync_add_and_fetch(&pool->_shared.num_warming, 1);
+#else
+        InterlockedIncrement(&pool->_shared.num_warming);
+#endif
+        connect_new(&warming->connect_req, pool, warmer->loop, warmer->getaddr_receiver, on_warm_connect, warming);
+    }
+}
+
+void h2o_socketpool_warmer_start(h2o_socketpool_warmer_t *warmer, h2o_socketpool_t *pool, h2o_loop_t *loop,
+                                 h2o_multithread_receiver_t *getaddr_receiver, SSL_CTX *ssl_ctx, size_t min_idle,
+                                 unsigned connect_rate)
+{
+    assert(min_idle != 0);
+    assert(connect_rate != 0);
+
+    *warmer = (h2o_socketpool_warmer_t){pool, loop, getaddr_receiver, ssl_ctx, min_idle, connect_rate};
+    warmer->_tokens = connect_rate;
+    warmer->_tokens_refilled_at = h2o_now(loop);
+    h2o_linklist_init_anchor(&warmer->_warming);
+#ifndef _MSC_VER
+    __sync_add_and_fetch(&pool->_shared.num_warmers, 1);
+#else
+    InterlockedIncrement(&pool->_shared.num_warmers);
+#endif
+
+    h2o_timeout_init(loop, &warmer->_interval, H2O_SOCKETPOOL_WARMER_INTERVAL);
+    warmer->_interval_entry.cb = on_warmer_interval;
+    h2o_timeout_link(loop, &warmer->_interval, &warmer->_interval_entry);
+}
+
+void h2o_socketpool_warmer_stop(h2o_socketpool_warmer_t *warmer)
+{
+    h2o_timeout_unlink(&warmer->_interval_entry);
+    h2o_timeout_dispose(warmer->loop, &warmer->_interval);
+
+    while (!h2o_linklist_is_empty(&warmer->_warming)) {
+        struct st_h2o_socketpool_warming_t *warming =
+            H2O_STRUCT_FROM_MEMBER(struct st_h2o_socketpool_warming_t, link, warmer->_warming.next);
+        if (warming->connect_req != NULL)
+            h2o_socketpool_cancel_connect(warming->connect_req);
+        if (warming->sock != NULL)
+            h2o_socket_close(warming->sock);
+        finish_warming(warming);
+    }
+
+#ifndef _MSC_VER
+    __sync_sub_and_fetch(&warmer->pool->_shared.num_warmers, 1);
+#else
+    InterlockedDecrement(&warmer->pool->_shared.num_warmers);
+#endif
+}
@@ -181,6 +181,11 @@ void h2o_config_init(h2o_globalconf_t *config)
     config->http2.idle_timeout = H2O_DEFAULT_HTTP2_IDLE_TIMEOUT;
     config->proxy.io_timeout = H2O_DEFAULT_PROXY_IO_TIMEOUT;
     config->proxy.emit_x_forwarded_headers = 1;
+    config->overload.retry_after = H2O_DEFAULT_OVERLOAD_RETRY_AFTER;
+    config->filecache.revalidate_interval = H2O_DEFAULT_FILECACHE_REVALIDATE_INTERVAL;
+    config->filecache.content.max_object_size = H2O_DEFAULT_FILECACHE_CONTENT_MAX_OBJECT_SIZE;
+    config->filecache.content.duration = H2O_DEFAULT_FILECACHE_CONTENT_DURATION;
+    config->compress.cache.max_object_size = H2O_DEFAULT_COMPRESS_CACHE_MAX_OBJECT_SIZE;
     config->http2.max_concurrent_requests_per_connection = H2O_HTTP2_SETTINGS_HOST.max_concurrent_streams;
     config->http2.max_streams_for_priority = 16;
     config->http2.latency_optimization.min_rtt = UINT_MAX;
@@ -281,6 +286,13 @@ void h2o_config_dispose(h2o_globalconf_t *config)
     free(config->hosts);
 
     h2o_mem_release_shared(config->mimemap);
+    if (config->filecache.content.cache != NULL)
+        h2o_cache_destroy(config->filecache.content.cache);
+    if (config->filecache.dir.cache != NULL)
+        h2o_cache_destroy(config->filecache.dir.cache);
+    if (config->compress.cache.cache != NULL)
+        h2o_cache_destroy(config->compress.cache.cache);
+    free(config->precompress.dir);
     h2o_configurator__dispose_configurators(config);
 }
 
@@ -73,11 +73,26 @@ static int on_core_enter(h2o_configurator_t *_self, h2o_configurator_context_t *
     return 0;
 }
 
+static void on_file_content_destroy(h2o_iovec_t value)
+{
+    free(value.base);
+}
+
 static int on_core_exit(h2o_configurator_t *_self, h2o_configurator_context_t *ctx, yoml_t *node)
 {
     struct st_core_configurator_t *self = (void *)_self;
 
-    if (ctx->hostconf != NULL && ctx->pathconf == NULL) {
+    if (ctx->parent == NULL) {
+        /* exitting from global-level configuration */
+        if (ctx->globalconf->filecache.content.capacity != 0 && ctx->globalconf->filecache.content.cache == NULL)
+            ctx->globalconf->filecache.content.cache =
+                h2o_cache_create(H2O_CACHE_FLAG_MULTITHREADED, ctx->globalconf->filecache.content.capacity,
+                                 ctx->globalconf->filecache.content.duration, on_file_content_destroy);
+        if (ctx->globalconf->filecache.dir.capacity != 0 && ctx->globalconf->filecache.dir.cache == NULL)
+            ctx->globalconf->filecache.dir.cache =
+                h2o_cache_create(H2O_CACHE_FLAG_MULTITHREADED, ctx->globalconf->filecache.dir.capacity,
+                                 H2O_FILECACHE_DIR_DURATION, on_file_content_destroy);
+    } else if (ctx->hostconf != NULL && ctx->pathconf == NULL) {
         /* exitting from host-level configuration */
         ctx->hostconf->http2.reprioritize_blocking_assets = self->vars->http2.reprioritize_blocking_assets;
         ctx->hostconf->http2.push_preload = self->vars->http2.push_preload;
@@ -408,6 +423,63 @@ static int on_config_http2_idle_timeout(h2o_configurator_command_t *cmd, h2o_con
     return config_timeout(cmd, node, &ctx->globalconf->http2.idle_timeout);
 }
 
+static int on_config_overload_max_loop_lag(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%" PRIu64, &ctx->globalconf->overload.max_loop_lag);
+}
+
+static int on_config_overload_max_queue_delay(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%" PRIu64, &ctx->globalconf->overload.max_queue_delay);
+}
+
+static int on_config_overload_retry_after(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%u", &ctx->globalconf->overload.retry_after);
+}
+
+static int on_config_filecache_capacity(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    if (h2o_configurator_scanf(cmd, node, "%zu", &ctx->globalconf->filecache.capacity) != 0)
+        return -1;
+    if (ctx->globalconf->filecache.capacity == 0) {
+        h2o_configurator_errprintf(cmd, node, "filecache.capacity must be >=1");
+        return -1;
+    }
+    return 0;
+}
+
+static int on_config_filecache_ttl(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return config_timeout(cmd, node, &ctx->globalconf->filecache.ttl);
+}
+
+static int on_config_filecache_revalidate_interval(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return config_timeout(cmd, node, &ctx->globalconf->filecache.revalidate_interval);
+}
+
+static int on_config_filecache_content_capacity(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%zu", &ctx->globalconf->filecache.content.capacity);
+}
+
+static int on_config_filecache_content_max_object_size(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx,
+                                                       yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%zu", &ctx->globalconf->filecache.content.max_object_size);
+}
+
+static int on_config_filecache_content_duration(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return config_timeout(cmd, node, &ctx->globalconf->filecache.content.duration);
+}
+
+static int on_config_filecache_dir_capacity(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%zu", &ctx->globalconf->filecache.dir.capacity);
+}
+
 static int on_config_http2_max_concurrent_requests_per_connection(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx,
                                                                   yoml_t *node)
 {
@@ -859,6 +931,35 @@ void h2o_configurator__init_core(h2o_globalconf_t *conf)
         h2o_configurator_define_command(&c->super, "http2-idle-timeout",
                                         H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                         on_config_http2_idle_timeout);
+        h2o_configurator_define_command(&c->super, "overload-max-loop-lag",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_overload_max_loop_lag);
+        h2o_configurator_define_command(&c->super, "overload-max-queue-delay",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_overload_max_queue_delay);
+        h2o_configurator_define_command(&c->super, "overload-retry-after",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_overload_retry_after);
+        h2o_configurator_define_command(&c->super, "filecache.capacity",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_filecache_capacity);
+        h2o_configurator_define_command(&c->super, "filecache.ttl", H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_filecache_ttl);
+        h2o_configurator_define_command(&c->super, "filecache.revalidate-interval",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_filecache_revalidate_interval);
+        h2o_configurator_define_command(&c->super, "filecache.content.capacity",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_filecache_content_capacity);
+        h2o_configurator_define_command(&c->super, "filecache.content.max-object-size",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_filecache_content_max_object_size);
+        h2o_configurator_define_command(&c->super, "filecache.content.duration",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_filecache_content_duration);
+        h2o_configurator_define_command(&c->super, "filecache.dir.capacity",
+                                        H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                        on_config_filecache_dir_capacity);
         h2o_configurator_define_command(&c->super, "http2-max-concurrent-requests-per-connection",
                                         H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                         on_config_http2_max_concurrent_requests_per_connection);
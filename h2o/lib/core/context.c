@@ -109,6 +109,48 @@ void h2o_context_dispose_pathconf_context(h2o_context_t *ctx, h2o_pathconf_t *pa
 #undef DOIT
 }
 
+static void on_overload_probe(h2o_timeout_entry_t *entry)
+{
+	h2o_context_t *ctx = H2O_STRUCT_FROM_MEMBER(h2o_context_t, overload._probe, entry);
+	h2o_globalconf_t *config = ctx->globalconf;
+	uint64_t now = h2o_now(ctx->loop), expected = entry->registered_at + ctx->hundred_ms_timeout.timeout;
+	int is_overloaded;
+
+	/* the lag is smoothed so that a single slow iteration of the loop does not cause the requests to be shed */
+	ctx->overload.loop_lag = (ctx->overload.loop_lag * 3 + (now > expected ? now - expected : 0)) / 4;
+	is_overloaded = config->overload.max_loop_lag != 0 && ctx->overload.loop_lag > config->overload.max_loop_lag;
+#if H2O_USE_LIBUV
+	if (config->overload.max_queue_delay != 0 && ctx->overload._exec_time_counter.average > config->overload.max_queue_delay)
+		is_overloaded = 1;
+#else
+	/* the execution time is recorded only by the iterations that handle I/O events; record zero for an iteration that only runs
+	 * the timers so that the average decays once the load goes away */
+	if (!h2o_sliding_counter_is_running(&ctx->loop->exec_time_counter)) {
+		h2o_sliding_counter_start(&ctx->loop->exec_time_counter, now);
+		h2o_sliding_counter_stop(&ctx->loop->exec_time_counter, now);
+	}
+	if (config->overload.max_queue_delay != 0 && h2o_evloop_get_execution_time(ctx->loop) > config->overload.max_queue_delay)
+		is_overloaded = 1;
+#endif
+	if (is_overloaded && !ctx->overload.is_overloaded)
+		++ctx->overload.events.episodes;
+	ctx->overload.is_overloaded = is_overloaded;
+
+	h2o_timeout_link(ctx->loop, &ctx->hundred_ms_timeout, &ctx->overload._probe);
+}
+
+#if H2O_USE_LIBUV
+static void on_overload_exec_time_check(uv_check_t *check)
+{
+	h2o_context_t *ctx = H2O_STRUCT_FROM_MEMBER(h2o_context_t, overload._exec_time_check, check);
+
+	/* libuv updates the time of the loop right after polling; the time elapsed since then has been spent for handling the I/O
+	 * events (and the idle / prepare callbacks) of this iteration */
+	h2o_sliding_counter_start(&ctx->overload._exec_time_counter, uv_now(ctx->loop));
+	h2o_sliding_counter_stop(&ctx->overload._exec_time_counter, uv_hrtime() / 1000000);
+}
+#endif
+
 void h2o_context_init(h2o_context_t *ctx, h2o_loop_t *loop, h2o_globalconf_t *config)
 {
 	size_t i, j;
@@ -123,7 +165,11 @@ void h2o_context_init(h2o_context_t *ctx, h2o_loop_t *loop, h2o_globalconf_t *co
 	h2o_timeout_init(ctx->loop, &ctx->hundred_ms_timeout, 100);
 	ctx->queue = h2o_multithread_create_queue(loop);
 	h2o_multithread_register_receiver(ctx->queue, &ctx->receivers.hostinfo_getaddr, h2o_hostinfo_getaddr_receiver);
+	h2o_multithread_register_receiver(ctx->queue, &ctx->receivers.fileio, h2o_fileio_receiver);
+	h2o_multithread_register_receiver(ctx->queue, &ctx->receivers.compress, h2o_compress_receiver);
 	ctx->filecache = h2o_filecache_create(config->filecache.capacity);
+	if (config->filecache.ttl != 0)
+		h2o_filecache_set_ttl(ctx->filecache, config->filecache.ttl, config->filecache.revalidate_interval);
 
 	h2o_timeout_init(ctx->loop, &ctx->handshake_timeout, config->handshake_timeout);
 	h2o_timeout_init(ctx->loop, &ctx->http1.req_timeout, config->http1.req_timeout);
@@ -135,6 +181,16 @@ void h2o_context_init(h2o_context_t *ctx, h2o_loop_t *loop, h2o_globalconf_t *co
 	ctx->proxy.client_ctx.getaddr_receiver = &ctx->receivers.hostinfo_getaddr;
 	ctx->proxy.client_ctx.io_timeout = &ctx->proxy.io_timeout;
 	ctx->proxy.client_ctx.ssl_ctx = config->proxy.ssl_ctx;
+	ctx->overload._probe.cb = on_overload_probe;
+	h2o_timeout_link(ctx->loop, &ctx->hundred_ms_timeout, &ctx->overload._probe);
+#if H2O_USE_LIBUV
+	if (config->overload.max_queue_delay != 0) {
+		uv_check_init(ctx->loop, &ctx->overload._exec_time_check);
+		uv_check_start(&ctx->overload._exec_time_check, on_overload_exec_time_check);
+		/* the handle should not keep the loop alive */
+		uv_unref((uv_handle_t *)&ctx->overload._exec_time_check);
+	}
+#endif
 
 	ctx->_module_configs = h2o_mem_alloc(sizeof(*ctx->_module_configs) * config->_num_config_slots);
 	memset(ctx->_module_configs, 0, sizeof(*ctx->_module_configs) * config->_num_config_slots);
@@ -175,6 +231,14 @@ void h2o_context_dispose(h2o_context_t *ctx)
 	}
 	free(ctx->_pathconfs_inited.entries);
 	free(ctx->_module_configs);
+	if (h2o_timeout_is_linked(&ctx->overload._probe))
+		h2o_timeout_unlink(&ctx->overload._probe);
+#if H2O_USE_LIBUV
+	if (config->overload.max_queue_delay != 0) {
+		uv_check_stop(&ctx->overload._exec_time_check);
+		uv_close((uv_handle_t *)&ctx->overload._exec_time_check, NULL);
+	}
+#endif
 	h2o_timeout_dispose(ctx->loop, &ctx->zero_timeout);
 	h2o_timeout_dispose(ctx->loop, &ctx->one_sec_timeout);
 	h2o_timeout_dispose(ctx->loop, &ctx->hundred_ms_timeout);
@@ -198,6 +262,8 @@ void h2o_context_dispose(h2o_context_t *ctx)
 
 	/* TODO assert that the all the getaddrinfo threads are idle */
 	h2o_multithread_unregister_receiver(ctx->queue, &ctx->receivers.hostinfo_getaddr);
+	h2o_multithread_unregister_receiver(ctx->queue, &ctx->receivers.fileio);
+	h2o_multithread_unregister_receiver(ctx->queue, &ctx->receivers.compress);
 	h2o_multithread_destroy_queue(ctx->queue);
 
 #if H2O_USE_LIBUV
@@ -29,19 +29,23 @@
 #include "h2o.h"
 #include "h2o/http1.h"
 #include "h2o/http1client.h"
+#include "h2o/http2client.h"
 #include "h2o/tunnel.h"
 
 struct rp_generator_t {
     h2o_generator_t super;
     h2o_req_t *src_req;
     h2o_http1client_t *client;
+    h2o_http2client_t *h2client; /* used instead of `client` when forwarding the request using HTTP/2 */
     struct {
         h2o_iovec_t bufs[2]; /* first buf is the request line and headers, the second is the POST content */
         int is_head;
+        h2o_http2client_req_t h2;
     } up_req;
     h2o_buffer_t *last_content_before_send;
     h2o_doublebuffer_t sending;
     int is_websocket_handshake;
+    int is_retried;     /* set once the request has been resent */
     int had_body_error; /* set if an error happened while fetching the body so that we can propagate the error */
 };
 
@@ -51,6 +55,14 @@ struct rp_ws_upgrade_info_t {
     h2o_socket_t *upstream_sock;
 };
 
+/* Retries are limited to 10% of the requests being forwarded using persistent connections, with bursts of up to 100 retries. The
+ * debt increases by RETRY_COST for every retry, and decreases by one for every request. */
+#define RETRY_COST 10
+#define RETRY_MAX_DEBT (100 * RETRY_COST)
+
+static h2o_http1client_head_cb on_connect(h2o_http1client_t *client, const char *errstr, h2o_iovec_t **reqbufs, size_t *reqbufcnt,
+                                          int *method_is_head);
+
 static h2o_http1client_ctx_t *get_client_ctx(h2o_req_t *req)
 {
     h2o_req_overrides_t *overrides = req->overrides;
@@ -106,61 +118,119 @@ static h2o_iovec_t build_request_merge_headers(h2o_mem_pool_t *pool, h2o_iovec_t
     return merged;
 }
 
+enum { HEADER_DROP, HEADER_COPY, HEADER_COOKIE, HEADER_VIA, HEADER_XFF };
+
+static int classify_request_header(const h2o_header_t *h, int preserve_x_forwarded_proto, int emit_x_forwarded_headers)
+{
+    if (h2o_iovec_is_token(h->name)) {
+        const h2o_token_t *token = (void *)h->name;
+        if (token->proxy_should_drop) {
+            return HEADER_DROP;
+        } else if (token == H2O_TOKEN_COOKIE) {
+            /* merge the cookie headers; see HTTP/2 8.1.2.5 and HTTP/1 (RFC6265 5.4) */
+            return HEADER_COOKIE;
+        } else if (token == H2O_TOKEN_VIA) {
+            return HEADER_VIA;
+        } else if (token == H2O_TOKEN_X_FORWARDED_FOR) {
+            return emit_x_forwarded_headers ? HEADER_XFF : HEADER_COPY;
+        }
+    }
+    if (!preserve_x_forwarded_proto && h2o_lcstris(h->name->base, h->name->len, H2O_STRLIT("x-forwarded-proto")))
+        return HEADER_DROP;
+    return HEADER_COPY;
+}
+
+/**
+ * writes the values of the headers of given kind separated by `separator` and a space, returning the end of the output
+ */
+static char *flatten_merged_headers(char *dst, h2o_req_t *req, int kind, int separator, int preserve_x_forwarded_proto,
+                                    int emit_x_forwarded_headers)
+{
+    const h2o_header_t *h, *h_end;
+    char *start = dst;
+
+    for (h = req->headers.entries, h_end = h + req->headers.size; h != h_end; ++h) {
+        if (h->value.len == 0 || classify_request_header(h, preserve_x_forwarded_proto, emit_x_forwarded_headers) != kind)
+            continue;
+        if (dst != start) {
+            *dst++ = separator;
+            *dst++ = ' ';
+        }
+        memcpy(dst, h->value.base, h->value.len);
+        dst += h->value.len;
+    }
+
+    return dst;
+}
+
 static h2o_iovec_t build_request(h2o_req_t *req, int keepalive, int is_websocket_handshake, int use_proxy_protocol)
 {
-    h2o_iovec_t buf;
-    size_t offset = 0, remote_addr_len = SIZE_MAX;
-    char remote_addr[NI_MAXHOST];
-    struct sockaddr_storage ss;
-    socklen_t sslen;
-#ifndef _MSC_VER
-    h2o_iovec_t cookie_buf = {NULL}, xff_buf = {NULL}, via_buf = {NULL};
-#else
-	h2o_iovec_t cookie_buf = { 0 }, xff_buf = { 0 }, via_buf = { 0 };
-#endif
+    h2o_iovec_t buf, connection;
+    size_t offset = 0, remote_addr_len = SIZE_MAX, content_length_len = 0, merged_len[HEADER_XFF + 1] = {0};
+    char remote_addr[NI_MAXHOST], content_length[sizeof(H2O_UINT64_LONGEST_STR)];
+    const h2o_header_t *h, *h_end;
     int preserve_x_forwarded_proto = req->conn->ctx->globalconf->proxy.preserve_x_forwarded_proto;
     int emit_x_forwarded_headers = req->conn->ctx->globalconf->proxy.emit_x_forwarded_headers;
 
     /* for x-f-f */
-    if ((sslen = req->conn->callbacks->get_peername(req->conn, (void *)&ss)) != 0)
-        remote_addr_len = h2o_socket_getnumerichost((void *)&ss, sslen, remote_addr);
+    if (emit_x_forwarded_headers)
+        remote_addr_len = h2o_conn_get_numeric_peername(req->conn, remote_addr);
 
-    /* build response */
-    buf.len = req->method.len + req->path.len + req->authority.len + 512;
+    if (is_websocket_handshake) {
+        connection = h2o_iovec_init(H2O_STRLIT("upgrade\r\nupgrade: websocket\r\nhost: "));
+    } else if (keepalive) {
+        connection = h2o_iovec_init(H2O_STRLIT("keep-alive\r\nhost: "));
+    } else {
+        connection = h2o_iovec_init(H2O_STRLIT("close\r\nhost: "));
+    }
+    if (req->entity.base != NULL)
+        content_length_len = sprintf(content_length, "%zu", req->entity.len);
+
+    /* calculate the exact size of the request, so that it can be built using a single allocation */
+    buf.len = req->method.len + 1 + req->path.len + sizeof(" HTTP/1.1\r\nconnection: ") - 1 + connection.len +
+              req->authority.len + 2;
     if (use_proxy_protocol)
         buf.len += H2O_PROXY_HEADER_MAX_LENGTH;
+    if (req->entity.base != NULL)
+        buf.len += sizeof("content-length: \r\n") - 1 + content_length_len;
+    for (h = req->headers.entries, h_end = h + req->headers.size; h != h_end; ++h) {
+        int kind = classify_request_header(h, preserve_x_forwarded_proto, emit_x_forwarded_headers);
+        switch (kind) {
+        case HEADER_DROP:
+            break;
+        case HEADER_COPY:
+            buf.len += h->name->len + h->value.len + 4;
+            break;
+        default:
+            if (h->value.len != 0)
+                merged_len[kind] += (merged_len[kind] != 0 ? 2 : 0) + h->value.len;
+            break;
+        }
+    }
+    if (merged_len[HEADER_COOKIE] != 0)
+        buf.len += sizeof("cookie: \r\n") - 1 + merged_len[HEADER_COOKIE];
+    if (emit_x_forwarded_headers) {
+        if (!preserve_x_forwarded_proto)
+            buf.len += sizeof("x-forwarded-proto: \r\n") - 1 + req->input.scheme->name.len;
+        buf.len += sizeof("x-forwarded-for: \r\n") - 1 + merged_len[HEADER_XFF];
+        if (remote_addr_len != SIZE_MAX)
+            buf.len += (merged_len[HEADER_XFF] != 0 ? 2 : 0) + remote_addr_len;
+    }
+    buf.len += sizeof("via: \r\n\r\n") - 1 + merged_len[HEADER_VIA] + (merged_len[HEADER_VIA] != 0 ? 2 : 0) +
+               (req->version < 0x200 ? sizeof("1.1 ") : sizeof("2 ")) - 1 + req->input.authority.len;
+
     buf.base = h2o_mem_alloc_pool(&req->pool, buf.len);
 
-#define RESERVE(sz)                                                                                                                \
-    do {                                                                                                                           \
-        size_t required = offset + sz + 4 /* for "\r\n\r\n" */;                                                                    \
-        if (required > buf.len) {                                                                                                  \
-            do {                                                                                                                   \
-                buf.len *= 2;                                                                                                      \
-            } while (required > buf.len);                                                                                          \
-            char *newp = h2o_mem_alloc_pool(&req->pool, buf.len);                                                                  \
-            memcpy(newp, buf.base, offset);                                                                                        \
-            buf.base = newp;                                                                                                       \
-        }                                                                                                                          \
-    } while (0)
 #define APPEND(s, l)                                                                                                               \
     do {                                                                                                                           \
         memcpy(buf.base + offset, (s), (l));                                                                                       \
         offset += (l);                                                                                                             \
     } while (0)
 #define APPEND_STRLIT(lit) APPEND((lit), sizeof(lit) - 1)
-#define FLATTEN_PREFIXED_VALUE(prefix, value, add_size)                                                                            \
-    do {                                                                                                                           \
-        RESERVE(sizeof(prefix) - 1 + value.len + 2 + add_size);                                                                    \
-        APPEND_STRLIT(prefix);                                                                                                     \
-        if (value.len != 0) {                                                                                                      \
-            APPEND(value.base, value.len);                                                                                         \
-            if (add_size != 0) {                                                                                                   \
-                buf.base[offset++] = ',';                                                                                          \
-                buf.base[offset++] = ' ';                                                                                          \
-            }                                                                                                                      \
-        }                                                                                                                          \
-    } while (0)
+#define APPEND_MERGED(kind, separator)                                                                                             \
+    (offset = flatten_merged_headers(buf.base + offset, req, (kind), (separator), preserve_x_forwarded_proto,                      \
+                                     emit_x_forwarded_headers) -                                                                   \
+              buf.base)
 
     if (use_proxy_protocol)
         offset += h2o_stringify_proxy_header(req->conn, buf.base + offset);
@@ -169,77 +239,47 @@ static h2o_iovec_t build_request(h2o_req_t *req, int keepalive, int is_websocket
     buf.base[offset++] = ' ';
     APPEND(req->path.base, req->path.len);
     APPEND_STRLIT(" HTTP/1.1\r\nconnection: ");
-    if (is_websocket_handshake) {
-        APPEND_STRLIT("upgrade\r\nupgrade: websocket\r\nhost: ");
-    } else if (keepalive) {
-        APPEND_STRLIT("keep-alive\r\nhost: ");
-    } else {
-        APPEND_STRLIT("close\r\nhost: ");
-    }
+    APPEND(connection.base, connection.len);
     APPEND(req->authority.base, req->authority.len);
-    buf.base[offset++] = '\r';
-    buf.base[offset++] = '\n';
-    assert(offset <= buf.len);
+    APPEND_STRLIT("\r\n");
     if (req->entity.base != NULL) {
-        RESERVE(sizeof("content-length: " H2O_UINT64_LONGEST_STR) - 1);
-        offset += sprintf(buf.base + offset, "content-length: %zu\r\n", req->entity.len);
+        APPEND_STRLIT("content-length: ");
+        APPEND(content_length, content_length_len);
+        APPEND_STRLIT("\r\n");
     }
-    {
-        const h2o_header_t *h, *h_end;
-        for (h = req->headers.entries, h_end = h + req->headers.size; h != h_end; ++h) {
-            if (h2o_iovec_is_token(h->name)) {
-                const h2o_token_t *token = (void *)h->name;
-                if (token->proxy_should_drop) {
-                    continue;
-                } else if (token == H2O_TOKEN_COOKIE) {
-                    /* merge the cookie headers; see HTTP/2 8.1.2.5 and HTTP/1 (RFC6265 5.4) */
-                    /* FIXME current algorithm is O(n^2) against the number of cookie headers */
-                    cookie_buf = build_request_merge_headers(&req->pool, cookie_buf, h->value, ';');
-                    continue;
-                } else if (token == H2O_TOKEN_VIA) {
-                    via_buf = build_request_merge_headers(&req->pool, via_buf, h->value, ',');
-                    continue;
-                } else if (token == H2O_TOKEN_X_FORWARDED_FOR) {
-                    if (!emit_x_forwarded_headers) {
-                        goto AddHeader;
-                    }
-                    xff_buf = build_request_merge_headers(&req->pool, xff_buf, h->value, ',');
-                    continue;
-                }
-            }
-            if (!preserve_x_forwarded_proto && h2o_lcstris(h->name->base, h->name->len, H2O_STRLIT("x-forwarded-proto")))
-                continue;
-        AddHeader:
-            RESERVE(h->name->len + h->value.len + 2);
-            APPEND(h->name->base, h->name->len);
-            buf.base[offset++] = ':';
-            buf.base[offset++] = ' ';
-            APPEND(h->value.base, h->value.len);
-            buf.base[offset++] = '\r';
-            buf.base[offset++] = '\n';
-        }
+    for (h = req->headers.entries, h_end = h + req->headers.size; h != h_end; ++h) {
+        if (classify_request_header(h, preserve_x_forwarded_proto, emit_x_forwarded_headers) != HEADER_COPY)
+            continue;
+        APPEND(h->name->base, h->name->len);
+        APPEND_STRLIT(": ");
+        APPEND(h->value.base, h->value.len);
+        APPEND_STRLIT("\r\n");
     }
-    if (cookie_buf.len != 0) {
-        FLATTEN_PREFIXED_VALUE("cookie: ", cookie_buf, 0);
-        buf.base[offset++] = '\r';
-        buf.base[offset++] = '\n';
+    if (merged_len[HEADER_COOKIE] != 0) {
+        APPEND_STRLIT("cookie: ");
+        APPEND_MERGED(HEADER_COOKIE, ';');
+        APPEND_STRLIT("\r\n");
     }
     if (emit_x_forwarded_headers) {
         if (!preserve_x_forwarded_proto) {
-            FLATTEN_PREFIXED_VALUE("x-forwarded-proto: ", req->input.scheme->name, 0);
-            buf.base[offset++] = '\r';
-            buf.base[offset++] = '\n';
+            APPEND_STRLIT("x-forwarded-proto: ");
+            APPEND(req->input.scheme->name.base, req->input.scheme->name.len);
+            APPEND_STRLIT("\r\n");
         }
+        APPEND_STRLIT("x-forwarded-for: ");
+        APPEND_MERGED(HEADER_XFF, ',');
         if (remote_addr_len != SIZE_MAX) {
-            FLATTEN_PREFIXED_VALUE("x-forwarded-for: ", xff_buf, remote_addr_len);
+            if (merged_len[HEADER_XFF] != 0)
+                APPEND_STRLIT(", ");
             APPEND(remote_addr, remote_addr_len);
-        } else {
-            FLATTEN_PREFIXED_VALUE("x-forwarded-for: ", xff_buf, 0);
         }
-        buf.base[offset++] = '\r';
-        buf.base[offset++] = '\n';
+        APPEND_STRLIT("\r\n");
+    }
+    APPEND_STRLIT("via: ");
+    if (merged_len[HEADER_VIA] != 0) {
+        APPEND_MERGED(HEADER_VIA, ',');
+        APPEND_STRLIT(", ");
     }
-    FLATTEN_PREFIXED_VALUE("via: ", via_buf, sizeof("1.1 ") - 1 + req->input.authority.len);
     if (req->version < 0x200) {
         buf.base[offset++] = '1';
         buf.base[offset++] = '.';
@@ -251,18 +291,95 @@ static h2o_iovec_t build_request(h2o_req_t *req, int keepalive, int is_websocket
     APPEND(req->input.authority.base, req->input.authority.len);
     APPEND_STRLIT("\r\n\r\n");
 
-#undef RESERVE
 #undef APPEND
 #undef APPEND_STRLIT
-#undef FLATTEN_PREFIXED_VALUE
+#undef APPEND_MERGED
 
     /* set the length */
-    assert(offset <= buf.len);
+    assert(use_proxy_protocol ? offset <= buf.len : offset == buf.len);
     buf.len = offset;
 
     return buf;
 }
 
+static void build_http2_request(h2o_req_t *req, h2o_http2client_req_t *h2req)
+{
+    h2o_headers_t headers = {NULL};
+    size_t remote_addr_len = SIZE_MAX;
+    char remote_addr[NI_MAXHOST];
+#ifndef _MSC_VER
+    h2o_iovec_t xff_buf = {NULL}, via_buf = {NULL};
+#else
+	h2o_iovec_t xff_buf = { 0 }, via_buf = { 0 };
+#endif
+    int preserve_x_forwarded_proto = req->conn->ctx->globalconf->proxy.preserve_x_forwarded_proto;
+    int emit_x_forwarded_headers = req->conn->ctx->globalconf->proxy.emit_x_forwarded_headers;
+    const h2o_header_t *h, *h_end;
+
+    /* for x-f-f */
+    if (emit_x_forwarded_headers)
+        remote_addr_len = h2o_conn_get_numeric_peername(req->conn, remote_addr);
+
+    h2o_vector_reserve(&req->pool, &headers, req->headers.size + 4);
+    if (req->entity.base != NULL) {
+        char *buf = h2o_mem_alloc_pool(&req->pool, sizeof(H2O_UINT64_LONGEST_STR));
+        size_t len = sprintf(buf, "%zu", req->entity.len);
+        h2o_add_header(&req->pool, &headers, H2O_TOKEN_CONTENT_LENGTH, buf, len);
+    }
+    for (h = req->headers.entries, h_end = h + req->headers.size; h != h_end; ++h) {
+        if (h2o_iovec_is_token(h->name)) {
+            const h2o_token_t *token = (void *)h->name;
+            /* the connection-specific headers are never sent using HTTP/2 */
+            if (token->proxy_should_drop || token->http2_should_reject) {
+                continue;
+            } else if (token == H2O_TOKEN_VIA) {
+                via_buf = build_request_merge_headers(&req->pool, via_buf, h->value, ',');
+                continue;
+            } else if (token == H2O_TOKEN_X_FORWARDED_FOR && emit_x_forwarded_headers) {
+                xff_buf = build_request_merge_headers(&req->pool, xff_buf, h->value, ',');
+                continue;
+            }
+        }
+        if (!preserve_x_forwarded_proto && h2o_lcstris(h->name->base, h->name->len, H2O_STRLIT("x-forwarded-proto")))
+            continue;
+        h2o_vector_reserve(&req->pool, &headers, headers.size + 1);
+        headers.entries[headers.size++] = *h;
+    }
+    if (emit_x_forwarded_headers) {
+        if (!preserve_x_forwarded_proto)
+            h2o_add_header_by_str(&req->pool, &headers, H2O_STRLIT("x-forwarded-proto"), 0, req->input.scheme->name.base,
+                                  req->input.scheme->name.len);
+        if (remote_addr_len != SIZE_MAX)
+            xff_buf = build_request_merge_headers(&req->pool, xff_buf, h2o_strdup(&req->pool, remote_addr, remote_addr_len), ',');
+        if (xff_buf.len != 0)
+            h2o_add_header(&req->pool, &headers, H2O_TOKEN_X_FORWARDED_FOR, xff_buf.base, xff_buf.len);
+    }
+    {
+        char *buf = h2o_mem_alloc_pool(&req->pool, sizeof("1.1 ") - 1 + req->input.authority.len);
+        size_t len = 0;
+        if (req->version < 0x200) {
+            buf[len++] = '1';
+            buf[len++] = '.';
+            buf[len++] = '0' + (0x100 <= req->version && req->version <= 0x109 ? req->version - 0x100 : 0);
+        } else {
+            buf[len++] = '2';
+        }
+        buf[len++] = ' ';
+        memcpy(buf + len, req->input.authority.base, req->input.authority.len);
+        len += req->input.authority.len;
+        via_buf = build_request_merge_headers(&req->pool, via_buf, h2o_iovec_init(buf, len), ',');
+        h2o_add_header(&req->pool, &headers, H2O_TOKEN_VIA, via_buf.base, via_buf.len);
+    }
+
+    h2req->method = req->method;
+    h2req->scheme = req->scheme;
+    h2req->authority = req->authority;
+    h2req->path = req->path;
+    h2req->headers = headers.entries;
+    h2req->num_headers = headers.size;
+    h2req->body = req->entity;
+}
+
 static void do_close(h2o_generator_t *generator, h2o_req_t *req)
 {
     struct rp_generator_t *self = (void *)generator;
@@ -271,6 +388,10 @@ static void do_close(h2o_generator_t *generator, h2o_req_t *req)
         h2o_http1client_cancel(self->client);
         self->client = NULL;
     }
+    if (self->h2client != NULL) {
+        h2o_http2client_cancel(self->h2client);
+        self->h2client = NULL;
+    }
 }
 
 static void do_send(struct rp_generator_t *self)
@@ -282,10 +403,13 @@ static void do_send(struct rp_generator_t *self)
     assert(self->sending.bytes_inflight == 0);
 
     vecs[0] = h2o_doublebuffer_prepare(&self->sending,
-                                       self->client != NULL ? &self->client->sock->input : &self->last_content_before_send,
+                                       self->client != NULL ? &self->client->sock->input
+                                                            : self->h2client != NULL ? &self->h2client->buf
+                                                                                     : &self->last_content_before_send,
                                        self->src_req->preferred_chunk_size);
 
-    if (self->client == NULL && vecs[0].len == self->sending.buf->size && self->last_content_before_send->size == 0) {
+    if (self->client == NULL && self->h2client == NULL && vecs[0].len == self->sending.buf->size &&
+        self->last_content_before_send->size == 0) {
         veccnt = vecs[0].len != 0 ? 1 : 0;
         ststate = H2O_SEND_STATE_FINAL;
     } else {
@@ -352,6 +476,77 @@ static int on_body(h2o_http1client_t *client, const char *errstr)
     return 0;
 }
 
+/**
+ * transfers a response header downstream, returns non-zero if the request has been redirected internally
+ */
+static int add_response_header(h2o_req_t *req, int status, const h2o_token_t *token, h2o_iovec_t name, h2o_iovec_t value,
+                               int needs_dup)
+{
+    if (token == NULL) {
+        if (needs_dup) {
+            name = h2o_strdup(&req->pool, name.base, name.len);
+            value = h2o_strdup(&req->pool, value.base, value.len);
+        }
+        h2o_add_header_by_str(&req->pool, &req->res.headers, name.base, name.len, 0, value.base, value.len);
+        return 0;
+    }
+
+    if (token->proxy_should_drop)
+        return 0;
+    if (token == H2O_TOKEN_LOCATION) {
+        if (req->res_is_delegated && (300 <= status && status <= 399) && status != 304) {
+            h2o_iovec_t method = h2o_get_redirect_method(req->method, status);
+            h2o_send_redirect_internal(req, method, value.base, value.len, 1);
+            return 1;
+        }
+        if (req->overrides != NULL && req->overrides->location_rewrite.match != NULL) {
+            h2o_iovec_t rewritten =
+                rewrite_location(&req->pool, value.base, value.len, req->overrides->location_rewrite.match, req->input.scheme,
+                                 req->input.authority, req->overrides->location_rewrite.path_prefix);
+            if (rewritten.base != NULL) {
+                value = rewritten;
+                needs_dup = 0;
+            }
+        }
+    } else if (token == H2O_TOKEN_LINK) {
+        h2o_push_path_in_link_header(req, value.base, value.len);
+    }
+    /* default behaviour, transfer the header downstream */
+    if (needs_dup)
+        value = h2o_strdup(&req->pool, value.base, value.len);
+    h2o_add_header(&req->pool, &req->res.headers, token, value.base, value.len);
+    return 0;
+}
+
+static int is_idempotent(h2o_iovec_t method)
+{
+    /* RFC 7231 4.2.2 */
+    return h2o_memis(method.base, method.len, H2O_STRLIT("GET")) || h2o_memis(method.base, method.len, H2O_STRLIT("HEAD")) ||
+           h2o_memis(method.base, method.len, H2O_STRLIT("OPTIONS")) || h2o_memis(method.base, method.len, H2O_STRLIT("TRACE")) ||
+           h2o_memis(method.base, method.len, H2O_STRLIT("PUT")) || h2o_memis(method.base, method.len, H2O_STRLIT("DELETE"));
+}
+
+static int retry_request(struct rp_generator_t *self, h2o_http1client_t *client)
+{
+    h2o_req_t *req = self->src_req;
+    h2o_context_t *ctx = req->conn->ctx;
+
+    if (!(client->closed_before_response && client->sockpool.pool != NULL && req->overrides != NULL &&
+          req->overrides->retry_idempotent && !self->is_retried && !self->is_websocket_handshake && is_idempotent(req->method)))
+        return 0;
+    if (ctx->proxy._retry_debt + RETRY_COST > RETRY_MAX_DEBT) {
+        ++ctx->proxy.events.retries_suppressed;
+        return 0;
+    }
+    ctx->proxy._retry_debt += RETRY_COST;
+    ++ctx->proxy.events.retries;
+    self->is_retried = 1;
+
+    /* the pooled connection might have been closed by the upstream after being idle; resend using a new connection */
+    h2o_http1client_connect_new_with_pool(&self->client, self, get_client_ctx(req), client->sockpool.pool, on_connect);
+    return 1;
+}
+
 static h2o_http1client_body_cb on_head(h2o_http1client_t *client, const char *errstr, int minor_version, int status,
                                        h2o_iovec_t msg, h2o_http1client_header_t *headers, size_t num_headers)
 {
@@ -361,6 +556,8 @@ static h2o_http1client_body_cb on_head(h2o_http1client_t *client, const char *er
 
     if (errstr != NULL && errstr != h2o_http1client_error_is_eos) {
         self->client = NULL;
+        if (retry_request(self, client))
+            return NULL;
         h2o_req_log_error(req, "lib/core/proxy.c", "%s", errstr);
         h2o_send_error_502(req, "Gateway Error", errstr, 0);
         return NULL;
@@ -371,48 +568,20 @@ static h2o_http1client_body_cb on_head(h2o_http1client_t *client, const char *er
     req->res.reason = h2o_strdup(&req->pool, msg.base, msg.len).base;
     for (i = 0; i != num_headers; ++i) {
         const h2o_token_t *token = h2o_lookup_token(headers[i].name, headers[i].name_len);
-        h2o_iovec_t value;
-        if (token != NULL) {
-            if (token->proxy_should_drop) {
-                goto Skip;
-            }
-            if (token == H2O_TOKEN_CONTENT_LENGTH) {
-                if (req->res.content_length != SIZE_MAX ||
-                    (req->res.content_length = h2o_strtosize(headers[i].value, headers[i].value_len)) == SIZE_MAX) {
-                    self->client = NULL;
-                    h2o_req_log_error(req, "lib/core/proxy.c", "%s", "invalid response from upstream (malformed content-length)");
-                    h2o_send_error_502(req, "Gateway Error", "invalid response from upstream", 0);
-                    return NULL;
-                }
-                goto Skip;
-            } else if (token == H2O_TOKEN_LOCATION) {
-                if (req->res_is_delegated && (300 <= status && status <= 399) && status != 304) {
-                    self->client = NULL;
-                    h2o_iovec_t method = h2o_get_redirect_method(req->method, status);
-                    h2o_send_redirect_internal(req, method, headers[i].value, headers[i].value_len, 1);
-                    return NULL;
-                }
-                if (req->overrides != NULL && req->overrides->location_rewrite.match != NULL) {
-                    value =
-                        rewrite_location(&req->pool, headers[i].value, headers[i].value_len, req->overrides->location_rewrite.match,
-                                         req->input.scheme, req->input.authority, req->overrides->location_rewrite.path_prefix);
-                    if (value.base != NULL)
-                        goto AddHeader;
-                }
-                goto AddHeaderDuped;
-            } else if (token == H2O_TOKEN_LINK) {
-                h2o_push_path_in_link_header(req, headers[i].value, headers[i].value_len);
+        if (token == H2O_TOKEN_CONTENT_LENGTH) {
+            if (req->res.content_length != SIZE_MAX ||
+                (req->res.content_length = h2o_strtosize(headers[i].value, headers[i].value_len)) == SIZE_MAX) {
+                self->client = NULL;
+                h2o_req_log_error(req, "lib/core/proxy.c", "%s", "invalid response from upstream (malformed content-length)");
+                h2o_send_error_502(req, "Gateway Error", "invalid response from upstream", 0);
+                return NULL;
             }
-        /* default behaviour, transfer the header downstream */
-        AddHeaderDuped:
-            value = h2o_strdup(&req->pool, headers[i].value, headers[i].value_len);
-        AddHeader:
-            h2o_add_header(&req->pool, &req->res.headers, token, value.base, value.len);
-        Skip:;
-        } else {
-            h2o_iovec_t name = h2o_strdup(&req->pool, headers[i].name, headers[i].name_len);
-            h2o_iovec_t value = h2o_strdup(&req->pool, headers[i].value, headers[i].value_len);
-            h2o_add_header_by_str(&req->pool, &req->res.headers, name.base, name.len, 0, value.base, value.len);
+            continue;
+        }
+        if (add_response_header(req, status, token, h2o_iovec_init(headers[i].name, headers[i].name_len),
+                                h2o_iovec_init(headers[i].value, headers[i].value_len), 1) != 0) {
+            self->client = NULL;
+            return NULL;
         }
     }
 
@@ -458,7 +627,11 @@ static h2o_http1client_head_cb on_connect(h2o_http1client_t *client, const char
     if (errstr != NULL) {
         self->client = NULL;
         h2o_req_log_error(self->src_req, "lib/core/proxy.c", "%s", errstr);
-        h2o_send_error_502(self->src_req, "Gateway Error", errstr, 0);
+        if (errstr == h2o_socketpool_error_unhealthy) {
+            h2o_send_error_503(self->src_req, "Service Unavailable", errstr, 0);
+        } else {
+            h2o_send_error_502(self->src_req, "Gateway Error", errstr, 0);
+        }
         return NULL;
     }
 
@@ -469,6 +642,67 @@ static h2o_http1client_head_cb on_connect(h2o_http1client_t *client, const char
     return on_head;
 }
 
+static int on_http2_body(h2o_http2client_t *client, const char *errstr)
+{
+    struct rp_generator_t *self = client->data;
+
+    if (errstr != NULL) {
+        /* detach the content */
+        self->last_content_before_send = client->buf;
+        h2o_buffer_init(&client->buf, &h2o_socket_buffer_prototype);
+        self->h2client = NULL;
+        if (errstr != h2o_http2client_error_is_eos) {
+            h2o_req_log_error(self->src_req, "lib/core/proxy.c", "%s", errstr);
+            self->had_body_error = 1;
+        }
+    }
+    if (self->sending.bytes_inflight == 0)
+        do_send(self);
+
+    return 0;
+}
+
+static h2o_http2client_body_cb on_http2_head(h2o_http2client_t *client, const char *errstr, int status, h2o_header_t *headers,
+                                             size_t num_headers, size_t content_length)
+{
+    struct rp_generator_t *self = client->data;
+    h2o_req_t *req = self->src_req;
+    size_t i;
+
+    if (errstr != NULL && errstr != h2o_http2client_error_is_eos) {
+        self->h2client = NULL;
+        h2o_req_log_error(req, "lib/core/proxy.c", "%s", errstr);
+        if (errstr == h2o_socketpool_error_unhealthy) {
+            h2o_send_error_503(req, "Service Unavailable", errstr, 0);
+        } else {
+            h2o_send_error_502(req, "Gateway Error", errstr, 0);
+        }
+        return NULL;
+    }
+
+    /* the headers are allocated from the pool of the request, and therefore are not copied */
+    req->res.status = status;
+    req->res.content_length = content_length;
+    for (i = 0; i != num_headers; ++i) {
+        const h2o_token_t *token = h2o_iovec_is_token(headers[i].name) ? (void *)headers[i].name : NULL;
+        if (add_response_header(req, status, token, *headers[i].name, headers[i].value, 0) != 0) {
+            self->h2client = NULL;
+            return NULL;
+        }
+    }
+
+    /* declare the start of the response */
+    h2o_start_response(req, &self->super);
+
+    if (errstr == h2o_http2client_error_is_eos) {
+        self->h2client = NULL;
+        h2o_send(req, NULL, 0, H2O_SEND_STATE_FINAL);
+        return NULL;
+    }
+
+    return on_http2_body;
+}
+
 static void on_generator_dispose(void *_self)
 {
     struct rp_generator_t *self = _self;
@@ -477,26 +711,38 @@ static void on_generator_dispose(void *_self)
         h2o_http1client_cancel(self->client);
         self->client = NULL;
     }
+    if (self->h2client != NULL) {
+        h2o_http2client_cancel(self->h2client);
+        self->h2client = NULL;
+    }
     h2o_buffer_dispose(&self->last_content_before_send);
     h2o_doublebuffer_dispose(&self->sending);
 }
 
-static struct rp_generator_t *proxy_send_prepare(h2o_req_t *req, int keepalive, int use_proxy_protocol)
+static int is_websocket_handshake(h2o_req_t *req)
+{
+    return get_client_ctx(req)->websocket_timeout != NULL &&
+           h2o_lcstris(req->upgrade.base, req->upgrade.len, H2O_STRLIT("websocket"));
+}
+
+static struct rp_generator_t *proxy_send_prepare(h2o_req_t *req, int keepalive, int use_proxy_protocol, int use_http2)
 {
     struct rp_generator_t *self = h2o_mem_alloc_shared(&req->pool, sizeof(*self), on_generator_dispose);
-    h2o_http1client_ctx_t *client_ctx = get_client_ctx(req);
 
     self->super.proceed = do_proceed;
     self->super.stop = do_close;
     self->src_req = req;
-    if (client_ctx->websocket_timeout != NULL && h2o_lcstris(req->upgrade.base, req->upgrade.len, H2O_STRLIT("websocket"))) {
-        self->is_websocket_handshake = 1;
+    self->client = NULL;
+    self->h2client = NULL;
+    self->is_websocket_handshake = is_websocket_handshake(req);
+    self->is_retried = 0;
+    self->had_body_error = 0;
+    if (use_http2) {
+        build_http2_request(req, &self->up_req.h2);
     } else {
-        self->is_websocket_handshake = 0;
+        self->up_req.bufs[0] = build_request(req, keepalive, self->is_websocket_handshake, use_proxy_protocol);
+        self->up_req.bufs[1] = req->entity;
     }
-    self->had_body_error = 0;
-    self->up_req.bufs[0] = build_request(req, keepalive, self->is_websocket_handshake, use_proxy_protocol);
-    self->up_req.bufs[1] = req->entity;
     self->up_req.is_head = h2o_memis(req->method.base, req->method.len, H2O_STRLIT("HEAD"));
     h2o_buffer_init(&self->last_content_before_send, &h2o_socket_buffer_prototype);
     h2o_doublebuffer_init(&self->sending, &h2o_socket_buffer_prototype);
@@ -511,14 +757,22 @@ void h2o__proxy_process_request(h2o_req_t *req)
     struct rp_generator_t *self;
 
     if (overrides != NULL) {
-        if (overrides->socketpool != NULL) {
+        if (overrides->http2client_pool != NULL && !is_websocket_handshake(req)) {
+            /* websocket handshakes are sent using HTTP/1.1, since the upgrade mechanism does not exist in HTTP/2 */
+            self = proxy_send_prepare(req, 1, 0, 1);
+            h2o_http2client_request(&self->h2client, self, overrides->http2client_pool, &self->up_req.h2, &req->pool,
+                                    on_http2_head);
+            return;
+        } else if (overrides->socketpool != NULL) {
             if (overrides->use_proxy_protocol)
                 assert(!"proxy protocol cannot be used for a persistent upstream connection");
-            self = proxy_send_prepare(req, 1, 0);
+            self = proxy_send_prepare(req, 1, 0, 0);
+            if (req->conn->ctx->proxy._retry_debt != 0)
+                --req->conn->ctx->proxy._retry_debt;
             h2o_http1client_connect_with_pool(&self->client, self, client_ctx, overrides->socketpool, on_connect);
             return;
         } else if (overrides->hostport.host.base != NULL) {
-            self = proxy_send_prepare(req, 0, overrides->use_proxy_protocol);
+            self = proxy_send_prepare(req, 0, overrides->use_proxy_protocol, 0);
             h2o_http1client_connect(&self->client, self, client_ctx, req->overrides->hostport.host, req->overrides->hostport.port,
                                     0, on_connect);
             return;
@@ -536,7 +790,7 @@ void h2o__proxy_process_request(h2o_req_t *req)
         }
         if (port == 65535)
             port = req->scheme->default_port;
-        self = proxy_send_prepare(req, 0, overrides != NULL && overrides->use_proxy_protocol);
+        self = proxy_send_prepare(req, 0, overrides != NULL && overrides->use_proxy_protocol, 0);
         h2o_http1client_connect(&self->client, self, client_ctx, host, port, req->scheme == &H2O_URL_SCHEME_HTTPS, on_connect);
         return;
     }
@@ -370,6 +370,31 @@ Unknown:
     return 15;
 }
 
+size_t h2o_conn_get_numeric_peername(h2o_conn_t *conn, char *buf)
+{
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    size_t len;
+
+    if (conn->_numeric_peername.len != 0) {
+        if (conn->_numeric_peername.len != SIZE_MAX)
+            memcpy(buf, conn->_numeric_peername.buf, conn->_numeric_peername.len);
+        return conn->_numeric_peername.len;
+    }
+
+    if ((sslen = conn->callbacks->get_peername(conn, (void *)&ss)) == 0 ||
+        (len = h2o_socket_getnumerichost((void *)&ss, sslen, buf)) == SIZE_MAX) {
+        conn->_numeric_peername.len = SIZE_MAX;
+        return SIZE_MAX;
+    }
+    /* IPv6 addresses with a scope id might not fit in the cache; they are stringified every time */
+    if (len <= sizeof(conn->_numeric_peername.buf)) {
+        memcpy(conn->_numeric_peername.buf, buf, len);
+        conn->_numeric_peername.len = len;
+    }
+    return len;
+}
+
 static void push_one_path(h2o_mem_pool_t *pool, h2o_iovec_vector_t *paths_to_push, h2o_iovec_t *url, h2o_iovec_t base_path,
                           const h2o_url_scheme_t *input_scheme, h2o_iovec_t input_authority, const h2o_url_scheme_t *base_scheme,
                           h2o_iovec_t *base_authority)
@@ -459,6 +484,8 @@ int h2o_get_compressible_types(const h2o_headers_t *headers)
                     compressible_types |= H2O_COMPRESSIBLE_GZIP;
                 else if (h2o_lcstris(token, token_len, H2O_STRLIT("br")))
                     compressible_types |= H2O_COMPRESSIBLE_BROTLI;
+                else if (h2o_lcstris(token, token_len, H2O_STRLIT("zstd")))
+                    compressible_types |= H2O_COMPRESSIBLE_ZSTD;
             }
         }
     }
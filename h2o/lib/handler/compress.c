@@ -20,39 +20,478 @@
  * IN THE SOFTWARE.
  */
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
+#include <openssl/sha.h>
 #include "h2o.h"
 
 #ifndef BUF_SIZE
 #define BUF_SIZE 8192
 #endif
+#define ADAPTIVE_FULL_LOAD_LOOP_LAG 50   /* delay of the event loop (in milliseconds) at which the minimum quality is used */
+#define ADAPTIVE_LARGE_SIZE (256 * 1024) /* the quality is lowered by one for every 4x of size above this */
+
+typedef H2O_VECTOR(char) char_vector_t;
 
 struct st_compress_filter_t {
     h2o_filter_t super;
     h2o_compress_args_t args;
 };
 
+/**
+ * a chunk being compressed by the thread pool; only one exists per response, since the generator does not send the next chunk
+ * until the compressed output is sent to the next ostream
+ */
+struct st_compress_offload_t {
+    h2o_req_t *req; /* set to NULL if the request is disposed while the chunk is being compressed */
+    struct st_compress_encoder_t *encoder;
+    h2o_compress_context_t *compressor; /* refcount is incremented while the chunk is being compressed */
+    int is_inflight;
+    h2o_iovec_t input; /* copy of the input, since the buffers supplied by the generator are freed once the request is disposed */
+    size_t inbufcnt;
+    h2o_send_state_t state;
+    h2o_iovec_t *outbufs;
+    size_t outbufcnt;
+    h2o_multithread_receiver_t *receiver;
+    h2o_linklist_t pending;
+    h2o_multithread_message_t message;
+};
+
+/**
+ * state of a response being sent from or stored to the cache of compressed responses (see h2o_globalconf_t::compress)
+ */
+struct st_compress_cache_state_t {
+    h2o_cache_t *cache;
+    /**
+     * key of the response; for the responses without strong etags, NULL until the entire body is received and hashed
+     */
+    h2o_iovec_t key;
+    /**
+     * the cached response being sent (or NULL)
+     */
+    h2o_cache_ref_t *hit;
+    int hit_is_sent;
+    /**
+     * set if the input is buffered so that the response can be looked up by the hash of the body
+     */
+    int buffer_input;
+    char_vector_t input;
+    /**
+     * copy of the compressed output to be stored; discarded once it exceeds the maximum size of the objects
+     */
+    char_vector_t output;
+    int output_overflowed;
+};
+
 struct st_compress_encoder_t {
     h2o_ostream_t super;
-    h2o_compress_context_t *compressor;
+    int encoding; /* one of H2O_COMPRESSIBLE_* */
+    int quality;
+    size_t content_length; /* of the original response */
+    int offload_enabled;
+    h2o_compress_context_t *compressor; /* instantiated when the first chunk is compressed */
+    struct st_compress_offload_t *offload;
+    struct st_compress_cache_state_t *cache; /* NULL if the compressed response is not cached */
 };
 
-static void do_send(h2o_ostream_t *_self, h2o_req_t *req, h2o_iovec_t *inbufs, size_t inbufcnt, h2o_send_state_t state)
+#ifndef _MSC_VER
+#else
+#define H2O_USE_BROTLI 0
+#endif
+
+size_t h2o_compress_max_threads = 1;
+
+#ifndef _MSC_VER
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    h2o_linklist_t pending; /* anchor of st_compress_offload_t::pending */
+    size_t num_threads;
+    size_t num_threads_idle;
+} offload_queue = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {&offload_queue.pending, &offload_queue.pending}};
+
+static void *offload_thread_main(void *_unused)
+{
+    pthread_mutex_lock(&offload_queue.mutex);
+
+    while (1) {
+        --offload_queue.num_threads_idle;
+        while (!h2o_linklist_is_empty(&offload_queue.pending)) {
+            struct st_compress_offload_t *offload =
+                H2O_STRUCT_FROM_MEMBER(struct st_compress_offload_t, pending, offload_queue.pending.next);
+            h2o_linklist_unlink(&offload->pending);
+            pthread_mutex_unlock(&offload_queue.mutex);
+            offload->compressor->compress(offload->compressor, &offload->input, offload->inbufcnt, offload->state,
+                                          &offload->outbufs, &offload->outbufcnt);
+            pthread_mutex_lock(&offload_queue.mutex);
+            h2o_multithread_send_message(offload->receiver, &offload->message);
+        }
+        ++offload_queue.num_threads_idle;
+        pthread_cond_wait(&offload_queue.cond, &offload_queue.mutex);
+    }
+
+    h2o_fatal("unreachable");
+    return NULL;
+}
+
+static int submit_offload(struct st_compress_offload_t *offload)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&offload_queue.mutex);
+
+    if (offload_queue.num_threads_idle == 0 && offload_queue.num_threads < h2o_compress_max_threads) {
+        pthread_t tid;
+        pthread_attr_t attr;
+        int err;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, 1);
+        if ((err = pthread_create(&tid, &attr, offload_thread_main, NULL)) != 0) {
+            fprintf(stderr, "[lib/handler/compress.c] failed to start thread for compression:%s\n", strerror(err));
+        } else {
+            ++offload_queue.num_threads;
+            ++offload_queue.num_threads_idle;
+        }
+    }
+    if (offload_queue.num_threads == 0) {
+        /* compress on the event loop */
+        ret = -1;
+        goto Exit;
+    }
+    h2o_linklist_insert(&offload_queue.pending, &offload->pending);
+    pthread_cond_signal(&offload_queue.cond);
+
+Exit:
+    pthread_mutex_unlock(&offload_queue.mutex);
+    return ret;
+}
+
+#else
+
+static int submit_offload(struct st_compress_offload_t *offload)
+{
+    return -1;
+}
+
+#endif
+
+static void on_offload_dispose(void *_offload)
+{
+    struct st_compress_offload_t **offload = _offload;
+
+    if ((*offload)->is_inflight) {
+        /* orphan the chunk, it is freed by the receiver */
+        (*offload)->req = NULL;
+    } else {
+        free(*offload);
+    }
+}
+
+static void append_to_vector(char_vector_t *vec, const char *src, size_t len)
+{
+    h2o_vector_reserve(NULL, vec, vec->size + len);
+    memcpy(vec->entries + vec->size, src, len);
+    vec->size += len;
+}
+
+static void send_compressed(struct st_compress_encoder_t *self, h2o_req_t *req, h2o_iovec_t *outbufs, size_t outbufcnt,
+                            h2o_send_state_t state)
+{
+    struct st_compress_cache_state_t *cache = self->cache;
+
+    /* retain a copy of the output, and store it once complete */
+    if (cache != NULL && cache->key.base != NULL && !cache->output_overflowed) {
+        size_t i;
+        for (i = 0; i != outbufcnt; ++i) {
+            if (cache->output.size + outbufs[i].len > req->conn->ctx->globalconf->compress.cache.max_object_size) {
+                free(cache->output.entries);
+                cache->output = (char_vector_t){NULL};
+                cache->output_overflowed = 1;
+                break;
+            }
+            append_to_vector(&cache->output, outbufs[i].base, outbufs[i].len);
+        }
+        if (!cache->output_overflowed && state == H2O_SEND_STATE_FINAL) {
+            h2o_cache_set(cache->cache, h2o_now(req->conn->ctx->loop), cache->key, 0,
+                          h2o_iovec_init(cache->output.entries, cache->output.size));
+            cache->output = (char_vector_t){NULL};
+            ++req->conn->ctx->compress.cache.stores;
+        }
+    }
+
+    h2o_ostream_send_next(&self->super, req, outbufs, outbufcnt, state);
+}
+
+void h2o_compress_receiver(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages)
+{
+    while (!h2o_linklist_is_empty(messages)) {
+        struct st_compress_offload_t *offload = H2O_STRUCT_FROM_MEMBER(struct st_compress_offload_t, message.link, messages->next);
+        h2o_linklist_unlink(&offload->message.link);
+        free(offload->input.base);
+        offload->input = h2o_iovec_init(NULL, 0);
+        offload->is_inflight = 0;
+        h2o_mem_release_shared(offload->compressor);
+        if (offload->req != NULL) {
+            send_compressed(offload->encoder, offload->req, offload->outbufs, offload->outbufcnt, offload->state);
+        } else {
+            free(offload);
+        }
+    }
+}
+
+static int do_send_offload(struct st_compress_encoder_t *self, h2o_req_t *req, h2o_iovec_t *inbufs, size_t inbufcnt,
+                           h2o_send_state_t state)
+{
+    struct st_compress_offload_t *offload = self->offload;
+    size_t i, off;
+
+    if (offload == NULL) {
+        struct st_compress_offload_t **guard = h2o_mem_alloc_shared(&req->pool, sizeof(*guard), on_offload_dispose);
+        *guard = offload = h2o_mem_alloc(sizeof(*offload));
+        *offload = (struct st_compress_offload_t){req, self, self->compressor};
+        offload->receiver = &req->conn->ctx->receivers.compress;
+        self->offload = offload;
+    }
+
+    offload->inbufcnt = inbufcnt != 0;
+    offload->input.len = 0;
+    for (i = 0; i != inbufcnt; ++i)
+        offload->input.len += inbufs[i].len;
+    offload->input.base = h2o_mem_alloc(offload->input.len + 1);
+    for (i = 0, off = 0; i != inbufcnt; ++i) {
+        memcpy(offload->input.base + off, inbufs[i].base, inbufs[i].len);
+        off += inbufs[i].len;
+    }
+    offload->state = state;
+    offload->is_inflight = 1;
+    h2o_mem_addref_shared(offload->compressor);
+
+    if (submit_offload(offload) != 0) {
+        free(offload->input.base);
+        offload->input = h2o_iovec_init(NULL, 0);
+        offload->is_inflight = 0;
+        h2o_mem_release_shared(offload->compressor);
+        return -1;
+    }
+    ++req->conn->ctx->compress.offloads;
+    return 0;
+}
+
+static void compress_and_send(struct st_compress_encoder_t *self, h2o_req_t *req, h2o_iovec_t *inbufs, size_t inbufcnt,
+                              h2o_send_state_t state)
 {
-    struct st_compress_encoder_t *self = (void *)_self;
     h2o_iovec_t *outbufs;
     size_t outbufcnt;
 
+    if (self->compressor == NULL) {
+        switch (self->encoding) {
+#if H2O_USE_BROTLI
+        case H2O_COMPRESSIBLE_BROTLI:
+            self->compressor = h2o_compress_brotli_open(&req->pool, self->quality, self->content_length);
+            break;
+#endif
+#if H2O_USE_ZSTD
+        case H2O_COMPRESSIBLE_ZSTD:
+            self->compressor = h2o_compress_zstd_open(&req->pool, self->quality);
+            break;
+#endif
+        default:
+            self->compressor = h2o_compress_gzip_open(&req->pool, self->quality);
+            break;
+        }
+    }
+
+    if (self->offload_enabled && do_send_offload(self, req, inbufs, inbufcnt, state) == 0)
+        return;
+
     self->compressor->compress(self->compressor, inbufs, inbufcnt, state, &outbufs, &outbufcnt);
-    h2o_ostream_send_next(&self->super, req, outbufs, outbufcnt, state);
+    send_compressed(self, req, outbufs, outbufcnt, state);
+}
+
+static void send_cached(struct st_compress_encoder_t *self, h2o_req_t *req, h2o_send_state_t state)
+{
+    /* the entire body is sent at once, the chunks supplied by the generator are discarded */
+    if (!self->cache->hit_is_sent && state != H2O_SEND_STATE_ERROR) {
+        h2o_iovec_t body = self->cache->hit->value;
+        self->cache->hit_is_sent = 1;
+        h2o_ostream_send_next(&self->super, req, &body, 1, state);
+    } else {
+        h2o_ostream_send_next(&self->super, req, NULL, 0, state);
+    }
+}
+
+static h2o_iovec_t get_encoding_name(int encoding)
+{
+    switch (encoding) {
+    case H2O_COMPRESSIBLE_BROTLI:
+        return h2o_iovec_init(H2O_STRLIT("br"));
+    case H2O_COMPRESSIBLE_ZSTD:
+        return h2o_iovec_init(H2O_STRLIT("zstd"));
+    default:
+        return h2o_iovec_init(H2O_STRLIT("gzip"));
+    }
+}
+
+static h2o_iovec_t build_cache_key(h2o_mem_pool_t *pool, struct st_compress_encoder_t *self, const char *type, h2o_iovec_t id1,
+                                   h2o_iovec_t id2)
+{
+    h2o_iovec_t key;
+
+    key.base = h2o_mem_alloc_pool(pool, sizeof("gzip:99::") + strlen(type) + id1.len + 1 + id2.len);
+    key.len = sprintf(key.base, "%s:%d:%s:%.*s", get_encoding_name(self->encoding).base, self->quality, type, (int)id1.len,
+                      id1.base);
+    if (id2.base != NULL)
+        key.len += sprintf(key.base + key.len, ":%.*s", (int)id2.len, id2.base);
+    return key;
+}
+
+static void lookup_by_hash(struct st_compress_encoder_t *self, h2o_req_t *req)
+{
+    struct st_compress_cache_state_t *cache = self->cache;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    char hex[SHA_DIGEST_LENGTH * 2 + 1];
+    size_t i;
+
+    SHA1((const unsigned char *)cache->input.entries, cache->input.size, digest);
+    for (i = 0; i != SHA_DIGEST_LENGTH; ++i)
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    cache->key = build_cache_key(&req->pool, self, "sha1", h2o_iovec_init(hex, sizeof(hex) - 1), h2o_iovec_init(NULL, 0));
+    if ((cache->hit = h2o_cache_fetch(cache->cache, h2o_now(req->conn->ctx->loop), cache->key, 0)) != NULL)
+        ++req->conn->ctx->compress.cache.hits;
+}
+
+static void do_send(h2o_ostream_t *_self, h2o_req_t *req, h2o_iovec_t *inbufs, size_t inbufcnt, h2o_send_state_t state)
+{
+    struct st_compress_encoder_t *self = (void *)_self;
+    struct st_compress_cache_state_t *cache = self->cache;
+    h2o_iovec_t input;
+    size_t i;
+
+    if (cache != NULL) {
+        if (cache->hit != NULL) {
+            send_cached(self, req, state);
+            return;
+        }
+        if (cache->buffer_input) {
+            /* buffer the entire body, and then look it up by the hash */
+            for (i = 0; i != inbufcnt; ++i)
+                append_to_vector(&cache->input, inbufs[i].base, inbufs[i].len);
+            if (state != H2O_SEND_STATE_FINAL) {
+                h2o_ostream_send_next(&self->super, req, NULL, 0, state);
+                return;
+            }
+            cache->buffer_input = 0;
+            lookup_by_hash(self, req);
+            if (cache->hit != NULL) {
+                send_cached(self, req, state);
+                return;
+            }
+            input = h2o_iovec_init(cache->input.entries, cache->input.size);
+            inbufs = &input;
+            inbufcnt = 1;
+        }
+    }
+
+    compress_and_send(self, req, inbufs, inbufcnt, state);
+}
+
+static void on_cache_state_dispose(void *_cache)
+{
+    struct st_compress_cache_state_t *cache = _cache;
+
+    if (cache->hit != NULL)
+        h2o_cache_release(cache->cache, cache->hit);
+    free(cache->input.entries);
+    free(cache->output.entries);
+}
+
+/**
+ * sets up the cache state of the response; the response is keyed by the strong etag if available, or otherwise by the hash of the
+ * body if it is small enough to be buffered
+ */
+static void setup_cache(struct st_compress_encoder_t *self, h2o_req_t *req, h2o_cache_t *cache)
+{
+    h2o_iovec_t etag = {NULL}, key = {NULL};
+    ssize_t etag_index;
+
+    if ((etag_index = h2o_find_header(&req->res.headers, H2O_TOKEN_ETAG, -1)) != -1) {
+        etag = req->res.headers.entries[etag_index].value;
+        if (etag.len >= 2 && memcmp(etag.base, "W/", 2) == 0)
+            etag = h2o_iovec_init(NULL, 0);
+    }
+    if (etag.base != NULL) {
+        /* strong etags are unique only within the resource, so the URL is also part of the key */
+        key = build_cache_key(&req->pool, self, "etag", h2o_concat(&req->pool, req->authority, req->path), etag);
+    } else if (self->content_length > req->conn->ctx->globalconf->compress.cache.max_object_size) {
+        return;
+    }
+
+    self->cache = h2o_mem_alloc_shared(&req->pool, sizeof(*self->cache), on_cache_state_dispose);
+    *self->cache = (struct st_compress_cache_state_t){cache, key};
+    if (key.base != NULL) {
+        if ((self->cache->hit = h2o_cache_fetch(cache, h2o_now(req->conn->ctx->loop), key, 0)) != NULL)
+            ++req->conn->ctx->compress.cache.hits;
+    } else {
+        self->cache->buffer_input = 1;
+    }
+}
+
+static int is_textual(h2o_req_t *req)
+{
+    ssize_t index;
+    h2o_iovec_t type;
+
+    if ((index = h2o_find_header(&req->res.headers, H2O_TOKEN_CONTENT_TYPE, -1)) == -1)
+        return 0;
+    type = req->res.headers.entries[index].value;
+    if (type.len >= 5 && h2o_lcstris(type.base, 5, H2O_STRLIT("text/")))
+        return 1;
+    return h2o_strstr(type.base, type.len, H2O_STRLIT("json")) != SIZE_MAX ||
+           h2o_strstr(type.base, type.len, H2O_STRLIT("javascript")) != SIZE_MAX ||
+           h2o_strstr(type.base, type.len, H2O_STRLIT("xml")) != SIZE_MAX;
+}
+
+static int choose_quality(h2o_req_t *req, int quality, int min_quality)
+{
+    h2o_context_t *ctx = req->conn->ctx;
+    uint64_t full_load_lag = ADAPTIVE_FULL_LOAD_LOOP_LAG;
+    size_t size;
+
+    if (min_quality == -1 || min_quality >= quality)
+        return quality;
+
+    /* lower the quality as the event loop gets delayed, reaching the minimum before the requests start getting shed */
+    if (ctx->globalconf->overload.max_loop_lag != 0 && ctx->globalconf->overload.max_loop_lag < full_load_lag)
+        full_load_lag = ctx->globalconf->overload.max_loop_lag;
+    if (ctx->overload.loop_lag >= full_load_lag)
+        return min_quality;
+    quality -= (int)((quality - min_quality) * ctx->overload.loop_lag / full_load_lag);
+
+    /* the cost of compression is proportional to the size, whereas the latency added to small responses is negligible */
+    if (req->res.content_length != SIZE_MAX) {
+        for (size = ADAPTIVE_LARGE_SIZE; req->res.content_length > size && quality > min_quality; size *= 4)
+            --quality;
+    }
+
+    /* higher levels have less to gain for types other than text (e.g. fonts, images marked as compressible) */
+    if (!is_textual(req))
+        quality = min_quality + (quality - min_quality) / 2;
+
+    return quality;
 }
 
 static void on_setup_ostream(h2o_filter_t *_self, h2o_req_t *req, h2o_ostream_t **slot)
 {
     struct st_compress_filter_t *self = (void *)_self;
     struct st_compress_encoder_t *encoder;
-    int compressible_types;
-    h2o_compress_context_t *compressor;
+    int compressible_types, encoding, quality;
+    h2o_iovec_t encoding_name;
+    h2o_cache_t *cache;
     ssize_t i;
 
     if (req->version < 0x101)
@@ -84,26 +523,47 @@ static void on_setup_ostream(h2o_filter_t *_self, h2o_req_t *req, h2o_ostream_t
     if (content_encoding_header_index != -1)
         goto Next;
 
-/* open the compressor */
-#ifndef _MSC_VER
-#else
-#define H2O_USE_BROTLI 0
+/* determine the encoding (the compressor is instantiated when it becomes necessary) */
+#if H2O_USE_ZSTD
+    if (self->args.zstd.quality != -1 && (compressible_types & H2O_COMPRESSIBLE_ZSTD) != 0) {
+        encoding = H2O_COMPRESSIBLE_ZSTD;
+        quality = choose_quality(req, self->args.zstd.quality, self->args.zstd.min_quality);
+        ++req->conn->ctx->compress.quality_histogram.zstd[quality];
+    } else
 #endif
-
 #if H2O_USE_BROTLI
-    if (self->args.brotli.quality != -1 && (compressible_types & H2O_COMPRESSIBLE_BROTLI) != 0) {
-        compressor = h2o_compress_brotli_open(&req->pool, self->args.brotli.quality, req->res.content_length);
+        if (self->args.brotli.quality != -1 && (compressible_types & H2O_COMPRESSIBLE_BROTLI) != 0) {
+        encoding = H2O_COMPRESSIBLE_BROTLI;
+        quality = choose_quality(req, self->args.brotli.quality, self->args.brotli.min_quality);
+        ++req->conn->ctx->compress.quality_histogram.brotli[quality];
     } else
 #endif
         if (self->args.gzip.quality != -1 && (compressible_types & H2O_COMPRESSIBLE_GZIP) != 0) {
-        compressor = h2o_compress_gzip_open(&req->pool, self->args.gzip.quality);
+        encoding = H2O_COMPRESSIBLE_GZIP;
+        quality = choose_quality(req, self->args.gzip.quality, self->args.gzip.min_quality);
+        ++req->conn->ctx->compress.quality_histogram.gzip[quality];
     } else {
         goto Next;
     }
 
+    /* setup filter */
+    encoder = (void *)h2o_add_ostream(req, sizeof(*encoder), slot);
+    encoder->super.do_send = do_send;
+    slot = &encoder->super.next;
+    encoder->encoding = encoding;
+    encoder->quality = quality;
+    encoder->content_length = req->res.content_length;
+    encoder->offload_enabled = self->args.offload;
+    encoder->compressor = NULL;
+    encoder->offload = NULL;
+    encoder->cache = NULL;
+    if ((cache = req->conn->ctx->globalconf->compress.cache.cache) != NULL)
+        setup_cache(encoder, req, cache);
+
     /* adjust the response headers */
-    req->res.content_length = SIZE_MAX;
-    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_ENCODING, compressor->name.base, compressor->name.len);
+    req->res.content_length = encoder->cache != NULL && encoder->cache->hit != NULL ? encoder->cache->hit->value.len : SIZE_MAX;
+    encoding_name = get_encoding_name(encoding);
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_ENCODING, encoding_name.base, encoding_name.len);
     h2o_set_header_token(&req->pool, &req->res.headers, H2O_TOKEN_VARY, H2O_STRLIT("accept-encoding"));
     if (accept_ranges_header_index != -1) {
         req->res.headers.entries[accept_ranges_header_index].value = h2o_iovec_init(H2O_STRLIT("none"));
@@ -111,12 +571,6 @@ static void on_setup_ostream(h2o_filter_t *_self, h2o_req_t *req, h2o_ostream_t
         h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ACCEPT_RANGES, H2O_STRLIT("none"));
     }
 
-    /* setup filter */
-    encoder = (void *)h2o_add_ostream(req, sizeof(*encoder), slot);
-    encoder->super.do_send = do_send;
-    slot = &encoder->super.next;
-    encoder->compressor = compressor;
-
     /* adjust preferred chunk size (compress by 8192 bytes) */
     if (req->preferred_chunk_size > BUF_SIZE)
         req->preferred_chunk_size = BUF_SIZE;
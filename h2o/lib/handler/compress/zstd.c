@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <zstd.h>
+#include "h2o.h"
+
+#ifndef BUF_SIZE /* is altered by unit test */
+#define BUF_SIZE 8192
+#endif
+
+typedef H2O_VECTOR(h2o_iovec_t) iovec_vector_t;
+
+enum { ZSTD_OP_CONTINUE, ZSTD_OP_FLUSH, ZSTD_OP_END };
+
+struct st_zstd_context_t {
+    h2o_compress_context_t super;
+    ZSTD_CStream *zs;
+    iovec_vector_t bufs;
+};
+
+static void expand_buf(iovec_vector_t *bufs)
+{
+    h2o_vector_reserve(NULL, bufs, bufs->size + 1);
+    bufs->entries[bufs->size++] = h2o_iovec_init(h2o_mem_alloc(BUF_SIZE), 0);
+}
+
+static size_t compress_chunk(struct st_zstd_context_t *self, const void *src, size_t len, int op, size_t bufindex)
+{
+    ZSTD_inBuffer input = {src, len, 0};
+    size_t ret;
+
+    /* the input is fed until it is consumed; then the data buffered within the stream is flushed (if requested), until the
+     * functions return zero meaning that nothing remains in the internal buffer */
+    do {
+        ZSTD_outBuffer output;
+        if (self->bufs.entries[bufindex].len == BUF_SIZE) {
+            ++bufindex;
+            if (bufindex == self->bufs.size)
+                expand_buf(&self->bufs);
+            self->bufs.entries[bufindex].len = 0;
+        }
+        output.dst = self->bufs.entries[bufindex].base;
+        output.size = BUF_SIZE;
+        output.pos = self->bufs.entries[bufindex].len;
+        if (input.pos != input.size) {
+            ret = ZSTD_compressStream(self->zs, &output, &input);
+        } else if (op == ZSTD_OP_FLUSH) {
+            ret = ZSTD_flushStream(self->zs, &output);
+        } else if (op == ZSTD_OP_END) {
+            ret = ZSTD_endStream(self->zs, &output);
+        } else {
+            break;
+        }
+        assert(!ZSTD_isError(ret));
+        self->bufs.entries[bufindex].len = output.pos;
+    } while (input.pos != input.size || (op != ZSTD_OP_CONTINUE && ret != 0));
+
+    return bufindex;
+}
+
+static void do_compress(h2o_compress_context_t *_self, h2o_iovec_t *inbufs, size_t inbufcnt, h2o_send_state_t state,
+                        h2o_iovec_t **outbufs, size_t *outbufcnt)
+{
+    struct st_zstd_context_t *self = (void *)_self;
+    size_t outbufindex;
+    h2o_iovec_t last_buf;
+
+    outbufindex = 0;
+    self->bufs.entries[0].len = 0;
+
+    if (inbufcnt != 0) {
+        size_t i;
+        for (i = 0; i != inbufcnt - 1; ++i)
+            outbufindex = compress_chunk(self, inbufs[i].base, inbufs[i].len, ZSTD_OP_CONTINUE, outbufindex);
+        last_buf = inbufs[i];
+    } else {
+        last_buf = h2o_iovec_init(NULL, 0);
+    }
+    /* flush at the end of every chunk so that the client can decode what has been sent so far, as gzip does with Z_SYNC_FLUSH */
+    outbufindex = compress_chunk(self, last_buf.base, last_buf.len,
+                                 h2o_send_state_is_in_progress(state) ? ZSTD_OP_FLUSH : ZSTD_OP_END, outbufindex);
+
+    *outbufs = self->bufs.entries;
+    *outbufcnt = outbufindex + 1;
+
+    if (!h2o_send_state_is_in_progress(state)) {
+        ZSTD_freeCStream(self->zs);
+        self->zs = NULL;
+    }
+}
+
+static void do_free(void *_self)
+{
+    struct st_zstd_context_t *self = _self;
+    size_t i;
+
+    if (self->zs != NULL)
+        ZSTD_freeCStream(self->zs);
+
+    for (i = 0; i != self->bufs.size; ++i)
+        free(self->bufs.entries[i].base);
+    free(self->bufs.entries);
+}
+
+h2o_compress_context_t *h2o_compress_zstd_open(h2o_mem_pool_t *pool, int quality)
+{
+    struct st_zstd_context_t *self = h2o_mem_alloc_shared(pool, sizeof(*self), do_free);
+
+    self->super.name = h2o_iovec_init(H2O_STRLIT("zstd"));
+    self->super.compress = do_compress;
+    if ((self->zs = ZSTD_createCStream()) == NULL)
+        h2o_fatal("no memory");
+    ZSTD_initCStream(self->zs, quality);
+    self->bufs = (iovec_vector_t){NULL};
+    expand_buf(&self->bufs);
+
+    return &self->super;
+}
@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include "h2o.h"
+
+#define MODULE_NAME "lib/handler/concurrency_limit.c"
+
+/**
+ * the counter of the requests in flight; there is one counter per context, or one shared by all the contexts if the limit is
+ * process-wide
+ */
+struct st_concurrency_limit_counter_t {
+#ifndef _MSC_VER
+    pthread_mutex_t mutex;
+#else
+    uv_mutex_t mutex;
+#endif
+    /* following properties are protected by the mutex */
+    size_t num_inflight;
+    size_t num_queued;
+    h2o_linklist_t waiters; /* list of st_concurrency_limit_context_t having requests waiting for a slot */
+};
+
+struct st_concurrency_limit_handler_t {
+    h2o_handler_t super;
+    h2o_concurrency_limit_config_t config;
+    struct st_concurrency_limit_counter_t *shared; /* non-NULL if the limit is process-wide */
+};
+
+struct st_concurrency_limit_context_t {
+    struct st_concurrency_limit_handler_t *handler;
+    struct st_concurrency_limit_counter_t *counter;
+    h2o_context_t *ctx;
+    h2o_linklist_t queue;   /* list of st_concurrency_limit_req_t waiting for a slot */
+    h2o_linklist_t holders; /* list of st_concurrency_limit_req_t holding a slot */
+    h2o_timeout_t queue_timeout;
+    h2o_multithread_receiver_t receiver;
+    h2o_multithread_message_t wakeup;
+    int wakeup_sent;              /* protected by the mutex of the counter */
+    h2o_linklist_t _waiters_link; /* link in st_concurrency_limit_counter_t::waiters (protected by the mutex of the counter) */
+    struct st_concurrency_limit_counter_t _own_counter;
+};
+
+/**
+ * per-request state, allocated from the memory pool of the request so that the slot is released (or the request is removed
+ * from the queue) when the request is disposed
+ */
+struct st_concurrency_limit_req_t {
+    struct st_concurrency_limit_context_t *handler_ctx;
+    h2o_req_t *req;
+    h2o_linklist_t link; /* link in either the queue or the holders of the context */
+    h2o_timeout_entry_t timeout;
+    int is_holding;
+};
+
+static void init_counter(struct st_concurrency_limit_counter_t *counter)
+{
+#ifndef _MSC_VER
+    pthread_mutex_init(&counter->mutex, NULL);
+#else
+    uv_mutex_init(&counter->mutex);
+#endif
+    counter->num_inflight = 0;
+    counter->num_queued = 0;
+    h2o_linklist_init_anchor(&counter->waiters);
+}
+
+static void dispose_counter(struct st_concurrency_limit_counter_t *counter)
+{
+#ifndef _MSC_VER
+    pthread_mutex_destroy(&counter->mutex);
+#else
+    uv_mutex_destroy(&counter->mutex);
+#endif
+}
+
+static void lock_counter(struct st_concurrency_limit_counter_t *counter)
+{
+#ifndef _MSC_VER
+    pthread_mutex_lock(&counter->mutex);
+#else
+    uv_mutex_lock(&counter->mutex);
+#endif
+}
+
+static void unlock_counter(struct st_concurrency_limit_counter_t *counter)
+{
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&counter->mutex);
+#else
+    uv_mutex_unlock(&counter->mutex);
+#endif
+}
+
+static void wakeup_waiter(struct st_concurrency_limit_counter_t *counter)
+{
+    /* caller should lock the mutex */
+    h2o_linklist_t *link;
+
+    /* notify the first context that has not yet been notified, moving it to the tail so that the contexts are served in
+     * round-robin */
+    for (link = counter->waiters.next; link != &counter->waiters; link = link->next) {
+        struct st_concurrency_limit_context_t *handler_ctx =
+            H2O_STRUCT_FROM_MEMBER(struct st_concurrency_limit_context_t, _waiters_link, link);
+        if (!handler_ctx->wakeup_sent) {
+            h2o_linklist_unlink(&handler_ctx->_waiters_link);
+            h2o_linklist_insert(&counter->waiters, &handler_ctx->_waiters_link);
+            handler_ctx->wakeup_sent = 1;
+            h2o_multithread_send_message(&handler_ctx->receiver, &handler_ctx->wakeup);
+            break;
+        }
+    }
+}
+
+static void unlink_queued(struct st_concurrency_limit_req_t *self)
+{
+    /* caller should lock the mutex */
+    struct st_concurrency_limit_context_t *handler_ctx = self->handler_ctx;
+
+    h2o_linklist_unlink(&self->link);
+    --handler_ctx->counter->num_queued;
+    if (h2o_linklist_is_empty(&handler_ctx->queue))
+        h2o_linklist_unlink(&handler_ctx->_waiters_link);
+}
+
+static void on_delegate(h2o_timeout_entry_t *entry)
+{
+    struct st_concurrency_limit_req_t *self = H2O_STRUCT_FROM_MEMBER(struct st_concurrency_limit_req_t, timeout, entry);
+    h2o_delegate_request(self->req, &self->handler_ctx->handler->super);
+}
+
+static void grant(struct st_concurrency_limit_req_t *self)
+{
+    struct st_concurrency_limit_context_t *handler_ctx = self->handler_ctx;
+
+    self->is_holding = 1;
+    h2o_linklist_insert(&handler_ctx->holders, &self->link);
+    /* the request is passed to the next handler from the event loop, using the timeout entry that is unlinked if the request
+     * gets disposed in the meantime */
+    if (h2o_timeout_is_linked(&self->timeout))
+        h2o_timeout_unlink(&self->timeout);
+    self->timeout.cb = on_delegate;
+    h2o_timeout_link(handler_ctx->ctx->loop, &handler_ctx->ctx->zero_timeout, &self->timeout);
+}
+
+static void dispatch_queued(struct st_concurrency_limit_context_t *handler_ctx)
+{
+    struct st_concurrency_limit_counter_t *counter = handler_ctx->counter;
+
+    while (1) {
+        struct st_concurrency_limit_req_t *self = NULL;
+        lock_counter(counter);
+        if (counter->num_inflight < handler_ctx->handler->config.max_requests) {
+            if (!h2o_linklist_is_empty(&handler_ctx->queue)) {
+                self = H2O_STRUCT_FROM_MEMBER(struct st_concurrency_limit_req_t, link, handler_ctx->queue.next);
+                ++counter->num_inflight;
+                unlink_queued(self);
+            } else {
+                /* no more requests are waiting in this thread (e.g. they have timed out after the notification was sent); pass the
+                 * free slot to other threads */
+                wakeup_waiter(counter);
+            }
+        }
+        unlock_counter(counter);
+        if (self == NULL)
+            break;
+        grant(self);
+    }
+}
+
+static void on_wakeup(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages)
+{
+    struct st_concurrency_limit_context_t *handler_ctx =
+        H2O_STRUCT_FROM_MEMBER(struct st_concurrency_limit_context_t, receiver, receiver);
+
+    while (!h2o_linklist_is_empty(messages))
+        h2o_linklist_unlink(messages->next);
+
+    lock_counter(handler_ctx->counter);
+    handler_ctx->wakeup_sent = 0;
+    unlock_counter(handler_ctx->counter);
+
+    dispatch_queued(handler_ctx);
+}
+
+static void on_queue_timeout(h2o_timeout_entry_t *entry)
+{
+    struct st_concurrency_limit_req_t *self = H2O_STRUCT_FROM_MEMBER(struct st_concurrency_limit_req_t, timeout, entry);
+
+    lock_counter(self->handler_ctx->counter);
+    unlink_queued(self);
+    unlock_counter(self->handler_ctx->counter);
+
+    h2o_req_log_error(self->req, MODULE_NAME, "timeout while waiting for the concurrency limit");
+    h2o_send_error_503(self->req, "Service Unavailable", "service unavailable", 0);
+}
+
+static void on_req_dispose(void *_self)
+{
+    struct st_concurrency_limit_req_t *self = _self;
+    struct st_concurrency_limit_context_t *handler_ctx = self->handler_ctx;
+    struct st_concurrency_limit_counter_t *counter = handler_ctx->counter;
+
+    if (h2o_timeout_is_linked(&self->timeout))
+        h2o_timeout_unlink(&self->timeout);
+
+    if (self->is_holding) {
+        h2o_linklist_unlink(&self->link);
+        lock_counter(counter);
+        --counter->num_inflight;
+        unlock_counter(counter);
+        /* requests queued in this thread are served first, without the cost of sending a notification */
+        dispatch_queued(handler_ctx);
+    } else if (h2o_linklist_is_linked(&self->link)) {
+        lock_counter(counter);
+        unlink_queued(self);
+        unlock_counter(counter);
+    }
+}
+
+static int is_holding(struct st_concurrency_limit_context_t *handler_ctx, h2o_req_t *req)
+{
+    h2o_linklist_t *link;
+
+    for (link = handler_ctx->holders.next; link != &handler_ctx->holders; link = link->next) {
+        struct st_concurrency_limit_req_t *self = H2O_STRUCT_FROM_MEMBER(struct st_concurrency_limit_req_t, link, link);
+        if (self->req == req)
+            return 1;
+    }
+    return 0;
+}
+
+static int on_req(h2o_handler_t *_handler, h2o_req_t *req)
+{
+    struct st_concurrency_limit_handler_t *handler = (void *)_handler;
+    struct st_concurrency_limit_context_t *handler_ctx = h2o_context_get_handler_context(req->conn->ctx, &handler->super);
+    struct st_concurrency_limit_counter_t *counter = handler_ctx->counter;
+    struct st_concurrency_limit_req_t *self;
+    int acquired = 0, queued = 0;
+
+    /* a request being reprocessed (e.g. by an internal redirect) keeps the slot it has acquired */
+    if (req->num_reprocessed != 0 && is_holding(handler_ctx, req))
+        return -1;
+
+    self = h2o_mem_alloc_shared(&req->pool, sizeof(*self), on_req_dispose);
+    *self = (struct st_concurrency_limit_req_t){handler_ctx, req};
+
+    lock_counter(counter);
+    /* requests already waiting in the queue are served first */
+    if (h2o_linklist_is_empty(&handler_ctx->queue) && counter->num_inflight < handler->config.max_requests) {
+        ++counter->num_inflight;
+        acquired = 1;
+    } else if (counter->num_queued < handler->config.max_queue_length) {
+        h2o_linklist_insert(&handler_ctx->queue, &self->link);
+        ++counter->num_queued;
+        if (!h2o_linklist_is_linked(&handler_ctx->_waiters_link))
+            h2o_linklist_insert(&counter->waiters, &handler_ctx->_waiters_link);
+        queued = 1;
+    }
+    unlock_counter(counter);
+
+    if (acquired) {
+        self->is_holding = 1;
+        h2o_linklist_insert(&handler_ctx->holders, &self->link);
+        return -1;
+    }
+    if (queued) {
+        self->timeout.cb = on_queue_timeout;
+        h2o_timeout_link(req->conn->ctx->loop, &handler_ctx->queue_timeout, &self->timeout);
+        return 0;
+    }
+
+    h2o_req_log_error(req, MODULE_NAME, "too many requests waiting for the concurrency limit");
+    h2o_send_error_503(req, "Service Unavailable", "service unavailable", 0);
+    return 0;
+}
+
+static void on_context_init(h2o_handler_t *_handler, h2o_context_t *ctx)
+{
+    struct st_concurrency_limit_handler_t *handler = (void *)_handler;
+    struct st_concurrency_limit_context_t *handler_ctx = h2o_mem_alloc(sizeof(*handler_ctx));
+
+    handler_ctx->handler = handler;
+    if (handler->shared != NULL) {
+        handler_ctx->counter = handler->shared;
+    } else {
+        init_counter(&handler_ctx->_own_counter);
+        handler_ctx->counter = &handler_ctx->_own_counter;
+    }
+    handler_ctx->ctx = ctx;
+    h2o_linklist_init_anchor(&handler_ctx->queue);
+    h2o_linklist_init_anchor(&handler_ctx->holders);
+    h2o_timeout_init(ctx->loop, &handler_ctx->queue_timeout, handler->config.max_queue_wait);
+    h2o_multithread_register_receiver(ctx->queue, &handler_ctx->receiver, on_wakeup);
+    handler_ctx->wakeup = (h2o_multithread_message_t){{NULL}};
+    handler_ctx->wakeup_sent = 0;
+    handler_ctx->_waiters_link = (h2o_linklist_t){NULL};
+
+    h2o_context_set_handler_context(ctx, &handler->super, handler_ctx);
+}
+
+static void on_context_dispose(h2o_handler_t *_handler, h2o_context_t *ctx)
+{
+    struct st_concurrency_limit_handler_t *handler = (void *)_handler;
+    struct st_concurrency_limit_context_t *handler_ctx = h2o_context_get_handler_context(ctx, &handler->super);
+
+    /* the context is no longer notified once removed from the waiters, therefore the pending notification can be discarded */
+    lock_counter(handler_ctx->counter);
+    if (h2o_linklist_is_linked(&handler_ctx->_waiters_link))
+        h2o_linklist_unlink(&handler_ctx->_waiters_link);
+    unlock_counter(handler_ctx->counter);
+    if (h2o_linklist_is_linked(&handler_ctx->wakeup.link))
+        h2o_linklist_unlink(&handler_ctx->wakeup.link);
+    h2o_multithread_unregister_receiver(ctx->queue, &handler_ctx->receiver);
+    h2o_timeout_dispose(ctx->loop, &handler_ctx->queue_timeout);
+    if (handler->shared == NULL)
+        dispose_counter(&handler_ctx->_own_counter);
+
+    free(handler_ctx);
+}
+
+static void on_dispose(h2o_handler_t *_handler)
+{
+    struct st_concurrency_limit_handler_t *handler = (void *)_handler;
+
+    if (handler->shared != NULL) {
+        dispose_counter(handler->shared);
+        free(handler->shared);
+    }
+}
+
+void h2o_concurrency_limit_register(h2o_pathconf_t *pathconf, h2o_concurrency_limit_config_t *config)
+{
+    struct st_concurrency_limit_handler_t *handler = (void *)h2o_create_handler(pathconf, sizeof(*handler));
+
+    assert(config->max_requests != 0);
+
+    handler->super.on_context_init = on_context_init;
+    handler->super.on_context_dispose = on_context_dispose;
+    handler->super.dispose = on_dispose;
+    handler->super.on_req = on_req;
+    handler->config = *config;
+    if (config->process_wide) {
+        handler->shared = h2o_mem_alloc(sizeof(*handler->shared));
+        init_counter(handler->shared);
+    }
+
+    /* the handler needs to run before the handler that generates the response, which has already been registered */
+    memmove(pathconf->handlers.entries + 1, pathconf->handlers.entries,
+            sizeof(pathconf->handlers.entries[0]) * (pathconf->handlers.size - 1));
+    pathconf->handlers.entries[0] = &handler->super;
+}
@@ -24,13 +24,23 @@
 
 #define DEFAULT_GZIP_QUALITY 1
 #define DEFAULT_BROTLI_QUALITY 1
+#define DEFAULT_ZSTD_QUALITY 3
 
 struct compress_configurator_t {
     h2o_configurator_t super;
     h2o_compress_args_t *vars, _vars_stack[H2O_CONFIGURATOR_NUM_LEVELS + 1];
 };
 
-static const h2o_compress_args_t all_off = {0, {-1}, {-1}}, all_on = {100, {DEFAULT_GZIP_QUALITY}, {DEFAULT_BROTLI_QUALITY}};
+/* zstd is not enabled by `compress: ON`; it needs to be listed explicitly */
+static const h2o_compress_args_t all_off = {0, {-1, -1}, {-1, -1}, {-1, -1}},
+                                 all_on = {100, {DEFAULT_GZIP_QUALITY, -1}, {DEFAULT_BROTLI_QUALITY, -1}, {-1, -1}};
+
+static void set_vars(h2o_compress_args_t *vars, const h2o_compress_args_t *src)
+{
+    int offload = vars->offload; /* set by its own directive */
+    *vars = *src;
+    vars->offload = offload;
+}
 
 static int on_config_gzip(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
@@ -40,16 +50,40 @@ static int on_config_gzip(h2o_configurator_command_t *cmd, h2o_configurator_cont
     if ((mode = (int)h2o_configurator_get_one_of(cmd, node, "OFF,ON")) == -1)
         return -1;
 
-    *self->vars = all_off;
+    set_vars(self->vars, &all_off);
     if (mode != 0)
         self->vars->gzip.quality = DEFAULT_GZIP_QUALITY;
 
     return 0;
 }
 
-static int obtain_quality(yoml_t *node, int min_quality, int max_quality, int default_quality, int *slot)
+static int parse_quality(yoml_t *node, int min_quality, int max_quality, int *slot)
 {
     int tmp;
+    if (node->type != YOML_TYPE_SCALAR)
+        return -1;
+    if (sscanf(node->data.scalar, "%d", &tmp) == 1 && (min_quality <= tmp && tmp <= max_quality)) {
+        *slot = tmp;
+        return 0;
+    }
+    return -1;
+}
+
+static int obtain_quality(yoml_t *node, int min_quality, int max_quality, int default_quality, int *slot, int *min_slot)
+{
+    *min_slot = -1;
+
+    /* a sequence of two values specifies the range within which the quality is adjusted */
+    if (node->type == YOML_TYPE_SEQUENCE) {
+        yoml_t **elements = node->data.sequence.elements;
+        if (node->data.sequence.size != 2 || parse_quality(elements[0], min_quality, max_quality, min_slot) != 0 ||
+            parse_quality(elements[1], *min_slot, max_quality, slot) != 0) {
+            *min_slot = -1;
+            return -1;
+        }
+        return 0;
+    }
+
     if (node->type != YOML_TYPE_SCALAR)
         return -1;
     if (strcasecmp(node->data.scalar, "OFF") == 0) {
@@ -60,11 +94,7 @@ static int obtain_quality(yoml_t *node, int min_quality, int max_quality, int de
         *slot = default_quality;
         return 0;
     }
-    if (sscanf(node->data.scalar, "%d", &tmp) == 1 && (min_quality <= tmp && tmp <= max_quality)) {
-        *slot = tmp;
-        return 0;
-    }
-    return -1;
+    return parse_quality(node, min_quality, max_quality, slot);
 }
 
 static int on_config_compress_min_size(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
@@ -73,6 +103,33 @@ static int on_config_compress_min_size(h2o_configurator_command_t *cmd, h2o_conf
     return h2o_configurator_scanf(cmd, node, "%zu", &self->vars->min_size);
 }
 
+static int on_config_compress_offload(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct compress_configurator_t *self = (void *)cmd->configurator;
+    ssize_t ret;
+
+    if ((ret = h2o_configurator_get_one_of(cmd, node, "OFF,ON")) == -1)
+        return -1;
+#ifdef _MSC_VER
+	if (ret != 0) {
+		h2o_configurator_errprintf(cmd, node, "compress-offload is not supported on this platform");
+		return -1;
+	}
+#endif
+    self->vars->offload = (int)ret;
+    return 0;
+}
+
+static int on_config_compress_cache_capacity(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%zu", &ctx->globalconf->compress.cache.capacity);
+}
+
+static int on_config_compress_cache_max_object_size(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%zu", &ctx->globalconf->compress.cache.max_object_size);
+}
+
 static int on_config_compress(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
     struct compress_configurator_t *self = (void *)cmd->configurator;
@@ -81,47 +138,58 @@ static int on_config_compress(h2o_configurator_command_t *cmd, h2o_configurator_
     switch (node->type) {
     case YOML_TYPE_SCALAR:
         if (strcasecmp(node->data.scalar, "OFF") == 0) {
-            *self->vars = all_off;
+            set_vars(self->vars, &all_off);
         } else if (strcasecmp(node->data.scalar, "ON") == 0) {
-            *self->vars = all_on;
+            set_vars(self->vars, &all_on);
         } else {
             h2o_configurator_errprintf(cmd, node, "scalar argument must be either of: `OFF`, `ON`");
             return -1;
         }
         break;
     case YOML_TYPE_SEQUENCE:
-        *self->vars = all_off;
+        set_vars(self->vars, &all_off);
         for (i = 0; i != node->data.sequence.size; ++i) {
             yoml_t *element = node->data.sequence.elements[i];
             if (element->type == YOML_TYPE_SCALAR && strcasecmp(element->data.scalar, "gzip") == 0) {
                 self->vars->gzip.quality = DEFAULT_GZIP_QUALITY;
             } else if (element->type == YOML_TYPE_SCALAR && strcasecmp(element->data.scalar, "br") == 0) {
                 self->vars->brotli.quality = DEFAULT_BROTLI_QUALITY;
+            } else if (element->type == YOML_TYPE_SCALAR && strcasecmp(element->data.scalar, "zstd") == 0) {
+                self->vars->zstd.quality = DEFAULT_ZSTD_QUALITY;
             } else {
-                h2o_configurator_errprintf(cmd, element, "element of the sequence must be either of: `gzip`, `br`");
+                h2o_configurator_errprintf(cmd, element, "element of the sequence must be either of: `gzip`, `br`, `zstd`");
                 return -1;
             }
         }
         break;
     case YOML_TYPE_MAPPING:
-        *self->vars = all_off;
+        set_vars(self->vars, &all_off);
         for (i = 0; i != node->data.mapping.size; ++i) {
             yoml_t *key = node->data.mapping.elements[i].key;
             yoml_t *value = node->data.mapping.elements[i].value;
             if (key->type == YOML_TYPE_SCALAR && strcasecmp(key->data.scalar, "gzip") == 0) {
-                if (obtain_quality(node, 1, 9, DEFAULT_GZIP_QUALITY, &self->vars->gzip.quality) != 0) {
-                    h2o_configurator_errprintf(
-                        cmd, value, "value of gzip attribute must be either of `OFF`, `ON` or an integer value between 1 and 9");
+                if (obtain_quality(value, 1, H2O_COMPRESS_GZIP_MAX_QUALITY, DEFAULT_GZIP_QUALITY, &self->vars->gzip.quality,
+                                   &self->vars->gzip.min_quality) != 0) {
+                    h2o_configurator_errprintf(cmd, value, "value of gzip attribute must be either of `OFF`, `ON`, an integer "
+                                                           "value between 1 and 9, or a sequence of two such integers");
                     return -1;
                 }
             } else if (key->type == YOML_TYPE_SCALAR && strcasecmp(key->data.scalar, "br") == 0) {
-                if (obtain_quality(node, 0, 11, DEFAULT_BROTLI_QUALITY, &self->vars->brotli.quality) != 0) {
-                    h2o_configurator_errprintf(
-                        cmd, value, "value of br attribute must be either of `OFF`, `ON` or an integer between 0 and 11");
+                if (obtain_quality(value, 0, H2O_COMPRESS_BROTLI_MAX_QUALITY, DEFAULT_BROTLI_QUALITY,
+                                   &self->vars->brotli.quality, &self->vars->brotli.min_quality) != 0) {
+                    h2o_configurator_errprintf(cmd, value, "value of br attribute must be either of `OFF`, `ON`, an integer "
+                                                           "between 0 and 11, or a sequence of two such integers");
+                    return -1;
+                }
+            } else if (key->type == YOML_TYPE_SCALAR && strcasecmp(key->data.scalar, "zstd") == 0) {
+                if (obtain_quality(value, 1, H2O_COMPRESS_ZSTD_MAX_QUALITY, DEFAULT_ZSTD_QUALITY, &self->vars->zstd.quality,
+                                   &self->vars->zstd.min_quality) != 0) {
+                    h2o_configurator_errprintf(cmd, value, "value of zstd attribute must be either of `OFF`, `ON`, an integer "
+                                                           "between 1 and 19, or a sequence of two such integers");
                     return -1;
                 }
             } else {
-                h2o_configurator_errprintf(cmd, key, "key must be either of: `gzip`, `br`");
+                h2o_configurator_errprintf(cmd, key, "key must be either of: `gzip`, `br`, `zstd`");
                 return -1;
             }
         }
@@ -143,11 +211,23 @@ static int on_config_enter(h2o_configurator_t *configurator, h2o_configurator_co
     return 0;
 }
 
+static void on_compressed_destroy(h2o_iovec_t value)
+{
+    free(value.base);
+}
+
 static int on_config_exit(h2o_configurator_t *configurator, h2o_configurator_context_t *ctx, yoml_t *node)
 {
     struct compress_configurator_t *self = (void *)configurator;
+    h2o_globalconf_t *conf = ctx->globalconf;
 
-    if (ctx->pathconf != NULL && (self->vars->gzip.quality != -1 || self->vars->brotli.quality != -1))
+    /* create the cache when exitting from global-level configuration */
+    if (ctx->parent == NULL && conf->compress.cache.capacity != 0 && conf->compress.cache.cache == NULL)
+        conf->compress.cache.cache = h2o_cache_create(H2O_CACHE_FLAG_MULTITHREADED, conf->compress.cache.capacity,
+                                                      H2O_COMPRESS_CACHE_DURATION, on_compressed_destroy);
+
+    if (ctx->pathconf != NULL &&
+        (self->vars->gzip.quality != -1 || self->vars->brotli.quality != -1 || self->vars->zstd.quality != -1))
         h2o_compress_register(ctx->pathconf, self->vars);
 
     --self->vars;
@@ -164,9 +244,22 @@ void h2o_compress_register_configurator(h2o_globalconf_t *conf)
     h2o_configurator_define_command(&c->super, "compress-minimum-size",
                                     H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                     on_config_compress_min_size);
+    h2o_configurator_define_command(&c->super, "compress-cache-capacity",
+                                    H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_compress_cache_capacity);
+    h2o_configurator_define_command(&c->super, "compress-cache-max-object-size",
+                                    H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_compress_cache_max_object_size);
+    h2o_configurator_define_command(&c->super, "compress-offload",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_compress_offload);
     h2o_configurator_define_command(&c->super, "gzip", H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                     on_config_gzip);
     c->vars = c->_vars_stack;
     c->vars->gzip.quality = -1;
+    c->vars->gzip.min_quality = -1;
     c->vars->brotli.quality = -1;
+    c->vars->brotli.min_quality = -1;
+    c->vars->zstd.quality = -1;
+    c->vars->zstd.min_quality = -1;
 }
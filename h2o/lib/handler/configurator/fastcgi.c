@@ -93,6 +93,32 @@ static int on_config_send_delegated_uri(h2o_configurator_command_t *cmd, h2o_con
     return 0;
 }
 
+static int on_config_multiplex(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct fastcgi_configurator_t *self = (void *)cmd->configurator;
+    ssize_t v;
+
+    if ((v = h2o_configurator_get_one_of(cmd, node, "OFF,ON")) == -1)
+        return -1;
+    self->vars->multiplex.enabled = (int)v;
+    return 0;
+}
+
+static int on_config_multiplex_max_requests(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct fastcgi_configurator_t *self = (void *)cmd->configurator;
+    size_t v;
+
+    if (h2o_configurator_scanf(cmd, node, "%zu", &v) != 0)
+        return -1;
+    if (!(1 <= v && v <= 65535)) {
+        h2o_configurator_errprintf(cmd, node, "value must be between 1 and 65535");
+        return -1;
+    }
+    self->vars->multiplex.max_requests = v;
+    return 0;
+}
+
 static int on_config_connect(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
     struct fastcgi_configurator_t *self = (void *)cmd->configurator;
@@ -296,6 +322,116 @@ Error:
 }
 #endif
 
+#ifndef _MSC_VER
+static int create_worker_listener(h2o_configurator_command_t *cmd, yoml_t *node, const char *dirname, size_t index,
+                                  struct passwd *pw)
+{
+    struct sockaddr_un sa;
+    int listen_fd;
+
+    /* build socket path */
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/_%zu", dirname, index);
+    /* create socket */
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        h2o_configurator_errprintf(cmd, node, "socket(2) failed: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+    if (bind(listen_fd, (void *)&sa, sizeof(sa)) != 0) {
+        h2o_configurator_errprintf(cmd, node, "bind(2) failed: %s", strerror(errno));
+        goto Error;
+    }
+    if (listen(listen_fd, H2O_SOMAXCONN) != 0) {
+        h2o_configurator_errprintf(cmd, node, "listen(2) failed: %s", strerror(errno));
+        goto Error;
+    }
+    /* change ownership of socket */
+    if (pw != NULL && chown(sa.sun_path, pw->pw_uid, pw->pw_gid) != 0) {
+        h2o_configurator_errprintf(cmd, node, "chown(2) failed to change ownership of socket:%s:%s", sa.sun_path, strerror(errno));
+        goto Error;
+    }
+
+    return listen_fd;
+
+Error:
+    close(listen_fd);
+    return -1;
+}
+
+/**
+ * spawns a process that removes the temporary directory when the returned file descriptor is closed
+ */
+static int create_janitor(h2o_configurator_command_t *cmd, yoml_t *node, char *kill_on_close_cmd_path, char *dirname)
+{
+    char *argv[] = {kill_on_close_cmd_path, "--rm", dirname, NULL};
+    int pipe_fds[2];
+
+    if (pipe(pipe_fds) != 0) {
+        h2o_configurator_errprintf(cmd, node, "pipe(2) failed: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+    int mapped_fds[] = {pipe_fds[0], 5, /* pipe_fds[0] to 5 */
+                        -1};
+    pid_t pid = h2o_spawnp(argv[0], argv, mapped_fds, 0);
+    close(pipe_fds[0]);
+    if (pid == -1) {
+        fprintf(stderr, "[lib/handler/fastcgi.c] failed to launch helper program %s:%s\n", argv[0], strerror(errno));
+        close(pipe_fds[1]);
+        return -1;
+    }
+
+    return pipe_fds[1];
+}
+#endif
+
+static int parse_workers_config(h2o_configurator_command_t *cmd, yoml_t *node, h2o_fastcgi_workers_config_t *config)
+{
+    yoml_t *t;
+    int found = 0;
+
+    *config = (h2o_fastcgi_workers_config_t){1, 0, H2O_DEFAULT_FASTCGI_WORKERS_IDLE_TIMEOUT, H2O_DEFAULT_FASTCGI_WORKERS_MAX_QUEUED, 0};
+
+    if ((t = yoml_get(node, "min-workers")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%zu", &config->min_workers) != 0)
+            return -1;
+        found = 1;
+    }
+    if ((t = yoml_get(node, "max-workers")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%zu", &config->max_workers) != 0)
+            return -1;
+        if (config->max_workers == 0) {
+            h2o_configurator_errprintf(cmd, t, "`max-workers` must be a positive number");
+            return -1;
+        }
+        found = 1;
+    } else {
+        config->max_workers = config->min_workers != 0 ? config->min_workers : 1;
+    }
+    if (config->min_workers > config->max_workers) {
+        h2o_configurator_errprintf(cmd, node, "`min-workers` must not be greater than `max-workers`");
+        return -1;
+    }
+    if ((t = yoml_get(node, "idle-timeout")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%" PRIu64, &config->idle_timeout) != 0)
+            return -1;
+        found = 1;
+    }
+    if ((t = yoml_get(node, "max-queued")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%zu", &config->max_queued) != 0)
+            return -1;
+        found = 1;
+    }
+    if ((t = yoml_get(node, "queue-timeout")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%" PRIu64, &config->queue_timeout) != 0)
+            return -1;
+        found = 1;
+    }
+
+    return found;
+}
 
 static void spawnproc_on_dispose(h2o_fastcgi_handler_t *handler, void *data)
 {
@@ -317,6 +453,9 @@ static int on_config_spawn(h2o_configurator_command_t *cmd, h2o_configurator_con
 	struct sockaddr sa;
 #endif
     h2o_fastcgi_config_vars_t config_vars;
+    h2o_fastcgi_workers_config_t workers_config;
+    int use_workers = 0, *listen_fds = NULL;
+    size_t num_listen_fds = 0;
     int ret = -1;
     struct passwd spawn_pwbuf, *spawn_pw;
     char spawn_buf[65536];
@@ -347,12 +486,33 @@ static int on_config_spawn(h2o_configurator_command_t *cmd, h2o_configurator_con
             }
             spawn_user = t->data.scalar;
         }
+        if ((use_workers = parse_workers_config(cmd, node, &workers_config)) == -1)
+            return -1;
     } break;
     default:
         h2o_configurator_errprintf(cmd, node, "argument must be scalar or mapping");
         return -1;
     }
 
+    if (use_workers) {
+#ifndef _MSC_VER
+        if (self->vars->multiplex.enabled) {
+            h2o_configurator_errprintf(cmd, node, "worker processes cannot be used together with `fastcgi.multiplex`");
+            return -1;
+        }
+        /* workers spawned on demand run with the privileges of the server */
+        if (workers_config.max_workers > workers_config.min_workers && ctx->globalconf->user != NULL &&
+            spawn_user != NULL && strcmp(spawn_user, ctx->globalconf->user) != 0) {
+            h2o_configurator_errprintf(cmd, node, "`user` must be the same as the user of the server when `max-workers` is greater "
+                                                  "than `min-workers`");
+            return -1;
+        }
+#else
+        h2o_configurator_errprintf(cmd, node, "worker processes are not supported on this platform");
+        return -1;
+#endif
+    }
+
 #ifndef _MSC_VER
     /* obtain uid & gid of spawn_user */
     if (spawn_user != NULL) {
@@ -375,8 +535,11 @@ static int on_config_spawn(h2o_configurator_command_t *cmd, h2o_configurator_con
     { /* build args */
         size_t i = 0;
         argv[i++] = kill_on_close_cmd_path = h2o_configurator_get_cmd_path("share/h2o/kill-on-close");
-        argv[i++] = "--rm";
-        argv[i++] = dirname;
+        if (!use_workers) {
+            /* the directory is removed by the janitor when using workers */
+            argv[i++] = "--rm";
+            argv[i++] = dirname;
+        }
         argv[i++] = "--";
         if (spawn_pw != NULL) {
             argv[i++] = setuidgid_cmd_path = h2o_configurator_get_cmd_path("share/h2o/setuidgid");
@@ -421,6 +584,34 @@ static int on_config_spawn(h2o_configurator_command_t *cmd, h2o_configurator_con
                                        strerror(errno));
             goto Exit;
         }
+#endif
+#ifndef _MSC_VER
+        if (use_workers) {
+            h2o_fastcgi_workers_t *workers;
+            /* launch the janitor, then create the listening sockets and spawn the workers */
+            if ((spawner_fd = create_janitor(cmd, node, kill_on_close_cmd_path, dirname)) == -1)
+                goto Exit;
+            listen_fds = h2o_mem_alloc(sizeof(*listen_fds) * workers_config.max_workers);
+            for (; num_listen_fds != workers_config.max_workers; ++num_listen_fds) {
+                if ((listen_fds[num_listen_fds] = create_worker_listener(cmd, node, dirname, num_listen_fds, spawn_pw)) == -1) {
+                    close(spawner_fd);
+                    goto Exit;
+                }
+            }
+            workers = h2o_fastcgi_workers_create(argv, listen_fds, &workers_config);
+            num_listen_fds = 0; /* the ownership has been transferred */
+            if (workers == NULL) {
+                h2o_configurator_errprintf(cmd, node, "failed to spawn worker processes");
+                close(spawner_fd);
+                goto Exit;
+            }
+            config_vars = *self->vars;
+            config_vars.callbacks.dispose = spawnproc_on_dispose;
+            config_vars.callbacks.data = (char *)NULL + spawner_fd;
+            h2o_fastcgi_register_by_workers(ctx->pathconf, workers, &config_vars);
+            ret = 0;
+            goto Exit;
+        }
 #endif
         /* launch spawnfcgi command */
         if ((spawner_fd = create_spawnproc(cmd, node, dirname, argv, &sa, spawn_pw)) == -1) {
@@ -437,6 +628,9 @@ static int on_config_spawn(h2o_configurator_command_t *cmd, h2o_configurator_con
 Exit:
     if (dirname[0] != '\0')
         unlink(dirname);
+    while (num_listen_fds != 0)
+        close(listen_fds[--num_listen_fds]);
+    free(listen_fds);
     free(kill_on_close_cmd_path);
     free(setuidgid_cmd_path);
     return ret;
@@ -467,6 +661,7 @@ void h2o_fastcgi_register_configurator(h2o_globalconf_t *conf)
     c->vars = c->_vars_stack;
     c->vars->io_timeout = H2O_DEFAULT_FASTCGI_IO_TIMEOUT;
     c->vars->keepalive_timeout = 0;
+    c->vars->multiplex.max_requests = H2O_DEFAULT_FASTCGI_MULTIPLEX_MAX_REQUESTS;
 
     /* setup handlers */
     c->super.enter = on_config_enter;
@@ -489,4 +684,9 @@ void h2o_fastcgi_register_configurator(h2o_globalconf_t *conf)
     h2o_configurator_define_command(&c->super, "fastcgi.send-delegated-uri",
                                     H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                     on_config_send_delegated_uri);
+    h2o_configurator_define_command(&c->super, "fastcgi.multiplex",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR, on_config_multiplex);
+    h2o_configurator_define_command(&c->super, "fastcgi.multiplex.max-requests",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_multiplex_max_requests);
 }
@@ -19,6 +19,7 @@
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
  * IN THE SOFTWARE.
  */
+#include <sys/stat.h>
 #include "h2o.h"
 #include "h2o/configurator.h"
 
@@ -124,6 +125,78 @@ static int on_config_dir_listing(h2o_configurator_command_t *cmd, h2o_configurat
     return 0;
 }
 
+static int on_config_io(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct st_h2o_file_configurator_t *self = (void *)cmd->configurator;
+
+    switch (h2o_configurator_get_one_of(cmd, node, "sync,async")) {
+    case 0: /* sync */
+        self->vars->flags &= ~H2O_FILE_FLAG_ASYNC_IO;
+        break;
+    case 1: /* async */
+        self->vars->flags |= H2O_FILE_FLAG_ASYNC_IO;
+        break;
+    default: /* error */
+        return -1;
+    }
+
+    return 0;
+}
+
+static int on_config_precompress(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct st_h2o_file_configurator_t *self = (void *)cmd->configurator;
+
+    switch (h2o_configurator_get_one_of(cmd, node, "OFF,ON")) {
+    case 0: /* off */
+        self->vars->flags &= ~H2O_FILE_FLAG_PRECOMPRESS;
+        break;
+    case 1: /* on */
+#ifndef _MSC_VER
+        self->vars->flags |= H2O_FILE_FLAG_PRECOMPRESS;
+        break;
+#else
+		h2o_configurator_errprintf(cmd, node, "precompression is not supported on this platform");
+		return -1;
+#endif
+    default: /* error */
+        return -1;
+    }
+
+    return 0;
+}
+
+static int on_config_mmap(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct st_h2o_file_configurator_t *self = (void *)cmd->configurator;
+
+    switch (h2o_configurator_get_one_of(cmd, node, "OFF,ON")) {
+    case 0: /* off */
+        self->vars->flags &= ~H2O_FILE_FLAG_MMAP;
+        break;
+    case 1: /* on */
+        self->vars->flags |= H2O_FILE_FLAG_MMAP;
+        break;
+    default: /* error */
+        return -1;
+    }
+
+    return 0;
+}
+
+static int on_config_precompress_dir(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct stat st;
+
+    if (stat(node->data.scalar, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        h2o_configurator_errprintf(cmd, node, "%s is not a directory", node->data.scalar);
+        return -1;
+    }
+    free(ctx->globalconf->precompress.dir);
+    ctx->globalconf->precompress.dir = h2o_strdup(NULL, node->data.scalar, SIZE_MAX).base;
+    return 0;
+}
+
 static const char **dup_strlist(const char **s)
 {
     size_t i;
@@ -191,4 +264,18 @@ void h2o_file_register_configurator(h2o_globalconf_t *globalconf)
                                     (H2O_CONFIGURATOR_FLAG_ALL_LEVELS & ~H2O_CONFIGURATOR_FLAG_EXTENSION) |
                                         H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                     on_config_dir_listing);
+    h2o_configurator_define_command(&self->super, "file.io",
+                                    (H2O_CONFIGURATOR_FLAG_ALL_LEVELS & ~H2O_CONFIGURATOR_FLAG_EXTENSION) |
+                                        H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_io);
+    h2o_configurator_define_command(&self->super, "file.precompress",
+                                    (H2O_CONFIGURATOR_FLAG_ALL_LEVELS & ~H2O_CONFIGURATOR_FLAG_EXTENSION) |
+                                        H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_precompress);
+    h2o_configurator_define_command(&self->super, "file.mmap",
+                                    (H2O_CONFIGURATOR_FLAG_ALL_LEVELS & ~H2O_CONFIGURATOR_FLAG_EXTENSION) |
+                                        H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_mmap);
+    h2o_configurator_define_command(&self->super, "file.precompress.dir",
+                                    H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR, on_config_precompress_dir);
 }
@@ -66,6 +66,44 @@ static int on_config_proxy_protocol(h2o_configurator_command_t *cmd, h2o_configu
     return 0;
 }
 
+static int on_config_http2(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    ssize_t ret = h2o_configurator_get_one_of(cmd, node, "OFF,ON");
+    if (ret == -1)
+        return -1;
+    self->vars->use_http2 = (int)ret;
+    return 0;
+}
+
+static int on_config_retry(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    ssize_t ret = h2o_configurator_get_one_of(cmd, node, "OFF,ON");
+    if (ret == -1)
+        return -1;
+    self->vars->retry_idempotent = (int)ret;
+    return 0;
+}
+
+static int on_config_prewarm_min_idle(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    return h2o_configurator_scanf(cmd, node, "%zu", &self->vars->prewarm.min_idle);
+}
+
+static int on_config_prewarm_connect_rate(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    if (h2o_configurator_scanf(cmd, node, "%u", &self->vars->prewarm.connect_rate) != 0)
+        return -1;
+    if (self->vars->prewarm.connect_rate == 0) {
+        h2o_configurator_errprintf(cmd, node, "connect rate must be greater than zero");
+        return -1;
+    }
+    return 0;
+}
+
 static int on_config_websocket_timeout(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
     struct proxy_configurator_t *self = (void *)cmd->configurator;
@@ -82,6 +120,48 @@ static int on_config_websocket(h2o_configurator_command_t *cmd, h2o_configurator
     return 0;
 }
 
+static int on_config_health_check_path(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+
+    if (node->data.scalar[0] != '/') {
+        h2o_configurator_errprintf(cmd, node, "path must start with `/`");
+        return -1;
+    }
+    self->vars->health_check.path = h2o_strdup(NULL, node->data.scalar, SIZE_MAX).base;
+    return 0;
+}
+
+static int on_config_health_check_interval(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    if (h2o_configurator_scanf(cmd, node, "%" PRIu64, &self->vars->health_check.interval) != 0)
+        return -1;
+    if (self->vars->health_check.interval == 0) {
+        h2o_configurator_errprintf(cmd, node, "interval must be a positive number");
+        return -1;
+    }
+    return 0;
+}
+
+static int on_config_health_check_max_failures(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    return h2o_configurator_scanf(cmd, node, "%u", &self->vars->health_check.config.max_failures);
+}
+
+static int on_config_health_check_ejection_time(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    return h2o_configurator_scanf(cmd, node, "%" PRIu64, &self->vars->health_check.config.ejection_time);
+}
+
+static int on_config_health_check_slow_start(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    return h2o_configurator_scanf(cmd, node, "%" PRIu64, &self->vars->health_check.config.slow_start);
+}
+
 static SSL_CTX *create_ssl_ctx(void)
 {
     SSL_CTX *ctx = SSL_CTX_new(SSLv23_client_method());
@@ -89,7 +169,15 @@ static SSL_CTX *create_ssl_ctx(void)
     return ctx;
 }
 
-static void update_ssl_ctx(SSL_CTX **ctx, X509_STORE *cert_store, int verify_mode)
+static h2o_cache_t *clone_session_cache(SSL_CTX *ctx)
+{
+    h2o_cache_t *cache = h2o_socket_ssl_get_session_cache(ctx);
+    if (cache == NULL)
+        return NULL;
+    return h2o_socket_ssl_new_session_cache(h2o_cache_get_capacity(cache), h2o_cache_get_duration(cache));
+}
+
+static void update_ssl_ctx(SSL_CTX **ctx, X509_STORE *cert_store, int verify_mode, h2o_cache_t **session_cache)
 {
     assert(*ctx != NULL);
 
@@ -99,6 +187,8 @@ static void update_ssl_ctx(SSL_CTX **ctx, X509_STORE *cert_store, int verify_mod
     CRYPTO_add(&cert_store->references, 1, CRYPTO_LOCK_X509_STORE);
     if (verify_mode == -1)
         verify_mode = (*ctx)->verify_mode;
+    /* the sessions are not carried over, since they might have been established under a different set of properties */
+    h2o_cache_t *new_session_cache = session_cache != NULL ? *session_cache : clone_session_cache(*ctx);
 
     /* free the existing context */
     if (*ctx != NULL)
@@ -110,6 +200,8 @@ static void update_ssl_ctx(SSL_CTX **ctx, X509_STORE *cert_store, int verify_mod
         X509_STORE_free((*ctx)->cert_store);
     (*ctx)->cert_store = cert_store;
     SSL_CTX_set_verify(*ctx, verify_mode, NULL);
+    if (new_session_cache != NULL)
+        h2o_socket_ssl_set_session_cache(*ctx, new_session_cache);
 }
 
 static int on_config_ssl_verify_peer(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
@@ -119,7 +211,8 @@ static int on_config_ssl_verify_peer(h2o_configurator_command_t *cmd, h2o_config
     if (ret == -1)
         return -1;
 
-    update_ssl_ctx(&self->vars->ssl_ctx, NULL, ret != 0 ? SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT : SSL_VERIFY_NONE);
+    update_ssl_ctx(&self->vars->ssl_ctx, NULL, ret != 0 ? SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT : SSL_VERIFY_NONE,
+                   NULL);
 
     return 0;
 }
@@ -131,7 +224,7 @@ static int on_config_ssl_cafile(h2o_configurator_command_t *cmd, h2o_configurato
     int ret = -1;
 
     if (X509_STORE_load_locations(store, node->data.scalar, NULL) == 1) {
-        update_ssl_ctx(&self->vars->ssl_ctx, store, -1);
+        update_ssl_ctx(&self->vars->ssl_ctx, store, -1, NULL);
         ret = 0;
     } else {
         h2o_configurator_errprintf(cmd, node, "failed to load certificates file:%s", node->data.scalar);
@@ -142,25 +235,118 @@ static int on_config_ssl_cafile(h2o_configurator_command_t *cmd, h2o_configurato
     return ret;
 }
 
+static int on_config_ssl_session_cache(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    struct proxy_configurator_t *self = (void *)cmd->configurator;
+    size_t capacity = 0;
+    uint64_t duration = 0;
+    h2o_cache_t *current_cache = h2o_socket_ssl_get_session_cache(self->vars->ssl_ctx), *new_cache = NULL;
+
+    switch (node->type) {
+    case YOML_TYPE_SCALAR:
+        if (strcasecmp(node->data.scalar, "OFF") == 0) {
+            if (current_cache != NULL) {
+                /* set the cache NULL */
+                h2o_cache_t *empty_cache = NULL;
+                update_ssl_ctx(&self->vars->ssl_ctx, NULL, -1, &empty_cache);
+            }
+            return 0;
+        } else if (strcasecmp(node->data.scalar, "ON") == 0) {
+            /* use default values */
+            capacity = H2O_DEFAULT_PROXY_SSL_SESSION_CACHE_CAPACITY;
+            duration = H2O_DEFAULT_PROXY_SSL_SESSION_CACHE_DURATION;
+        } else {
+            h2o_configurator_errprintf(cmd, node, "scalar argument must be either of: `OFF`, `ON`");
+            return -1;
+        }
+        break;
+    case YOML_TYPE_MAPPING: {
+        yoml_t *t;
+        if ((t = yoml_get(node, "capacity")) == NULL) {
+            h2o_configurator_errprintf(cmd, node, "mandatory attribute `capacity` is missing");
+            return -1;
+        }
+        if (h2o_configurator_scanf(cmd, t, "%zu", &capacity) != 0)
+            return -1;
+        if (capacity == 0) {
+            h2o_configurator_errprintf(cmd, t, "capacity must be greater than zero");
+            return -1;
+        }
+        if ((t = yoml_get(node, "lifetime")) == NULL) {
+            h2o_configurator_errprintf(cmd, node, "mandatory attribute `lifetime` is missing");
+            return -1;
+        }
+        if (h2o_configurator_scanf(cmd, t, "%" PRIu64, &duration) != 0)
+            return -1;
+        if (duration == 0) {
+            h2o_configurator_errprintf(cmd, t, "lifetime must be greater than zero");
+            return -1;
+        }
+        duration *= 1000; /* lifetime is specified in seconds */
+    } break;
+    default:
+        h2o_configurator_errprintf(cmd, node, "node must be a scalar or a mapping");
+        return -1;
+    }
+
+    if (current_cache != NULL && h2o_cache_get_capacity(current_cache) == capacity &&
+        h2o_cache_get_duration(current_cache) == duration) {
+        /* parameters not changed */
+        return 0;
+    }
+
+    new_cache = h2o_socket_ssl_new_session_cache(capacity, duration);
+    update_ssl_ctx(&self->vars->ssl_ctx, NULL, -1, &new_cache);
+    return 0;
+}
+
 static int on_config_reverse_url(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
     struct proxy_configurator_t *self = (void *)cmd->configurator;
+    h2o_proxy_config_vars_t vars = *self->vars;
+    h2o_iovec_t url = h2o_iovec_init(node->data.scalar, strlen(node->data.scalar));
     h2o_url_t parsed;
+    int ret = -1;
 
-    if (h2o_url_parse(node->data.scalar, SIZE_MAX, &parsed) != 0) {
+    if (url.len >= 6 && memcmp(url.base, "h2c://", 6) == 0) {
+        /* HTTP/2 over cleartext TCP, which is parsed as http:// */
+        url = h2o_concat(NULL, h2o_iovec_init(H2O_STRLIT("http")), h2o_iovec_init(url.base + 3, url.len - 3));
+        vars.use_http2 = 1;
+    }
+
+    if (h2o_url_parse(url.base, url.len, &parsed) != 0) {
         h2o_configurator_errprintf(cmd, node, "failed to parse URL: %s\n", node->data.scalar);
-        return -1;
+        goto Exit;
     }
-    if (self->vars->keepalive_timeout != 0 && self->vars->use_proxy_protocol) {
+    if (vars.keepalive_timeout != 0 && vars.use_proxy_protocol) {
         h2o_configurator_errprintf(cmd, node, "please either set `proxy.use-proxy-protocol` to `OFF` or disable keep-alive by "
                                               "setting `proxy.timeout.keepalive` to zero; the features are mutually exclusive");
-        return -1;
+        goto Exit;
+    }
+    if (vars.keepalive_timeout == 0 && (vars.health_check.path != NULL || vars.health_check.config.max_failures != 0)) {
+        h2o_configurator_errprintf(cmd, node, "health checking requires keep-alive; please set `proxy.timeout.keepalive` to a "
+                                              "non-zero value");
+        goto Exit;
+    }
+    if (vars.prewarm.min_idle != 0 && (vars.keepalive_timeout == 0 || vars.use_http2)) {
+        h2o_configurator_errprintf(cmd, node, "`proxy.prewarm.min-idle` requires keep-alive and cannot be used together with "
+                                              "`proxy.http2`");
+        goto Exit;
+    }
+    if (vars.keepalive_timeout == 0 && vars.use_http2) {
+        h2o_configurator_errprintf(cmd, node, "proxying using HTTP/2 requires keep-alive; please set `proxy.timeout.keepalive` to "
+                                              "a non-zero value");
+        goto Exit;
     }
 
     /* register */
-    h2o_proxy_register_reverse_proxy(ctx->pathconf, &parsed, self->vars);
+    h2o_proxy_register_reverse_proxy(ctx->pathconf, &parsed, &vars);
+    ret = 0;
 
-    return 0;
+Exit:
+    if (url.base != node->data.scalar)
+        free(url.base);
+    return ret;
 }
 
 static int on_config_emit_x_forwarded_headers(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
@@ -197,6 +383,9 @@ static int on_config_enter(h2o_configurator_t *_self, h2o_configurator_context_t
                     ca_bundle);
         free(ca_bundle);
         SSL_CTX_set_verify(self->vars->ssl_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+        h2o_socket_ssl_set_session_cache(self->vars->ssl_ctx,
+                                         h2o_socket_ssl_new_session_cache(H2O_DEFAULT_PROXY_SSL_SESSION_CACHE_CAPACITY,
+                                                                          H2O_DEFAULT_PROXY_SSL_SESSION_CACHE_DURATION));
     } else {
         CRYPTO_add(&self->vars->ssl_ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
     }
@@ -230,6 +419,11 @@ void h2o_proxy_register_configurator(h2o_globalconf_t *conf)
     c->vars->keepalive_timeout = 2000;
     c->vars->websocket.enabled = 0; /* have websocket proxying disabled by default; until it becomes non-experimental */
     c->vars->websocket.timeout = H2O_DEFAULT_PROXY_WEBSOCKET_TIMEOUT;
+    c->vars->health_check.interval = H2O_DEFAULT_PROXY_HEALTH_CHECK_INTERVAL;
+    c->vars->health_check.config.ejection_time = H2O_DEFAULT_PROXY_EJECTION_TIME;
+    c->vars->health_check.config.slow_start = H2O_DEFAULT_PROXY_SLOW_START;
+    c->vars->prewarm.connect_rate = H2O_DEFAULT_PROXY_PREWARM_CONNECT_RATE;
+    c->vars->retry_idempotent = 1;
 
     /* setup handlers */
     c->super.enter = on_config_enter;
@@ -248,6 +442,16 @@ void h2o_proxy_register_configurator(h2o_globalconf_t *conf)
     h2o_configurator_define_command(&c->super, "proxy.timeout.keepalive",
                                     H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                     on_config_timeout_keepalive);
+    h2o_configurator_define_command(&c->super, "proxy.http2",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR, on_config_http2);
+    h2o_configurator_define_command(&c->super, "proxy.retry",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR, on_config_retry);
+    h2o_configurator_define_command(&c->super, "proxy.prewarm.min-idle",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_prewarm_min_idle);
+    h2o_configurator_define_command(&c->super, "proxy.prewarm.connect-rate",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_prewarm_connect_rate);
     h2o_configurator_define_command(&c->super, "proxy.websocket",
                                     H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR, on_config_websocket);
     h2o_configurator_define_command(&c->super, "proxy.websocket.timeout",
@@ -258,6 +462,23 @@ void h2o_proxy_register_configurator(h2o_globalconf_t *conf)
                                     on_config_ssl_verify_peer);
     h2o_configurator_define_command(&c->super, "proxy.ssl.cafile",
                                     H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR, on_config_ssl_cafile);
+    h2o_configurator_define_command(&c->super, "proxy.ssl.session-cache", H2O_CONFIGURATOR_FLAG_ALL_LEVELS,
+                                    on_config_ssl_session_cache);
+    h2o_configurator_define_command(&c->super, "proxy.health-check.path",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_health_check_path);
+    h2o_configurator_define_command(&c->super, "proxy.health-check.interval",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_health_check_interval);
+    h2o_configurator_define_command(&c->super, "proxy.health-check.max-failures",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_health_check_max_failures);
+    h2o_configurator_define_command(&c->super, "proxy.health-check.ejection-time",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_health_check_ejection_time);
+    h2o_configurator_define_command(&c->super, "proxy.health-check.slow-start",
+                                    H2O_CONFIGURATOR_FLAG_ALL_LEVELS | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                    on_config_health_check_slow_start);
     h2o_configurator_define_command(&c->super, "proxy.preserve-x-forwarded-proto",
                                     H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                     on_config_preserve_x_forwarded_proto);
@@ -19,10 +19,19 @@
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
  * IN THE SOFTWARE.
  */
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
+#ifndef _MSC_VER
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "cloexec.h"
+#endif
 #include "picohttpparser.h"
 #include "h2o.h"
+#include "h2o/serverutil.h"
 
 #define FCGI_VERSION_1 1
 
@@ -30,12 +39,16 @@
 #define FCGI_KEEP_CONN 1
 
 #define FCGI_BEGIN_REQUEST 1
+#define FCGI_ABORT_REQUEST 2
 #define FCGI_END_REQUEST 3
 #define FCGI_PARAMS 4
 #define FCGI_STDIN 5
 #define FCGI_STDOUT 6
 #define FCGI_STDERR 7
 #define FCGI_DATA 8
+#define FCGI_GET_VALUES 9
+#define FCGI_GET_VALUES_RESULT 10
+#define FCGI_UNKNOWN_TYPE 11
 
 #define FCGI_RECORD_HEADER_SIZE (sizeof(struct st_fcgi_record_header_t))
 #define FCGI_BEGIN_REQUEST_BODY_SIZE 8
@@ -43,6 +56,9 @@
 #define MODULE_NAME "lib/handler/fastcgi.c"
 
 #define APPEND_BLOCKSIZE 512 /* the size should be small enough to be allocated within the buffer of the memory pool */
+#define MAX_SEND_VECS 32      /* maximum number of FCGI_STDOUT records being sent to the client at once */
+#define MPX_WRITE_WINDOW 65536 /* request bodies are copied to the write buffer of a multiplexed connection up to this size */
+#define MPX_MAX_BUFFERED_RESPONSE (1024 * 1024) /* reading from a multiplexed connection is suspended above this size */
 
 struct st_fcgi_record_header_t {
     uint8_t version;
@@ -64,6 +80,91 @@ typedef H2O_VECTOR(h2o_iovec_t) iovec_vector_t;
 struct st_fcgi_context_t {
     h2o_fastcgi_handler_t *handler;
     h2o_timeout_t io_timeout;
+    struct {
+        h2o_linklist_t conns; /* list of st_fcgi_mpx_conn_t */
+        h2o_timeout_t idle_timeout;
+        int unsupported; /* set when the application refuses to multiplex, in which case one request is sent per connection */
+    } mpx;
+    struct {
+        h2o_linklist_t queue; /* generators waiting for a worker to become available */
+        h2o_timeout_t queue_timeout;
+        h2o_multithread_receiver_t receiver;
+        h2o_multithread_message_t wakeup;
+        int wakeup_sent;               /* protected by the mutex of the pool */
+        h2o_linklist_t _waiters_link; /* link in h2o_fastcgi_workers_t::waiters (protected by the mutex of the pool) */
+    } workers;
+};
+
+/**
+ * a worker process, handling one request at a time
+ */
+struct st_fcgi_worker_t {
+    h2o_socketpool_t sockpool;
+    int listen_fd;
+    pid_t pid;   /* pid of the process running the worker, 0 if the process is being spawned, or -1 if the worker is not running */
+    int pipe_fd; /* the worker terminates when the write side of the pipe is closed */
+    int is_busy;
+    uint64_t idle_since;
+};
+
+struct st_h2o_fastcgi_workers_t {
+    h2o_linklist_t _link; /* link in the list of the pools being reported through h2o_fastcgi_foreach_workers */
+    char **argv;
+    h2o_fastcgi_workers_config_t config;
+    h2o_iovec_t path;
+#ifndef _MSC_VER
+    pthread_mutex_t mutex;
+#else
+    uv_mutex_t mutex;
+#endif
+    /* following properties are protected by the mutex */
+    struct st_fcgi_worker_t *workers; /* array of config.max_workers entries */
+    size_t num_running;
+    size_t num_busy;
+    size_t num_queued;
+    h2o_linklist_t waiters;        /* list of st_fcgi_context_t having requests waiting for a worker */
+    H2O_VECTOR(pid_t) terminated; /* pids of the terminated workers that have not been reaped */
+    uint64_t latency;
+    struct {
+        uint64_t spawned;
+        uint64_t terminated;
+        uint64_t requests;
+        uint64_t queue_rejected;
+        uint64_t queue_timeouts;
+    } stats;
+    /* reaper of the idle workers, running on the loop of the first context */
+    struct {
+        h2o_loop_t *loop;
+        h2o_timeout_t timeout;
+        h2o_timeout_entry_t entry;
+    } reaper;
+};
+
+struct st_fcgi_mpx_slot_t {
+    struct st_fcgi_generator_t *generator; /* NULL if the request has been aborted and FCGI_END_REQUEST is awaited */
+    int in_use;
+};
+
+/**
+ * a connection to the application carrying multiple requests, each identified by its requestId
+ */
+struct st_fcgi_mpx_conn_t {
+    struct st_fcgi_context_t *ctx;
+    h2o_loop_t *loop;
+    h2o_linklist_t _link;
+    h2o_socketpool_connect_request_t *connect_req;
+    h2o_socket_t *sock;
+    int is_ready; /* set when FCGI_GET_VALUES_RESULT is received */
+    size_t max_requests;
+    size_t num_requests; /* number of requests associated to the connection, including the pending and the aborted ones */
+    H2O_VECTOR(struct st_fcgi_mpx_slot_t) slots; /* indexed by requestId - 1 */
+    h2o_linklist_t pending; /* generators waiting for the connection to become ready */
+    h2o_linklist_t stdin_queue; /* generators having FCGI_STDIN records to be sent */
+    struct {
+        h2o_buffer_t *buf;
+        h2o_buffer_t *buf_in_flight;
+    } _write;
+    h2o_timeout_entry_t timeout; /* used for waiting for FCGI_GET_VALUES_RESULT, or for closing the connection when idle */
 };
 
 struct st_fcgi_generator_t {
@@ -72,8 +173,28 @@ struct st_fcgi_generator_t {
     h2o_req_t *req;
     h2o_socketpool_connect_request_t *connect_req;
     h2o_socket_t *sock;
+    struct st_fcgi_mpx_conn_t *mpx; /* non-NULL if the request is (to be) sent using a multiplexed connection */
+    uint16_t request_id;            /* requestId used on the multiplexed connection (or 0 if pending) */
+    h2o_linklist_t _pending_link;
+    struct st_fcgi_worker_t *worker; /* worker handling the request, if dispatched to a pool of workers */
+    uint64_t worker_acquired_at;
     int sent_headers;
     size_t leftsize; /* remaining amount of the content to receive (or SIZE_MAX if unknown) */
+    struct {
+        int is_open; /* if the header of the record has been received */
+        uint8_t type;
+        size_t content_left;
+        size_t padding_left;
+    } _record; /* state of the record being received on a non-multiplexed connection */
+    struct {
+        size_t bytes_inflight; /* bytes at the head of the input buffer being referred to by the data being sent to the client */
+        int eos_received;
+        int can_keepalive;
+    } _input;
+    struct {
+        size_t off; /* amount of the request body that has been sent on a multiplexed connection */
+        h2o_linklist_t _link;
+    } _stdin;
     struct {
         h2o_doublebuffer_t sending;
         h2o_buffer_t *receiving;
@@ -84,6 +205,7 @@ struct st_fcgi_generator_t {
 struct st_h2o_fastcgi_handler_t {
     h2o_handler_t super;
     h2o_socketpool_t sockpool;
+    h2o_fastcgi_workers_t *workers; /* non-NULL if the requests are dispatched to a pool of workers */
     h2o_fastcgi_config_vars_t config;
 };
 
@@ -183,6 +305,49 @@ static void *append_pair(h2o_mem_pool_t *pool, iovec_vector_t *blocks, const cha
     return name_buf;
 }
 
+static size_t decode_length_of_pair(const char **src, const char *end)
+{
+    const unsigned char *p = (const unsigned char *)*src;
+    size_t len;
+
+    if (*src == end)
+        return SIZE_MAX;
+    if ((p[0] & 0x80) == 0) {
+        *src += 1;
+        return p[0];
+    }
+    if (end - *src < 4)
+        return SIZE_MAX;
+    len = (size_t)(p[0] & 0x7f) << 24 | (size_t)p[1] << 16 | (size_t)p[2] << 8 | (size_t)p[3];
+    *src += 4;
+    return len;
+}
+
+static int decode_get_values_result(const char *src, size_t len, int *mpxs_conns, size_t *max_reqs)
+{
+    const char *end = src + len;
+
+    *mpxs_conns = 0;
+    *max_reqs = 0;
+
+    while (src != end) {
+        size_t namelen, valuelen;
+        if ((namelen = decode_length_of_pair(&src, end)) == SIZE_MAX || (valuelen = decode_length_of_pair(&src, end)) == SIZE_MAX)
+            return -1;
+        if ((size_t)(end - src) < namelen + valuelen)
+            return -1;
+        if (h2o_memis(src, namelen, H2O_STRLIT("FCGI_MPXS_CONNS"))) {
+            *mpxs_conns = h2o_memis(src + namelen, valuelen, H2O_STRLIT("1"));
+        } else if (h2o_memis(src, namelen, H2O_STRLIT("FCGI_MAX_REQS"))) {
+            if ((*max_reqs = h2o_strtosize(src + namelen, valuelen)) == SIZE_MAX)
+                *max_reqs = 0;
+        }
+        src += namelen + valuelen;
+    }
+
+    return 0;
+}
+
 static void append_address_info(h2o_req_t *req, iovec_vector_t *vecs, const char *addrlabel, size_t addrlabel_len,
                                 const char *portlabel, size_t portlabel_len, socklen_t (*cb)(h2o_conn_t *conn, struct sockaddr *))
 {
@@ -382,22 +547,29 @@ static void annotate_params(h2o_mem_pool_t *pool, iovec_vector_t *vecs, unsigned
     }
 }
 
-static void build_request(h2o_req_t *req, iovec_vector_t *vecs, unsigned request_id, size_t max_record_size,
-                          h2o_fastcgi_config_vars_t *config)
+static void build_request_header(h2o_req_t *req, iovec_vector_t *vecs, unsigned request_id, size_t max_record_size,
+                                 h2o_fastcgi_config_vars_t *config)
 {
     *vecs = (iovec_vector_t){NULL};
 
     /* first entry is FCGI_BEGIN_REQUEST */
     h2o_vector_reserve(&req->pool, vecs, 5 /* we send at least 5 iovecs */);
     vecs->entries[0] =
-        create_begin_request(&req->pool, request_id, FCGI_RESPONDER, config->keepalive_timeout != 0 ? FCGI_KEEP_CONN : 0);
+        create_begin_request(&req->pool, request_id, FCGI_RESPONDER,
+                             config->keepalive_timeout != 0 || config->multiplex.enabled ? FCGI_KEEP_CONN : 0);
     /* second entry is reserved for FCGI_PARAMS header */
     vecs->entries[1] = h2o_iovec_init(NULL, APPEND_BLOCKSIZE); /* dummy value set to prevent params being appended to the entry */
     vecs->size = 2;
     /* accumulate the params data, and annotate them with FCGI_PARAM headers */
     append_params(req, vecs, config);
     annotate_params(&req->pool, vecs, request_id, max_record_size);
-    /* setup FCGI_STDIN headers */
+}
+
+static void build_request(h2o_req_t *req, iovec_vector_t *vecs, unsigned request_id, size_t max_record_size,
+                          h2o_fastcgi_config_vars_t *config)
+{
+    build_request_header(req, vecs, request_id, max_record_size, config);
+    /* setup FCGI_STDIN headers; the records refer to the request body without copying */
     if (req->entity.len != 0) {
         size_t off = 0;
         for (; off + max_record_size < req->entity.len; off += max_record_size) {
@@ -424,6 +596,9 @@ static void set_timeout(struct st_fcgi_generator_t *generator, h2o_timeout_t *ti
     h2o_timeout_link(generator->req->conn->ctx->loop, timeout, &generator->timeout);
 }
 
+static void mpx_detach(struct st_fcgi_generator_t *generator, int is_complete);
+static void workers_detach(struct st_fcgi_generator_t *generator);
+
 static void close_generator(struct st_fcgi_generator_t *generator)
 {
     /* can be called more than once */
@@ -438,6 +613,10 @@ static void close_generator(struct st_fcgi_generator_t *generator)
         h2o_socket_close(generator->sock);
         generator->sock = NULL;
     }
+    if (generator->mpx != NULL)
+        mpx_detach(generator, 0);
+    if (generator->ctx->handler->workers != NULL)
+        workers_detach(generator);
     if (generator->resp.sending.buf != NULL)
         h2o_doublebuffer_dispose(&generator->resp.sending);
     if (generator->resp.receiving != NULL)
@@ -452,7 +631,8 @@ static void do_send(struct st_fcgi_generator_t *generator)
 
     vecs[0] = h2o_doublebuffer_prepare(&generator->resp.sending, &generator->resp.receiving, generator->req->preferred_chunk_size);
     veccnt = vecs[0].len != 0 ? 1 : 0;
-    if (generator->sock == NULL && vecs[0].len == generator->resp.sending.buf->size && generator->resp.receiving->size == 0) {
+    if (generator->sock == NULL && generator->mpx == NULL && vecs[0].len == generator->resp.sending.buf->size &&
+        generator->resp.receiving->size == 0) {
         is_final = 1;
         if (!(generator->leftsize == 0 || generator->leftsize == SIZE_MAX))
             generator->req->http1_is_persistent = 0;
@@ -466,11 +646,19 @@ static void do_send(struct st_fcgi_generator_t *generator)
 
 static void send_eos_and_close(struct st_fcgi_generator_t *generator, int can_keepalive)
 {
-    if (generator->ctx->handler->config.keepalive_timeout != 0 && can_keepalive)
-        h2o_socketpool_return(&generator->ctx->handler->sockpool, generator->sock);
-    else
-        h2o_socket_close(generator->sock);
-    generator->sock = NULL;
+    if (generator->mpx != NULL) {
+        mpx_detach(generator, can_keepalive);
+    } else if (generator->sock != NULL) {
+        h2o_socketpool_t *sockpool =
+            generator->worker != NULL ? &generator->worker->sockpool : &generator->ctx->handler->sockpool;
+        if (generator->ctx->handler->config.keepalive_timeout != 0 && can_keepalive)
+            h2o_socketpool_return(sockpool, generator->sock);
+        else
+            h2o_socket_close(generator->sock);
+        generator->sock = NULL;
+    }
+    if (generator->ctx->handler->workers != NULL)
+        workers_detach(generator);
 
     if (h2o_timeout_is_linked(&generator->timeout))
         h2o_timeout_unlink(&generator->timeout);
@@ -570,9 +758,8 @@ static void append_content(struct st_fcgi_generator_t *generator, const void *sr
     generator->resp.receiving->size += len;
 }
 
-static int handle_stdin_record(struct st_fcgi_generator_t *generator, struct st_fcgi_record_header_t *header)
+static int handle_stdin_record(struct st_fcgi_generator_t *generator, struct st_fcgi_record_header_t *header, const char *payload)
 {
-    h2o_buffer_t *input = generator->sock->input;
     struct phr_header headers[100];
     size_t num_headers;
     int parse_result;
@@ -582,17 +769,17 @@ static int handle_stdin_record(struct st_fcgi_generator_t *generator, struct st_
 
     if (generator->sent_headers) {
         /* simply accumulate the data to response buffer */
-        append_content(generator, input->bytes + FCGI_RECORD_HEADER_SIZE, header->contentLength);
+        append_content(generator, payload, header->contentLength);
         return 0;
     }
 
     /* parse the headers using the input buffer (or keep it in response buffer and parse) */
     num_headers = sizeof(headers) / sizeof(headers[0]);
     if (generator->resp.receiving->size == 0) {
-        parse_result = phr_parse_headers(input->bytes + FCGI_RECORD_HEADER_SIZE, header->contentLength, headers, &num_headers, 0);
+        parse_result = phr_parse_headers(payload, header->contentLength, headers, &num_headers, 0);
     } else {
         size_t prevlen = generator->resp.receiving->size;
-        memcpy(h2o_buffer_reserve(&generator->resp.receiving, header->contentLength).base, input->bytes + FCGI_RECORD_HEADER_SIZE,
+        memcpy(h2o_buffer_reserve(&generator->resp.receiving, header->contentLength).base, payload,
                header->contentLength);
         generator->resp.receiving->size = prevlen + header->contentLength;
         parse_result =
@@ -603,7 +790,7 @@ static int handle_stdin_record(struct st_fcgi_generator_t *generator, struct st_
             /* incomplete */
             if (generator->resp.receiving->size == 0) {
                 memcpy(h2o_buffer_reserve(&generator->resp.receiving, header->contentLength).base,
-                       input->bytes + FCGI_RECORD_HEADER_SIZE, header->contentLength);
+                       payload, header->contentLength);
                 generator->resp.receiving->size = header->contentLength;
             }
             return 0;
@@ -624,7 +811,7 @@ static int handle_stdin_record(struct st_fcgi_generator_t *generator, struct st_
     if (generator->resp.receiving->size == 0) {
         size_t leftlen = header->contentLength - parse_result;
         if (leftlen != 0) {
-            append_content(generator, input->bytes + FCGI_RECORD_HEADER_SIZE + parse_result, leftlen);
+            append_content(generator, payload + parse_result, leftlen);
         }
     } else {
         h2o_buffer_consume(&generator->resp.receiving, parse_result);
@@ -641,79 +828,164 @@ static void on_rw_timeout(h2o_timeout_entry_t *entry)
     errorclose(generator);
 }
 
-static void on_read(h2o_socket_t *sock, const char *err)
+/**
+ * handles a record addressed to the generator
+ * @return 0 if more records are expected, 1 if the response is complete, -1 on error
+ */
+static int handle_record(struct st_fcgi_generator_t *generator, struct st_fcgi_record_header_t *header, const char *payload)
 {
-    struct st_fcgi_generator_t *generator = sock->data;
-    int can_keepalive = 0;
-
-    if (err != NULL) {
-        /* note: FastCGI server is allowed to close the connection any time after sending an empty FCGI_STDOUT record */
-        if (!generator->sent_headers)
-            h2o_req_log_error(generator->req, MODULE_NAME, "fastcgi connection closed unexpectedly");
-        errorclose(generator);
-        return;
+    switch (header->type) {
+    case FCGI_STDOUT:
+        return handle_stdin_record(generator, header, payload);
+    case FCGI_STDERR:
+        if (header->contentLength != 0)
+            h2o_req_log_error(generator->req, MODULE_NAME, "%.*s", (int)header->contentLength, payload);
+        return 0;
+    case FCGI_END_REQUEST:
+        if (!generator->sent_headers) {
+            h2o_req_log_error(generator->req, MODULE_NAME, "received FCGI_END_REQUEST before end of the headers");
+            return -1;
+        }
+        return 1;
+    default:
+        h2o_req_log_error(generator->req, MODULE_NAME, "received unexpected record, type: %u", header->type);
+        return generator->sent_headers ? 1 : -1;
     }
+}
 
-    /* handle the records */
-    while (1) {
-        struct st_fcgi_record_header_t header;
-        size_t recsize;
-        if (sock->input->size < FCGI_RECORD_HEADER_SIZE)
-            break;
-        decode_header(&header, sock->input->bytes);
-        recsize = FCGI_RECORD_HEADER_SIZE + header.contentLength + header.paddingLength;
-        if (sock->input->size < recsize)
-            break;
-        /* we have a complete record */
-        switch (header.type) {
-        case FCGI_STDOUT:
-            if (handle_stdin_record(generator, &header) != 0)
-                goto Error;
-            h2o_buffer_consume(&sock->input, recsize);
-            break;
-        case FCGI_STDERR:
-            if (header.contentLength != 0)
-                h2o_req_log_error(generator->req, MODULE_NAME, "%.*s", (int)header.contentLength,
-                                  sock->input->bytes + FCGI_RECORD_HEADER_SIZE);
-            h2o_buffer_consume(&sock->input, recsize);
-            break;
-        case FCGI_END_REQUEST:
-            if (!generator->sent_headers) {
-                h2o_req_log_error(generator->req, MODULE_NAME, "received FCGI_END_REQUEST before end of the headers");
-                goto Error;
+/**
+ * processes the records being received on a non-multiplexed connection.  The payload of FCGI_STDOUT is handled as it arrives, and
+ * once the headers have been sent, it is passed to h2o_send as references to the input buffer of the socket.  Reading from the
+ * socket is suspended until the client consumes the data (see do_proceed).
+ */
+static void handle_input(struct st_fcgi_generator_t *generator)
+{
+    h2o_socket_t *sock = generator->sock;
+    h2o_iovec_t vecs[MAX_SEND_VECS + 1], *send_vecs = vecs + 1;
+    size_t veccnt = 0, bytes_to_send = 0, off = 0, len;
+    int eos = 0, can_keepalive = 0;
+
+    while (veccnt != MAX_SEND_VECS && bytes_to_send < generator->req->preferred_chunk_size) {
+        const char *src = sock->input->bytes + off;
+        size_t avail = sock->input->size - off;
+        if (!generator->_record.is_open) {
+            struct st_fcgi_record_header_t header;
+            if (avail < FCGI_RECORD_HEADER_SIZE)
+                break;
+            decode_header(&header, src);
+            if (header.type == FCGI_STDOUT) {
+                generator->_record.content_left = header.contentLength;
+                off += FCGI_RECORD_HEADER_SIZE;
+            } else {
+                /* records other than FCGI_STDOUT are handled once they are received in full */
+                int ret;
+                if (avail < FCGI_RECORD_HEADER_SIZE + header.contentLength)
+                    break;
+                ret = handle_record(generator, &header, src + FCGI_RECORD_HEADER_SIZE);
+                off += FCGI_RECORD_HEADER_SIZE + header.contentLength;
+                if (ret == -1)
+                    goto Error;
+                if (ret == 1) {
+                    eos = 1;
+                    can_keepalive = header.type == FCGI_END_REQUEST;
+                    if (avail - FCGI_RECORD_HEADER_SIZE - header.contentLength >= header.paddingLength) {
+                        off += header.paddingLength;
+                    } else {
+                        can_keepalive = 0;
+                    }
+                    break;
+                }
+                generator->_record.content_left = 0;
             }
-            h2o_buffer_consume(&sock->input, recsize);
-            can_keepalive = 1;
-            goto EOS_Received;
-        default:
-            h2o_req_log_error(generator->req, MODULE_NAME, "received unexpected record, type: %u", header.type);
-            h2o_buffer_consume(&sock->input, recsize);
-            if (!generator->sent_headers)
-                goto Error;
-            goto EOS_Received;
+            generator->_record.is_open = 1;
+            generator->_record.type = header.type;
+            generator->_record.padding_left = header.paddingLength;
+        } else if (generator->_record.content_left != 0) {
+            /* FCGI_STDOUT */
+            if (avail == 0)
+                break;
+            len = avail < generator->_record.content_left ? avail : generator->_record.content_left;
+            if (generator->sent_headers) {
+                size_t sendlen = len;
+                if (generator->leftsize != SIZE_MAX) {
+                    if (sendlen > generator->leftsize)
+                        sendlen = generator->leftsize;
+                    generator->leftsize -= sendlen;
+                }
+                if (sendlen != 0) {
+                    send_vecs[veccnt++] = h2o_iovec_init(src, sendlen);
+                    bytes_to_send += sendlen;
+                }
+            } else {
+                struct st_fcgi_record_header_t header = {FCGI_VERSION_1, FCGI_STDOUT, 1, (uint16_t)len, 0};
+                if (handle_stdin_record(generator, &header, src) != 0)
+                    goto Error;
+            }
+            off += len;
+            generator->_record.content_left -= len;
+        } else if (generator->_record.padding_left != 0) {
+            if (avail == 0)
+                break;
+            len = avail < generator->_record.padding_left ? avail : generator->_record.padding_left;
+            off += len;
+            generator->_record.padding_left -= len;
+        } else {
+            generator->_record.is_open = 0;
         }
     }
 
-    /* send data if necessary */
-    if (generator->sent_headers && generator->resp.sending.bytes_inflight == 0)
-        do_send(generator);
+    /* the content received together with the end of the headers has been copied to the response buffer; it is sent first */
+    if (generator->sent_headers && generator->resp.receiving->size != 0) {
+        *--send_vecs = h2o_iovec_init(generator->resp.receiving->bytes, generator->resp.receiving->size);
+        ++veccnt;
+    }
 
-    set_timeout(generator, &generator->ctx->io_timeout, on_rw_timeout);
-    return;
+    if (veccnt != 0) {
+        /* retain the input until the client consumes the data */
+        generator->_input.bytes_inflight = off;
+        generator->_input.eos_received = eos;
+        generator->_input.can_keepalive = can_keepalive;
+        h2o_socket_read_stop(sock);
+        if (h2o_timeout_is_linked(&generator->timeout))
+            h2o_timeout_unlink(&generator->timeout);
+        h2o_send(generator->req, send_vecs, veccnt, H2O_SEND_STATE_IN_PROGRESS);
+        return;
+    }
 
-EOS_Received:
-    send_eos_and_close(generator, can_keepalive);
+    h2o_buffer_consume(&sock->input, off);
+    if (eos) {
+        send_eos_and_close(generator, can_keepalive);
+        return;
+    }
+    set_timeout(generator, &generator->ctx->io_timeout, on_rw_timeout);
     return;
 
 Error:
     errorclose(generator);
 }
 
+static void on_read(h2o_socket_t *sock, const char *err)
+{
+    struct st_fcgi_generator_t *generator = sock->data;
+
+    if (err != NULL) {
+        /* note: FastCGI server is allowed to close the connection any time after sending an empty FCGI_STDOUT record */
+        if (!generator->sent_headers)
+            h2o_req_log_error(generator->req, MODULE_NAME, "fastcgi connection closed unexpectedly");
+        errorclose(generator);
+        return;
+    }
+
+    handle_input(generator);
+}
+
 static void on_send_complete(h2o_socket_t *sock, const char *err)
 {
     struct st_fcgi_generator_t *generator = sock->data;
 
-    set_timeout(generator, &generator->ctx->io_timeout, on_rw_timeout);
+    /* the timeout is not used while the client is consuming the response */
+    if (generator->_input.bytes_inflight == 0)
+        set_timeout(generator, &generator->ctx->io_timeout, on_rw_timeout);
     /* do nothing else!  all the rest is handled by the on_read */
 }
 
@@ -744,12 +1016,1029 @@ static void on_connect(h2o_socket_t *sock, const char *errstr, void *data)
     h2o_socket_read_start(sock, on_read);
 }
 
+static void mpx_close(struct st_fcgi_mpx_conn_t *conn, const char *errstr)
+{
+    h2o_linklist_t generators;
+    size_t i;
+
+    /* collect the generators, detaching them from the connection */
+    h2o_linklist_init_anchor(&generators);
+    h2o_linklist_insert_list(&generators, &conn->pending);
+    for (i = 0; i != conn->slots.size; ++i) {
+        struct st_fcgi_generator_t *generator = conn->slots.entries[i].generator;
+        if (generator != NULL) {
+            if (h2o_linklist_is_linked(&generator->_stdin._link))
+                h2o_linklist_unlink(&generator->_stdin._link);
+            h2o_linklist_insert(&generators, &generator->_pending_link);
+        }
+    }
+
+    /* dispose the connection */
+    h2o_linklist_unlink(&conn->_link);
+    if (h2o_timeout_is_linked(&conn->timeout))
+        h2o_timeout_unlink(&conn->timeout);
+    if (conn->connect_req != NULL)
+        h2o_socketpool_cancel_connect(conn->connect_req);
+    if (conn->sock != NULL)
+        h2o_socket_close(conn->sock);
+    h2o_buffer_dispose(&conn->_write.buf);
+    if (conn->_write.buf_in_flight != NULL)
+        h2o_buffer_dispose(&conn->_write.buf_in_flight);
+    free(conn->slots.entries);
+    free(conn);
+
+    /* close the generators */
+    while (!h2o_linklist_is_empty(&generators)) {
+        struct st_fcgi_generator_t *generator =
+            H2O_STRUCT_FROM_MEMBER(struct st_fcgi_generator_t, _pending_link, generators.next);
+        h2o_linklist_unlink(&generator->_pending_link);
+        generator->mpx = NULL;
+        if (errstr != NULL)
+            h2o_req_log_error(generator->req, MODULE_NAME, "%s", errstr);
+        errorclose(generator);
+    }
+}
+
+static void on_mpx_write_complete(h2o_socket_t *sock, const char *err);
+
+static void mpx_append(struct st_fcgi_mpx_conn_t *conn, h2o_iovec_t *vecs, size_t veccnt)
+{
+    size_t i;
+
+    for (i = 0; i != veccnt; ++i) {
+        if (vecs[i].len == 0)
+            continue;
+        memcpy(h2o_buffer_reserve(&conn->_write.buf, vecs[i].len).base, vecs[i].base, vecs[i].len);
+        conn->_write.buf->size += vecs[i].len;
+    }
+}
+
+static void mpx_fill_stdin(struct st_fcgi_mpx_conn_t *conn)
+{
+    /* request bodies are copied to the write buffer one record at a time in round-robin, only up to the window size; the rest is
+     * sent as the writes complete, so that the memory footprint does not depend on the size of the bodies */
+    while (conn->_write.buf->size < MPX_WRITE_WINDOW && !h2o_linklist_is_empty(&conn->stdin_queue)) {
+        struct st_fcgi_generator_t *generator =
+            H2O_STRUCT_FROM_MEMBER(struct st_fcgi_generator_t, _stdin._link, conn->stdin_queue.next);
+        char header[FCGI_RECORD_HEADER_SIZE];
+        h2o_iovec_t vecs[2];
+        size_t len = generator->req->entity.len - generator->_stdin.off;
+        if (len > MPX_WRITE_WINDOW - conn->_write.buf->size)
+            len = MPX_WRITE_WINDOW - conn->_write.buf->size;
+        if (len > 65535)
+            len = 65535;
+        encode_record_header(header, FCGI_STDIN, generator->request_id, (uint16_t)len);
+        vecs[0] = h2o_iovec_init(header, sizeof(header));
+        vecs[1] = h2o_iovec_init(generator->req->entity.base + generator->_stdin.off, len);
+        mpx_append(conn, vecs, 2);
+        generator->_stdin.off += len;
+        h2o_linklist_unlink(&generator->_stdin._link);
+        /* an empty record terminates the stream */
+        if (len != 0)
+            h2o_linklist_insert(&conn->stdin_queue, &generator->_stdin._link);
+    }
+}
+
+static void mpx_flush(struct st_fcgi_mpx_conn_t *conn)
+{
+    h2o_iovec_t buf;
+
+    mpx_fill_stdin(conn);
+    if (conn->_write.buf->size == 0)
+        return;
+
+    buf = h2o_iovec_init(conn->_write.buf->bytes, conn->_write.buf->size);
+    conn->_write.buf_in_flight = conn->_write.buf;
+    h2o_buffer_init(&conn->_write.buf, &h2o_socket_buffer_prototype);
+    h2o_socket_write(conn->sock, &buf, 1, on_mpx_write_complete);
+}
+
+static void on_mpx_write_complete(h2o_socket_t *sock, const char *err)
+{
+    struct st_fcgi_mpx_conn_t *conn = sock->data;
+
+    h2o_buffer_dispose(&conn->_write.buf_in_flight);
+    if (err != NULL) {
+        mpx_close(conn, "failed to write to fastcgi connection");
+        return;
+    }
+    mpx_flush(conn);
+}
+
+static void mpx_write(struct st_fcgi_mpx_conn_t *conn, h2o_iovec_t *vecs, size_t veccnt)
+{
+    /* the records of the requests are interleaved at record boundaries, by copying them to the write buffer */
+    mpx_append(conn, vecs, veccnt);
+    if (conn->_write.buf_in_flight == NULL)
+        mpx_flush(conn);
+}
+
+static void on_mpx_idle_timeout(h2o_timeout_entry_t *entry)
+{
+    struct st_fcgi_mpx_conn_t *conn = H2O_STRUCT_FROM_MEMBER(struct st_fcgi_mpx_conn_t, timeout, entry);
+    mpx_close(conn, NULL);
+}
+
+static void mpx_link_idle_timeout(struct st_fcgi_mpx_conn_t *conn)
+{
+    conn->timeout.cb = on_mpx_idle_timeout;
+    h2o_timeout_link(conn->loop, &conn->ctx->mpx.idle_timeout, &conn->timeout);
+}
+
+static void mpx_release(struct st_fcgi_mpx_conn_t *conn)
+{
+    /* the connection is closed asynchronously, since the function might be called while the records are being processed */
+    if (--conn->num_requests == 0 && conn->is_ready)
+        mpx_link_idle_timeout(conn);
+}
+
+static void mpx_send_request(struct st_fcgi_mpx_conn_t *conn, struct st_fcgi_generator_t *generator)
+{
+    iovec_vector_t vecs;
+    size_t slot_index;
+
+    /* assign requestId */
+    for (slot_index = 0; slot_index != conn->slots.size; ++slot_index)
+        if (!conn->slots.entries[slot_index].in_use)
+            break;
+    if (slot_index == conn->slots.size) {
+        h2o_vector_reserve(NULL, &conn->slots, slot_index + 1);
+        ++conn->slots.size;
+    }
+    conn->slots.entries[slot_index].generator = generator;
+    conn->slots.entries[slot_index].in_use = 1;
+    generator->request_id = (uint16_t)(slot_index + 1);
+
+    /* FCGI_STDIN records are generated by mpx_fill_stdin as the connection becomes writable */
+    build_request_header(generator->req, &vecs, generator->request_id, 65535, &conn->ctx->handler->config);
+    generator->_stdin.off = 0;
+    h2o_linklist_insert(&conn->stdin_queue, &generator->_stdin._link);
+    mpx_write(conn, vecs.entries, vecs.size);
+
+    set_timeout(generator, &conn->ctx->io_timeout, on_rw_timeout);
+}
+
+static void start_request(struct st_fcgi_generator_t *generator);
+
+static int mpx_on_ready(struct st_fcgi_mpx_conn_t *conn, int mpxs_conns, size_t max_reqs)
+{
+    h2o_linklist_t pending;
+
+    if (h2o_timeout_is_linked(&conn->timeout))
+        h2o_timeout_unlink(&conn->timeout);
+    h2o_linklist_init_anchor(&pending);
+    h2o_linklist_insert_list(&pending, &conn->pending);
+    conn->num_requests = 0;
+
+    if (mpxs_conns) {
+        conn->is_ready = 1;
+        if (max_reqs != 0 && max_reqs < conn->max_requests)
+            conn->max_requests = max_reqs;
+    } else {
+        fprintf(stderr, "[%s] the application does not support multiplexing; sending one request per connection\n", MODULE_NAME);
+        conn->ctx->mpx.unsupported = 1;
+        mpx_close(conn, NULL);
+        conn = NULL;
+    }
+
+    /* restart the pending requests; they are sent using this connection unless it has been closed or has become full */
+    while (!h2o_linklist_is_empty(&pending)) {
+        struct st_fcgi_generator_t *generator = H2O_STRUCT_FROM_MEMBER(struct st_fcgi_generator_t, _pending_link, pending.next);
+        h2o_linklist_unlink(&generator->_pending_link);
+        generator->mpx = NULL;
+        start_request(generator);
+    }
+
+    if (conn == NULL)
+        return -1;
+    if (conn->num_requests == 0)
+        mpx_link_idle_timeout(conn);
+    return 0;
+}
+
+/**
+ * handles a record received on a multiplexed connection
+ * @return 0 if successful, -1 if the connection has been closed
+ */
+static int mpx_handle_record(struct st_fcgi_mpx_conn_t *conn, struct st_fcgi_record_header_t *header, const char *payload)
+{
+    struct st_fcgi_mpx_slot_t *slot;
+    struct st_fcgi_generator_t *generator;
+
+    /* management records */
+    if (header->requestId == 0) {
+        int mpxs_conns = 0;
+        size_t max_reqs = 0;
+        switch (header->type) {
+        case FCGI_GET_VALUES_RESULT:
+            if (decode_get_values_result(payload, header->contentLength, &mpxs_conns, &max_reqs) != 0) {
+                mpx_close(conn, "received broken FCGI_GET_VALUES_RESULT");
+                return -1;
+            }
+            break;
+        case FCGI_UNKNOWN_TYPE:
+            break;
+        default:
+            return 0;
+        }
+        if (conn->is_ready)
+            return 0;
+        return mpx_on_ready(conn, mpxs_conns, max_reqs);
+    }
+
+    if (header->requestId > conn->slots.size || !conn->slots.entries[header->requestId - 1].in_use) {
+        mpx_close(conn, "received a record with unknown requestId");
+        return -1;
+    }
+    slot = conn->slots.entries + header->requestId - 1;
+
+    /* discard the records of aborted requests until FCGI_END_REQUEST is received */
+    if ((generator = slot->generator) == NULL) {
+        if (header->type == FCGI_END_REQUEST) {
+            slot->in_use = 0;
+            mpx_release(conn);
+        }
+        return 0;
+    }
+
+    switch (handle_record(generator, header, payload)) {
+    case 0:
+        if (generator->sent_headers && generator->resp.sending.bytes_inflight == 0)
+            do_send(generator);
+        set_timeout(generator, &conn->ctx->io_timeout, on_rw_timeout);
+        break;
+    case 1:
+        send_eos_and_close(generator, header->type == FCGI_END_REQUEST);
+        break;
+    default:
+        errorclose(generator);
+        break;
+    }
+    return 0;
+}
+
+static void on_mpx_read(h2o_socket_t *sock, const char *err);
+
+static void mpx_update_reading(struct st_fcgi_mpx_conn_t *conn)
+{
+    size_t i;
+    int is_congested = 0;
+
+    if (conn->sock == NULL)
+        return;
+
+    /* FastCGI has no flow control; reading from the connection is suspended while any of the clients is slow in consuming the
+     * response */
+    for (i = 0; i != conn->slots.size; ++i) {
+        struct st_fcgi_generator_t *generator = conn->slots.entries[i].generator;
+        if (generator != NULL && generator->resp.receiving->size >= MPX_MAX_BUFFERED_RESPONSE) {
+            is_congested = 1;
+            break;
+        }
+    }
+    if (is_congested) {
+        if (h2o_socket_is_reading(conn->sock))
+            h2o_socket_read_stop(conn->sock);
+    } else {
+        if (!h2o_socket_is_reading(conn->sock))
+            h2o_socket_read_start(conn->sock, on_mpx_read);
+    }
+}
+
+static void on_mpx_read(h2o_socket_t *sock, const char *err)
+{
+    struct st_fcgi_mpx_conn_t *conn = sock->data;
+
+    if (err != NULL) {
+        mpx_close(conn, "fastcgi connection closed unexpectedly");
+        return;
+    }
+
+    while (1) {
+        struct st_fcgi_record_header_t header;
+        size_t recsize;
+        if (sock->input->size < FCGI_RECORD_HEADER_SIZE)
+            break;
+        decode_header(&header, sock->input->bytes);
+        recsize = FCGI_RECORD_HEADER_SIZE + header.contentLength + header.paddingLength;
+        if (sock->input->size < recsize)
+            break;
+        if (mpx_handle_record(conn, &header, sock->input->bytes + FCGI_RECORD_HEADER_SIZE) != 0)
+            return;
+        h2o_buffer_consume(&sock->input, recsize);
+    }
+
+    mpx_update_reading(conn);
+}
+
+static void on_mpx_probe_timeout(h2o_timeout_entry_t *entry)
+{
+    struct st_fcgi_mpx_conn_t *conn = H2O_STRUCT_FROM_MEMBER(struct st_fcgi_mpx_conn_t, timeout, entry);
+    mpx_close(conn, "timeout while waiting for FCGI_GET_VALUES_RESULT");
+}
+
+static void on_mpx_connect(h2o_socket_t *sock, const char *errstr, void *data)
+{
+    static const char get_values_body[] = "\x0d\x00"
+                                          "FCGI_MAX_REQS"
+                                          "\x0f\x00"
+                                          "FCGI_MPXS_CONNS";
+    struct st_fcgi_mpx_conn_t *conn = data;
+    char header[FCGI_RECORD_HEADER_SIZE];
+    h2o_iovec_t vecs[2];
+
+    conn->connect_req = NULL;
+
+    if (sock == NULL) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "connection failed:%s", errstr);
+        mpx_close(conn, buf);
+        return;
+    }
+
+    conn->sock = sock;
+    sock->data = conn;
+
+    /* ask if the application supports multiplexing, and the maximum number of requests it accepts */
+    encode_record_header(header, FCGI_GET_VALUES, 0, sizeof(get_values_body) - 1);
+    vecs[0] = h2o_iovec_init(header, sizeof(header));
+    vecs[1] = h2o_iovec_init(get_values_body, sizeof(get_values_body) - 1);
+    mpx_write(conn, vecs, 2);
+
+    conn->timeout.cb = on_mpx_probe_timeout;
+    h2o_timeout_link(conn->loop, &conn->ctx->io_timeout, &conn->timeout);
+
+    h2o_socket_read_start(sock, on_mpx_read);
+}
+
+static void mpx_attach(struct st_fcgi_generator_t *generator)
+{
+    struct st_fcgi_context_t *ctx = generator->ctx;
+    struct st_fcgi_mpx_conn_t *conn = NULL;
+    h2o_linklist_t *node;
+    int is_new = 0;
+
+    /* find a connection that can accept more requests, or create a new one */
+    for (node = ctx->mpx.conns.next; node != &ctx->mpx.conns; node = node->next) {
+        struct st_fcgi_mpx_conn_t *c = H2O_STRUCT_FROM_MEMBER(struct st_fcgi_mpx_conn_t, _link, node);
+        if (c->num_requests < c->max_requests) {
+            conn = c;
+            break;
+        }
+    }
+    if (conn == NULL) {
+        conn = h2o_mem_alloc(sizeof(*conn));
+        memset(conn, 0, sizeof(*conn));
+        conn->ctx = ctx;
+        conn->loop = generator->req->conn->ctx->loop;
+        conn->max_requests = ctx->handler->config.multiplex.max_requests;
+        h2o_linklist_init_anchor(&conn->pending);
+        h2o_linklist_init_anchor(&conn->stdin_queue);
+        h2o_buffer_init(&conn->_write.buf, &h2o_socket_buffer_prototype);
+        h2o_linklist_insert(&ctx->mpx.conns, &conn->_link);
+        is_new = 1;
+    }
+
+    generator->mpx = conn;
+    if (conn->num_requests++ == 0 && conn->is_ready && h2o_timeout_is_linked(&conn->timeout))
+        h2o_timeout_unlink(&conn->timeout);
+
+    if (conn->is_ready) {
+        mpx_send_request(conn, generator);
+    } else {
+        h2o_linklist_insert(&conn->pending, &generator->_pending_link);
+        if (is_new)
+            h2o_socketpool_connect(&conn->connect_req, &ctx->handler->sockpool, conn->loop,
+                                   &generator->req->conn->ctx->receivers.hostinfo_getaddr, on_mpx_connect, conn);
+    }
+}
+
+static void mpx_detach(struct st_fcgi_generator_t *generator, int is_complete)
+{
+    struct st_fcgi_mpx_conn_t *conn = generator->mpx;
+    struct st_fcgi_mpx_slot_t *slot;
+
+    generator->mpx = NULL;
+
+    /* the request has not been sent yet */
+    if (generator->request_id == 0) {
+        h2o_linklist_unlink(&generator->_pending_link);
+        mpx_release(conn);
+        return;
+    }
+
+    if (h2o_linklist_is_linked(&generator->_stdin._link))
+        h2o_linklist_unlink(&generator->_stdin._link);
+    slot = conn->slots.entries + generator->request_id - 1;
+    slot->generator = NULL;
+    if (is_complete) {
+        slot->in_use = 0;
+        mpx_release(conn);
+    } else {
+        /* abort the request, keeping the requestId reserved until FCGI_END_REQUEST is received */
+        char header[FCGI_RECORD_HEADER_SIZE];
+        h2o_iovec_t vec = h2o_iovec_init(header, sizeof(header));
+        encode_record_header(header, FCGI_ABORT_REQUEST, generator->request_id, 0);
+        mpx_write(conn, &vec, 1);
+    }
+    mpx_update_reading(conn);
+}
+
+/* list of the pools of workers, used for reporting the status */
+static struct {
+#ifndef _MSC_VER
+    pthread_mutex_t mutex;
+#else
+    uv_mutex_t mutex;
+#endif
+    h2o_linklist_t pools;
+#ifndef _MSC_VER
+} workers_registry = {PTHREAD_MUTEX_INITIALIZER, {&workers_registry.pools, &workers_registry.pools}};
+#else
+} workers_registry = {UV_MUTEX_INITIALIZER, {&workers_registry.pools, &workers_registry.pools}};
+#endif
+
+static void lock_workers(h2o_fastcgi_workers_t *workers)
+{
+#ifndef _MSC_VER
+    pthread_mutex_lock(&workers->mutex);
+#else
+    uv_mutex_lock(&workers->mutex);
+#endif
+}
+
+static void unlock_workers(h2o_fastcgi_workers_t *workers)
+{
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&workers->mutex);
+#else
+    uv_mutex_unlock(&workers->mutex);
+#endif
+}
+
+static pid_t spawn_worker_process(h2o_fastcgi_workers_t *workers, int listen_fd, int *pipe_fd)
+{
+#ifndef _MSC_VER
+    int pipe_fds[2];
+    pid_t pid;
+
+    /* create pipe which is used to notify the termination of the worker */
+    if (cloexec_pipe(pipe_fds) != 0) {
+        fprintf(stderr, "[%s] pipe(2) failed:%s\n", MODULE_NAME, strerror(errno));
+        return -1;
+    }
+    /* spawn */
+    int mapped_fds[] = {listen_fd, 0,   /* listen_fd to 0 */
+                        pipe_fds[0], 5, /* pipe_fds[0] to 5 */
+                        -1};
+    pid = h2o_spawnp(workers->argv[0], workers->argv, mapped_fds, 0);
+    close(pipe_fds[0]);
+    if (pid == -1) {
+        fprintf(stderr, "[%s] failed to launch helper program %s:%s\n", MODULE_NAME, workers->argv[0], strerror(errno));
+        close(pipe_fds[1]);
+        return -1;
+    }
+
+    *pipe_fd = pipe_fds[1];
+    return pid;
+#else
+    fprintf(stderr, "[%s] spawning workers is not supported on this platform\n", MODULE_NAME);
+    return -1;
+#endif
+}
+
+static void reserve_worker(h2o_fastcgi_workers_t *workers, struct st_fcgi_worker_t *worker, uint64_t now)
+{
+    /* caller should lock the mutex; the process is spawned by start_worker after the mutex is unlocked */
+    worker->pid = 0;
+    worker->pipe_fd = -1;
+    worker->idle_since = now;
+    ++workers->num_running;
+}
+
+static void reject_queued_connections(int listen_fd)
+{
+#ifndef _MSC_VER
+    /* no process is accepting from the socket, therefore accept(2) does not block once poll(2) reports it readable */
+    struct pollfd pfd = {listen_fd, POLLIN};
+    int fd;
+    while (poll(&pfd, 1, 0) == 1 && (fd = accept(listen_fd, NULL, NULL)) != -1)
+        close(fd);
+#endif
+}
+
+static int start_worker(h2o_fastcgi_workers_t *workers, struct st_fcgi_worker_t *worker, int reject_queued)
+{
+    /* spawns the process of a worker reserved by reserve_worker; the mutex should NOT be locked, since spawning takes time */
+    int pipe_fd = -1;
+    pid_t pid = spawn_worker_process(workers, worker->listen_fd, &pipe_fd);
+
+    /* connections that have been queued for the worker would not be accepted by anyone */
+    if (pid == -1 && reject_queued)
+        reject_queued_connections(worker->listen_fd);
+
+    lock_workers(workers);
+    if (pid != -1) {
+        worker->pid = pid;
+        worker->pipe_fd = pipe_fd;
+        ++workers->stats.spawned;
+    } else {
+        worker->pid = -1;
+        --workers->num_running;
+    }
+    unlock_workers(workers);
+
+    return pid != -1 ? 0 : -1;
+}
+
+static void terminate_worker(h2o_fastcgi_workers_t *workers, struct st_fcgi_worker_t *worker)
+{
+    /* caller should lock the mutex; the worker is killed by kill-on-close when the pipe is closed */
+    close(worker->pipe_fd);
+    h2o_vector_reserve(NULL, &workers->terminated, workers->terminated.size + 1);
+    workers->terminated.entries[workers->terminated.size++] = worker->pid;
+    worker->pid = -1;
+    worker->pipe_fd = -1;
+    --workers->num_running;
+    ++workers->stats.terminated;
+}
+
+static void reap_terminated(h2o_fastcgi_workers_t *workers)
+{
+    /* caller should lock the mutex */
+#ifndef _MSC_VER
+    size_t i = 0;
+
+    while (i != workers->terminated.size) {
+        if (waitpid(workers->terminated.entries[i], NULL, WNOHANG) == 0) {
+            ++i;
+        } else {
+            workers->terminated.entries[i] = workers->terminated.entries[--workers->terminated.size];
+        }
+    }
+#endif
+}
+
+static struct st_fcgi_worker_t *acquire_worker(h2o_fastcgi_workers_t *workers, uint64_t now, int *spawn)
+{
+    /* caller should lock the mutex, and call start_worker after unlocking it if *spawn is set */
+    struct st_fcgi_worker_t *worker = NULL, *vacant = NULL;
+    size_t i;
+
+    *spawn = 0;
+
+    /* use the idle worker that has been used most recently, so that the others stay idle long enough to be reaped */
+    for (i = 0; i != workers->config.max_workers; ++i) {
+        struct st_fcgi_worker_t *w = workers->workers + i;
+        if (w->pid == -1) {
+            if (vacant == NULL)
+                vacant = w;
+        } else if (!w->is_busy && (worker == NULL || w->idle_since > worker->idle_since)) {
+            worker = w;
+        }
+    }
+    /* spawn a new worker if all the running ones are busy; the listening socket already exists, so the request can be sent to the
+     * socket before the worker becomes ready */
+    if (worker == NULL) {
+        if (vacant == NULL)
+            return NULL;
+        reserve_worker(workers, vacant, now);
+        worker = vacant;
+        *spawn = 1;
+    }
+
+    worker->is_busy = 1;
+    ++workers->num_busy;
+    return worker;
+}
+
+static void wakeup_waiter(h2o_fastcgi_workers_t *workers)
+{
+    /* caller should lock the mutex */
+    h2o_linklist_t *link;
+
+    /* notify the first context that has not yet been notified, moving it to the tail so that the contexts are served in
+     * round-robin; contexts already being notified will acquire as many workers as available when handling the notification */
+    for (link = workers->waiters.next; link != &workers->waiters; link = link->next) {
+        struct st_fcgi_context_t *ctx = H2O_STRUCT_FROM_MEMBER(struct st_fcgi_context_t, workers._waiters_link, link);
+        if (!ctx->workers.wakeup_sent) {
+            h2o_linklist_unlink(&ctx->workers._waiters_link);
+            h2o_linklist_insert(&workers->waiters, &ctx->workers._waiters_link);
+            ctx->workers.wakeup_sent = 1;
+            h2o_multithread_send_message(&ctx->workers.receiver, &ctx->workers.wakeup);
+            break;
+        }
+    }
+}
+
+static void release_worker(h2o_fastcgi_workers_t *workers, struct st_fcgi_worker_t *worker)
+{
+    /* called when the process of an acquired worker could not be spawned */
+    lock_workers(workers);
+    worker->is_busy = 0;
+    --workers->num_busy;
+    wakeup_waiter(workers);
+    unlock_workers(workers);
+}
+
+static void on_connect_timeout(h2o_timeout_entry_t *entry);
+
+static void connect_to_worker(struct st_fcgi_generator_t *generator, struct st_fcgi_worker_t *worker)
+{
+    h2o_context_t *ctx = generator->req->conn->ctx;
+
+    generator->worker = worker;
+    generator->worker_acquired_at = h2o_now(ctx->loop);
+    set_timeout(generator, &generator->ctx->io_timeout, on_connect_timeout);
+    h2o_socketpool_connect(&generator->connect_req, &worker->sockpool, ctx->loop, &ctx->receivers.hostinfo_getaddr, on_connect,
+                           generator);
+}
+
+static void send_service_unavailable(struct st_fcgi_generator_t *generator, const char *msg)
+{
+    h2o_req_t *req = generator->req;
+
+    h2o_req_log_error(req, MODULE_NAME, "%s", msg);
+    close_generator(generator);
+    h2o_send_error_503(req, "Service Unavailable", "service unavailable", 0);
+}
+
+static void on_queue_timeout(h2o_timeout_entry_t *entry)
+{
+    struct st_fcgi_generator_t *generator = H2O_STRUCT_FROM_MEMBER(struct st_fcgi_generator_t, timeout, entry);
+    h2o_fastcgi_workers_t *workers = generator->ctx->handler->workers;
+
+    lock_workers(workers);
+    ++workers->stats.queue_timeouts;
+    unlock_workers(workers);
+
+    send_service_unavailable(generator, "timeout while waiting for a worker");
+}
+
+static void dispatch_queued(struct st_fcgi_context_t *ctx, h2o_loop_t *loop)
+{
+    h2o_fastcgi_workers_t *workers = ctx->handler->workers;
+
+    while (!h2o_linklist_is_empty(&ctx->workers.queue)) {
+        struct st_fcgi_generator_t *generator =
+            H2O_STRUCT_FROM_MEMBER(struct st_fcgi_generator_t, _pending_link, ctx->workers.queue.next);
+        struct st_fcgi_worker_t *worker;
+        int spawn;
+        lock_workers(workers);
+        if ((worker = acquire_worker(workers, h2o_now(loop), &spawn)) != NULL) {
+            h2o_linklist_unlink(&generator->_pending_link);
+            --workers->num_queued;
+            if (h2o_linklist_is_empty(&ctx->workers.queue))
+                h2o_linklist_unlink(&ctx->workers._waiters_link);
+        }
+        unlock_workers(workers);
+        if (worker == NULL)
+            break;
+        if (spawn && start_worker(workers, worker, 0) != 0) {
+            release_worker(workers, worker);
+            send_service_unavailable(generator, "failed to spawn a worker");
+            continue;
+        }
+        connect_to_worker(generator, worker);
+    }
+}
+
+static void on_worker_available(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages)
+{
+    struct st_fcgi_context_t *ctx = H2O_STRUCT_FROM_MEMBER(struct st_fcgi_context_t, workers.receiver, receiver);
+
+    while (!h2o_linklist_is_empty(messages))
+        h2o_linklist_unlink(messages->next);
+
+    lock_workers(ctx->handler->workers);
+    ctx->workers.wakeup_sent = 0;
+    unlock_workers(ctx->handler->workers);
+
+    dispatch_queued(ctx, h2o_multithread_get_loop(receiver->queue));
+}
+
+static void workers_attach(struct st_fcgi_generator_t *generator)
+{
+    h2o_fastcgi_workers_t *workers = generator->ctx->handler->workers;
+    struct st_fcgi_context_t *ctx = generator->ctx;
+    struct st_fcgi_worker_t *worker = NULL;
+    int spawn = 0, queued = 0;
+
+    lock_workers(workers);
+    /* requests already waiting in the queue are served first */
+    if (h2o_linklist_is_empty(&ctx->workers.queue))
+        worker = acquire_worker(workers, h2o_now(generator->req->conn->ctx->loop), &spawn);
+    if (worker == NULL) {
+        if (workers->num_queued < workers->config.max_queued) {
+            h2o_linklist_insert(&ctx->workers.queue, &generator->_pending_link);
+            ++workers->num_queued;
+            if (!h2o_linklist_is_linked(&ctx->workers._waiters_link))
+                h2o_linklist_insert(&workers->waiters, &ctx->workers._waiters_link);
+            queued = 1;
+        } else {
+            ++workers->stats.queue_rejected;
+        }
+    }
+    unlock_workers(workers);
+
+    if (worker != NULL) {
+        if (spawn && start_worker(workers, worker, 0) != 0) {
+            release_worker(workers, worker);
+            send_service_unavailable(generator, "failed to spawn a worker");
+            return;
+        }
+        connect_to_worker(generator, worker);
+    } else if (queued) {
+        set_timeout(generator, &ctx->workers.queue_timeout, on_queue_timeout);
+    } else {
+        send_service_unavailable(generator, "too many requests waiting for a worker");
+    }
+}
+
+static void workers_detach(struct st_fcgi_generator_t *generator)
+{
+    h2o_fastcgi_workers_t *workers = generator->ctx->handler->workers;
+
+    if (generator->worker != NULL) {
+        uint64_t now = h2o_now(generator->req->conn->ctx->loop), elapsed = now - generator->worker_acquired_at;
+        lock_workers(workers);
+        generator->worker->is_busy = 0;
+        generator->worker->idle_since = now;
+        --workers->num_busy;
+        workers->latency = workers->stats.requests == 0 ? elapsed : (workers->latency * 7 + elapsed) / 8;
+        ++workers->stats.requests;
+        wakeup_waiter(workers);
+        unlock_workers(workers);
+        generator->worker = NULL;
+    } else if (h2o_linklist_is_linked(&generator->_pending_link)) {
+        struct st_fcgi_context_t *ctx = generator->ctx;
+        lock_workers(workers);
+        h2o_linklist_unlink(&generator->_pending_link);
+        --workers->num_queued;
+        if (h2o_linklist_is_empty(&ctx->workers.queue))
+            h2o_linklist_unlink(&ctx->workers._waiters_link);
+        unlock_workers(workers);
+    }
+}
+
+static void on_reaper_timeout(h2o_timeout_entry_t *entry)
+{
+    h2o_fastcgi_workers_t *workers = H2O_STRUCT_FROM_MEMBER(h2o_fastcgi_workers_t, reaper.entry, entry);
+    uint64_t now = h2o_now(workers->reaper.loop);
+    H2O_VECTOR(struct st_fcgi_worker_t *) respawn = {NULL};
+    H2O_VECTOR(int) respawn_is_busy = {NULL};
+    size_t i;
+
+    lock_workers(workers);
+#ifndef _MSC_VER
+    /* respawn the workers that have exited unexpectedly, if they are handling a request (so that the connection queued in the
+     * listening socket gets accepted) or if necessary for maintaining min_workers */
+    for (i = 0; i != workers->config.max_workers; ++i) {
+        struct st_fcgi_worker_t *worker = workers->workers + i;
+        if (worker->pid > 0 && waitpid(worker->pid, NULL, WNOHANG) == worker->pid) {
+            fprintf(stderr, "[%s] worker process (pid:%d) exited unexpectedly\n", MODULE_NAME, (int)worker->pid);
+            close(worker->pipe_fd);
+            worker->pid = -1;
+            worker->pipe_fd = -1;
+            --workers->num_running;
+            ++workers->stats.terminated;
+            if (worker->is_busy || workers->num_running < workers->config.min_workers) {
+                reserve_worker(workers, worker, now);
+                h2o_vector_reserve(NULL, &respawn, respawn.size + 1);
+                h2o_vector_reserve(NULL, &respawn_is_busy, respawn_is_busy.size + 1);
+                respawn.entries[respawn.size++] = worker;
+                respawn_is_busy.entries[respawn_is_busy.size++] = worker->is_busy;
+            }
+        }
+    }
+#endif
+    /* terminate the workers that have been idle for too long, starting from the ones spawned on demand */
+    for (i = workers->config.max_workers; i != 0 && workers->num_running > workers->config.min_workers; --i) {
+        struct st_fcgi_worker_t *worker = workers->workers + i - 1;
+        if (worker->pid > 0 && !worker->is_busy && now - worker->idle_since >= workers->config.idle_timeout)
+            terminate_worker(workers, worker);
+    }
+    reap_terminated(workers);
+    unlock_workers(workers);
+
+    /* the request handled by a worker that cannot be respawned fails immediately, instead of waiting for the I/O timeout */
+    for (i = 0; i != respawn.size; ++i)
+        start_worker(workers, respawn.entries[i], respawn_is_busy.entries[i]);
+    free(respawn.entries);
+    free(respawn_is_busy.entries);
+
+    h2o_timeout_link(workers->reaper.loop, &workers->reaper.timeout, &workers->reaper.entry);
+}
+
+static void workers_on_context_init(struct st_fcgi_context_t *handler_ctx, h2o_context_t *ctx)
+{
+    h2o_fastcgi_workers_t *workers = handler_ctx->handler->workers;
+    size_t i;
+
+    h2o_linklist_init_anchor(&handler_ctx->workers.queue);
+    h2o_timeout_init(ctx->loop, &handler_ctx->workers.queue_timeout,
+                     workers->config.queue_timeout != 0 ? workers->config.queue_timeout : handler_ctx->handler->config.io_timeout);
+    h2o_multithread_register_receiver(ctx->queue, &handler_ctx->workers.receiver, on_worker_available);
+    handler_ctx->workers.wakeup = (h2o_multithread_message_t){{NULL}};
+    handler_ctx->workers.wakeup_sent = 0;
+    handler_ctx->workers._waiters_link = (h2o_linklist_t){NULL};
+
+    /* use the first event loop for handling timeouts of the socket pools and for reaping the workers */
+    if (workers->reaper.loop == NULL) {
+        for (i = 0; i != workers->config.max_workers; ++i)
+            h2o_socketpool_set_timeout(&workers->workers[i].sockpool, ctx->loop,
+                                       handler_ctx->handler->config.keepalive_timeout != 0 ? handler_ctx->handler->config.keepalive_timeout
+                                                                                          : 60000);
+        workers->reaper.loop = ctx->loop;
+        h2o_timeout_init(ctx->loop, &workers->reaper.timeout, 1000);
+        workers->reaper.entry.cb = on_reaper_timeout;
+        h2o_timeout_link(ctx->loop, &workers->reaper.timeout, &workers->reaper.entry);
+    }
+}
+
+static void workers_on_context_dispose(struct st_fcgi_context_t *handler_ctx, h2o_context_t *ctx)
+{
+    h2o_fastcgi_workers_t *workers = handler_ctx->handler->workers;
+
+    /* the context is no longer notified once removed from the waiters, therefore the pending notification can be discarded */
+    lock_workers(workers);
+    if (h2o_linklist_is_linked(&handler_ctx->workers._waiters_link))
+        h2o_linklist_unlink(&handler_ctx->workers._waiters_link);
+    unlock_workers(workers);
+    if (h2o_linklist_is_linked(&handler_ctx->workers.wakeup.link))
+        h2o_linklist_unlink(&handler_ctx->workers.wakeup.link);
+    h2o_multithread_unregister_receiver(ctx->queue, &handler_ctx->workers.receiver);
+    h2o_timeout_dispose(ctx->loop, &handler_ctx->workers.queue_timeout);
+
+    if (workers->reaper.loop == ctx->loop) {
+        if (h2o_timeout_is_linked(&workers->reaper.entry))
+            h2o_timeout_unlink(&workers->reaper.entry);
+        h2o_timeout_dispose(ctx->loop, &workers->reaper.timeout);
+    }
+}
+
+static void destroy_workers(h2o_fastcgi_workers_t *workers)
+{
+    size_t i;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&workers_registry.mutex);
+    if (h2o_linklist_is_linked(&workers->_link))
+        h2o_linklist_unlink(&workers->_link);
+    pthread_mutex_unlock(&workers_registry.mutex);
+#else
+    uv_mutex_lock(&workers_registry.mutex);
+    if (h2o_linklist_is_linked(&workers->_link))
+        h2o_linklist_unlink(&workers->_link);
+    uv_mutex_unlock(&workers_registry.mutex);
+#endif
+
+    for (i = 0; i != workers->config.max_workers; ++i) {
+        struct st_fcgi_worker_t *worker = workers->workers + i;
+        if (worker->pid > 0)
+            terminate_worker(workers, worker);
+        close(worker->listen_fd);
+        h2o_socketpool_dispose(&worker->sockpool);
+    }
+    reap_terminated(workers);
+    free(workers->terminated.entries);
+    free(workers->workers);
+    for (i = 0; workers->argv[i] != NULL; ++i)
+        free(workers->argv[i]);
+    free(workers->argv);
+    free(workers->path.base);
+#ifndef _MSC_VER
+    pthread_mutex_destroy(&workers->mutex);
+#else
+    uv_mutex_destroy(&workers->mutex);
+#endif
+    free(workers);
+}
+
+h2o_fastcgi_workers_t *h2o_fastcgi_workers_create(char **argv, int *listen_fds, h2o_fastcgi_workers_config_t *config)
+{
+    h2o_fastcgi_workers_t *workers = h2o_mem_alloc(sizeof(*workers));
+    size_t i, argc;
+
+    assert(config->min_workers <= config->max_workers);
+    assert(config->max_workers != 0);
+
+    *workers = (h2o_fastcgi_workers_t){{NULL}};
+    for (argc = 0; argv[argc] != NULL; ++argc)
+        ;
+    workers->argv = h2o_mem_alloc(sizeof(*workers->argv) * (argc + 1));
+    for (i = 0; i != argc; ++i)
+        workers->argv[i] = h2o_strdup(NULL, argv[i], SIZE_MAX).base;
+    workers->argv[argc] = NULL;
+    workers->config = *config;
+#ifndef _MSC_VER
+    pthread_mutex_init(&workers->mutex, NULL);
+#else
+    uv_mutex_init(&workers->mutex);
+#endif
+    h2o_linklist_init_anchor(&workers->waiters);
+
+    workers->workers = h2o_mem_alloc(sizeof(*workers->workers) * config->max_workers);
+    for (i = 0; i != config->max_workers; ++i) {
+        struct st_fcgi_worker_t *worker = workers->workers + i;
+        struct sockaddr_storage ss;
+        socklen_t sslen = sizeof(ss);
+        memset(&ss, 0, sizeof(ss));
+        if (getsockname(listen_fds[i], (void *)&ss, &sslen) != 0)
+            fprintf(stderr, "[%s] getsockname(2) failed:%s\n", MODULE_NAME, strerror(errno));
+        h2o_socketpool_init_by_address(&worker->sockpool, (void *)&ss, sslen, 0, SIZE_MAX);
+        worker->listen_fd = listen_fds[i];
+        worker->pid = -1;
+        worker->pipe_fd = -1;
+        worker->is_busy = 0;
+        worker->idle_since = 0;
+    }
+
+    /* spawn the minimum number of workers */
+    for (i = 0; i != config->min_workers; ++i) {
+        reserve_worker(workers, workers->workers + i, 0);
+        if (start_worker(workers, workers->workers + i, 0) != 0) {
+            destroy_workers(workers);
+            return NULL;
+        }
+    }
+
+    return workers;
+}
+
+void h2o_fastcgi_foreach_workers(void (*cb)(h2o_fastcgi_workers_status_t *status, void *data), void *data)
+{
+    h2o_linklist_t *link;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&workers_registry.mutex);
+#else
+    uv_mutex_lock(&workers_registry.mutex);
+#endif
+
+    for (link = workers_registry.pools.next; link != &workers_registry.pools; link = link->next) {
+        h2o_fastcgi_workers_t *workers = H2O_STRUCT_FROM_MEMBER(h2o_fastcgi_workers_t, _link, link);
+        h2o_fastcgi_workers_status_t status;
+        lock_workers(workers);
+        status.path = workers->path;
+        status.min_workers = workers->config.min_workers;
+        status.max_workers = workers->config.max_workers;
+        status.num_running = workers->num_running;
+        status.num_busy = workers->num_busy;
+        status.num_queued = workers->num_queued;
+        status.num_spawned = workers->stats.spawned;
+        status.num_terminated = workers->stats.terminated;
+        status.num_requests = workers->stats.requests;
+        status.num_queue_rejected = workers->stats.queue_rejected;
+        status.num_queue_timeouts = workers->stats.queue_timeouts;
+        status.latency = workers->latency;
+        unlock_workers(workers);
+        cb(&status, data);
+    }
+
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&workers_registry.mutex);
+#else
+    uv_mutex_unlock(&workers_registry.mutex);
+#endif
+}
+
+static void start_request(struct st_fcgi_generator_t *generator)
+{
+    h2o_context_t *ctx = generator->req->conn->ctx;
+
+    if (generator->ctx->handler->workers != NULL) {
+        workers_attach(generator);
+    } else if (generator->ctx->handler->config.multiplex.enabled && !generator->ctx->mpx.unsupported) {
+        mpx_attach(generator);
+    } else {
+        h2o_socketpool_connect(&generator->connect_req, &generator->ctx->handler->sockpool, ctx->loop,
+                               &ctx->receivers.hostinfo_getaddr, on_connect, generator);
+    }
+}
+
 static void do_proceed(h2o_generator_t *_generator, h2o_req_t *req)
 {
     struct st_fcgi_generator_t *generator = (void *)_generator;
 
+    if (generator->sock != NULL) {
+        /* release the input that has been sent by handle_input, and resume reading */
+        h2o_buffer_consume(&generator->sock->input, generator->_input.bytes_inflight);
+        generator->_input.bytes_inflight = 0;
+        h2o_buffer_consume(&generator->resp.receiving, generator->resp.receiving->size);
+        if (generator->_input.eos_received) {
+            send_eos_and_close(generator, generator->_input.can_keepalive);
+            return;
+        }
+        h2o_socket_read_start(generator->sock, on_read);
+        handle_input(generator);
+        return;
+    }
+
     h2o_doublebuffer_consume(&generator->resp.sending);
     do_send(generator);
+    if (generator->mpx != NULL)
+        mpx_update_reading(generator->mpx);
 }
 
 static void do_stop(h2o_generator_t *_generator, h2o_req_t *req)
@@ -777,14 +2066,22 @@ static int on_req(h2o_handler_t *_handler, h2o_req_t *req)
     generator->ctx = h2o_context_get_handler_context(req->conn->ctx, &handler->super);
     generator->req = req;
     generator->sock = NULL;
+    generator->mpx = NULL;
+    generator->request_id = 0;
+    generator->_pending_link = (h2o_linklist_t){NULL};
+    generator->worker = NULL;
     generator->sent_headers = 0;
+    generator->_record.is_open = 0;
+    generator->_input.bytes_inflight = 0;
+    generator->_input.eos_received = 0;
+    generator->_stdin.off = 0;
+    generator->_stdin._link = (h2o_linklist_t){NULL};
     h2o_doublebuffer_init(&generator->resp.sending, &h2o_socket_buffer_prototype);
     h2o_buffer_init(&generator->resp.receiving, &h2o_socket_buffer_prototype);
     generator->timeout = (h2o_timeout_entry_t){0};
 
     set_timeout(generator, &generator->ctx->io_timeout, on_connect_timeout);
-    h2o_socketpool_connect(&generator->connect_req, &handler->sockpool, req->conn->ctx->loop,
-                           &req->conn->ctx->receivers.hostinfo_getaddr, on_connect, generator);
+    start_request(generator);
 
     return 0;
 }
@@ -795,12 +2092,21 @@ static void on_context_init(h2o_handler_t *_handler, h2o_context_t *ctx)
     struct st_fcgi_context_t *handler_ctx = h2o_mem_alloc(sizeof(*handler_ctx));
 
     /* use the first event loop for handling timeouts of the socket pool */
-    if (handler->sockpool.timeout == UINT64_MAX)
+    if (handler->workers == NULL && handler->sockpool.timeout == UINT64_MAX)
         h2o_socketpool_set_timeout(&handler->sockpool, ctx->loop,
                                    handler->config.keepalive_timeout != 0 ? handler->config.keepalive_timeout : 60000);
 
     handler_ctx->handler = handler;
     h2o_timeout_init(ctx->loop, &handler_ctx->io_timeout, handler->config.io_timeout);
+    h2o_linklist_init_anchor(&handler_ctx->mpx.conns);
+    /* multiplexed connections are always kept, and keepalive_timeout (if set) determines how long they may stay idle */
+    if (handler->config.multiplex.enabled)
+        h2o_timeout_init(ctx->loop, &handler_ctx->mpx.idle_timeout,
+                         handler->config.keepalive_timeout != 0 ? handler->config.keepalive_timeout
+                                                                : H2O_DEFAULT_FASTCGI_MULTIPLEX_IDLE_TIMEOUT);
+    handler_ctx->mpx.unsupported = 0;
+    if (handler->workers != NULL)
+        workers_on_context_init(handler_ctx, ctx);
 
     h2o_context_set_handler_context(ctx, &handler->super, handler_ctx);
 }
@@ -813,6 +2119,12 @@ static void on_context_dispose(h2o_handler_t *_handler, h2o_context_t *ctx)
     if (handler_ctx == NULL)
         return;
 
+    while (!h2o_linklist_is_empty(&handler_ctx->mpx.conns))
+        mpx_close(H2O_STRUCT_FROM_MEMBER(struct st_fcgi_mpx_conn_t, _link, handler_ctx->mpx.conns.next), NULL);
+    if (handler->config.multiplex.enabled)
+        h2o_timeout_dispose(ctx->loop, &handler_ctx->mpx.idle_timeout);
+    if (handler->workers != NULL)
+        workers_on_context_dispose(handler_ctx, ctx);
     h2o_timeout_dispose(ctx->loop, &handler_ctx->io_timeout);
     free(handler_ctx);
 }
@@ -821,10 +2133,14 @@ static void on_handler_dispose(h2o_handler_t *_handler)
 {
     h2o_fastcgi_handler_t *handler = (void *)_handler;
 
+    /* terminate the workers before calling the dispose callback, which removes the directory containing their sockets */
+    if (handler->workers != NULL)
+        destroy_workers(handler->workers);
+    else
+        h2o_socketpool_dispose(&handler->sockpool);
+
     if (handler->config.callbacks.dispose != NULL)
         handler->config.callbacks.dispose(handler, handler->config.callbacks.data);
-
-    h2o_socketpool_dispose(&handler->sockpool);
     free(handler->config.document_root.base);
 }
 
@@ -860,3 +2176,23 @@ h2o_fastcgi_handler_t *h2o_fastcgi_register_by_address(h2o_pathconf_t *pathconf,
     h2o_socketpool_init_by_address(&handler->sockpool, sa, salen, 0, SIZE_MAX /* FIXME */);
     return handler;
 }
+
+h2o_fastcgi_handler_t *h2o_fastcgi_register_by_workers(h2o_pathconf_t *pathconf, h2o_fastcgi_workers_t *workers,
+                                                       h2o_fastcgi_config_vars_t *vars)
+{
+    h2o_fastcgi_handler_t *handler = register_common(pathconf, vars);
+
+    handler->workers = workers;
+    if (pathconf->path.base != NULL)
+        workers->path = h2o_strdup(NULL, pathconf->path.base, pathconf->path.len);
+#ifndef _MSC_VER
+    pthread_mutex_lock(&workers_registry.mutex);
+    h2o_linklist_insert(&workers_registry.pools, &workers->_link);
+    pthread_mutex_unlock(&workers_registry.mutex);
+#else
+    uv_mutex_lock(&workers_registry.mutex);
+    h2o_linklist_insert(&workers_registry.pools, &workers->_link);
+    uv_mutex_unlock(&workers_registry.mutex);
+#endif
+    return handler;
+}
@@ -29,6 +29,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -52,12 +53,36 @@ int pread(unsigned int fd, char *buf, size_t count, int offset)
 
 #endif
 
+#ifndef _MSC_VER
+#include <pthread.h>
+#include <openssl/sha.h>
+#endif
+
 #include "h2o.h"
 
 #define MAX_BUF_SIZE 65000
+#define MAX_SLICE_SIZE (1024 * 1024) /* maximum size of the slices of the mapping being sent at once */
+#define PRECOMPRESS_MIN_SIZE 1024
+#define PRECOMPRESS_MAX_SIZE (64 * 1024 * 1024)
+#define PRECOMPRESS_MAX_PENDING 256
+#define PRECOMPRESS_GZIP_QUALITY 9
+#define PRECOMPRESS_BROTLI_QUALITY 11
 #define BOUNDARY_SIZE 20
 #define FIXED_PART_SIZE (sizeof("\r\n--") - 1 + BOUNDARY_SIZE + sizeof("\r\nContent-Range: bytes=-/\r\nContent-Type: \r\n\r\n") - 1)
 
+/**
+ * state of the reads being run by the file I/O threads; the memory is shared by the request pool and the read in flight, so that
+ * the buffer remains valid if the request is disposed while a read is in progress
+ */
+struct st_h2o_sendfile_aio_t {
+    h2o_fileio_req_t req;
+    struct st_h2o_sendfile_generator_t *generator; /* NULL if the generator has been closed */
+    h2o_filecache_ref_t *fileref;
+    int is_inflight;
+    size_t prefix_len; /* number of bytes preceding the file content in the buffer */
+    char buf[1];
+};
+
 struct st_h2o_sendfile_generator_t {
     h2o_generator_t super;
     struct {
@@ -69,7 +94,13 @@ struct st_h2o_sendfile_generator_t {
     h2o_iovec_t content_encoding;
     unsigned send_vary : 1;
     unsigned send_etag : 1;
+    unsigned use_aio : 1;
+    unsigned fill_content_cache : 1; /* set if the content should be stored to the content cache once it is read */
+    unsigned precompress : 1;
+    unsigned use_mmap : 1;
     char *buf;
+    const char *mapping; /* set if the response is sent from the mapping of the file */
+    struct st_h2o_sendfile_aio_t *aio;
     struct {
         size_t filesize;
         size_t range_count;
@@ -124,30 +155,234 @@ static int tm_is_lessthan(struct tm *x, struct tm *y)
 #undef CMP
 }
 
+/**
+ * content of a file stored in the content cache, along with the attributes used for validating the entry
+ */
+struct st_h2o_file_content_t {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    char bytes[1];
+};
+
+struct st_h2o_file_content_ref_t {
+    h2o_cache_t *cache;
+    h2o_cache_ref_t *ref;
+};
+
+static void on_content_ref_dispose(void *_ref)
+{
+    struct st_h2o_file_content_ref_t *ref = _ref;
+    h2o_cache_release(ref->cache, ref->ref);
+}
+
+static h2o_cache_ref_t *fetch_content(h2o_req_t *req, h2o_filecache_ref_t *fileref)
+{
+    h2o_cache_t *cache = req->conn->ctx->globalconf->filecache.content.cache;
+    h2o_cache_ref_t *ref;
+    struct st_h2o_file_content_t *content;
+
+    if ((ref = h2o_cache_fetch(cache, h2o_now(req->conn->ctx->loop), h2o_iovec_init(fileref->_path, strlen(fileref->_path)), 0)) ==
+        NULL)
+        return NULL;
+    /* the cached content is used only if it was read from the file that the filecache considers current */
+    content = (void *)ref->value.base;
+    if (!(content->dev == fileref->st.st_dev && content->ino == fileref->st.st_ino && content->size == fileref->st.st_size &&
+          content->mtime == fileref->st.st_mtime && content->ctime == fileref->st.st_ctime)) {
+        h2o_cache_release(cache, ref);
+        return NULL;
+    }
+    ++req->conn->ctx->file.content_cache.hits;
+    return ref;
+}
+
+static void store_content(h2o_req_t *req, h2o_filecache_ref_t *fileref, const char *bytes, size_t len)
+{
+    struct st_h2o_file_content_t *content;
+
+    /* modifications made within the same second cannot be detected by comparing the mtime and the ctime */
+    if (fileref->st.st_mtime >= req->processed_at.at.tv_sec || fileref->st.st_ctime >= req->processed_at.at.tv_sec)
+        return;
+
+    content = h2o_mem_alloc(offsetof(struct st_h2o_file_content_t, bytes) + len);
+    content->dev = fileref->st.st_dev;
+    content->ino = fileref->st.st_ino;
+    content->size = fileref->st.st_size;
+    content->mtime = fileref->st.st_mtime;
+    content->ctime = fileref->st.st_ctime;
+    memcpy(content->bytes, bytes, len);
+    h2o_cache_set(req->conn->ctx->globalconf->filecache.content.cache, h2o_now(req->conn->ctx->loop),
+                  h2o_iovec_init(fileref->_path, strlen(fileref->_path)), 0,
+                  h2o_iovec_init(content, offsetof(struct st_h2o_file_content_t, bytes) + len));
+    ++req->conn->ctx->file.content_cache.stores;
+}
+
+static void on_mapped_file_dispose(void *_ref)
+{
+    h2o_filecache_ref_t **ref = _ref;
+    h2o_filecache_close_file(*ref);
+}
+
+/**
+ * the index file of a directory and the directory listing, cached while the directory is not modified
+ */
+struct st_h2o_file_dir_t {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    int index_file;     /* offset within h2o_file_handler_t::index_files, or -1 if none of the index files exist */
+    size_t listing_len; /* SIZE_MAX if the listing has not been rendered */
+    char listing[1];
+};
+
+struct st_h2o_file_dir_lookup_t {
+    h2o_cache_t *cache; /* NULL if the cache is disabled, or if the directory cannot be stat'ed */
+    h2o_iovec_t key;
+    struct stat st;
+};
+
+/**
+ * stats the directory (`path` ending with a slash) and returns the cached entry if it is up-to-date; the entry is released when the
+ * request is disposed
+ */
+static struct st_h2o_file_dir_t *fetch_dir(h2o_handler_t *handler, h2o_req_t *req, const char *path,
+                                           struct st_h2o_file_dir_lookup_t *lookup)
+{
+    h2o_cache_ref_t *ref;
+    struct st_h2o_file_dir_t *dir;
+    struct st_h2o_file_content_ref_t *slot;
+
+    if ((lookup->cache = req->conn->ctx->globalconf->filecache.dir.cache) == NULL)
+        return NULL;
+    if (stat(path, &lookup->st) != 0) {
+        lookup->cache = NULL;
+        return NULL;
+    }
+
+    /* the result depends on the configuration of the handler as well as the path */
+    lookup->key.base = h2o_mem_alloc_pool(&req->pool, sizeof("0x:") + sizeof(void *) * 2 + req->path_normalized.len);
+    lookup->key.len = sprintf(lookup->key.base, "%p:", handler);
+    memcpy(lookup->key.base + lookup->key.len, req->path_normalized.base, req->path_normalized.len);
+    lookup->key.len += req->path_normalized.len;
+
+    if ((ref = h2o_cache_fetch(lookup->cache, h2o_now(req->conn->ctx->loop), lookup->key, 0)) == NULL)
+        return NULL;
+    dir = (void *)ref->value.base;
+    if (!(dir->dev == lookup->st.st_dev && dir->ino == lookup->st.st_ino && dir->mtime == lookup->st.st_mtime)) {
+        h2o_cache_release(lookup->cache, ref);
+        return NULL;
+    }
+    slot = h2o_mem_alloc_shared(&req->pool, sizeof(*slot), on_content_ref_dispose);
+    slot->cache = lookup->cache;
+    slot->ref = ref;
+    return dir;
+}
+
+static void store_dir(h2o_req_t *req, struct st_h2o_file_dir_lookup_t *lookup, int index_file, h2o_iovec_t listing)
+{
+    struct st_h2o_file_dir_t *dir;
+
+    if (lookup->cache == NULL)
+        return;
+    /* modifications made within the same second cannot be detected by comparing the mtime */
+    if (lookup->st.st_mtime >= req->processed_at.at.tv_sec)
+        return;
+
+    dir = h2o_mem_alloc(offsetof(struct st_h2o_file_dir_t, listing) + listing.len);
+    dir->dev = lookup->st.st_dev;
+    dir->ino = lookup->st.st_ino;
+    dir->mtime = lookup->st.st_mtime;
+    dir->index_file = index_file;
+    dir->listing_len = listing.base != NULL ? listing.len : SIZE_MAX;
+    memcpy(dir->listing, listing.base, listing.len);
+    h2o_cache_set(lookup->cache, h2o_now(req->conn->ctx->loop), lookup->key, 0,
+                  h2o_iovec_init(dir, offsetof(struct st_h2o_file_dir_t, listing) + listing.len));
+}
+
 static void do_close(h2o_generator_t *_self, h2o_req_t *req)
 {
     struct st_h2o_sendfile_generator_t *self = (void *)_self;
+
+    /* the protocol handler might still be referring to the slices of the mapping, so the file is closed when the pool is cleared
+     * (see do_send_file) */
+    if (self->mapping != NULL)
+        return;
+    if (self->aio != NULL && self->aio->is_inflight) {
+        /* the file is closed once the read completes */
+        self->aio->generator = NULL;
+        self->aio->fileref = self->file.ref;
+        self->aio = NULL;
+        return;
+    }
     h2o_filecache_close_file(self->file.ref);
 }
 
-static void do_proceed(h2o_generator_t *_self, h2o_req_t *req)
+static void on_aio_complete(h2o_fileio_req_t *_req);
+
+/**
+ * reads the file into the buffer (after `prefix_len` bytes), calling `cb` synchronously, or upon completion if the generator uses
+ * the file I/O threads
+ */
+static void read_file(struct st_h2o_sendfile_generator_t *self, size_t prefix_len, size_t rlen,
+                      void (*cb)(struct st_h2o_sendfile_generator_t *self, size_t prefix_len, ssize_t rret))
 {
-    struct st_h2o_sendfile_generator_t *self = (void *)_self;
-    size_t rlen;
     ssize_t rret;
+
+    if (self->aio != NULL) {
+        struct st_h2o_sendfile_aio_t *aio = self->aio;
+        aio->req.op = H2O_FILEIO_OP_PREAD;
+        aio->req.pread.fd = self->file.ref->fd;
+        aio->req.pread.buf = self->buf + prefix_len;
+        aio->req.pread.len = rlen;
+        aio->req.pread.off = self->file.off;
+        aio->req.cb = on_aio_complete;
+        aio->req.data = (void *)cb;
+        aio->is_inflight = 1;
+        aio->prefix_len = prefix_len;
+        h2o_mem_addref_shared(aio);
+        h2o_fileio_submit(&aio->req, &self->req->conn->ctx->receivers.fileio);
+        return;
+    }
+
+    while ((rret = pread(self->file.ref->fd, self->buf + prefix_len, rlen, self->file.off)) == -1 && errno == EINTR)
+        ;
+    cb(self, prefix_len, rret);
+}
+
+static void on_aio_complete(h2o_fileio_req_t *_req)
+{
+    struct st_h2o_sendfile_aio_t *aio = H2O_STRUCT_FROM_MEMBER(struct st_h2o_sendfile_aio_t, req, _req);
+    void (*cb)(struct st_h2o_sendfile_generator_t *, size_t, ssize_t) = (void *)aio->req.data;
+
+    aio->is_inflight = 0;
+    if (aio->generator != NULL) {
+        if (aio->req.ret == -1)
+            errno = aio->req.err;
+        cb(aio->generator, aio->prefix_len, aio->req.ret);
+    } else {
+        h2o_filecache_close_file(aio->fileref);
+    }
+    h2o_mem_release_shared(aio);
+}
+
+static void on_read(struct st_h2o_sendfile_generator_t *self, size_t prefix_len, ssize_t rret)
+{
+    h2o_req_t *req = self->req;
     h2o_iovec_t vec;
     h2o_send_state_t send_state;
 
-    /* read the file */
-    rlen = self->bytesleft;
-    if (rlen > MAX_BUF_SIZE)
-        rlen = MAX_BUF_SIZE;
-    while ((rret = pread(self->file.ref->fd, self->buf, rlen, self->file.off)) == -1 && errno == EINTR)
-    if (rret == -1) {
+    if (rret <= 0) {
         h2o_send(req, NULL, 0, H2O_SEND_STATE_ERROR);
         do_close(&self->super, req);
         return;
     }
+    if (self->fill_content_cache) {
+        if (self->file.off == 0 && rret == self->file.ref->st.st_size)
+            store_content(req, self->file.ref, self->buf, rret);
+        self->fill_content_cache = 0;
+    }
     self->file.off += rret;
     self->bytesleft -= rret;
     if (self->bytesleft == 0) {
@@ -164,35 +399,71 @@ static void do_proceed(h2o_generator_t *_self, h2o_req_t *req)
         do_close(&self->super, req);
 }
 
+static void do_proceed(h2o_generator_t *_self, h2o_req_t *req)
+{
+    struct st_h2o_sendfile_generator_t *self = (void *)_self;
+    size_t rlen;
+
+    /* read the file */
+    rlen = self->bytesleft;
+    if (rlen > MAX_BUF_SIZE && !self->fill_content_cache)
+        rlen = MAX_BUF_SIZE;
+    read_file(self, 0, rlen, on_read);
+}
+
+static void on_multirange_read(struct st_h2o_sendfile_generator_t *self, size_t used_buf, ssize_t rret);
+
+/**
+ * moves to the next range of a multipart/byteranges response, writing the headers of the part to `buf`
+ */
+static size_t start_next_range(struct st_h2o_sendfile_generator_t *self, char *buf)
+{
+    size_t *range_cur = self->ranged.range_infos + 2 * self->ranged.current_range;
+    size_t range_end = *range_cur + *(range_cur + 1) - 1, len;
+
+    if (H2O_LIKELY(self->ranged.current_range != 0))
+        len = sprintf(buf, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zd-%zd/%zd\r\n\r\n", self->ranged.boundary.base,
+                      self->ranged.mimetype.base, *range_cur, range_end, self->ranged.filesize);
+    else
+        len = sprintf(buf, "--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zd-%zd/%zd\r\n\r\n", self->ranged.boundary.base,
+                      self->ranged.mimetype.base, *range_cur, range_end, self->ranged.filesize);
+    self->ranged.current_range++;
+    self->file.off = *range_cur;
+    self->bytesleft = *++range_cur;
+
+    return len;
+}
+
+static h2o_iovec_t build_last_boundary(struct st_h2o_sendfile_generator_t *self, h2o_req_t *req)
+{
+    h2o_iovec_t buf;
+
+    buf.base = h2o_mem_alloc_pool(&req->pool, sizeof("\r\n--") - 1 + BOUNDARY_SIZE + sizeof("--\r\n"));
+    buf.len = sprintf(buf.base, "\r\n--%s--\r\n", self->ranged.boundary.base);
+    return buf;
+}
+
 static void do_multirange_proceed(h2o_generator_t *_self, h2o_req_t *req)
 {
     struct st_h2o_sendfile_generator_t *self = (void *)_self;
     size_t rlen, used_buf = 0;
-    ssize_t rret, vecarrsize;
-    h2o_iovec_t vec[2];
-    h2o_send_state_t send_state;
 
-    if (self->bytesleft == 0) {
-        size_t *range_cur = self->ranged.range_infos + 2 * self->ranged.current_range;
-        size_t range_end = *range_cur + *(range_cur + 1) - 1;
-        if (H2O_LIKELY(self->ranged.current_range != 0))
-            used_buf =
-                sprintf(self->buf, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zd-%zd/%zd\r\n\r\n",
-                        self->ranged.boundary.base, self->ranged.mimetype.base, *range_cur, range_end, self->ranged.filesize);
-        else
-            used_buf =
-                sprintf(self->buf, "--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zd-%zd/%zd\r\n\r\n",
-                        self->ranged.boundary.base, self->ranged.mimetype.base, *range_cur, range_end, self->ranged.filesize);
-        self->ranged.current_range++;
-        self->file.off = *range_cur;
-        self->bytesleft = *++range_cur;
-    }
+    if (self->bytesleft == 0)
+        used_buf = start_next_range(self, self->buf);
     rlen = self->bytesleft;
     if (rlen + used_buf > MAX_BUF_SIZE)
         rlen = MAX_BUF_SIZE - used_buf;
-    while ((rret = pread(self->file.ref->fd, self->buf + used_buf, rlen, self->file.off)) == -1 && errno == EINTR)
-        ;
-    if (rret == -1)
+    read_file(self, used_buf, rlen, on_multirange_read);
+}
+
+static void on_multirange_read(struct st_h2o_sendfile_generator_t *self, size_t used_buf, ssize_t rret)
+{
+    h2o_req_t *req = self->req;
+    ssize_t vecarrsize;
+    h2o_iovec_t vec[2];
+    h2o_send_state_t send_state;
+
+    if (rret <= 0)
         goto Error;
     self->file.off += rret;
     self->bytesleft -= rret;
@@ -200,8 +471,7 @@ static void do_multirange_proceed(h2o_generator_t *_self, h2o_req_t *req)
     vec[0].base = self->buf;
     vec[0].len = rret + used_buf;
     if (self->ranged.current_range == self->ranged.range_count && self->bytesleft == 0) {
-        vec[1].base = h2o_mem_alloc_pool(&req->pool, sizeof("\r\n--") - 1 + BOUNDARY_SIZE + sizeof("--\r\n"));
-        vec[1].len = sprintf(vec[1].base, "\r\n--%s--\r\n", self->ranged.boundary.base);
+        vec[1] = build_last_boundary(self, req);
         vecarrsize = 2;
         send_state = H2O_SEND_STATE_FINAL;
     } else {
@@ -219,6 +489,48 @@ Error:
     return;
 }
 
+/**
+ * sends the slices of the mapping; single-range and multirange responses are handled by adjusting the offsets
+ */
+static void do_mmap_proceed(h2o_generator_t *_self, h2o_req_t *req)
+{
+    struct st_h2o_sendfile_generator_t *self = (void *)_self;
+    h2o_iovec_t vecs[3];
+    size_t veccnt = 0, slice_len;
+
+    /* abort if the pages sent so far have been found to be missing, and drop the entry so that the file is mapped again */
+    if (h2o_filecache_mapping_is_truncated(self->file.ref)) {
+        h2o_filecache_invalidate(req->conn->ctx->filecache, self->file.ref);
+        h2o_send(req, NULL, 0, H2O_SEND_STATE_ERROR);
+        return;
+    }
+    /* the last slice is sent as IN_PROGRESS, so that the response is closed only after all the pages have been read */
+    if (self->bytesleft == 0 && self->ranged.current_range == self->ranged.range_count) {
+        h2o_send(req, NULL, 0, H2O_SEND_STATE_FINAL);
+        return;
+    }
+
+    if (self->ranged.range_count > 1 && self->bytesleft == 0) {
+        vecs[veccnt].base =
+            h2o_mem_alloc_pool(&req->pool, FIXED_PART_SIZE + self->ranged.mimetype.len + sizeof(H2O_UINT64_LONGEST_STR) * 3);
+        vecs[veccnt].len = start_next_range(self, vecs[veccnt].base);
+        ++veccnt;
+    }
+
+    slice_len = self->bytesleft;
+    if (slice_len > req->preferred_chunk_size)
+        slice_len = req->preferred_chunk_size;
+    if (slice_len > MAX_SLICE_SIZE)
+        slice_len = MAX_SLICE_SIZE;
+    vecs[veccnt++] = h2o_iovec_init(self->mapping + self->file.off, slice_len);
+    self->file.off += slice_len;
+    self->bytesleft -= slice_len;
+
+    if (self->bytesleft == 0 && self->ranged.current_range == self->ranged.range_count && self->ranged.range_count > 1)
+        vecs[veccnt++] = build_last_boundary(self, req);
+    h2o_send(req, vecs, veccnt, H2O_SEND_STATE_IN_PROGRESS);
+}
+
 static h2o_send_state_t do_pull(h2o_generator_t *_self, h2o_req_t *req, h2o_iovec_t *buf)
 {
     struct st_h2o_sendfile_generator_t *self = (void *)_self;
@@ -257,7 +569,7 @@ static struct st_h2o_sendfile_generator_t *create_generator(h2o_req_t *req, cons
     if ((flags & H2O_FILE_FLAG_SEND_COMPRESSED) != 0 && req->version >= 0x101) {
         int compressible_types = h2o_get_compressible_types(&req->headers);
         if (compressible_types != 0) {
-            char *variant_path = h2o_mem_alloc_pool(&req->pool, path_len + sizeof(".gz"));
+            char *variant_path = h2o_mem_alloc_pool(&req->pool, path_len + sizeof(".zst"));
             memcpy(variant_path, path, path_len);
 #define TRY_VARIANT(mask, enc, ext)                                                                                                \
     if ((compressible_types & mask) != 0) {                                                                                        \
@@ -267,6 +579,7 @@ static struct st_h2o_sendfile_generator_t *create_generator(h2o_req_t *req, cons
             goto Opened;                                                                                                           \
         }                                                                                                                          \
     }
+            TRY_VARIANT(H2O_COMPRESSIBLE_ZSTD, "zstd", ".zst");
             TRY_VARIANT(H2O_COMPRESSIBLE_BROTLI, "br", ".br");
             TRY_VARIANT(H2O_COMPRESSIBLE_GZIP, "gzip", ".gz");
 #undef TRY_VARIANT
@@ -307,8 +620,14 @@ Opened:
     self->ranged.range_count = 0;
     self->ranged.range_infos = NULL;
     self->content_encoding = content_encoding;
-    self->send_vary = (flags & H2O_FILE_FLAG_SEND_COMPRESSED) != 0;
+    self->send_vary = (flags & (H2O_FILE_FLAG_SEND_COMPRESSED | H2O_FILE_FLAG_PRECOMPRESS)) != 0;
+    self->precompress = (flags & H2O_FILE_FLAG_PRECOMPRESS) != 0;
     self->send_etag = (flags & H2O_FILE_FLAG_NO_ETAG) == 0;
+    self->use_aio = (flags & H2O_FILE_FLAG_ASYNC_IO) != 0;
+    self->use_mmap = (flags & H2O_FILE_FLAG_MMAP) != 0;
+    self->mapping = NULL;
+    self->fill_content_cache = 0;
+    self->aio = NULL;
 
     return self;
 }
@@ -370,18 +689,61 @@ static void do_send_file(struct st_h2o_sendfile_generator_t *self, h2o_req_t *re
         return;
     }
 
+    if (self->ranged.range_count == 1)
+        self->file.off = self->ranged.range_infos[0];
+
+    /* send from the content cache, or read the entire file at once so that it can be cached */
+    if (req->conn->ctx->globalconf->filecache.content.cache != NULL && self->ranged.range_count < 2 &&
+        self->file.ref->st.st_size <= req->conn->ctx->globalconf->filecache.content.max_object_size) {
+        h2o_cache_ref_t *content_ref;
+        if ((content_ref = fetch_content(req, self->file.ref)) != NULL) {
+            static h2o_generator_t generator = {NULL, NULL};
+            struct st_h2o_file_content_ref_t *slot =
+                h2o_mem_alloc_shared(&req->pool, sizeof(*slot), on_content_ref_dispose);
+            h2o_iovec_t body =
+                h2o_iovec_init(((struct st_h2o_file_content_t *)content_ref->value.base)->bytes + self->file.off, self->bytesleft);
+            slot->cache = req->conn->ctx->globalconf->filecache.content.cache;
+            slot->ref = content_ref;
+            h2o_start_response(req, &generator);
+            h2o_send(req, &body, 1, H2O_SEND_STATE_FINAL);
+            do_close(&self->super, req);
+            return;
+        }
+        self->fill_content_cache = self->ranged.range_count == 0;
+    }
+
+    /* send slices of the mapping shared by the requests for the file */
+    if (self->use_mmap && !self->fill_content_cache && (self->mapping = h2o_filecache_get_mapping(self->file.ref).base) != NULL) {
+        h2o_filecache_ref_t **ref = h2o_mem_alloc_shared(&req->pool, sizeof(*ref), on_mapped_file_dispose);
+        *ref = self->file.ref;
+        self->super.proceed = do_mmap_proceed;
+        if (self->ranged.range_count > 1)
+            self->bytesleft = 0;
+        else
+            self->ranged.current_range = self->ranged.range_count;
+        h2o_start_response(req, &self->super);
+        do_mmap_proceed(&self->super, req);
+        return;
+    }
+
     /* send data */
     h2o_start_response(req, &self->super);
 
-    if (self->ranged.range_count == 1)
-        self->file.off = self->ranged.range_infos[0];
-    if (req->_ostr_top->start_pull != NULL && self->ranged.range_count < 2) {
+    if (!self->use_aio && !self->fill_content_cache && req->_ostr_top->start_pull != NULL && self->ranged.range_count < 2) {
         req->_ostr_top->start_pull(req->_ostr_top, do_pull);
     } else {
         size_t bufsz = MAX_BUF_SIZE;
-        if (self->bytesleft < bufsz)
+        if (self->bytesleft < bufsz || self->fill_content_cache)
             bufsz = self->bytesleft;
-        self->buf = h2o_mem_alloc_pool(&req->pool, bufsz);
+        if (self->use_aio) {
+            self->aio = h2o_mem_alloc_shared(&req->pool, offsetof(struct st_h2o_sendfile_aio_t, buf) + bufsz, NULL);
+            self->aio->generator = self;
+            self->aio->fileref = NULL;
+            self->aio->is_inflight = 0;
+            self->buf = self->aio->buf;
+        } else {
+            self->buf = h2o_mem_alloc_pool(&req->pool, bufsz);
+        }
         if (self->ranged.range_count < 2)
             do_proceed(&self->super, req);
         else {
@@ -404,21 +766,27 @@ int h2o_file_send(h2o_req_t *req, int status, const char *reason, const char *pa
     return 0;
 }
 
-static int send_dir_listing(h2o_req_t *req, const char *path, size_t path_len, int is_get)
+static int send_dir_listing(h2o_req_t *req, const char *path, size_t path_len, int is_get, struct st_h2o_file_dir_t *cached,
+                            struct st_h2o_file_dir_lookup_t *lookup)
 {
     static h2o_generator_t generator = {NULL, NULL};
     DIR *dp;
     h2o_buffer_t *body;
     h2o_iovec_t bodyvec;
 
-    /* build html */
-    if ((dp = opendir(path)) == NULL)
-        return -1;
-    body = build_dir_listing_html(&req->pool, req->path_normalized, dp);
-    closedir(dp);
+    if (cached != NULL && cached->listing_len != SIZE_MAX) {
+        bodyvec = h2o_iovec_init(cached->listing, cached->listing_len);
+    } else {
+        /* build html */
+        if ((dp = opendir(path)) == NULL)
+            return -1;
+        body = build_dir_listing_html(&req->pool, req->path_normalized, dp);
+        closedir(dp);
 
-    bodyvec = h2o_iovec_init(body->bytes, body->size);
-    h2o_buffer_link_to_pool(body, &req->pool);
+        bodyvec = h2o_iovec_init(body->bytes, body->size);
+        h2o_buffer_link_to_pool(body, &req->pool);
+        store_dir(req, lookup, -1, bodyvec);
+    }
 
     /* send response */
     req->res.status = 200;
@@ -601,6 +969,278 @@ static void send_method_not_allowed(h2o_req_t *req)
     h2o_send_error_405(req, "Method Not Allowed", "method not allowed", H2O_SEND_ERROR_KEEP_HEADERS);
 }
 
+#ifndef _MSC_VER
+
+/**
+ * a file being compressed in background; the results are saved as `<dst_base>.gz` (and `<dst_base>.br`)
+ */
+struct st_h2o_precompress_job_t {
+    h2o_linklist_t link;
+    char *src_path;
+    char *dst_base;
+    off_t size;
+    time_t mtime;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    h2o_linklist_t pending; /* list of jobs waiting to be run */
+    h2o_linklist_t running; /* list of jobs being run (at most one) */
+    size_t num_pending;
+    int thread_started;
+} precompress_queue = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {&precompress_queue.pending, &precompress_queue.pending},
+                       {&precompress_queue.running, &precompress_queue.running}};
+
+static void write_precompressed(struct st_h2o_precompress_job_t *job, const char *ext, h2o_compress_context_t *compressor,
+                                h2o_iovec_t content)
+{
+    h2o_iovec_t *outbufs;
+    size_t outbufcnt, i;
+    char *tmp_path, *dst_path;
+    int fd;
+
+    compressor->compress(compressor, &content, 1, H2O_SEND_STATE_FINAL, &outbufs, &outbufcnt);
+
+    /* write to a temporary file, then rename it, so that the file being served is always complete */
+    dst_path = h2o_concat(NULL, h2o_iovec_init(job->dst_base, strlen(job->dst_base)), h2o_iovec_init(ext, strlen(ext))).base;
+    tmp_path = h2o_concat(NULL, h2o_iovec_init(dst_path, strlen(dst_path)), h2o_iovec_init(H2O_STRLIT(".XXXXXX"))).base;
+    if ((fd = mkstemp(tmp_path)) == -1) {
+        fprintf(stderr, "[lib/handler/file.c] failed to create temporary file:%s:%s\n", tmp_path, strerror(errno));
+        goto Exit;
+    }
+    for (i = 0; i != outbufcnt; ++i) {
+        const char *p = outbufs[i].base, *end = p + outbufs[i].len;
+        while (p != end) {
+            ssize_t wret;
+            while ((wret = write(fd, p, end - p)) == -1 && errno == EINTR)
+                ;
+            if (wret == -1) {
+                fprintf(stderr, "[lib/handler/file.c] failed to write to file:%s:%s\n", tmp_path, strerror(errno));
+                close(fd);
+                unlink(tmp_path);
+                goto Exit;
+            }
+            p += wret;
+        }
+    }
+    fchmod(fd, 0644);
+    close(fd);
+    if (rename(tmp_path, dst_path) != 0) {
+        fprintf(stderr, "[lib/handler/file.c] failed to rename file:%s:%s\n", tmp_path, strerror(errno));
+        unlink(tmp_path);
+    }
+
+Exit:
+    free(tmp_path);
+    free(dst_path);
+}
+
+/**
+ * removes the variants built from the older versions of the file (i.e. those sharing the hash of the path but with a different mtime
+ * or size), so that the directory does not grow every time the file is modified
+ */
+static void remove_stale_variants(struct st_h2o_precompress_job_t *job)
+{
+    const char *basename = strrchr(job->dst_base, '/') + 1;
+    size_t basename_len = strlen(basename), hash_len = SHA_DIGEST_LENGTH * 2 + 1 /* "-" */;
+    char *dir = h2o_strdup(NULL, job->dst_base, basename - job->dst_base).base;
+    DIR *dp;
+    struct dirent *ent;
+
+    if ((dp = opendir(dir)) == NULL)
+        goto Exit;
+    while ((ent = readdir(dp)) != NULL) {
+        if (strncmp(ent->d_name, basename, hash_len) != 0)
+            continue;
+        if (strncmp(ent->d_name, basename, basename_len) == 0 && ent->d_name[basename_len] == '.')
+            continue;
+        unlinkat(dirfd(dp), ent->d_name, 0);
+    }
+    closedir(dp);
+
+Exit:
+    free(dir);
+}
+
+static void run_precompress_job(struct st_h2o_precompress_job_t *job)
+{
+    struct stat st;
+    h2o_mem_pool_t pool;
+    char *buf = NULL;
+    size_t off = 0;
+    int fd;
+
+    if ((fd = open(job->src_path, O_RDONLY | O_CLOEXEC)) == -1)
+        return;
+    /* do nothing if the file has been modified since the job was queued */
+    if (fstat(fd, &st) != 0 || st.st_size != job->size || st.st_mtime != job->mtime)
+        goto Exit;
+    buf = h2o_mem_alloc(job->size);
+    while (off != job->size) {
+        ssize_t rret;
+        while ((rret = pread(fd, buf + off, job->size - off, off)) == -1 && errno == EINTR)
+            ;
+        if (rret <= 0)
+            goto Exit;
+        off += rret;
+    }
+
+    h2o_mem_init_pool(&pool);
+    write_precompressed(job, ".gz", h2o_compress_gzip_open(&pool, PRECOMPRESS_GZIP_QUALITY), h2o_iovec_init(buf, off));
+#if H2O_USE_BROTLI
+    write_precompressed(job, ".br", h2o_compress_brotli_open(&pool, PRECOMPRESS_BROTLI_QUALITY, off), h2o_iovec_init(buf, off));
+#endif
+    h2o_mem_clear_pool(&pool);
+    remove_stale_variants(job);
+
+Exit:
+    free(buf);
+    close(fd);
+}
+
+static void *precompress_thread_main(void *_unused)
+{
+    pthread_mutex_lock(&precompress_queue.mutex);
+
+    while (1) {
+        struct st_h2o_precompress_job_t *job;
+        while (h2o_linklist_is_empty(&precompress_queue.pending))
+            pthread_cond_wait(&precompress_queue.cond, &precompress_queue.mutex);
+        job = H2O_STRUCT_FROM_MEMBER(struct st_h2o_precompress_job_t, link, precompress_queue.pending.next);
+        h2o_linklist_unlink(&job->link);
+        --precompress_queue.num_pending;
+        h2o_linklist_insert(&precompress_queue.running, &job->link);
+        pthread_mutex_unlock(&precompress_queue.mutex);
+
+        run_precompress_job(job);
+
+        pthread_mutex_lock(&precompress_queue.mutex);
+        h2o_linklist_unlink(&job->link);
+        free(job->src_path);
+        free(job->dst_base);
+        free(job);
+    }
+
+    return NULL;
+}
+
+static int precompress_job_exists(h2o_linklist_t *anchor, const char *dst_base)
+{
+    h2o_linklist_t *node;
+
+    for (node = anchor->next; node != anchor; node = node->next) {
+        struct st_h2o_precompress_job_t *job = H2O_STRUCT_FROM_MEMBER(struct st_h2o_precompress_job_t, link, node);
+        if (strcmp(job->dst_base, dst_base) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void queue_precompress_job(const char *src_path, const char *dst_base, struct stat *st)
+{
+    struct st_h2o_precompress_job_t *job;
+
+    pthread_mutex_lock(&precompress_queue.mutex);
+
+    if (precompress_queue.num_pending >= PRECOMPRESS_MAX_PENDING || precompress_job_exists(&precompress_queue.pending, dst_base) ||
+        precompress_job_exists(&precompress_queue.running, dst_base))
+        goto Exit;
+    if (!precompress_queue.thread_started) {
+        pthread_t tid;
+        pthread_attr_t attr;
+        int ret;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, 1);
+        if ((ret = pthread_create(&tid, &attr, precompress_thread_main, NULL)) != 0) {
+            fprintf(stderr, "[lib/handler/file.c] failed to start thread for precompression:%s\n", strerror(ret));
+            goto Exit;
+        }
+        precompress_queue.thread_started = 1;
+    }
+
+    job = h2o_mem_alloc(sizeof(*job));
+    job->src_path = h2o_strdup(NULL, src_path, SIZE_MAX).base;
+    job->dst_base = h2o_strdup(NULL, dst_base, SIZE_MAX).base;
+    job->size = st->st_size;
+    job->mtime = st->st_mtime;
+    h2o_linklist_insert(&precompress_queue.pending, &job->link);
+    ++precompress_queue.num_pending;
+    pthread_cond_signal(&precompress_queue.cond);
+
+Exit:
+    pthread_mutex_unlock(&precompress_queue.mutex);
+}
+
+/**
+ * replaces the file being served with the one compressed in background if it exists, or queues the compression
+ */
+static void try_precompressed(struct st_h2o_sendfile_generator_t *generator, h2o_req_t *req, const char *rpath,
+                              h2o_mimemap_type_t *mime_type)
+{
+    const char *dir = req->conn->ctx->globalconf->precompress.dir;
+    struct stat *st = &generator->file.ref->st;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    char *dst_base, *variant_path;
+    size_t dst_base_len, i;
+    int compressible_types;
+    h2o_filecache_ref_t *fileref;
+
+    if (dir == NULL || generator->content_encoding.base != NULL)
+        return;
+    if (!(mime_type->type == H2O_MIMEMAP_TYPE_MIMETYPE && mime_type->data.attr.is_compressible))
+        return;
+    if (st->st_size < PRECOMPRESS_MIN_SIZE || st->st_size > PRECOMPRESS_MAX_SIZE)
+        return;
+    if (req->version < 0x101)
+        return;
+    compressible_types = h2o_get_compressible_types(&req->headers);
+#if !H2O_USE_BROTLI
+    /* the brotli variant is never built; do not queue the job again and again for the clients accepting only brotli */
+    compressible_types &= ~H2O_COMPRESSIBLE_BROTLI;
+#endif
+    if (compressible_types == 0)
+        return;
+
+    /* the name of the compressed file is built from the path, mtime, and size of the original */
+    SHA1((const unsigned char *)rpath, strlen(rpath), digest);
+    dst_base = h2o_mem_alloc_pool(&req->pool, strlen(dir) + sizeof("/-ffffffffffffffff-ffffffffffffffff.gz") + SHA_DIGEST_LENGTH * 2);
+    dst_base_len = sprintf(dst_base, "%s/", dir);
+    for (i = 0; i != SHA_DIGEST_LENGTH; ++i)
+        dst_base_len += sprintf(dst_base + dst_base_len, "%02x", digest[i]);
+    dst_base_len += sprintf(dst_base + dst_base_len, "-%" PRIx64 "-%" PRIx64, (uint64_t)st->st_mtime, (uint64_t)st->st_size);
+
+    variant_path = h2o_mem_alloc_pool(&req->pool, dst_base_len + sizeof(".gz"));
+    memcpy(variant_path, dst_base, dst_base_len);
+#define TRY_VARIANT(mask, enc, ext)                                                                                                \
+    if ((compressible_types & mask) != 0) {                                                                                        \
+        strcpy(variant_path + dst_base_len, ext);                                                                                  \
+        if ((fileref = h2o_filecache_open_file(req->conn->ctx->filecache, variant_path, O_RDONLY)) != NULL) {                      \
+            h2o_filecache_close_file(generator->file.ref);                                                                         \
+            generator->file.ref = fileref;                                                                                         \
+            generator->bytesleft = fileref->st.st_size;                                                                            \
+            generator->content_encoding = h2o_iovec_init(enc, sizeof(enc) - 1);                                                    \
+            return;                                                                                                                \
+        }                                                                                                                          \
+    }
+    TRY_VARIANT(H2O_COMPRESSIBLE_BROTLI, "br", ".br");
+    TRY_VARIANT(H2O_COMPRESSIBLE_GZIP, "gzip", ".gz");
+#undef TRY_VARIANT
+
+    /* the queue is locked only when the variants are missing; the job is not queued twice while it is pending or running */
+    queue_precompress_job(rpath, dst_base, st);
+}
+
+#else
+
+/* never called, since file.precompress is rejected by the configurator on this platform */
+static void try_precompressed(struct st_h2o_sendfile_generator_t *generator, h2o_req_t *req, const char *rpath,
+                              h2o_mimemap_type_t *mime_type)
+{
+}
+
+#endif
+
 static int serve_with_generator(struct st_h2o_sendfile_generator_t *generator, h2o_req_t *req, const char *rpath, size_t rpath_len,
                                 h2o_mimemap_type_t *mime_type)
 {
@@ -617,6 +1257,10 @@ static int serve_with_generator(struct st_h2o_sendfile_generator_t *generator, h
         method_type = METHOD_IS_OTHER;
     }
 
+    /* switch to the precompressed file if available; the conditions are evaluated against the file being served */
+    if (generator->precompress && method_type != METHOD_IS_OTHER)
+        try_precompressed(generator, req, rpath, mime_type);
+
     /* if-non-match and if-modified-since */
     if ((if_none_match_header_index = h2o_find_header(&req->headers, H2O_TOKEN_IF_NONE_MATCH, SIZE_MAX)) != -1) {
         h2o_iovec_t *if_none_match = &req->headers.entries[if_none_match_header_index].value;
@@ -725,7 +1369,127 @@ Close:
     return 0;
 }
 
-static int on_req(h2o_handler_t *_self, h2o_req_t *req)
+/**
+ * state of the opens being run by the file I/O threads prior to serving a request; the files being opened are registered to the
+ * filecache upon completion, so that the handler can serve the request without blocking
+ */
+struct st_h2o_file_prefetch_t {
+    h2o_req_t *req; /* NULL if the request has been disposed */
+    struct st_h2o_file_prefetch_t **req_slot;
+    h2o_handler_t *handler;
+    int (*serve)(h2o_handler_t *handler, h2o_req_t *req);
+    size_t num_files;
+    size_t num_pending;
+    struct {
+        h2o_fileio_req_t req;
+        char *path;
+    } files[4]; /* .zst, .br, .gz and the file itself */
+};
+
+static void on_prefetch_req_dispose(void *_slot)
+{
+    struct st_h2o_file_prefetch_t **slot = _slot;
+
+    if (*slot != NULL)
+        (*slot)->req = NULL;
+}
+
+static void on_prefetch_complete(h2o_fileio_req_t *_req)
+{
+    struct st_h2o_file_prefetch_t *prefetch = _req->data;
+    h2o_filecache_ref_t *refs[sizeof(prefetch->files) / sizeof(prefetch->files[0])];
+    size_t i;
+
+    if (--prefetch->num_pending != 0)
+        return;
+
+    /* register the results to the filecache, and serve the request (that would hit the cache) */
+    if (prefetch->req != NULL) {
+        h2o_req_t *req = prefetch->req;
+        *prefetch->req_slot = NULL;
+        for (i = 0; i != prefetch->num_files; ++i)
+            refs[i] = h2o_filecache_open_file_with_fd(req->conn->ctx->filecache, prefetch->files[i].path,
+                                                      (int)prefetch->files[i].req.ret, prefetch->files[i].req.err);
+        if (prefetch->serve(prefetch->handler, req) != 0)
+            h2o_delegate_request(req, prefetch->handler);
+        for (i = 0; i != prefetch->num_files; ++i)
+            if (refs[i] != NULL)
+                h2o_filecache_close_file(refs[i]);
+    } else {
+        for (i = 0; i != prefetch->num_files; ++i)
+            if (prefetch->files[i].req.ret != -1)
+                close((int)prefetch->files[i].req.ret);
+    }
+
+    for (i = 0; i != prefetch->num_files; ++i)
+        free(prefetch->files[i].path);
+    free(prefetch);
+}
+
+/**
+ * opens the file (and the precompressed variants that might be served) using the file I/O threads, then calls `serve`
+ * @return 0 if the open has been started, or -1 if the request should be served synchronously
+ */
+static int prefetch_open(h2o_handler_t *handler, h2o_req_t *req, h2o_iovec_t path, int flags,
+                         int (*serve)(h2o_handler_t *handler, h2o_req_t *req))
+{
+    struct st_h2o_file_prefetch_t *prefetch;
+    size_t i;
+
+    if ((flags & H2O_FILE_FLAG_ASYNC_IO) == 0)
+        return -1;
+
+    prefetch = h2o_mem_alloc(sizeof(*prefetch));
+    prefetch->req = req;
+    prefetch->handler = handler;
+    prefetch->serve = serve;
+    prefetch->num_files = 0;
+
+#define ADD_FILE(ext)                                                                                                              \
+    do {                                                                                                                           \
+        char *p = h2o_mem_alloc(path.len + sizeof(ext));                                                                           \
+        memcpy(p, path.base, path.len);                                                                                            \
+        strcpy(p + path.len, ext);                                                                                                 \
+        if (h2o_filecache_is_cached(req->conn->ctx->filecache, p))                                                                 \
+            free(p);                                                                                                               \
+        else                                                                                                                       \
+            prefetch->files[prefetch->num_files++].path = p;                                                                       \
+    } while (0)
+    if ((flags & H2O_FILE_FLAG_SEND_COMPRESSED) != 0 && req->version >= 0x101) {
+        int compressible_types = h2o_get_compressible_types(&req->headers);
+        if ((compressible_types & H2O_COMPRESSIBLE_ZSTD) != 0)
+            ADD_FILE(".zst");
+        if ((compressible_types & H2O_COMPRESSIBLE_BROTLI) != 0)
+            ADD_FILE(".br");
+        if ((compressible_types & H2O_COMPRESSIBLE_GZIP) != 0)
+            ADD_FILE(".gz");
+    }
+    ADD_FILE("");
+#undef ADD_FILE
+
+    /* serve synchronously if all the files are in the cache */
+    if (prefetch->num_files == 0) {
+        free(prefetch);
+        return -1;
+    }
+
+    prefetch->req_slot = h2o_mem_alloc_shared(&req->pool, sizeof(*prefetch->req_slot), on_prefetch_req_dispose);
+    *prefetch->req_slot = prefetch;
+    prefetch->num_pending = prefetch->num_files;
+    for (i = 0; i != prefetch->num_files; ++i) {
+        h2o_fileio_req_t *fr = &prefetch->files[i].req;
+        fr->op = H2O_FILEIO_OP_OPEN;
+        fr->open.path = prefetch->files[i].path;
+        fr->open.oflag = O_RDONLY;
+        fr->cb = on_prefetch_complete;
+        fr->data = prefetch;
+        h2o_fileio_submit(fr, &req->conn->ctx->receivers.fileio);
+    }
+
+    return 0;
+}
+
+static int serve_file(h2o_handler_t *_self, h2o_req_t *req)
 {
     h2o_file_handler_t *self = (void *)_self;
     char *rpath;
@@ -756,11 +1520,35 @@ static int on_req(h2o_handler_t *_self, h2o_req_t *req)
 
     /* build generator (as well as terminating the rpath and its length upon success) */
     if (rpath[rpath_len - 1] == '/') {
-        h2o_iovec_t *index_file;
-        for (index_file = self->index_files; index_file->base != NULL; ++index_file) {
+        h2o_iovec_t *index_file = self->index_files;
+        struct st_h2o_file_dir_lookup_t lookup;
+        struct st_h2o_file_dir_t *cached;
+        rpath[rpath_len] = '\0';
+        if ((cached = fetch_dir(&self->super, req, rpath, &lookup)) != NULL) {
+            if (cached->index_file != -1) {
+                /* open the index file found last time */
+                index_file = self->index_files + cached->index_file;
+                memcpy(rpath + rpath_len, index_file->base, index_file->len);
+                rpath[rpath_len + index_file->len] = '\0';
+                if ((generator = create_generator(req, rpath, rpath_len + index_file->len, &is_dir, self->flags)) != NULL) {
+                    rpath_len += index_file->len;
+                    goto Opened;
+                }
+                /* the file has gone away without the directory being modified (e.g. replaced by a directory); probe again */
+                index_file = self->index_files;
+                cached = NULL;
+            } else {
+                /* none of the index files exist */
+                while (index_file->base != NULL)
+                    ++index_file;
+                errno = ENOENT;
+            }
+        }
+        for (; index_file->base != NULL; ++index_file) {
             memcpy(rpath + rpath_len, index_file->base, index_file->len);
             rpath[rpath_len + index_file->len] = '\0';
             if ((generator = create_generator(req, rpath, rpath_len + index_file->len, &is_dir, self->flags)) != NULL) {
+                store_dir(req, &lookup, (int)(index_file - self->index_files), h2o_iovec_init(NULL, 0));
                 rpath_len += index_file->len;
                 goto Opened;
             }
@@ -788,8 +1576,10 @@ static int on_req(h2o_handler_t *_self, h2o_req_t *req)
                 send_method_not_allowed(req);
                 return 0;
             }
-            if (send_dir_listing(req, rpath, rpath_len, is_get) == 0)
+            if (send_dir_listing(req, rpath, rpath_len, is_get, cached, &lookup) == 0)
                 return 0;
+        } else if (index_file->base == NULL && cached == NULL) {
+            store_dir(req, &lookup, -1, h2o_iovec_init(NULL, 0));
         }
     } else {
         rpath[rpath_len] = '\0';
@@ -824,6 +1614,25 @@ Opened:
                                 h2o_mimemap_get_type_by_extension(self->mimemap, h2o_get_filext(rpath, rpath_len)));
 }
 
+static int on_req(h2o_handler_t *_self, h2o_req_t *req)
+{
+    h2o_file_handler_t *self = (void *)_self;
+
+    if (req->path_normalized.len >= self->conf_path.len) {
+        /* open the file to be served (or the first index file) off the event loop; other candidates are opened synchronously */
+        size_t req_path_prefix = self->conf_path.len;
+        h2o_iovec_t rpath = h2o_concat(&req->pool, self->real_path,
+                                       h2o_iovec_init(req->path_normalized.base + req_path_prefix,
+                                                      req->path_normalized.len - req_path_prefix),
+                                       req->path_normalized.base[req->path_normalized.len - 1] == '/' ? self->index_files[0]
+                                                                                                      : h2o_iovec_init(NULL, 0));
+        if (prefetch_open(&self->super, req, rpath, self->flags, serve_file) == 0)
+            return 0;
+    }
+
+    return serve_file(&self->super, req);
+}
+
 static void on_context_init(h2o_handler_t *_self, h2o_context_t *ctx)
 {
     h2o_file_handler_t *self = (void *)_self;
@@ -919,7 +1728,7 @@ static void specific_handler_on_dispose(h2o_handler_t *_self)
     h2o_mem_release_shared(self->mime_type);
 }
 
-static int specific_handler_on_req(h2o_handler_t *_self, h2o_req_t *req)
+static int specific_handler_serve(h2o_handler_t *_self, h2o_req_t *req)
 {
     struct st_h2o_specific_file_handler_t *self = (void *)_self;
     struct st_h2o_sendfile_generator_t *generator;
@@ -942,6 +1751,15 @@ static int specific_handler_on_req(h2o_handler_t *_self, h2o_req_t *req)
     return serve_with_generator(generator, req, self->real_path.base, self->real_path.len, self->mime_type);
 }
 
+static int specific_handler_on_req(h2o_handler_t *_self, h2o_req_t *req)
+{
+    struct st_h2o_specific_file_handler_t *self = (void *)_self;
+
+    if (prefetch_open(&self->super, req, self->real_path, self->flags, specific_handler_serve) == 0)
+        return 0;
+    return specific_handler_serve(&self->super, req);
+}
+
 h2o_handler_t *h2o_file_register_file(h2o_pathconf_t *pathconf, const char *real_path, h2o_mimemap_type_t *mime_type, int flags)
 {
     struct st_h2o_specific_file_handler_t *self = (void *)h2o_create_handler(pathconf, sizeof(*self));
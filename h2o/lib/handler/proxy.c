@@ -31,6 +31,23 @@ struct rp_handler_t {
     h2o_url_t upstream;         /* host should be NULL-terminated */
     h2o_socketpool_t *sockpool; /* non-NULL if config.use_keepalive == 1 */
     h2o_proxy_config_vars_t config;
+    SSL_CTX *http2_ssl_ctx; /* non-NULL if forwarding the requests to a TLS upstream using HTTP/2 */
+    struct {
+        h2o_iovec_t request;
+        uint64_t next_probe_at; /* shared by the contexts; the one that advances it sends the probe */
+    } health_check;
+};
+
+struct rp_handler_context_t {
+    struct rp_handler_t *handler;
+    h2o_http1client_ctx_t client_ctx;
+    h2o_http2client_pool_t http2; /* only initialized if config.use_http2 is set */
+    h2o_socketpool_warmer_t warmer; /* only initialized if config.prewarm.min_idle is non-zero */
+    struct {
+        h2o_timeout_t interval;
+        h2o_timeout_entry_t interval_entry;
+        h2o_http1client_t *client; /* the probe in flight */
+    } health_check;                /* only initialized if health_check.request of the handler is set */
 };
 
 static int on_req(h2o_handler_t *_self, h2o_req_t *req)
@@ -51,7 +68,13 @@ static int on_req(h2o_handler_t *_self, h2o_req_t *req)
     overrides->location_rewrite.match = &self->upstream;
     overrides->location_rewrite.path_prefix = req->pathconf->path;
     overrides->use_proxy_protocol = self->config.use_proxy_protocol;
-    overrides->client_ctx = h2o_context_get_handler_context(req->conn->ctx, &self->super);
+    overrides->retry_idempotent = self->config.retry_idempotent;
+    struct rp_handler_context_t *handler_ctx = h2o_context_get_handler_context(req->conn->ctx, &self->super);
+    if (handler_ctx != NULL) {
+        overrides->client_ctx = &handler_ctx->client_ctx;
+        if (self->config.use_http2)
+            overrides->http2client_pool = &handler_ctx->http2;
+    }
 
     /* determine the scheme and authority */
     if (self->config.preserve_host) {
@@ -69,6 +92,93 @@ static int on_req(h2o_handler_t *_self, h2o_req_t *req)
     return 0;
 }
 
+static h2o_http1client_body_cb on_probe_head(h2o_http1client_t *client, const char *errstr, int minor_version, int status,
+                                             h2o_iovec_t msg, h2o_http1client_header_t *headers, size_t num_headers)
+{
+    struct rp_handler_context_t *handler_ctx = client->data;
+    int is_healthy = (errstr == NULL || errstr == h2o_http1client_error_is_eos) && 200 <= status && status <= 399;
+
+    handler_ctx->health_check.client = NULL;
+    h2o_socketpool_report_probe(handler_ctx->handler->sockpool, is_healthy, h2o_now(handler_ctx->client_ctx.loop));
+    return NULL;
+}
+
+static h2o_http1client_head_cb on_probe_connect(h2o_http1client_t *client, const char *errstr, h2o_iovec_t **reqbufs,
+                                                size_t *reqbufcnt, int *method_is_head)
+{
+    struct rp_handler_context_t *handler_ctx = client->data;
+
+    if (errstr != NULL) {
+        handler_ctx->health_check.client = NULL;
+        h2o_socketpool_report_probe(handler_ctx->handler->sockpool, 0, h2o_now(handler_ctx->client_ctx.loop));
+        return NULL;
+    }
+
+    *reqbufs = &handler_ctx->handler->health_check.request;
+    *reqbufcnt = 1;
+    *method_is_head = 0;
+    return on_probe_head;
+}
+
+static int claim_probe(struct rp_handler_t *self, uint64_t now)
+{
+    uint64_t next_probe_at = self->health_check.next_probe_at;
+
+    if (now < next_probe_at)
+        return 0;
+#ifndef _MSC_VER
+    return __sync_bool_compare_and_swap(&self->health_check.next_probe_at, next_probe_at, now + self->config.health_check.interval);
+#else
+	return InterlockedCompareExchange64((LONG64 *)&self->health_check.next_probe_at, now + self->config.health_check.interval,
+		next_probe_at) == (LONG64)next_probe_at;
+#endif
+}
+
+static void on_probe_interval(h2o_timeout_entry_t *entry)
+{
+    struct rp_handler_context_t *handler_ctx =
+        H2O_STRUCT_FROM_MEMBER(struct rp_handler_context_t, health_check.interval_entry, entry);
+    struct rp_handler_t *self = handler_ctx->handler;
+    h2o_loop_t *loop = handler_ctx->client_ctx.loop;
+
+    if (handler_ctx->health_check.client != NULL) {
+        /* the previous probe did not complete within the interval */
+        h2o_http1client_cancel(handler_ctx->health_check.client);
+        handler_ctx->health_check.client = NULL;
+        h2o_socketpool_report_probe(self->sockpool, 0, h2o_now(loop));
+    }
+
+    /* every context ticks at the interval, and the first one to notice that a probe is due sends it; therefore the probes keep
+     * going as long as any of the threads is responsive */
+    if (claim_probe(self, h2o_now(loop))) {
+        /* the probe is sent using a new connection so that it would neither be affected by nor affect the pooled connections */
+        h2o_http1client_connect(&handler_ctx->health_check.client, handler_ctx, &handler_ctx->client_ctx, self->upstream.host,
+                                h2o_url_get_port(&self->upstream), self->upstream.scheme == &H2O_URL_SCHEME_HTTPS,
+                                on_probe_connect);
+    }
+    h2o_timeout_link(loop, &handler_ctx->health_check.interval, &handler_ctx->health_check.interval_entry);
+}
+
+static void start_health_check(struct rp_handler_context_t *handler_ctx)
+{
+    h2o_loop_t *loop = handler_ctx->client_ctx.loop;
+
+    h2o_timeout_init(loop, &handler_ctx->health_check.interval, handler_ctx->handler->config.health_check.interval);
+    handler_ctx->health_check.interval_entry = (h2o_timeout_entry_t){0, on_probe_interval};
+    handler_ctx->health_check.client = NULL;
+    h2o_timeout_link(loop, &handler_ctx->health_check.interval, &handler_ctx->health_check.interval_entry);
+}
+
+static void stop_health_check(struct rp_handler_context_t *handler_ctx)
+{
+    if (handler_ctx->health_check.client != NULL) {
+        h2o_http1client_cancel(handler_ctx->health_check.client);
+        handler_ctx->health_check.client = NULL;
+    }
+    h2o_timeout_unlink(&handler_ctx->health_check.interval_entry);
+    h2o_timeout_dispose(handler_ctx->client_ctx.loop, &handler_ctx->health_check.interval);
+}
+
 static void on_context_init(h2o_handler_t *_self, h2o_context_t *ctx)
 {
     struct rp_handler_t *self = (void *)_self;
@@ -79,10 +189,13 @@ static void on_context_init(h2o_handler_t *_self, h2o_context_t *ctx)
 
     /* setup a specific client context only if we need to */
     if (ctx->globalconf->proxy.io_timeout == self->config.io_timeout && !self->config.websocket.enabled &&
-        self->config.ssl_ctx == ctx->globalconf->proxy.ssl_ctx)
+        self->config.ssl_ctx == ctx->globalconf->proxy.ssl_ctx && !self->config.use_http2 && self->config.prewarm.min_idle == 0 &&
+        self->health_check.request.base == NULL)
         return;
 
-    h2o_http1client_ctx_t *client_ctx = h2o_mem_alloc(sizeof(*ctx));
+    struct rp_handler_context_t *handler_ctx = h2o_mem_alloc(sizeof(*handler_ctx));
+    handler_ctx->handler = self;
+    h2o_http1client_ctx_t *client_ctx = &handler_ctx->client_ctx;
     client_ctx->loop = ctx->loop;
     client_ctx->getaddr_receiver = &ctx->receivers.hostinfo_getaddr;
     if (ctx->globalconf->proxy.io_timeout == self->config.io_timeout) {
@@ -99,18 +212,37 @@ static void on_context_init(h2o_handler_t *_self, h2o_context_t *ctx)
         client_ctx->websocket_timeout = NULL;
     }
     client_ctx->ssl_ctx = self->config.ssl_ctx;
+    /* the HTTP/2 connections are per-thread, since the streams multiplexed over a connection are handled by a single loop */
+    if (self->config.use_http2)
+        h2o_http2client_pool_init(&handler_ctx->http2, ctx->loop, &ctx->receivers.hostinfo_getaddr, client_ctx->io_timeout,
+                                  self->http2_ssl_ctx, self->sockpool, self->config.keepalive_timeout);
+    if (self->config.prewarm.min_idle != 0)
+        h2o_socketpool_warmer_start(&handler_ctx->warmer, self->sockpool, ctx->loop, &ctx->receivers.hostinfo_getaddr,
+                                    self->config.ssl_ctx, self->config.prewarm.min_idle, self->config.prewarm.connect_rate);
+    if (self->health_check.request.base != NULL)
+        start_health_check(handler_ctx);
 
-    h2o_context_set_handler_context(ctx, &self->super, client_ctx);
+    h2o_context_set_handler_context(ctx, &self->super, handler_ctx);
 }
 
 static void on_context_dispose(h2o_handler_t *_self, h2o_context_t *ctx)
 {
     struct rp_handler_t *self = (void *)_self;
-    h2o_http1client_ctx_t *client_ctx = h2o_context_get_handler_context(ctx, &self->super);
+    struct rp_handler_context_t *handler_ctx = h2o_context_get_handler_context(ctx, &self->super);
+    h2o_http1client_ctx_t *client_ctx;
 
-    if (client_ctx == NULL)
+    if (handler_ctx == NULL)
         return;
 
+    if (self->health_check.request.base != NULL)
+        stop_health_check(handler_ctx);
+
+    if (self->config.use_http2)
+        h2o_http2client_pool_dispose(&handler_ctx->http2);
+    if (self->config.prewarm.min_idle != 0)
+        h2o_socketpool_warmer_stop(&handler_ctx->warmer);
+    client_ctx = &handler_ctx->client_ctx;
+
     if (client_ctx->io_timeout != &ctx->proxy.io_timeout) {
         h2o_timeout_dispose(client_ctx->loop, client_ctx->io_timeout);
         free(client_ctx->io_timeout);
@@ -119,7 +251,30 @@ static void on_context_dispose(h2o_handler_t *_self, h2o_context_t *ctx)
         h2o_timeout_dispose(client_ctx->loop, client_ctx->websocket_timeout);
         free(client_ctx->websocket_timeout);
     }
-    free(client_ctx);
+    free(handler_ctx);
+}
+
+static SSL_CTX *create_http2_ssl_ctx(SSL_CTX *base)
+{
+    static const unsigned char alpn_protos[] = {2, 'h', '2'};
+
+    /* a dedicated context is used, since the health checks and websocket connections are sent using the original one which
+     * negotiates HTTP/1.1 */
+    SSL_CTX *ctx = SSL_CTX_new(SSLv23_client_method());
+    SSL_CTX_set_options(ctx, SSL_CTX_get_options(ctx) | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+    if (base != NULL) {
+        if (ctx->cert_store != NULL)
+            X509_STORE_free(ctx->cert_store);
+        ctx->cert_store = base->cert_store;
+        CRYPTO_add(&ctx->cert_store->references, 1, CRYPTO_LOCK_X509_STORE);
+        SSL_CTX_set_verify(ctx, base->verify_mode, NULL);
+        h2o_cache_t *base_cache = h2o_socket_ssl_get_session_cache(base);
+        if (base_cache != NULL)
+            h2o_socket_ssl_set_session_cache(ctx, h2o_socket_ssl_new_session_cache(h2o_cache_get_capacity(base_cache),
+                                                                                   h2o_cache_get_duration(base_cache)));
+    }
+    SSL_CTX_set_alpn_protos(ctx, alpn_protos, sizeof(alpn_protos));
+    return ctx;
 }
 
 static void on_handler_dispose(h2o_handler_t *_self)
@@ -128,8 +283,11 @@ static void on_handler_dispose(h2o_handler_t *_self)
 
     if (self->config.ssl_ctx != NULL)
         SSL_CTX_free(self->config.ssl_ctx);
+    if (self->http2_ssl_ctx != NULL)
+        SSL_CTX_free(self->http2_ssl_ctx);
     free(self->upstream.host.base);
     free(self->upstream.path.base);
+    free(self->health_check.request.base);
     if (self->sockpool != NULL) {
         h2o_socketpool_dispose(self->sockpool);
         free(self->sockpool);
@@ -159,10 +317,22 @@ void h2o_proxy_register_reverse_proxy(h2o_pathconf_t *pathconf, h2o_url_t *upstr
             assert(to_sa_err == NULL);
             h2o_socketpool_init_by_address(self->sockpool, (void *)&sa, sizeof(sa), is_ssl, SIZE_MAX /* FIXME */);
         }
+        if (config->health_check.path != NULL || config->health_check.config.max_failures != 0)
+            h2o_socketpool_enable_health_check(self->sockpool, &config->health_check.config, config->health_check.path != NULL);
     }
     h2o_url_copy(NULL, &self->upstream, upstream);
     h2o_strtolower(self->upstream.host.base, self->upstream.host.len);
+    if (self->sockpool != NULL && config->health_check.path != NULL) {
+        size_t len = sizeof("GET  HTTP/1.1\r\nhost: \r\nconnection: close\r\n\r\n") - 1 + strlen(config->health_check.path) +
+                     self->upstream.authority.len;
+        self->health_check.request.base = h2o_mem_alloc(len + 1);
+        self->health_check.request.len =
+            sprintf(self->health_check.request.base, "GET %s HTTP/1.1\r\nhost: %.*s\r\nconnection: close\r\n\r\n",
+                    config->health_check.path, (int)self->upstream.authority.len, self->upstream.authority.base);
+    }
     self->config = *config;
     if (self->config.ssl_ctx != NULL)
         CRYPTO_add(&self->config.ssl_ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+    if (self->config.use_http2 && self->upstream.scheme == &H2O_URL_SCHEME_HTTPS)
+        self->http2_ssl_ctx = create_http2_ssl_ctx(self->config.ssl_ctx);
 }
@@ -24,6 +24,11 @@
 extern h2o_status_handler_t events_status_handler;
 extern h2o_status_handler_t requests_status_handler;
 extern h2o_status_handler_t durations_status_handler;
+extern h2o_status_handler_t hostinfo_status_handler;
+extern h2o_status_handler_t upstreams_status_handler;
+extern h2o_status_handler_t fastcgi_status_handler;
+extern h2o_status_handler_t fileio_status_handler;
+extern h2o_status_handler_t compress_status_handler;
 
 struct st_h2o_status_logger_t {
     h2o_logger_t super;
@@ -290,4 +295,9 @@ void h2o_status_register(h2o_pathconf_t *conf)
     h2o_config_register_status_handler(conf->global, requests_status_handler);
     h2o_config_register_status_handler(conf->global, events_status_handler);
     h2o_config_register_status_handler(conf->global, durations_status_handler);
+    h2o_config_register_status_handler(conf->global, hostinfo_status_handler);
+    h2o_config_register_status_handler(conf->global, upstreams_status_handler);
+    h2o_config_register_status_handler(conf->global, fastcgi_status_handler);
+    h2o_config_register_status_handler(conf->global, fileio_status_handler);
+    h2o_config_register_status_handler(conf->global, compress_status_handler);
 }
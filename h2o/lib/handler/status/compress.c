@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include "h2o.h"
+
+struct st_compress_status_ctx_t {
+    uint64_t gzip[H2O_COMPRESS_GZIP_MAX_QUALITY + 1];
+    uint64_t brotli[H2O_COMPRESS_BROTLI_MAX_QUALITY + 1];
+    uint64_t zstd[H2O_COMPRESS_ZSTD_MAX_QUALITY + 1];
+    uint64_t cache_hits;
+    uint64_t cache_stores;
+    uint64_t offloads;
+#ifndef _MSC_VER
+    pthread_mutex_t mutex;
+#else
+	uv_mutex_t	mutex;
+#endif
+};
+
+static void compress_status_per_thread(void *priv, h2o_context_t *ctx)
+{
+    struct st_compress_status_ctx_t *csc = priv;
+    size_t i;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&csc->mutex);
+#else
+	uv_mutex_lock(&csc->mutex);
+#endif
+    for (i = 0; i <= H2O_COMPRESS_GZIP_MAX_QUALITY; ++i)
+        csc->gzip[i] += ctx->compress.quality_histogram.gzip[i];
+    for (i = 0; i <= H2O_COMPRESS_BROTLI_MAX_QUALITY; ++i)
+        csc->brotli[i] += ctx->compress.quality_histogram.brotli[i];
+    for (i = 0; i <= H2O_COMPRESS_ZSTD_MAX_QUALITY; ++i)
+        csc->zstd[i] += ctx->compress.quality_histogram.zstd[i];
+    csc->cache_hits += ctx->compress.cache.hits;
+    csc->cache_stores += ctx->compress.cache.stores;
+    csc->offloads += ctx->compress.offloads;
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&csc->mutex);
+#else
+	uv_mutex_unlock(&csc->mutex);
+#endif
+}
+
+static void *compress_status_init(void)
+{
+    struct st_compress_status_ctx_t *ret;
+
+    ret = h2o_mem_alloc(sizeof(*ret));
+    memset(ret, 0, sizeof(*ret));
+#ifndef _MSC_VER
+    pthread_mutex_init(&ret->mutex, NULL);
+#else
+	uv_mutex_init(&ret->mutex);
+#endif
+    return ret;
+}
+
+static size_t append_histogram(char *dst, const char *name, uint64_t *counts, size_t num_counts)
+{
+    size_t len, i;
+
+    len = sprintf(dst, ",\n \"%s\": [", name);
+    for (i = 0; i != num_counts; ++i)
+        len += sprintf(dst + len, "%s%" PRIu64, i == 0 ? "" : ", ", counts[i]);
+    len += sprintf(dst + len, "]");
+    return len;
+}
+
+static h2o_iovec_t compress_status_final(void *priv, h2o_globalconf_t *gconf, h2o_req_t *req)
+{
+    struct st_compress_status_ctx_t *csc = priv;
+    h2o_iovec_t ret;
+
+    /* each histogram has one entry per quality level (starting from zero) */
+#define BUFSIZE 1024
+    ret.base = h2o_mem_alloc_pool(&req->pool, BUFSIZE);
+    ret.len = append_histogram(ret.base, "compress.gzip.quality", csc->gzip, H2O_COMPRESS_GZIP_MAX_QUALITY + 1);
+    ret.len += append_histogram(ret.base + ret.len, "compress.br.quality", csc->brotli, H2O_COMPRESS_BROTLI_MAX_QUALITY + 1);
+    ret.len += append_histogram(ret.base + ret.len, "compress.zstd.quality", csc->zstd, H2O_COMPRESS_ZSTD_MAX_QUALITY + 1);
+    ret.len += sprintf(ret.base + ret.len,
+                       ",\n"
+                       " \"compress.cache-hits\": %" PRIu64 ",\n"
+                       " \"compress.cache-stores\": %" PRIu64 ",\n"
+                       " \"compress.offloads\": %" PRIu64 "\n",
+                       csc->cache_hits, csc->cache_stores, csc->offloads);
+#ifndef _MSC_VER
+	pthread_mutex_destroy(&csc->mutex);
+#else
+	uv_mutex_destroy(&csc->mutex);
+#endif
+    free(csc);
+    return ret;
+#undef BUFSIZE
+}
+
+#ifndef _MSC_VER
+h2o_status_handler_t compress_status_handler = {
+    {H2O_STRLIT("compress")}, compress_status_init, compress_status_per_thread, compress_status_final,
+};
+#else
+h2o_status_handler_t compress_status_handler = {
+	{ H2O_MY_STRLIT("compress") }, compress_status_init, compress_status_per_thread, compress_status_final,
+};
+#endif
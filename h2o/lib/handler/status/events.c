@@ -28,6 +28,12 @@ struct st_events_status_ctx_t {
     uint64_t h2_protocol_level_errors[H2O_HTTP2_ERROR_MAX];
     uint64_t h2_read_closed;
     uint64_t h2_write_closed;
+    uint64_t proxy_retries;
+    uint64_t proxy_retries_suppressed;
+    uint64_t overload_episodes;
+    uint64_t overload_shed_requests;
+    uint64_t file_content_cache_hits;
+    uint64_t file_content_cache_stores;
 #ifndef _MSC_VER
     pthread_mutex_t mutex;
 #else
@@ -52,6 +58,12 @@ static void events_status_per_thread(void *priv, h2o_context_t *ctx)
     }
     esc->h2_read_closed += ctx->http2.events.read_closed;
     esc->h2_write_closed += ctx->http2.events.write_closed;
+    esc->proxy_retries += ctx->proxy.events.retries;
+    esc->proxy_retries_suppressed += ctx->proxy.events.retries_suppressed;
+    esc->overload_episodes += ctx->overload.events.episodes;
+    esc->overload_shed_requests += ctx->overload.events.shed_requests;
+    esc->file_content_cache_hits += ctx->file.content_cache.hits;
+    esc->file_content_cache_stores += ctx->file.content_cache.stores;
 #ifndef _MSC_VER
     pthread_mutex_unlock(&esc->mutex);
 #else
@@ -110,12 +122,20 @@ static h2o_iovec_t events_status_final(void *priv, h2o_globalconf_t *gconf, h2o_
                                           " \"http2-errors.enhance-your-calm\": %" PRIu64 ", \n"
                                           " \"http2-errors.inadequate-security\": %" PRIu64 ", \n"
                                           " \"http2.read-closed\": %" PRIu64 ", \n"
-                                          " \"http2.write-closed\": %" PRIu64 "\n",
+                                          " \"http2.write-closed\": %" PRIu64 ", \n"
+                                          " \"proxy.retries\": %" PRIu64 ", \n"
+                                          " \"proxy.retries-suppressed\": %" PRIu64 ", \n"
+                                          " \"overload.episodes\": %" PRIu64 ", \n"
+                                          " \"overload.shed-requests\": %" PRIu64 ", \n"
+                                          " \"file.content-cache-hits\": %" PRIu64 ", \n"
+                                          " \"file.content-cache-stores\": %" PRIu64 "\n",
                        H1_AGG_ERR(400), H1_AGG_ERR(403), H1_AGG_ERR(404), H1_AGG_ERR(405), H1_AGG_ERR(416), H1_AGG_ERR(417),
                        H1_AGG_ERR(500), H1_AGG_ERR(502), H1_AGG_ERR(503), H2_AGG_ERR(PROTOCOL), H2_AGG_ERR(INTERNAL),
                        H2_AGG_ERR(FLOW_CONTROL), H2_AGG_ERR(SETTINGS_TIMEOUT), H2_AGG_ERR(STREAM_CLOSED), H2_AGG_ERR(FRAME_SIZE),
                        H2_AGG_ERR(REFUSED_STREAM), H2_AGG_ERR(CANCEL), H2_AGG_ERR(COMPRESSION), H2_AGG_ERR(CONNECT),
-                       H2_AGG_ERR(ENHANCE_YOUR_CALM), H2_AGG_ERR(INADEQUATE_SECURITY), esc->h2_read_closed, esc->h2_write_closed);
+                       H2_AGG_ERR(ENHANCE_YOUR_CALM), H2_AGG_ERR(INADEQUATE_SECURITY), esc->h2_read_closed, esc->h2_write_closed,
+                       esc->proxy_retries, esc->proxy_retries_suppressed, esc->overload_episodes, esc->overload_shed_requests,
+                       esc->file_content_cache_hits, esc->file_content_cache_stores);
 #ifndef _MSC_VER
 	pthread_mutex_destroy(&esc->mutex);
 #else
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include "h2o.h"
+
+struct st_fastcgi_status_t {
+    h2o_mem_pool_t *pool;
+    H2O_VECTOR(h2o_iovec_t) entries;
+};
+
+static void collect_workers(h2o_fastcgi_workers_status_t *workers, void *_status)
+{
+    struct st_fastcgi_status_t *status = _status;
+    h2o_iovec_t *entry;
+
+#define BUFSIZE 512
+    h2o_vector_reserve(status->pool, &status->entries, status->entries.size + 1);
+    entry = status->entries.entries + status->entries.size++;
+    entry->base = h2o_mem_alloc_pool(status->pool, BUFSIZE + workers->path.len);
+    entry->len = snprintf(entry->base, BUFSIZE + workers->path.len,
+                          "%s\n  {\"path\": \"%.*s\", \"workers\": %zu, \"min-workers\": %zu, \"max-workers\": %zu, \"busy\": %zu, "
+                          "\"queued\": %zu, \"spawned\": %" PRIu64 ", \"terminated\": %" PRIu64 ", \"requests\": %" PRIu64
+                          ", \"queue-rejected\": %" PRIu64 ", \"queue-timeouts\": %" PRIu64 ", \"latency\": %" PRIu64 "}",
+                          status->entries.size == 2 ? "" : ",", (int)workers->path.len, workers->path.base, workers->num_running,
+                          workers->min_workers, workers->max_workers, workers->num_busy, workers->num_queued, workers->num_spawned,
+                          workers->num_terminated, workers->num_requests, workers->num_queue_rejected, workers->num_queue_timeouts,
+                          workers->latency);
+#undef BUFSIZE
+}
+
+static h2o_iovec_t fastcgi_status_final(void *priv, h2o_globalconf_t *gconf, h2o_req_t *req)
+{
+    struct st_fastcgi_status_t status = {&req->pool};
+
+    h2o_vector_reserve(&req->pool, &status.entries, 16);
+    status.entries.entries[status.entries.size++] = h2o_iovec_init(H2O_STRLIT(",\n \"fastcgi-workers\": ["));
+    h2o_fastcgi_foreach_workers(collect_workers, &status);
+    h2o_vector_reserve(&req->pool, &status.entries, status.entries.size + 1);
+    status.entries.entries[status.entries.size++] = h2o_iovec_init(H2O_STRLIT("\n ]\n"));
+
+    return h2o_concat_list(&req->pool, status.entries.entries, status.entries.size);
+}
+
+#ifndef _MSC_VER
+h2o_status_handler_t fastcgi_status_handler = {
+    {H2O_STRLIT("fastcgi")}, NULL, NULL, fastcgi_status_final,
+};
+#else
+h2o_status_handler_t fastcgi_status_handler = {
+	{ H2O_MY_STRLIT("fastcgi") }, NULL, NULL, fastcgi_status_final,
+};
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2016 Fastly
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include "h2o.h"
+
+static h2o_iovec_t hostinfo_status_final(void *priv, h2o_globalconf_t *gconf, h2o_req_t *req)
+{
+    h2o_hostinfo_cache_stats_t stats;
+    h2o_iovec_t ret;
+
+    h2o_hostinfo_get_cache_stats(&stats);
+
+#define BUFSIZE 512
+    ret.base = h2o_mem_alloc_pool(&req->pool, BUFSIZE);
+    ret.len = snprintf(ret.base, BUFSIZE, ",\n"
+                                          " \"name-resolution.cache-hits\": %" PRIu64 ",\n"
+                                          " \"name-resolution.cache-stale-hits\": %" PRIu64 ",\n"
+                                          " \"name-resolution.cache-misses\": %" PRIu64 ",\n"
+                                          " \"name-resolution.coalesced\": %" PRIu64 ",\n"
+                                          " \"name-resolution.failed-revalidations\": %" PRIu64 ",\n"
+                                          " \"name-resolution.cache-entries\": %zu\n",
+                       stats.hits, stats.stale_hits, stats.misses, stats.coalesced, stats.failed_revalidations, stats.num_entries);
+    return ret;
+#undef BUFSIZE
+}
+
+#ifndef _MSC_VER
+h2o_status_handler_t hostinfo_status_handler = {
+    {H2O_STRLIT("hostinfo")}, NULL, NULL, hostinfo_status_final,
+};
+#else
+h2o_status_handler_t hostinfo_status_handler = {
+	{ H2O_MY_STRLIT("hostinfo") }, NULL, NULL, hostinfo_status_final,
+};
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016 Fastly
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include "h2o.h"
+
+struct st_upstreams_status_t {
+    h2o_mem_pool_t *pool;
+    H2O_VECTOR(h2o_iovec_t) entries;
+};
+
+static const char *health_state_to_string(h2o_socketpool_health_state_t state)
+{
+    switch (state) {
+    case H2O_SOCKETPOOL_HEALTHY:
+        return "healthy";
+    case H2O_SOCKETPOOL_UNHEALTHY:
+        return "unhealthy";
+    case H2O_SOCKETPOOL_SLOW_START:
+        return "slow-start";
+    }
+    return "unknown";
+}
+
+static void collect_health(h2o_socketpool_t *pool, h2o_socketpool_health_t *health, void *_status)
+{
+    struct st_upstreams_status_t *status = _status;
+    h2o_iovec_t serv = pool->type == H2O_SOCKETPOOL_TYPE_NAMED ? pool->peer.named_serv : h2o_iovec_init(NULL, 0);
+    h2o_iovec_t *entry;
+
+#define BUFSIZE 512
+    h2o_vector_reserve(status->pool, &status->entries, status->entries.size + 1);
+    entry = status->entries.entries + status->entries.size++;
+    entry->base = h2o_mem_alloc_pool(status->pool, BUFSIZE + pool->peer.host.len);
+    entry->len = snprintf(entry->base, BUFSIZE + pool->peer.host.len, "%s\n  {\"peer\": \"%.*s%s%.*s\", \"state\": \"%s\", "
+                                                                      "\"consecutive-failures\": %zu, \"ejections\": %" PRIu64
+                                                                      ", \"rejected\": %" PRIu64 ", \"probes\": %" PRIu64
+                                                                      ", \"probe-failures\": %" PRIu64 "}",
+                          status->entries.size == 2 ? "" : ",", (int)pool->peer.host.len, pool->peer.host.base,
+                          serv.len != 0 ? ":" : "", (int)serv.len, serv.base, health_state_to_string(health->state),
+                          health->consecutive_failures, health->num_ejections, health->num_rejected, health->num_probes,
+                          health->num_probe_failures);
+#undef BUFSIZE
+}
+
+static h2o_iovec_t upstreams_status_final(void *priv, h2o_globalconf_t *gconf, h2o_req_t *req)
+{
+    struct st_upstreams_status_t status = {&req->pool};
+
+    h2o_vector_reserve(&req->pool, &status.entries, 16);
+    status.entries.entries[status.entries.size++] = h2o_iovec_init(H2O_STRLIT(",\n \"upstreams\": ["));
+    h2o_socketpool_foreach_health(collect_health, &status);
+    h2o_vector_reserve(&req->pool, &status.entries, status.entries.size + 1);
+    status.entries.entries[status.entries.size++] = h2o_iovec_init(H2O_STRLIT("\n ]\n"));
+
+    return h2o_concat_list(&req->pool, status.entries.entries, status.entries.size);
+}
+
+#ifndef _MSC_VER
+h2o_status_handler_t upstreams_status_handler = {
+    {H2O_STRLIT("upstreams")}, NULL, NULL, upstreams_status_final,
+};
+#else
+h2o_status_handler_t upstreams_status_handler = {
+	{ H2O_MY_STRLIT("upstreams") }, NULL, NULL, upstreams_status_final,
+};
+#endif
@@ -426,6 +426,19 @@ static void send_bad_request(struct st_h2o_http1_conn_t *conn)
     h2o_socket_write(conn->sock, (h2o_iovec_t *)&resp, 1, send_bad_request_on_complete);
 }
 
+static void send_overloaded(struct st_h2o_http1_conn_t *conn)
+{
+    char *retry_after = h2o_mem_alloc_pool(&conn->req.pool, sizeof(H2O_UINT32_LONGEST_STR));
+    size_t retry_after_len = sprintf(retry_after, "%u", conn->super.ctx->globalconf->overload.retry_after);
+
+    set_timeout(conn, NULL, NULL);
+    h2o_socket_read_stop(conn->sock);
+    ++conn->super.ctx->overload.events.shed_requests;
+    h2o_add_header(&conn->req.pool, &conn->req.res.headers, H2O_TOKEN_RETRY_AFTER, retry_after, retry_after_len);
+    h2o_send_error_503(&conn->req, "Service Unavailable", "server is overloaded",
+                       H2O_SEND_ERROR_HTTP1_CLOSE_CONNECTION | H2O_SEND_ERROR_KEEP_HEADERS);
+}
+
 static void handle_incoming_request(struct st_h2o_http1_conn_t *conn)
 {
     size_t inreqlen = conn->sock->input->size < H2O_MAX_REQLEN ? conn->sock->input->size : H2O_MAX_REQLEN;
@@ -447,7 +460,13 @@ static void handle_incoming_request(struct st_h2o_http1_conn_t *conn)
     switch (reqlen) {
     default: // parse complete
         conn->_reqsize = reqlen;
-        if ((entity_body_header_index = fixup_request(conn, headers, num_headers, minor_version, &expect)) != -1) {
+        entity_body_header_index = fixup_request(conn, headers, num_headers, minor_version, &expect);
+        /* shed the request while the thread is overloaded; the connection is closed since the request body is not read */
+        if (h2o_context_is_overloaded(conn->super.ctx)) {
+            send_overloaded(conn);
+            return;
+        }
+        if (entity_body_header_index != -1) {
             conn->req.timestamps.request_body_begin_at = *h2o_get_timestamp(conn->super.ctx, NULL, NULL);
             if (expect.base != NULL) {
                 if (!h2o_lcstris(expect.base, expect.len, H2O_STRLIT("100-continue"))) {
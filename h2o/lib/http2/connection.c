@@ -372,6 +372,12 @@ static int handle_incoming_request(h2o_http2_conn_t *conn, h2o_http2_stream_t *s
         ret = H2O_HTTP2_ERROR_REFUSED_STREAM;
         goto SendRSTStream;
     }
+    /* shed the request while the thread is overloaded; REFUSED_STREAM tells the client that it can be retried safely */
+    if (h2o_context_is_overloaded(conn->super.ctx)) {
+        ++conn->super.ctx->overload.events.shed_requests;
+        ret = H2O_HTTP2_ERROR_REFUSED_STREAM;
+        goto SendRSTStream;
+    }
 
     if (stream->_req_body == NULL) {
         execute_or_enqueue_request(conn, stream);
@@ -508,6 +514,11 @@ static int handle_data_frame(h2o_http2_conn_t *conn, h2o_http2_frame_t *frame, c
     if (conn->state >= H2O_HTTP2_CONN_STATE_HALF_CLOSED)
         return 0;
 
+    if ((ssize_t)frame->length > h2o_http2_window_get_window(&conn->_input_window)) {
+        *err_desc = "flow control window exceeded";
+        return H2O_HTTP2_ERROR_FLOW_CONTROL;
+    }
+
     stream = h2o_http2_conn_get_stream(conn, frame->stream_id);
 
     /* save the input in the request body buffer, or send error (and close the stream) */
@@ -522,6 +533,10 @@ static int handle_data_frame(h2o_http2_conn_t *conn, h2o_http2_frame_t *frame, c
         stream_send_error(conn, frame->stream_id, H2O_HTTP2_ERROR_STREAM_CLOSED);
         h2o_http2_stream_reset(conn, stream);
         stream = NULL;
+    } else if ((ssize_t)frame->length > h2o_http2_window_get_window(&stream->input_window)) {
+        stream_send_error(conn, frame->stream_id, H2O_HTTP2_ERROR_FLOW_CONTROL);
+        h2o_http2_stream_reset(conn, stream);
+        stream = NULL;
     } else if (stream->_req_body->size + payload.length > conn->super.ctx->globalconf->max_request_entity_size) {
         stream_send_error(conn, frame->stream_id, H2O_HTTP2_ERROR_REFUSED_STREAM);
         h2o_http2_stream_reset(conn, stream);
@@ -683,10 +698,10 @@ static int handle_settings_frame(h2o_http2_conn_t *conn, h2o_http2_frame_t *fram
         }
     } else {
         uint32_t prev_initial_window_size = conn->peer_settings.initial_window_size;
-        /* FIXME handle SETTINGS_HEADER_TABLE_SIZE */
         int ret = h2o_http2_update_peer_settings(&conn->peer_settings, frame->payload, frame->length, err_desc);
         if (ret != 0)
             return ret;
+        h2o_hpack_apply_header_table_size(&conn->_output_header_table, conn->peer_settings.header_table_size);
         { /* schedule ack */
             h2o_iovec_t header_buf = h2o_buffer_reserve(&conn->_write.buf, H2O_HTTP2_FRAME_HEADER_SIZE);
             h2o_http2_encode_frame_header((void *)header_buf.base, 0, H2O_HTTP2_FRAME_TYPE_SETTINGS, H2O_HTTP2_FRAME_FLAG_ACK, 0);
@@ -30,6 +30,7 @@
 #define HEADER_TABLE_OFFSET 62
 #define HEADER_TABLE_ENTRY_SIZE_OFFSET 32
 #define STATUS_HEADER_MAX_SIZE 5
+#define HEADER_TABLE_SIZE_UPDATE_MAX_SIZE 6
 #define CONTENT_LENGTH_HEADER_MAX_SIZE                                                                                             \
     (3 + sizeof(H2O_UINT64_LONGEST_STR) - 1) /* uses Literal Header Field without Indexing (RFC7541 6.2.2) */
 
@@ -404,8 +405,8 @@ Redo:
     if (do_index) {
         struct st_h2o_hpack_header_table_entry_t *entry =
             header_table_add(hpack_header_table, result->name->len + result->value->len + HEADER_TABLE_ENTRY_SIZE_OFFSET, SIZE_MAX);
-        entry->err_desc = *err_desc;
         if (entry != NULL) {
+            entry->err_desc = *err_desc;
             entry->name = result->name;
             if (!h2o_iovec_is_token(entry->name))
                 h2o_mem_addref_shared(entry->name);
@@ -467,6 +468,17 @@ static uint8_t *encode_content_length(uint8_t *dst, size_t value)
     return dst;
 }
 
+void h2o_hpack_apply_header_table_size(h2o_hpack_header_table_t *header_table, uint32_t header_table_size)
+{
+    /* the table is never enlarged; the peer is notified of the reduction at the head of the next header block */
+    if (header_table_size >= header_table->hpack_capacity)
+        return;
+    header_table->hpack_capacity = header_table_size;
+    while (header_table->num_entries != 0 && header_table->hpack_size > header_table->hpack_capacity)
+        header_table_evict_one(header_table);
+    header_table->hpack_capacity_update_pending = 1;
+}
+
 void h2o_hpack_dispose_header_table(h2o_hpack_header_table_t *header_table)
 {
     if (header_table->num_entries != 0) {
@@ -579,6 +591,64 @@ int h2o_hpack_parse_headers(h2o_req_t *req, h2o_hpack_header_table_t *header_tab
     return 0;
 }
 
+int h2o_hpack_parse_response_headers(h2o_mem_pool_t *pool, int *status, h2o_headers_t *headers,
+                                     h2o_hpack_header_table_t *header_table, const uint8_t *src, size_t len, size_t *content_length,
+                                     const char **err_desc)
+{
+    const uint8_t *src_end = src + len;
+
+    *status = 0;
+    *content_length = SIZE_MAX;
+
+    while (src != src_end) {
+        struct st_h2o_decode_header_result_t r;
+        const char *decode_err = NULL;
+        int ret = decode_header(pool, &r, header_table, &src, src_end, &decode_err);
+        if (ret != 0) {
+            if (ret == H2O_HTTP2_ERROR_INVALID_HEADER_CHAR) {
+                /* this is a soft error, we continue parsing, but register only the first error */
+                if (*err_desc == NULL) {
+                    *err_desc = decode_err;
+                }
+            } else {
+                *err_desc = decode_err;
+                return ret;
+            }
+        }
+        if (r.name->base[0] == ':') {
+            /* only :status is allowed, and it must precede the regular headers (RFC 7540 8.1.2.4) */
+            if (r.name != &H2O_TOKEN_STATUS->buf || *status != 0 || headers->size != 0)
+                return H2O_HTTP2_ERROR_PROTOCOL;
+            if (r.value->len != 3 || !('1' <= r.value->base[0] && r.value->base[0] <= '9') ||
+                !('0' <= r.value->base[1] && r.value->base[1] <= '9') || !('0' <= r.value->base[2] && r.value->base[2] <= '9'))
+                return H2O_HTTP2_ERROR_PROTOCOL;
+            *status = (r.value->base[0] - '0') * 100 + (r.value->base[1] - '0') * 10 + (r.value->base[2] - '0');
+        } else {
+            if (h2o_iovec_is_token(r.name)) {
+                h2o_token_t *token = H2O_STRUCT_FROM_MEMBER(h2o_token_t, buf, r.name);
+                if (token == H2O_TOKEN_CONTENT_LENGTH) {
+                    if ((*content_length = h2o_strtosize(r.value->base, r.value->len)) == SIZE_MAX)
+                        return H2O_HTTP2_ERROR_PROTOCOL;
+                } else {
+                    /* connection-specific headers are not allowed (RFC 7540 8.1.2.2) */
+                    if (token->http2_should_reject)
+                        return H2O_HTTP2_ERROR_PROTOCOL;
+                    h2o_add_header(pool, headers, token, r.value->base, r.value->len);
+                }
+            } else {
+                h2o_add_header_by_str(pool, headers, r.name->base, r.name->len, 0, r.value->base, r.value->len);
+            }
+        }
+    }
+
+    if (*status == 0)
+        return H2O_HTTP2_ERROR_PROTOCOL;
+    if (*err_desc) {
+        return H2O_HTTP2_ERROR_INVALID_HEADER_CHAR;
+    }
+    return 0;
+}
+
 static inline int encode_int_is_onebyte(uint32_t value, size_t prefix_bits)
 {
     return value < (1 << prefix_bits) - 1;
@@ -667,6 +737,16 @@ size_t h2o_hpack_encode_string(uint8_t *dst, const char *s, size_t len)
     return encode_as_is(dst, s, len);
 }
 
+static uint8_t *encode_header_table_size_update(h2o_hpack_header_table_t *header_table, uint8_t *dst)
+{
+    if (header_table->hpack_capacity_update_pending) {
+        *dst = 0x20;
+        dst = encode_int(dst, (uint32_t)header_table->hpack_capacity, 5);
+        header_table->hpack_capacity_update_pending = 0;
+    }
+    return dst;
+}
+
 static uint8_t *encode_header(h2o_hpack_header_table_t *header_table, uint8_t *dst, const h2o_iovec_t *name,
                               const h2o_iovec_t *value)
 {
@@ -799,19 +879,20 @@ static size_t calc_headers_capacity(const h2o_header_t *headers, size_t num_head
     return capacity;
 }
 
-static void fixup_frame_headers(h2o_buffer_t **buf, size_t start_at, uint8_t type, uint32_t stream_id, size_t max_frame_size)
+static void fixup_frame_headers(h2o_buffer_t **buf, size_t start_at, uint8_t type, uint8_t flags, uint32_t stream_id,
+                                size_t max_frame_size)
 {
     /* try to fit all data into single frame, using the preallocated space for the frame header */
     size_t payload_size = (*buf)->size - start_at - H2O_HTTP2_FRAME_HEADER_SIZE;
     if (payload_size <= max_frame_size) {
-        h2o_http2_encode_frame_header((uint8_t *)((*buf)->bytes + start_at), payload_size, type, H2O_HTTP2_FRAME_FLAG_END_HEADERS,
-                                      stream_id);
+        h2o_http2_encode_frame_header((uint8_t *)((*buf)->bytes + start_at), payload_size, type,
+                                      flags | H2O_HTTP2_FRAME_FLAG_END_HEADERS, stream_id);
         return;
     }
 
     /* need to setup continuation frames */
     size_t off;
-    h2o_http2_encode_frame_header((uint8_t *)((*buf)->bytes + start_at), max_frame_size, type, 0, stream_id);
+    h2o_http2_encode_frame_header((uint8_t *)((*buf)->bytes + start_at), max_frame_size, type, flags, stream_id);
     off = start_at + H2O_HTTP2_FRAME_HEADER_SIZE + max_frame_size;
     while (1) {
         size_t left = (*buf)->size - off;
@@ -830,40 +911,80 @@ static void fixup_frame_headers(h2o_buffer_t **buf, size_t start_at, uint8_t typ
     }
 }
 
+static size_t calc_request_capacity(h2o_iovec_t method, const h2o_url_scheme_t *scheme, h2o_iovec_t authority, h2o_iovec_t path,
+                                    const h2o_header_t *headers, size_t num_headers)
+{
+    size_t capacity = calc_headers_capacity(headers, num_headers);
+    capacity += calc_capacity(H2O_TOKEN_METHOD->buf.len, method.len);
+    capacity += calc_capacity(H2O_TOKEN_SCHEME->buf.len, scheme->name.len);
+    capacity += calc_capacity(H2O_TOKEN_AUTHORITY->buf.len, authority.len);
+    capacity += calc_capacity(H2O_TOKEN_PATH->buf.len, path.len);
+    capacity += HEADER_TABLE_SIZE_UPDATE_MAX_SIZE;
+    return capacity;
+}
+
+static uint8_t *encode_request(h2o_hpack_header_table_t *header_table, uint8_t *dst, h2o_iovec_t method,
+                               const h2o_url_scheme_t *scheme, h2o_iovec_t authority, h2o_iovec_t path,
+                               const h2o_header_t *headers, size_t num_headers)
+{
+    dst = encode_method(header_table, dst, method);
+    dst = encode_scheme(header_table, dst, scheme);
+    dst = encode_header(header_table, dst, &H2O_TOKEN_AUTHORITY->buf, &authority);
+    dst = encode_path(header_table, dst, path);
+    size_t i;
+    for (i = 0; i != num_headers; ++i) {
+        const h2o_header_t *header = headers + i;
+        if (header->name == &H2O_TOKEN_ACCEPT_ENCODING->buf &&
+            h2o_memis(header->value.base, header->value.len, H2O_STRLIT("gzip, deflate"))) {
+            *dst++ = 0x90;
+        } else {
+            dst = encode_header(header_table, dst, header->name, &header->value);
+        }
+    }
+    return dst;
+}
+
 void h2o_hpack_flatten_request(h2o_buffer_t **buf, h2o_hpack_header_table_t *header_table, uint32_t stream_id,
                                size_t max_frame_size, h2o_req_t *req, uint32_t parent_stream_id)
 {
-    size_t capacity = calc_headers_capacity(req->headers.entries, req->headers.size);
+    size_t capacity = calc_request_capacity(req->input.method, req->input.scheme, req->input.authority, req->input.path,
+                                            req->headers.entries, req->headers.size);
     capacity += H2O_HTTP2_FRAME_HEADER_SIZE /* first frame header */
                 + 4;                        /* promised stream id */
-    capacity += calc_capacity(H2O_TOKEN_METHOD->buf.len, req->input.method.len);
-    capacity += calc_capacity(H2O_TOKEN_SCHEME->buf.len, req->input.scheme->name.len);
-    capacity += calc_capacity(H2O_TOKEN_AUTHORITY->buf.len, req->input.authority.len);
-    capacity += calc_capacity(H2O_TOKEN_PATH->buf.len, req->input.path.len);
 
     size_t start_at = (*buf)->size;
     uint8_t *dst = (void *)(h2o_buffer_reserve(buf, capacity).base + H2O_HTTP2_FRAME_HEADER_SIZE);
 
     /* encode */
     dst = h2o_http2_encode32u(dst, stream_id);
-    dst = encode_method(header_table, dst, req->input.method);
-    dst = encode_scheme(header_table, dst, req->input.scheme);
-    dst = encode_header(header_table, dst, &H2O_TOKEN_AUTHORITY->buf, &req->input.authority);
-    dst = encode_path(header_table, dst, req->input.path);
-    size_t i;
-    for (i = 0; i != req->headers.size; ++i) {
-        const h2o_header_t *header = req->headers.entries + i;
-        if (header->name == &H2O_TOKEN_ACCEPT_ENCODING->buf &&
-            h2o_memis(header->value.base, header->value.len, H2O_STRLIT("gzip, deflate"))) {
-            *dst++ = 0x90;
-        } else {
-            dst = encode_header(header_table, dst, header->name, &header->value);
-        }
-    }
+    dst = encode_header_table_size_update(header_table, dst);
+    dst = encode_request(header_table, dst, req->input.method, req->input.scheme, req->input.authority, req->input.path,
+                         req->headers.entries, req->headers.size);
+    (*buf)->size = (char *)dst - (*buf)->bytes;
+
+    /* setup the frame headers */
+    fixup_frame_headers(buf, start_at, H2O_HTTP2_FRAME_TYPE_PUSH_PROMISE, 0, parent_stream_id, max_frame_size);
+}
+
+void h2o_hpack_flatten_request_headers(h2o_buffer_t **buf, h2o_hpack_header_table_t *header_table, uint32_t stream_id,
+                                       size_t max_frame_size, h2o_iovec_t method, const h2o_url_scheme_t *scheme,
+                                       h2o_iovec_t authority, h2o_iovec_t path, const h2o_header_t *headers, size_t num_headers,
+                                       int is_end_stream)
+{
+    size_t capacity = calc_request_capacity(method, scheme, authority, path, headers, num_headers);
+    capacity += H2O_HTTP2_FRAME_HEADER_SIZE; /* first frame header */
+
+    size_t start_at = (*buf)->size;
+    uint8_t *dst = (void *)(h2o_buffer_reserve(buf, capacity).base + H2O_HTTP2_FRAME_HEADER_SIZE);
+
+    /* encode */
+    dst = encode_header_table_size_update(header_table, dst);
+    dst = encode_request(header_table, dst, method, scheme, authority, path, headers, num_headers);
     (*buf)->size = (char *)dst - (*buf)->bytes;
 
     /* setup the frame headers */
-    fixup_frame_headers(buf, start_at, H2O_HTTP2_FRAME_TYPE_PUSH_PROMISE, parent_stream_id, max_frame_size);
+    fixup_frame_headers(buf, start_at, H2O_HTTP2_FRAME_TYPE_HEADERS, is_end_stream ? H2O_HTTP2_FRAME_FLAG_END_STREAM : 0,
+                        stream_id, max_frame_size);
 }
 
 void h2o_hpack_flatten_response(h2o_buffer_t **buf, h2o_hpack_header_table_t *header_table, uint32_t stream_id,
@@ -873,6 +994,7 @@ void h2o_hpack_flatten_response(h2o_buffer_t **buf, h2o_hpack_header_table_t *he
     size_t capacity = calc_headers_capacity(res->headers.entries, res->headers.size);
     capacity += H2O_HTTP2_FRAME_HEADER_SIZE; /* for the first header */
     capacity += STATUS_HEADER_MAX_SIZE;      /* for :status: */
+    capacity += HEADER_TABLE_SIZE_UPDATE_MAX_SIZE;
 #ifndef H2O_UNITTEST
     capacity += 2 + H2O_TIMESTR_RFC1123_LEN; /* for Date: */
     if (server_name->len) {
@@ -886,6 +1008,7 @@ void h2o_hpack_flatten_response(h2o_buffer_t **buf, h2o_hpack_header_table_t *he
     uint8_t *dst = (void *)(h2o_buffer_reserve(buf, capacity).base + H2O_HTTP2_FRAME_HEADER_SIZE); /* skip frame header */
 
     /* encode */
+    dst = encode_header_table_size_update(header_table, dst);
     dst = encode_status(dst, res->status);
 #ifndef H2O_UNITTEST
     /* TODO keep some kind of reference to the indexed headers of Server and Date, and reuse them */
@@ -907,5 +1030,5 @@ void h2o_hpack_flatten_response(h2o_buffer_t **buf, h2o_hpack_header_table_t *he
     (*buf)->size = (char *)dst - (*buf)->bytes;
 
     /* setup the frame headers */
-    fixup_frame_headers(buf, start_at, H2O_HTTP2_FRAME_TYPE_HEADERS, stream_id, max_frame_size);
+    fixup_frame_headers(buf, start_at, H2O_HTTP2_FRAME_TYPE_HEADERS, 0, stream_id, max_frame_size);
 }
@@ -71,6 +71,9 @@
 
 #define H2O_DEFAULT_NUM_NAME_RESOLUTION_THREADS 32
 
+#define H2O_DEFAULT_NUM_FILE_IO_THREADS 16
+#define H2O_DEFAULT_NUM_COMPRESS_THREADS 4
+
 #define H2O_DEFAULT_OCSP_UPDATER_MAX_THREADS 10
 
 struct listener_ssl_config_t {
@@ -100,9 +103,19 @@ struct listener_config_t {
     int proxy_protocol;
 };
 
+struct connection_counter_t {
+    int num_connections;        /* number of currently handled incoming connections, only updated by the owning thread */
+    unsigned long num_sessions; /* total number of opened incoming connections, only updated by the owning thread */
+    int accept_paused; /* set by the owning thread while the listeners are stopped due to max-connections, cleared by the thread
+                          that wakes it up */
+    /* unused buffer exists to avoid false sharing of the cache line */
+    char _unused_avoid_false_sharing[44];
+};
+
 struct listener_ctx_t {
     h2o_accept_ctx_t accept_ctx;
     h2o_socket_t *sock;
+    struct connection_counter_t *counter;
 };
 
 typedef struct st_resolve_tag_node_cache_entry_t {
@@ -143,19 +156,10 @@ static struct {
         h2o_context_t ctx;
         h2o_multithread_receiver_t server_notifications;
         h2o_multithread_receiver_t memcached;
+        struct connection_counter_t counter;
     } * threads;
     volatile sig_atomic_t shutdown_requested;
     volatile sig_atomic_t initialized_threads;
-    struct {
-        /* unused buffers exist to avoid false sharing of the cache line */
-        char _unused1_avoir_false_sharing[32];
-        int _num_connections; /* number of currently handled incoming connections, should use atomic functions to update the value
-                                 */
-        char _unused2_avoir_false_sharing[32];
-        unsigned long
-            _num_sessions; /* total number of opened incoming connections, should use atomic functions to update the value */
-        char _unused3_avoir_false_sharing[32];
-    } state;
     char *crash_handler;
 } conf = {
     {NULL},                                 /* globalconf */
@@ -172,7 +176,6 @@ static struct {
     NULL,                                   /* thread_ids */
     0,                                      /* shutdown_requested */
     0,                                      /* initialized_threads */
-    {{0}},                                  /* state */
     "share/h2o/annotate-backtrace-symbols", /* crash_handler */
 };
 
@@ -1098,6 +1101,51 @@ static int on_config_num_name_resolution_threads(h2o_configurator_command_t *cmd
     return 0;
 }
 
+static int on_config_num_file_io_threads(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    if (h2o_configurator_scanf(cmd, node, "%zu", &h2o_fileio_max_threads) != 0)
+        return -1;
+    if (h2o_fileio_max_threads == 0) {
+        h2o_configurator_errprintf(cmd, node, "num-file-io-threads must be >=1");
+        return -1;
+    }
+    return 0;
+}
+
+static int on_config_num_compress_threads(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    if (h2o_configurator_scanf(cmd, node, "%zu", &h2o_compress_max_threads) != 0)
+        return -1;
+    if (h2o_compress_max_threads == 0) {
+        h2o_configurator_errprintf(cmd, node, "num-compress-threads must be >=1");
+        return -1;
+    }
+    return 0;
+}
+
+static int on_config_name_resolution_cache_ttl(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    uint64_t secs, *dst;
+
+    if (h2o_configurator_scanf(cmd, node, "%" PRIu64, &secs) != 0)
+        return -1;
+    if (strcmp(cmd->name, "name-resolution-cache-ttl") == 0) {
+        dst = &h2o_hostinfo_cache_ttl;
+    } else if (strcmp(cmd->name, "name-resolution-cache-negative-ttl") == 0) {
+        dst = &h2o_hostinfo_cache_negative_ttl;
+    } else {
+        dst = &h2o_hostinfo_cache_stale_ttl;
+    }
+    *dst = secs * 1000;
+    return 0;
+}
+
+static int on_config_upstream_connection_attempt_delay(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx,
+                                                       yoml_t *node)
+{
+    return h2o_configurator_scanf(cmd, node, "%" PRIu64, &h2o_happy_eyeballs_delay);
+}
+
 static int on_config_tcp_fastopen(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
     if (h2o_configurator_scanf(cmd, node, "%d", &conf.tfo_queues) != 0)
@@ -1317,23 +1365,38 @@ static void setup_signal_handlers(void)
 #endif
 }
 
-static int num_connections(int delta)
+static int num_connections(void)
 {
-    return __sync_fetch_and_add(&conf.state._num_connections, delta);
+    /* the counters are updated only by their owning threads; the sum is an approximation that is good enough for admission
+     * control */
+    int sum = 0;
+    size_t i;
+    for (i = 0; i != conf.num_threads; ++i)
+        sum += *(volatile int *)&conf.threads[i].counter.num_connections;
+    return sum;
 }
 
-static unsigned long num_sessions(int delta)
+static unsigned long num_sessions(void)
 {
-    return __sync_fetch_and_add(&conf.state._num_sessions, delta);
+    unsigned long sum = 0;
+    size_t i;
+    for (i = 0; i != conf.num_threads; ++i)
+        sum += *(volatile unsigned long *)&conf.threads[i].counter.num_sessions;
+    return sum;
 }
 
 static void on_socketclose(void *data)
 {
-    int prev_num_connections = num_connections(-1);
+    struct connection_counter_t *counter = data;
+    size_t i;
+
+    --counter->num_connections;
 
-    if (prev_num_connections == conf.max_connections) {
-        /* ready to accept new connections. wake up all the threads! */
-        notify_all_threads();
+    /* ready to accept new connections. wake up the threads that have stopped accepting due to max-connections, only once per
+     * pause so that the threads are not flooded by notifications while the server is running at the limit */
+    for (i = 0; i != conf.num_threads; ++i) {
+        if (conf.threads[i].counter.accept_paused && __sync_bool_compare_and_swap(&conf.threads[i].counter.accept_paused, 1, 0))
+            h2o_multithread_send_message(&conf.threads[i].server_notifications, NULL);
     }
 }
 
@@ -1350,33 +1413,38 @@ static void on_accept(h2o_socket_t *listener, const char *err)
 
     do {
         h2o_socket_t *sock;
-        if (num_connections(0) >= conf.max_connections) {
+        if (num_connections() >= conf.max_connections || h2o_context_is_overloaded(ctx->accept_ctx.ctx)) {
             /* The accepting socket is disactivated before entering the next in `run_loop`.
              * Note: it is possible that the server would accept at most `max_connections + num_threads` connections, since the
              * server does not check if the number of connections has exceeded _after_ epoll notifies of a new connection _but_
              * _before_ calling `accept`.  In other words t/40max-connections.t may fail.
+             * While the event loop is overloaded, new connections are left in the backlog so that other threads (or processes) can
+             * pick them up.
              */
             break;
         }
         if ((sock = h2o_evloop_socket_accept(listener)) == NULL) {
             break;
         }
-        num_connections(1);
-        num_sessions(1);
+        ++ctx->counter->num_connections;
+        ++ctx->counter->num_sessions;
 
         sock->on_close.cb = on_socketclose;
-        sock->on_close.data = ctx->accept_ctx.ctx;
+        sock->on_close.data = ctx->counter;
 
         h2o_accept(&ctx->accept_ctx, sock);
 
     } while (--num_accepts != 0);
 }
 
-static void update_listener_state(struct listener_ctx_t *listeners)
+static void update_listener_state(h2o_context_t *ctx, struct connection_counter_t *counter, struct listener_ctx_t *listeners)
 {
     size_t i;
 
-    if (num_connections(0) < conf.max_connections) {
+    /* the overload probe keeps waking up the loop, so that the listeners are restarted once the load goes down (or if the
+     * notification sent by on_socketclose is missed) */
+    counter->accept_paused = num_connections() >= conf.max_connections;
+    if (!counter->accept_paused && !h2o_context_is_overloaded(ctx)) {
         for (i = 0; i != conf.num_listeners; ++i) {
             if (!h2o_socket_is_reading(listeners[i].sock))
                 h2o_socket_read_start(listeners[i].sock, on_accept);
@@ -1438,21 +1506,22 @@ H2O_NORETURN static void *run_loop(void *_thread_index)
             listeners[i].accept_ctx.ssl_ctx = listener_config->ssl.entries[0]->ctx;
         listeners[i].accept_ctx.expect_proxy_line = listener_config->proxy_protocol;
         listeners[i].accept_ctx.libmemcached_receiver = &conf.threads[thread_index].memcached;
+        listeners[i].counter = &conf.threads[thread_index].counter;
         listeners[i].sock = h2o_evloop_socket_create(conf.threads[thread_index].ctx.loop, fd, H2O_SOCKET_FLAG_DONT_READ);
         listeners[i].sock->data = listeners + i;
     }
     /* and start listening */
-    update_listener_state(listeners);
+    update_listener_state(&conf.threads[thread_index].ctx, &conf.threads[thread_index].counter, listeners);
 
     __sync_fetch_and_add(&conf.initialized_threads, 1);
     /* the main loop */
     while (1) {
         if (conf.shutdown_requested)
             break;
-        update_listener_state(listeners);
+        update_listener_state(&conf.threads[thread_index].ctx, &conf.threads[thread_index].counter, listeners);
         /* run the loop once */
         h2o_evloop_run(conf.threads[thread_index].ctx.loop);
-        h2o_filecache_clear(conf.threads[thread_index].ctx.filecache);
+        h2o_filecache_update(conf.threads[thread_index].ctx.filecache, h2o_now(conf.threads[thread_index].ctx.loop));
     }
 
     if (thread_index == 0)
@@ -1466,7 +1535,7 @@ H2O_NORETURN static void *run_loop(void *_thread_index)
     h2o_context_request_shutdown(&conf.threads[thread_index].ctx);
 
     /* wait until all the connection gets closed */
-    while (num_connections(0) != 0)
+    while (num_connections() != 0)
         h2o_evloop_run(conf.threads[thread_index].ctx.loop);
 
     /* the process that detects num_connections becoming zero performs the last cleanup */
@@ -1635,7 +1704,7 @@ static h2o_iovec_t on_extra_status(void *unused, h2o_globalconf_t *_conf, h2o_re
                                           " \"worker-threads\": %zu,\n"
                                           " \"num-sessions\": %lu",
                        SSLeay_version(SSLEAY_VERSION), current_time, restart_time, (uint64_t)(now - conf.launch_time), generation,
-                       num_connections(0), conf.max_connections, conf.num_listeners, conf.num_threads, num_sessions(0));
+                       num_connections(), conf.max_connections, conf.num_listeners, conf.num_threads, num_sessions());
     assert(ret.len < BUFSIZE);
 
 #if JEMALLOC_STATS == 1
@@ -1724,6 +1793,16 @@ static void setup_configurators(void)
         h2o_configurator_define_command(c, "num-threads", H2O_CONFIGURATOR_FLAG_GLOBAL, on_config_num_threads);
         h2o_configurator_define_command(c, "num-name-resolution-threads", H2O_CONFIGURATOR_FLAG_GLOBAL,
                                         on_config_num_name_resolution_threads);
+        h2o_configurator_define_command(c, "num-file-io-threads", H2O_CONFIGURATOR_FLAG_GLOBAL, on_config_num_file_io_threads);
+        h2o_configurator_define_command(c, "num-compress-threads", H2O_CONFIGURATOR_FLAG_GLOBAL, on_config_num_compress_threads);
+        h2o_configurator_define_command(c, "name-resolution-cache-ttl", H2O_CONFIGURATOR_FLAG_GLOBAL,
+                                        on_config_name_resolution_cache_ttl);
+        h2o_configurator_define_command(c, "name-resolution-cache-negative-ttl", H2O_CONFIGURATOR_FLAG_GLOBAL,
+                                        on_config_name_resolution_cache_ttl);
+        h2o_configurator_define_command(c, "name-resolution-cache-stale-ttl", H2O_CONFIGURATOR_FLAG_GLOBAL,
+                                        on_config_name_resolution_cache_ttl);
+        h2o_configurator_define_command(c, "upstream-connection-attempt-delay", H2O_CONFIGURATOR_FLAG_GLOBAL,
+                                        on_config_upstream_connection_attempt_delay);
         h2o_configurator_define_command(c, "tcp-fastopen", H2O_CONFIGURATOR_FLAG_GLOBAL, on_config_tcp_fastopen);
         h2o_configurator_define_command(c, "ssl-session-resumption",
                                         H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_MAPPING,
@@ -1738,6 +1817,7 @@ static void setup_configurators(void)
 
     h2o_access_log_register_configurator(&conf.globalconf);
     h2o_compress_register_configurator(&conf.globalconf);
+    h2o_concurrency_limit_register_configurator(&conf.globalconf);
     h2o_expires_register_configurator(&conf.globalconf);
     h2o_errordoc_register_configurator(&conf.globalconf);
     h2o_fastcgi_register_configurator(&conf.globalconf);
@@ -1766,6 +1846,8 @@ int main(int argc, char **argv)
     conf.launch_time = time(NULL);
 
     h2o_hostinfo_max_threads = H2O_DEFAULT_NUM_NAME_RESOLUTION_THREADS;
+    h2o_fileio_max_threads = H2O_DEFAULT_NUM_FILE_IO_THREADS;
+    h2o_compress_max_threads = H2O_DEFAULT_NUM_COMPRESS_THREADS;
 
     h2o_sem_init(&ocsp_updater_semaphore, H2O_DEFAULT_OCSP_UPDATER_MAX_THREADS);
 
@@ -1893,8 +1975,9 @@ int main(int argc, char **argv)
         dispose_resolve_tag_arg(&resolve_tag_arg);
         yoml_free(yoml, NULL);
     }
-    /* calculate defaults (note: open file cached is purged once every loop) */
-    conf.globalconf.filecache.capacity = conf.globalconf.http2.max_concurrent_requests_per_connection * 2;
+    /* calculate defaults (note: unless filecache.ttl is set, open file cache is purged once every loop) */
+    if (conf.globalconf.filecache.capacity == 0)
+        conf.globalconf.filecache.capacity = conf.globalconf.http2.max_concurrent_requests_per_connection * 2;
 
     /* check if all the fds passed in by server::starter were bound */
     if (conf.server_starter.fds != NULL) {
@@ -2035,6 +2118,7 @@ int main(int argc, char **argv)
 #else
 	conf.threads = _alloca(sizeof(conf.threads[0]) * conf.num_threads);
 #endif
+    memset(conf.threads, 0, sizeof(conf.threads[0]) * conf.num_threads);
     size_t i;
     for (i = 1; i != conf.num_threads; ++i) {
         pthread_t tid;
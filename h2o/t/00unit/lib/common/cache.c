@@ -85,4 +85,17 @@ void test_lib__common__cache_c(void)
     h2o_cache_destroy(cache);
 
     ok(bytes_destroyed == 16);
+
+    /* the lock of a multithreaded cache should be released after every operation */
+    cache = h2o_cache_create(H2O_CACHE_FLAG_MULTITHREADED, 1024, 1000, on_destroy);
+    h2o_cache_set(cache, now, key, 0, h2o_iovec_init(H2O_STRLIT("value")));
+    ref = h2o_cache_fetch(cache, now, key, 0);
+    ok(h2o_memis(ref->value.base, ref->value.len, H2O_STRLIT("value")));
+    h2o_cache_release(cache, ref);
+    ref = h2o_cache_fetch(cache, now, key, 0);
+    ok(ref != NULL);
+    h2o_cache_release(cache, ref);
+    ok(h2o_cache_get_capacity(cache) == 1024);
+    ok(h2o_cache_get_duration(cache) == 1000);
+    h2o_cache_destroy(cache);
 }
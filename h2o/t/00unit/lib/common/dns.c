@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "../../test.h"
+#include "../../../../lib/common/dns.c"
+
+static void test_parse_resolv_conf(void)
+{
+    h2o_dns_config_t config;
+    struct sockaddr_in *sin;
+    struct sockaddr_in6 *sin6;
+
+    h2o_dns_config_init(&config);
+#ifndef _MSC_VER
+    h2o_dns_config_parse_resolv_conf(&config, (h2o_iovec_t){H2O_STRLIT("# comment\n"
+                                                                       "nameserver 192.0.2.53\r\n"
+                                                                       "nameserver 2001:db8::53 # trailing comment\n"
+                                                                       "nameserver bogus\n"
+                                                                       "nameserver 192.0.2.54\n"
+                                                                       "nameserver 192.0.2.55\n"
+                                                                       "options rotate timeout:2 attempts:9\n")});
+#else
+	h2o_dns_config_parse_resolv_conf(&config, (h2o_iovec_t) { H2O_MY_STRLIT("# comment\n"
+																			"nameserver 192.0.2.53\r\n"
+																			"nameserver 2001:db8::53 # trailing comment\n"
+																			"nameserver bogus\n"
+																			"nameserver 192.0.2.54\n"
+																			"nameserver 192.0.2.55\n"
+																			"options rotate timeout:2 attempts:9\n") });
+#endif
+    ok(config.num_nameservers == 3);
+    sin = (void *)&config.nameservers[0].addr;
+    ok(sin->sin_family == AF_INET);
+    ok(ntohs(sin->sin_port) == 53);
+    ok(ntohl(sin->sin_addr.s_addr) == 0xc0000235);
+    sin6 = (void *)&config.nameservers[1].addr;
+    ok(sin6->sin6_family == AF_INET6);
+    ok(config.nameservers[1].len == sizeof(*sin6));
+    sin = (void *)&config.nameservers[2].addr;
+    ok(ntohl(sin->sin_addr.s_addr) == 0xc0000236);
+    ok(config.timeout == 2000);
+    ok(config.attempts == 5);
+    ok(!config.has_search);
+    h2o_dns_config_dispose(&config);
+
+    h2o_dns_config_init(&config);
+#ifndef _MSC_VER
+    h2o_dns_config_parse_resolv_conf(&config, (h2o_iovec_t){H2O_STRLIT("search example.com\noptions ndots:2")});
+#else
+	h2o_dns_config_parse_resolv_conf(&config, (h2o_iovec_t) { H2O_MY_STRLIT("search example.com\noptions ndots:2") });
+#endif
+    ok(config.num_nameservers == 0);
+    ok(config.has_search);
+    ok(config.ndots == 2);
+    h2o_dns_config_dispose(&config);
+}
+
+static void test_parse_hosts(void)
+{
+    h2o_dns_config_t config;
+
+    h2o_dns_config_init(&config);
+#ifndef _MSC_VER
+    h2o_dns_config_parse_hosts(&config, (h2o_iovec_t){H2O_STRLIT("127.0.0.1\tlocalhost\n"
+                                                                 "::1 localhost ip6-localhost # comment\n"
+                                                                 "# 192.0.2.1 commented.example.com\n"
+                                                                 "192.0.2.2 Mixed.Example.com\n"
+                                                                 "bogus bogus.example.com")});
+#else
+	h2o_dns_config_parse_hosts(&config, (h2o_iovec_t) { H2O_MY_STRLIT("127.0.0.1\tlocalhost\n"
+																	  "::1 localhost ip6-localhost # comment\n"
+																	  "# 192.0.2.1 commented.example.com\n"
+																	  "192.0.2.2 Mixed.Example.com\n"
+																	  "bogus bogus.example.com") });
+#endif
+    ok(config.hosts.size == 4);
+    ok(strcmp(config.hosts.entries[0].name, "localhost") == 0);
+    ok(config.hosts.entries[0].family == AF_INET);
+    ok(strcmp(config.hosts.entries[1].name, "localhost") == 0);
+    ok(config.hosts.entries[1].family == AF_INET6);
+    ok(strcmp(config.hosts.entries[2].name, "ip6-localhost") == 0);
+    ok(strcmp(config.hosts.entries[3].name, "mixed.example.com") == 0);
+    ok(ntohl(config.hosts.entries[3].addr.v4.s_addr) == 0xc0000202);
+    h2o_dns_config_dispose(&config);
+}
+
+#ifndef _MSC_VER
+
+static void write_file(const char *path, const char *content)
+{
+    FILE *fp = fopen(path, "wb");
+    assert(fp != NULL);
+    fputs(content, fp);
+    fclose(fp);
+}
+
+static void test_config_is_modified(void)
+{
+    char resolv_conf[] = "/tmp/h2o-dns-test.XXXXXX", hosts[] = "/tmp/h2o-dns-test.XXXXXX";
+    h2o_dns_config_t config;
+
+    close(mkstemp(resolv_conf));
+    close(mkstemp(hosts));
+    write_file(resolv_conf, "nameserver 192.0.2.53\n");
+    write_file(hosts, "192.0.2.1 a.example.com\n");
+
+    ok(load_files(&config, resolv_conf, hosts) == 0);
+    ok(config.num_nameservers == 1);
+    ok(config.hosts.size == 1);
+    ok(!h2o_dns_config_is_modified(&config));
+
+    write_file(resolv_conf, "nameserver 192.0.2.53\nnameserver 192.0.2.54\n");
+    ok(h2o_dns_config_is_modified(&config));
+    h2o_dns_config_dispose(&config);
+
+    ok(load_files(&config, resolv_conf, hosts) == 0);
+    ok(config.num_nameservers == 2);
+    ok(!h2o_dns_config_is_modified(&config));
+    unlink(hosts);
+    ok(h2o_dns_config_is_modified(&config));
+    h2o_dns_config_dispose(&config);
+
+    unlink(resolv_conf);
+    ok(load_files(&config, resolv_conf, hosts) != 0);
+    ok(!h2o_dns_config_is_modified(&config));
+    write_file(resolv_conf, "nameserver 192.0.2.53\n");
+    ok(h2o_dns_config_is_modified(&config));
+    h2o_dns_config_dispose(&config);
+
+    unlink(resolv_conf);
+}
+
+#endif
+
+#if H2O_USE_DNS_RESOLVER
+
+/* a nameserver that answers the queries sent by the tests */
+static struct {
+    uv_udp_t udp;
+    uv_tcp_t tcp;
+    struct sockaddr_in addr;
+    size_t num_received;
+    size_t num_dropped;
+} stub;
+
+static size_t build_stub_response(const uint8_t *query, size_t query_len, uint8_t *dst, int is_tcp)
+{
+    char name[256];
+    size_t pos = DNS_HEADER_SIZE, name_len = 0, dst_len;
+    uint16_t qtype, flags = 0x8180;
+    uint8_t rdata[16];
+    size_t rdlen = 0;
+
+    /* decode the question */
+    while (query[pos] != 0) {
+        if (name_len != 0)
+            name[name_len++] = '.';
+        memcpy(name + name_len, query + pos + 1, query[pos]);
+        name_len += query[pos];
+        pos += 1 + query[pos];
+    }
+    name[name_len] = '\0';
+    qtype = decode16(query + pos + 1);
+    pos += 5;
+
+    if (strcmp(name, "www.example.com") == 0 || strcmp(name, "retry.example.com") == 0) {
+        if (qtype == DNS_TYPE_A) {
+            static const uint8_t v4[] = {192, 0, 2, 1};
+            memcpy(rdata, v4, rdlen = 4);
+        } else {
+            static const uint8_t v6[] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+            memcpy(rdata, v6, rdlen = 16);
+        }
+    } else if (strcmp(name, "truncated.example.com") == 0) {
+        if (is_tcp) {
+            static const uint8_t v4[] = {192, 0, 2, 2};
+            memcpy(rdata, v4, rdlen = 4);
+        } else {
+            flags |= DNS_FLAG_TC;
+        }
+    } else if (strcmp(name, "servfail.example.com") == 0) {
+        flags |= 2;
+    } else {
+        flags |= DNS_RCODE_NXDOMAIN;
+    }
+
+    memcpy(dst, query, pos);
+    encode16(dst + 2, flags);
+    encode16(dst + 6, rdlen != 0);
+    dst_len = pos;
+    if (rdlen != 0) {
+        encode16(dst + dst_len, 0xc000 | DNS_HEADER_SIZE);
+        encode16(dst + dst_len + 2, qtype);
+        encode16(dst + dst_len + 4, DNS_CLASS_IN);
+        encode16(dst + dst_len + 6, 0);
+        encode16(dst + dst_len + 8, 60);
+        encode16(dst + dst_len + 10, (uint16_t)rdlen);
+        memcpy(dst + dst_len + 12, rdata, rdlen);
+        dst_len += 12 + rdlen;
+    }
+    return dst_len;
+}
+
+static void on_stub_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf)
+{
+    static char recvbuf[4096];
+    *buf = uv_buf_init(recvbuf, sizeof(recvbuf));
+}
+
+static void on_stub_send_complete(uv_udp_send_t *req, int status)
+{
+    free(req);
+}
+
+static void on_stub_udp_recv(uv_udp_t *udp, ssize_t nread, const uv_buf_t *buf, const struct sockaddr *addr, unsigned flags)
+{
+    struct {
+        uv_udp_send_t req;
+        uint8_t bytes[512];
+    } *resp;
+    uv_buf_t respbuf;
+
+    if (nread <= 0)
+        return;
+    ++stub.num_received;
+
+    /* drop the first query for the name, so that it would be resent */
+    if (nread > DNS_HEADER_SIZE + 6 && memcmp(buf->base + DNS_HEADER_SIZE, "\5retry", 6) == 0 && stub.num_dropped++ == 0)
+        return;
+
+    resp = h2o_mem_alloc(sizeof(*resp));
+    respbuf = uv_buf_init((char *)resp->bytes, (unsigned)build_stub_response((const uint8_t *)buf->base, nread, resp->bytes, 0));
+    uv_udp_send(&resp->req, udp, &respbuf, 1, addr, on_stub_send_complete);
+}
+
+static void on_stub_tcp_write_complete(uv_write_t *req, int status)
+{
+    uv_close((uv_handle_t *)req->handle, (uv_close_cb)free);
+    free(req);
+}
+
+static void on_stub_tcp_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+    struct {
+        uv_write_t req;
+        uint8_t bytes[514];
+    } *resp;
+    uv_buf_t respbuf;
+    size_t len;
+
+    /* for simplicity, expects the entire query to be received at once */
+    if (nread < 2) {
+        uv_close((uv_handle_t *)stream, (uv_close_cb)free);
+        return;
+    }
+    uv_read_stop(stream);
+    resp = h2o_mem_alloc(sizeof(*resp));
+    len = build_stub_response((const uint8_t *)buf->base + 2, nread - 2, resp->bytes + 2, 1);
+    encode16(resp->bytes, (uint16_t)len);
+    respbuf = uv_buf_init((char *)resp->bytes, (unsigned)(len + 2));
+    uv_write(&resp->req, stream, &respbuf, 1, on_stub_tcp_write_complete);
+}
+
+static void on_stub_tcp_connection(uv_stream_t *listener, int status)
+{
+    uv_tcp_t *conn = h2o_mem_alloc(sizeof(*conn));
+
+    uv_tcp_init(listener->loop, conn);
+    if (uv_accept(listener, (uv_stream_t *)conn) != 0) {
+        uv_close((uv_handle_t *)conn, (uv_close_cb)free);
+        return;
+    }
+    uv_read_start((uv_stream_t *)conn, on_stub_alloc, on_stub_tcp_read);
+}
+
+static void start_stub(h2o_loop_t *loop, h2o_dns_config_t *config)
+{
+    int addrlen = sizeof(stub.addr);
+
+    uv_udp_init(loop, &stub.udp);
+    uv_ip4_addr("127.0.0.1", 0, &stub.addr);
+    uv_udp_bind(&stub.udp, (void *)&stub.addr, 0);
+    uv_udp_getsockname(&stub.udp, (void *)&stub.addr, &addrlen);
+    uv_udp_recv_start(&stub.udp, on_stub_alloc, on_stub_udp_recv);
+
+    uv_tcp_init(loop, &stub.tcp);
+    uv_tcp_bind(&stub.tcp, (void *)&stub.addr, 0);
+    uv_listen((uv_stream_t *)&stub.tcp, 8, on_stub_tcp_connection);
+
+    h2o_dns_config_init(config);
+    memcpy(&config->nameservers[0].addr, &stub.addr, sizeof(stub.addr));
+    config->nameservers[0].len = sizeof(stub.addr);
+    config->num_nameservers = 1;
+    config->timeout = 100;
+}
+
+static void stop_stub(void)
+{
+    uv_close((uv_handle_t *)&stub.udp, NULL);
+    uv_close((uv_handle_t *)&stub.tcp, NULL);
+}
+
+static struct {
+    int called;
+    const char *errstr;
+    struct addrinfo *ai;
+} result;
+
+static void on_resolve(h2o_dns_query_t *query, const char *errstr, struct addrinfo *ai, void *data)
+{
+    result.called = 1;
+    result.errstr = errstr;
+    result.ai = ai;
+}
+
+static void resolve(h2o_loop_t *loop, h2o_dns_config_t *config, const char *name, int family)
+{
+    struct addrinfo hints;
+
+    free(result.ai);
+    memset(&result, 0, sizeof(result));
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    h2o_dns_resolve(loop, config, name, 8080, &hints, on_resolve, NULL);
+    ok(!result.called);
+    while (!result.called)
+        uv_run(loop, UV_RUN_ONCE);
+}
+
+static uint32_t first_ipv4(void)
+{
+    struct addrinfo *ai;
+
+    for (ai = result.ai; ai != NULL; ai = ai->ai_next)
+        if (ai->ai_family == AF_INET)
+            return ntohl(((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr);
+    return 0;
+}
+
+static void test_resolve(void)
+{
+    h2o_loop_t *loop = test_loop;
+    h2o_dns_config_t config;
+    struct addrinfo *ai;
+    uint16_t port;
+
+    start_stub(loop, &config);
+#ifndef _MSC_VER
+    h2o_dns_config_parse_hosts(&config, (h2o_iovec_t){H2O_STRLIT("192.0.2.100 hosts.example.com")});
+#else
+	h2o_dns_config_parse_hosts(&config, (h2o_iovec_t) { H2O_MY_STRLIT("192.0.2.100 hosts.example.com") });
+#endif
+
+    /* numeric addresses */
+    resolve(loop, &config, "192.0.2.3", AF_UNSPEC);
+    ok(result.errstr == NULL);
+    ok(result.ai != NULL && result.ai->ai_next == NULL);
+    ok(first_ipv4() == 0xc0000203);
+    ok(ntohs(((struct sockaddr_in *)result.ai->ai_addr)->sin_port) == 8080);
+    resolve(loop, &config, "192.0.2.3", AF_INET6);
+    ok(result.errstr == h2o_dns_error_no_address);
+
+    /* hosts file (compared case-insensitively, trailing dot is ignored) */
+    resolve(loop, &config, "Hosts.Example.com.", AF_UNSPEC);
+    ok(result.errstr == NULL);
+    ok(first_ipv4() == 0xc0000264);
+    ok(stub.num_received == 0);
+
+    /* A and AAAA records are queried in parallel, IPv6 addresses are returned first */
+    resolve(loop, &config, "www.example.com", AF_UNSPEC);
+    ok(result.errstr == NULL);
+    ok(stub.num_received == 2);
+    ai = result.ai;
+    ok(ai != NULL && ai->ai_family == AF_INET6 && ai->ai_socktype == SOCK_STREAM);
+    ok(ai != NULL && ai->ai_next != NULL && ai->ai_next->ai_family == AF_INET && ai->ai_next->ai_next == NULL);
+    ok(first_ipv4() == 0xc0000201);
+
+    /* IPv4 only */
+    stub.num_received = 0;
+    resolve(loop, &config, "www.example.com", AF_INET);
+    ok(result.errstr == NULL);
+    ok(stub.num_received == 1);
+    ok(result.ai != NULL && result.ai->ai_next == NULL);
+
+    /* errors */
+    resolve(loop, &config, "nonexistent.example.com", AF_INET);
+    ok(result.errstr == h2o_dns_error_not_found);
+    ok(result.ai == NULL);
+    stub.num_received = 0;
+    resolve(loop, &config, "servfail.example.com", AF_INET);
+    ok(result.errstr == h2o_dns_error_server_failure);
+    ok(stub.num_received == config.attempts);
+
+    /* lost queries are resent */
+    stub.num_received = 0;
+    resolve(loop, &config, "retry.example.com", AF_INET);
+    ok(result.errstr == NULL);
+    ok(stub.num_received == 2);
+    ok(first_ipv4() == 0xc0000201);
+
+    /* truncated responses are retried over TCP */
+    resolve(loop, &config, "truncated.example.com", AF_INET);
+    ok(result.errstr == NULL);
+    ok(first_ipv4() == 0xc0000202);
+
+    /* timeout */
+    stop_stub();
+    resolve(loop, &config, "www.example.com", AF_INET);
+    ok(result.errstr == h2o_dns_error_timeout);
+
+    /* cancel */
+    {
+        struct addrinfo hints = {0};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        h2o_dns_cancel(h2o_dns_resolve(loop, &config, "www.example.com", 80, &hints, on_resolve, NULL));
+    }
+
+    /* names subject to the search list and non-numeric services are left to getaddrinfo */
+    {
+        struct addrinfo hints = {0};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+        ok(h2o_dns_can_resolve(&config, "www.example.com", "443", &hints, &port));
+        ok(port == 443);
+        ok(!h2o_dns_can_resolve(&config, "www.example.com", "https", &hints, &port));
+        config.has_search = 1;
+        ok(!h2o_dns_can_resolve(&config, "www", "443", &hints, &port));
+        ok(h2o_dns_can_resolve(&config, "www.example.com", "443", &hints, &port));
+        hints.ai_flags |= AI_CANONNAME;
+        ok(!h2o_dns_can_resolve(&config, "www.example.com", "443", &hints, &port));
+    }
+
+    free(result.ai);
+    result.ai = NULL;
+    uv_run(loop, UV_RUN_NOWAIT);
+    h2o_dns_config_dispose(&config);
+}
+
+#endif
+
+void test_lib__common__dns_c(void)
+{
+    subtest("parse-resolv-conf", test_parse_resolv_conf);
+    subtest("parse-hosts", test_parse_hosts);
+#ifndef _MSC_VER
+    subtest("config-is-modified", test_config_is_modified);
+#endif
+#if H2O_USE_DNS_RESOLVER
+    subtest("resolve", test_resolve);
+#endif
+}
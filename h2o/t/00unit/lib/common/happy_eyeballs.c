@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "../../test.h"
+#include "../../../../lib/common/happy_eyeballs.c"
+
+static void setup_addrinfo(struct addrinfo *ai, struct sockaddr_in6 *sa, int family, uint16_t port, struct addrinfo *next)
+{
+    memset(ai, 0, sizeof(*ai));
+    memset(sa, 0, sizeof(*sa));
+    ai->ai_family = family;
+    ai->ai_socktype = SOCK_STREAM;
+    ai->ai_addr = (void *)sa;
+    ai->ai_next = next;
+    if (family == AF_INET) {
+        struct sockaddr_in *sin = (void *)sa;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sin->sin_addr.s_addr = htonl(0x7f000001);
+        ai->ai_addrlen = sizeof(*sin);
+    } else {
+        sa->sin6_family = AF_INET6;
+        sa->sin6_port = htons(port);
+        sa->sin6_addr.s6_addr[15] = 1;
+        ai->ai_addrlen = sizeof(*sa);
+    }
+}
+
+static void test_interleave(void)
+{
+    struct addrinfo ai[4];
+    struct sockaddr_in6 sa[4];
+    struct st_h2o_happy_eyeballs_attempt_t attempts[4];
+
+    setup_addrinfo(ai + 3, sa + 3, AF_INET, 4, NULL);
+    setup_addrinfo(ai + 2, sa + 2, AF_INET6, 3, ai + 3);
+    setup_addrinfo(ai + 1, sa + 1, AF_INET6, 2, ai + 2);
+    setup_addrinfo(ai + 0, sa + 0, AF_INET6, 1, ai + 1);
+
+    ok(interleave(attempts, ai) == 4);
+    ok(attempts[0].addr.ss_family == AF_INET6);
+    ok(attempts[1].addr.ss_family == AF_INET);
+    ok(attempts[2].addr.ss_family == AF_INET6);
+    ok(attempts[3].addr.ss_family == AF_INET6);
+    ok(((struct sockaddr_in *)&attempts[1].addr)->sin_port == htons(4));
+}
+
+static struct {
+    int called;
+    h2o_socket_t *sock;
+    const char *errstr;
+} result;
+
+static void on_connect_result(h2o_socket_t *sock, const char *errstr, void *data)
+{
+    result.called = 1;
+    result.sock = sock;
+    result.errstr = errstr;
+}
+
+static void on_accept(uv_stream_t *listener, int status)
+{
+    uv_tcp_t *conn = h2o_mem_alloc(sizeof(*conn));
+
+    uv_tcp_init(listener->loop, conn);
+    if (uv_accept(listener, (uv_stream_t *)conn) == 0)
+        uv_close((uv_handle_t *)conn, (uv_close_cb)free);
+}
+
+static uint16_t get_port(uv_tcp_t *tcp)
+{
+    struct sockaddr_in sin;
+    int len = sizeof(sin);
+
+    uv_tcp_getsockname(tcp, (void *)&sin, &len);
+    return ntohs(sin.sin_port);
+}
+
+static void connect_and_wait(h2o_loop_t *loop, struct addrinfo *res)
+{
+    memset(&result, 0, sizeof(result));
+    h2o_happy_eyeballs_connect(loop, res, on_connect_result, NULL);
+    ok(!result.called);
+    while (!result.called)
+        uv_run(loop, UV_RUN_ONCE);
+}
+
+static void test_connect(void)
+{
+    h2o_loop_t *loop = test_loop;
+    uv_tcp_t listener, unused;
+    struct sockaddr_in sin;
+    uint16_t port, closed_port;
+    struct addrinfo ai[2];
+    struct sockaddr_in6 sa[2];
+
+    /* setup a listener, and obtain a port number that is not being listened to */
+    uv_ip4_addr("127.0.0.1", 0, &sin);
+    uv_tcp_init(loop, &listener);
+    uv_tcp_bind(&listener, (void *)&sin, 0);
+    uv_listen((uv_stream_t *)&listener, 8, on_accept);
+    port = get_port(&listener);
+    uv_tcp_init(loop, &unused);
+    uv_tcp_bind(&unused, (void *)&sin, 0);
+    closed_port = get_port(&unused);
+    uv_close((uv_handle_t *)&unused, NULL);
+
+    /* the next address is tried when the first attempt fails */
+    setup_addrinfo(ai + 1, sa + 1, AF_INET, port, NULL);
+    setup_addrinfo(ai, sa, AF_INET, closed_port, ai + 1);
+    srand(0);
+    connect_and_wait(loop, ai);
+    ok(result.sock != NULL);
+    ok(result.errstr == NULL);
+    if (result.sock != NULL)
+        h2o_socket_close(result.sock);
+
+    /* all attempts fail */
+    setup_addrinfo(ai + 1, sa + 1, AF_INET, closed_port, NULL);
+    connect_and_wait(loop, ai);
+    ok(result.sock == NULL);
+    ok(result.errstr != NULL);
+
+    /* cancel */
+    setup_addrinfo(ai + 1, sa + 1, AF_INET, port, NULL);
+    memset(&result, 0, sizeof(result));
+    h2o_happy_eyeballs_cancel(h2o_happy_eyeballs_connect(loop, ai, on_connect_result, NULL));
+    uv_run(loop, UV_RUN_NOWAIT);
+    ok(!result.called);
+
+    uv_close((uv_handle_t *)&listener, NULL);
+    uv_run(loop, UV_RUN_NOWAIT);
+}
+
+void test_lib__common__happy_eyeballs_c(void)
+{
+    subtest("interleave", test_interleave);
+#if H2O_USE_LIBUV
+    subtest("connect", test_connect);
+#endif
+}
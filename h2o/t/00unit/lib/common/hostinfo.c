@@ -70,8 +70,94 @@ static void test_aton(void)
 #endif
 }
 
+static size_t num_lookups_completed;
+
+static void on_getaddr(h2o_hostinfo_getaddr_req_t *req, const char *errstr, struct addrinfo *res, void *cbdata)
+{
+    ok(errstr == NULL);
+    ok(res != NULL && res->ai_family == AF_INET);
+    ++num_lookups_completed;
+}
+
+static void lookup_localhost(h2o_loop_t *loop, h2o_multithread_receiver_t *receiver, size_t num_concurrent)
+{
+    size_t i;
+
+    num_lookups_completed = 0;
+    for (i = 0; i != num_concurrent; ++i) {
+#ifndef _MSC_VER
+        h2o_hostinfo_getaddr(receiver, (h2o_iovec_t){H2O_STRLIT("localhost")}, (h2o_iovec_t){H2O_STRLIT("80")}, AF_INET, SOCK_STREAM,
+                             IPPROTO_TCP, AI_NUMERICSERV, on_getaddr, NULL);
+#else
+		h2o_hostinfo_getaddr(receiver, (h2o_iovec_t) { H2O_MY_STRLIT("localhost") }, (h2o_iovec_t) { H2O_MY_STRLIT("80") }, AF_INET,
+							 SOCK_STREAM, IPPROTO_TCP, AI_NUMERICSERV, on_getaddr, NULL);
+#endif
+    }
+    while (num_lookups_completed != num_concurrent) {
+#if H2O_USE_LIBUV
+        uv_run(loop, UV_RUN_ONCE);
+#else
+        h2o_evloop_run(loop);
+#endif
+    }
+}
+
+static void test_cache(void)
+{
+    h2o_loop_t *loop;
+    h2o_multithread_queue_t *queue;
+    h2o_multithread_receiver_t receiver;
+    h2o_hostinfo_cache_stats_t stats;
+
+#if H2O_USE_LIBUV
+    loop = h2o_mem_alloc(sizeof(*loop));
+    uv_loop_init(loop);
+#else
+    loop = h2o_evloop_create();
+#endif
+    queue = h2o_multithread_create_queue(loop);
+    h2o_multithread_register_receiver(queue, &receiver, h2o_hostinfo_getaddr_receiver);
+    h2o_hostinfo_clear_cache();
+
+    /* concurrent lookups share a single resolution */
+    lookup_localhost(loop, &receiver, 2);
+    h2o_hostinfo_get_cache_stats(&stats);
+    ok(stats.misses == 1);
+    ok(stats.hits + stats.coalesced == 1);
+    ok(stats.num_entries == 1);
+
+    /* the answer is cached */
+    lookup_localhost(loop, &receiver, 1);
+    h2o_hostinfo_get_cache_stats(&stats);
+    ok(stats.misses == 1);
+    ok(stats.hits + stats.coalesced == 2);
+
+    /* expired answers are used while being revalidated */
+    h2o_hostinfo_cache_ttl = 1;
+    h2o_hostinfo_clear_cache();
+    lookup_localhost(loop, &receiver, 1);
+#ifndef _MSC_VER
+    usleep(10000);
+#else
+	Sleep(10);
+#endif
+    lookup_localhost(loop, &receiver, 1);
+    h2o_hostinfo_get_cache_stats(&stats);
+    ok(stats.misses == 2);
+    ok(stats.stale_hits == 1);
+    h2o_hostinfo_cache_ttl = 60000;
+
+    h2o_multithread_unregister_receiver(queue, &receiver);
+    h2o_multithread_destroy_queue(queue);
+#if H2O_USE_LIBUV
+    uv_run(loop, UV_RUN_NOWAIT);
+    uv_loop_close(loop);
+    free(loop);
+#endif
+}
+
 void test_lib__common__hostinfo_c(void)
 {
-    /* TODO add tests for h2o_hostinfo_getaddr and related */
     subtest("aton", test_aton);
+    subtest("cache", test_cache);
 }
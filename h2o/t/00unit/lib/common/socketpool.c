@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2016 DeNA Co., Ltd., Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "../../test.h"
+#include "../../../../lib/common/socketpool.c"
+
+static int admit_many(h2o_socketpool_t *pool, uint64_t now)
+{
+    int i, num_admitted = 0;
+
+    for (i = 0; i != 1000; ++i)
+        if (admit_connect(pool, now))
+            ++num_admitted;
+    return num_admitted;
+}
+
+static void test_passive_ejection(void)
+{
+    h2o_socketpool_t pool;
+    h2o_socketpool_health_config_t config = {3, 1000, 1000};
+    int num_admitted;
+
+    h2o_socketpool_init_by_hostport(&pool, h2o_iovec_init(H2O_STRLIT("127.0.0.1")), 80, 0, SIZE_MAX);
+    h2o_socketpool_enable_health_check(&pool, &config, 0);
+
+    /* failures that are not consecutive do not eject the upstream */
+    h2o_socketpool_report_failure(&pool, 0);
+    h2o_socketpool_report_failure(&pool, 0);
+    h2o_socketpool_report_success(&pool);
+    h2o_socketpool_report_failure(&pool, 0);
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_HEALTHY);
+    ok(admit_connect(&pool, 0));
+
+    /* eject */
+    h2o_socketpool_report_failure(&pool, 100);
+    h2o_socketpool_report_failure(&pool, 100);
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_UNHEALTHY);
+    ok(pool._shared.health.num_ejections == 1);
+    ok(!admit_connect(&pool, 500));
+    ok(pool._shared.health.num_rejected == 1);
+
+    /* re-admitted after the ejection time, but only a share of the requests are let through */
+    num_admitted = admit_many(&pool, 1100);
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_SLOW_START);
+    ok(50 <= num_admitted && num_admitted <= 150);
+    num_admitted = admit_many(&pool, 1600);
+    ok(450 <= num_admitted && num_admitted <= 650);
+
+    /* a single failure while in slow start ejects the upstream again */
+    h2o_socketpool_report_failure(&pool, 1700);
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_UNHEALTHY);
+    ok(pool._shared.health.num_ejections == 2);
+
+    /* fully recovered */
+    admit_connect(&pool, 2700);
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_SLOW_START);
+    h2o_socketpool_report_success(&pool);
+    ok(admit_connect(&pool, 3700));
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_HEALTHY);
+    ok(pool._shared.health.consecutive_failures == 0);
+
+    h2o_socketpool_dispose(&pool);
+}
+
+static void test_active_check(void)
+{
+    h2o_socketpool_t pool;
+    h2o_socketpool_health_config_t config = {0, 1000, 0};
+
+    h2o_socketpool_init_by_hostport(&pool, h2o_iovec_init(H2O_STRLIT("127.0.0.1")), 80, 0, SIZE_MAX);
+    h2o_socketpool_enable_health_check(&pool, &config, 1);
+
+    /* passive failures do not eject the upstream when max_failures is zero */
+    h2o_socketpool_report_failure(&pool, 0);
+    h2o_socketpool_report_failure(&pool, 0);
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_HEALTHY);
+
+    /* a failed probe ejects the upstream, and it is not re-admitted until a probe succeeds */
+    h2o_socketpool_report_probe(&pool, 0, 100);
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_UNHEALTHY);
+    ok(!admit_connect(&pool, 10000));
+    h2o_socketpool_report_probe(&pool, 1, 10100);
+    ok(pool._shared.health.state == H2O_SOCKETPOOL_HEALTHY);
+    ok(admit_connect(&pool, 10100));
+    ok(pool._shared.health.num_probes == 2);
+    ok(pool._shared.health.num_probe_failures == 1);
+
+    h2o_socketpool_dispose(&pool);
+}
+
+static void count_pools(h2o_socketpool_t *pool, h2o_socketpool_health_t *health, void *data)
+{
+    ++*(size_t *)data;
+}
+
+static void test_foreach_health(void)
+{
+    h2o_socketpool_t pool1, pool2;
+    h2o_socketpool_health_config_t config = {1, 1000, 0};
+    size_t num_pools;
+
+    h2o_socketpool_init_by_hostport(&pool1, h2o_iovec_init(H2O_STRLIT("127.0.0.1")), 80, 0, SIZE_MAX);
+    h2o_socketpool_init_by_hostport(&pool2, h2o_iovec_init(H2O_STRLIT("127.0.0.1")), 81, 0, SIZE_MAX);
+    h2o_socketpool_enable_health_check(&pool1, &config, 0);
+
+    num_pools = 0;
+    h2o_socketpool_foreach_health(count_pools, &num_pools);
+    ok(num_pools == 1);
+
+    h2o_socketpool_dispose(&pool1);
+    num_pools = 0;
+    h2o_socketpool_foreach_health(count_pools, &num_pools);
+    ok(num_pools == 0);
+
+    h2o_socketpool_dispose(&pool2);
+}
+
+static void test_warmer_rate_limit(void)
+{
+    h2o_socketpool_warmer_t warmer = {NULL};
+
+    warmer.connect_rate = 5;
+
+    /* tokens are earned every 200ms, and the fraction is carried over */
+    ok(refill_connect_tokens(&warmer, 100) == 0);
+    ok(refill_connect_tokens(&warmer, 200) == 1);
+    ok(refill_connect_tokens(&warmer, 350) == 1);
+    ok(refill_connect_tokens(&warmer, 400) == 2);
+    warmer._tokens = 0;
+    ok(refill_connect_tokens(&warmer, 600) == 1);
+
+    /* the burst is capped at one second worth of connections */
+    ok(refill_connect_tokens(&warmer, 10000) == 5);
+    warmer._tokens = 0;
+    ok(refill_connect_tokens(&warmer, 10100) == 0);
+    ok(refill_connect_tokens(&warmer, 10200) == 1);
+}
+
+void test_lib__common__socketpool_c(void)
+{
+    subtest("passive-ejection", test_passive_ejection);
+    subtest("active-check", test_active_check);
+    subtest("foreach-health", test_foreach_health);
+    subtest("warmer-rate-limit", test_warmer_rate_limit);
+}
@@ -43,7 +43,59 @@ static void test_rewrite_location(void)
     h2o_mem_clear_pool(&pool);
 }
 
+static void test_build_request(void)
+{
+    h2o_globalconf_t globalconf;
+    h2o_hostconf_t *hostconf;
+    h2o_context_t ctx;
+    h2o_loopback_conn_t *conn;
+    h2o_iovec_t buf;
+
+    h2o_config_init(&globalconf);
+    hostconf = h2o_config_register_host(&globalconf, h2o_iovec_init(H2O_STRLIT("default")), 65535);
+    h2o_config_register_path(hostconf, "/", 0);
+    h2o_context_init(&ctx, test_loop, &globalconf);
+
+    conn = h2o_loopback_create(&ctx, ctx.globalconf->hosts);
+    conn->req.input.method = conn->req.method = h2o_iovec_init(H2O_STRLIT("POST"));
+    conn->req.input.scheme = conn->req.scheme = &H2O_URL_SCHEME_HTTP;
+    conn->req.input.authority = conn->req.authority = h2o_iovec_init(H2O_STRLIT("example.com"));
+    conn->req.input.path = conn->req.path = h2o_iovec_init(H2O_STRLIT("/path"));
+    conn->req.version = 0x101;
+    h2o_add_header(&conn->req.pool, &conn->req.headers, H2O_TOKEN_COOKIE, H2O_STRLIT("a=b"));
+    h2o_add_header(&conn->req.pool, &conn->req.headers, H2O_TOKEN_USER_AGENT, H2O_STRLIT("ua"));
+    h2o_add_header(&conn->req.pool, &conn->req.headers, H2O_TOKEN_CONNECTION, H2O_STRLIT("keep-alive"));
+    h2o_add_header(&conn->req.pool, &conn->req.headers, H2O_TOKEN_COOKIE, H2O_STRLIT("c=d"));
+    h2o_add_header(&conn->req.pool, &conn->req.headers, H2O_TOKEN_X_FORWARDED_FOR, H2O_STRLIT("10.0.0.1"));
+    h2o_add_header(&conn->req.pool, &conn->req.headers, H2O_TOKEN_VIA, H2O_STRLIT("1.0 front"));
+    h2o_add_header_by_str(&conn->req.pool, &conn->req.headers, H2O_STRLIT("x-forwarded-proto"), 0, H2O_STRLIT("https"));
+    conn->req.entity = h2o_iovec_init(H2O_STRLIT("hello"));
+
+    buf = build_request(&conn->req, 1, 0, 0);
+    ok(h2o_memis(buf.base, buf.len, H2O_STRLIT("POST /path HTTP/1.1\r\nconnection: keep-alive\r\nhost: example.com\r\n"
+                                               "content-length: 5\r\nuser-agent: ua\r\ncookie: a=b; c=d\r\n"
+                                               "x-forwarded-proto: http\r\nx-forwarded-for: 10.0.0.1, 127.0.0.1\r\n"
+                                               "via: 1.0 front, 1.1 example.com\r\n\r\n")));
+
+    /* the peer address is cached within the connection */
+    ok(h2o_memis(conn->super._numeric_peername.buf, conn->super._numeric_peername.len, H2O_STRLIT("127.0.0.1")));
+
+    /* no headers to be merged */
+    conn->req.headers = (h2o_headers_t){NULL};
+    conn->req.entity = h2o_iovec_init(NULL, 0);
+    conn->req.version = 0x200;
+    buf = build_request(&conn->req, 0, 0, 0);
+    ok(h2o_memis(buf.base, buf.len, H2O_STRLIT("POST /path HTTP/1.1\r\nconnection: close\r\nhost: example.com\r\n"
+                                               "x-forwarded-proto: http\r\nx-forwarded-for: 127.0.0.1\r\n"
+                                               "via: 2 example.com\r\n\r\n")));
+
+    h2o_loopback_destroy(conn);
+    h2o_context_dispose(&ctx);
+    h2o_config_dispose(&globalconf);
+}
+
 void test_lib__core__proxy_c()
 {
     subtest("rewrite_location", test_rewrite_location);
+    subtest("build_request", test_build_request);
 }
@@ -143,8 +143,67 @@ void test_gzip_multi(void)
 #undef P3
 }
 
+#if H2O_USE_ZSTD
+
+#include <zstd.h>
+
+static size_t decompress_zstd(ZSTD_DStream *zds, ZSTD_outBuffer *output, h2o_iovec_t *vecs, size_t num_vecs)
+{
+    size_t i, ret = 1;
+
+    for (i = 0; i != num_vecs; ++i) {
+        ZSTD_inBuffer input = {vecs[i].base, vecs[i].len, 0};
+        while (input.pos != input.size) {
+            if (output->pos == output->size)
+                return SIZE_MAX;
+            ret = ZSTD_decompressStream(zds, output, &input);
+            if (ZSTD_isError(ret))
+                return SIZE_MAX;
+        }
+    }
+
+    return ret;
+}
+
+void test_zstd_flush(void)
+{
+    h2o_mem_pool_t pool;
+    h2o_iovec_t inbuf, *outbufs;
+    size_t outbufcnt;
+    char decbuf[256];
+    ZSTD_outBuffer output = {decbuf, sizeof(decbuf), 0};
+    ZSTD_DStream *zds = ZSTD_createDStream();
+
+    h2o_mem_init_pool(&pool);
+    ZSTD_initDStream(zds);
+
+    h2o_compress_context_t *compressor = h2o_compress_zstd_open(&pool, 1);
+
+    /* the data compressed so far can be decoded when the chunk is not the last one */
+    inbuf = h2o_iovec_init(H2O_STRLIT("hello "));
+    compressor->compress(compressor, &inbuf, 1, H2O_SEND_STATE_IN_PROGRESS, &outbufs, &outbufcnt);
+    ok(decompress_zstd(zds, &output, outbufs, outbufcnt) != SIZE_MAX);
+    ok(output.pos == 6);
+    ok(memcmp(decbuf, "hello ", 6) == 0);
+
+    /* the frame is completed by the last chunk */
+    inbuf = h2o_iovec_init(H2O_STRLIT("world"));
+    compressor->compress(compressor, &inbuf, 1, H2O_SEND_STATE_FINAL, &outbufs, &outbufcnt);
+    ok(decompress_zstd(zds, &output, outbufs, outbufcnt) == 0);
+    ok(output.pos == 11);
+    ok(memcmp(decbuf, "hello world", 11) == 0);
+
+    ZSTD_freeDStream(zds);
+    h2o_mem_clear_pool(&pool);
+}
+
+#endif
+
 void test_lib__handler__gzip_c()
 {
     subtest("gzip_simple", test_gzip_simple);
     subtest("gzip_multi", test_gzip_multi);
+#if H2O_USE_ZSTD
+    subtest("zstd_flush", test_zstd_flush);
+#endif
 }
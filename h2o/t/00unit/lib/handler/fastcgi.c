@@ -163,6 +163,41 @@ static void test_build_request(void)
     h2o_loopback_destroy(conn);
 }
 
+static void test_decode_get_values_result(void)
+{
+    int mpxs_conns;
+    size_t max_reqs;
+
+    ok(decode_get_values_result(H2O_STRLIT("\x0f\x01"
+                                           "FCGI_MPXS_CONNS1"
+                                           "\x0d\x03"
+                                           "FCGI_MAX_REQS100"),
+                                &mpxs_conns, &max_reqs) == 0);
+    ok(mpxs_conns == 1);
+    ok(max_reqs == 100);
+
+    ok(decode_get_values_result(H2O_STRLIT("\x0f\x01"
+                                           "FCGI_MPXS_CONNS0"),
+                                &mpxs_conns, &max_reqs) == 0);
+    ok(mpxs_conns == 0);
+    ok(max_reqs == 0);
+
+    /* unknown names are ignored, four-octet lengths are recognized */
+    ok(decode_get_values_result(H2O_STRLIT("\x80\x00\x00\x03\x01"
+                                           "foox"
+                                           "\x0d\x02"
+                                           "FCGI_MAX_REQS10"),
+                                &mpxs_conns, &max_reqs) == 0);
+    ok(mpxs_conns == 0);
+    ok(max_reqs == 10);
+
+    /* broken input */
+    ok(decode_get_values_result(H2O_STRLIT("\x0f\x01"
+                                           "FCGI_MPXS_CONNS"),
+                                &mpxs_conns, &max_reqs) != 0);
+    ok(decode_get_values_result(H2O_STRLIT("\x80\x00"), &mpxs_conns, &max_reqs) != 0);
+}
+
 void test_lib__handler__fastcgi_c()
 {
     h2o_globalconf_t globalconf;
@@ -177,6 +212,7 @@ void test_lib__handler__fastcgi_c()
     h2o_context_init(&ctx, test_loop, &globalconf);
 
     subtest("build-request", test_build_request);
+    subtest("decode-get-values-result", test_decode_get_values_result);
 
     h2o_context_dispose(&ctx);
     h2o_config_dispose(&globalconf);
@@ -472,6 +472,150 @@ static void test_hpack_push(void)
     h2o_mem_clear_pool(&req.pool);
 }
 
+static void test_hpack_client(void)
+{
+    h2o_hpack_header_table_t encode_table = {NULL}, decode_table = {NULL};
+    encode_table.hpack_capacity = decode_table.hpack_capacity = 4096;
+    h2o_mem_pool_t pool;
+    h2o_mem_init_pool(&pool);
+    h2o_buffer_t *buf;
+    h2o_buffer_init(&buf, &h2o_socket_buffer_prototype);
+    h2o_headers_t headers = {NULL};
+    int status, r;
+    size_t content_length;
+    const char *err_desc = NULL;
+
+    /* request; serialize as HEADERS, deserialize, and compare */
+    h2o_add_header(&pool, &headers, H2O_TOKEN_USER_AGENT, H2O_STRLIT("h2o"));
+    h2o_hpack_flatten_request_headers(&buf, &encode_table, 3, 16384, h2o_iovec_init(H2O_STRLIT("GET")), &H2O_URL_SCHEME_HTTP,
+                                      h2o_iovec_init(H2O_STRLIT("example.com")), h2o_iovec_init(H2O_STRLIT("/index.html")),
+                                      headers.entries, headers.size, 1);
+    ok(buf->size > 9);
+    ok(buf->bytes[3] == H2O_HTTP2_FRAME_TYPE_HEADERS);
+    ok(buf->bytes[4] == (H2O_HTTP2_FRAME_FLAG_END_HEADERS | H2O_HTTP2_FRAME_FLAG_END_STREAM));
+    ok(memcmp(buf->bytes + 5, "\x00\x00\x00\x03", 4) == 0);
+    {
+        h2o_req_t req = {NULL};
+        int pseudo_header_exists_map = 0;
+        h2o_mem_init_pool(&req.pool);
+        content_length = SIZE_MAX;
+        r = h2o_hpack_parse_headers(&req, &decode_table, (void *)(buf->bytes + 9), buf->size - 9, &pseudo_header_exists_map,
+                                    &content_length, NULL, &err_desc);
+        ok(r == 0);
+        ok(h2o_memis(req.input.method.base, req.input.method.len, H2O_STRLIT("GET")));
+        ok(req.input.scheme == &H2O_URL_SCHEME_HTTP);
+        ok(h2o_memis(req.input.authority.base, req.input.authority.len, H2O_STRLIT("example.com")));
+        ok(h2o_memis(req.input.path.base, req.input.path.len, H2O_STRLIT("/index.html")));
+        ok(req.headers.size == 1);
+        ok(req.headers.entries[0].name == &H2O_TOKEN_USER_AGENT->buf);
+        ok(h2o_memis(req.headers.entries[0].value.base, req.headers.entries[0].value.len, H2O_STRLIT("h2o")));
+        h2o_mem_clear_pool(&req.pool);
+    }
+    h2o_buffer_consume(&buf, buf->size);
+
+    /* the request body follows the headers */
+    h2o_hpack_flatten_request_headers(&buf, &encode_table, 5, 16384, h2o_iovec_init(H2O_STRLIT("POST")), &H2O_URL_SCHEME_HTTP,
+                                      h2o_iovec_init(H2O_STRLIT("example.com")), h2o_iovec_init(H2O_STRLIT("/")), NULL, 0, 0);
+    ok(buf->bytes[4] == H2O_HTTP2_FRAME_FLAG_END_HEADERS);
+    h2o_buffer_consume(&buf, buf->size);
+
+    /* response */
+    h2o_hpack_dispose_header_table(&decode_table);
+    decode_table = (h2o_hpack_header_table_t){NULL};
+    decode_table.hpack_capacity = 4096;
+    headers = (h2o_headers_t){NULL};
+    err_desc = NULL;
+    r = h2o_hpack_parse_response_headers(&pool, &status, &headers, &decode_table,
+                                         (const uint8_t *)"\x88"                 /* :status: 200 */
+                                                          "\x0f\x0d\x01"         /* content-length (literal, name indexed) */
+                                                          "5"                      /* 5 */
+                                                          "\x00\x05x-foo\x03" "bar", /* x-foo: bar (literal) */
+                                         16, &content_length, &err_desc);
+    ok(r == 0);
+    ok(status == 200);
+    ok(content_length == 5);
+    ok(headers.size == 1);
+    ok(h2o_memis(headers.entries[0].name->base, headers.entries[0].name->len, H2O_STRLIT("x-foo")));
+    ok(h2o_memis(headers.entries[0].value.base, headers.entries[0].value.len, H2O_STRLIT("bar")));
+
+    /* :status is mandatory */
+    headers = (h2o_headers_t){NULL};
+    err_desc = NULL;
+    r = h2o_hpack_parse_response_headers(&pool, &status, &headers, &decode_table, (const uint8_t *)"\x0f\x0d\x01" "5", 4,
+                                         &content_length, &err_desc);
+    ok(r == H2O_HTTP2_ERROR_PROTOCOL);
+
+    /* request pseudo headers are rejected */
+    headers = (h2o_headers_t){NULL};
+    err_desc = NULL;
+    r = h2o_hpack_parse_response_headers(&pool, &status, &headers, &decode_table, (const uint8_t *)"\x88\x84" /* :path: / */, 2,
+                                         &content_length, &err_desc);
+    ok(r == H2O_HTTP2_ERROR_PROTOCOL);
+
+    /* connection-specific headers are rejected */
+    headers = (h2o_headers_t){NULL};
+    err_desc = NULL;
+    r = h2o_hpack_parse_response_headers(&pool, &status, &headers, &decode_table,
+                                         (const uint8_t *)"\x88\x00\x0a" "connection" "\x05" "close", 19, &content_length,
+                                         &err_desc);
+    ok(r == H2O_HTTP2_ERROR_PROTOCOL);
+
+    h2o_hpack_dispose_header_table(&encode_table);
+    h2o_hpack_dispose_header_table(&decode_table);
+    h2o_buffer_dispose(&buf);
+    h2o_mem_clear_pool(&pool);
+}
+
+static void test_hpack_header_table_size(void)
+{
+    h2o_hpack_header_table_t encode_table = {NULL}, decode_table = {NULL};
+    encode_table.hpack_capacity = 4096;
+    decode_table.hpack_capacity = decode_table.hpack_max_capacity = 4096;
+    h2o_mem_pool_t pool;
+    h2o_mem_init_pool(&pool);
+    h2o_buffer_t *buf;
+    h2o_buffer_init(&buf, &h2o_socket_buffer_prototype);
+    h2o_headers_t headers = {NULL};
+    h2o_add_header(&pool, &headers, H2O_TOKEN_USER_AGENT, H2O_STRLIT("h2o"));
+    int round;
+
+    for (round = 0; round != 3; ++round) {
+        h2o_req_t req = {NULL};
+        int pseudo_header_exists_map = 0, r;
+        size_t content_length = SIZE_MAX;
+        const char *err_desc = NULL;
+        if (round == 1) {
+            /* peer reduces SETTINGS_HEADER_TABLE_SIZE to zero */
+            h2o_hpack_apply_header_table_size(&encode_table, 0);
+            ok(encode_table.hpack_capacity == 0);
+            ok(encode_table.num_entries == 0);
+            /* raising it does not enlarge the table */
+            h2o_hpack_apply_header_table_size(&encode_table, 4096);
+            ok(encode_table.hpack_capacity == 0);
+        }
+        h2o_hpack_flatten_request_headers(&buf, &encode_table, 1 + round * 2, 16384, h2o_iovec_init(H2O_STRLIT("GET")),
+                                          &H2O_URL_SCHEME_HTTP, h2o_iovec_init(H2O_STRLIT("example.com")),
+                                          h2o_iovec_init(H2O_STRLIT("/")), headers.entries, headers.size, 1);
+        /* the reduction is signalled only at the head of the first header block that follows */
+        ok(((uint8_t)buf->bytes[9] == 0x20) == (round == 1));
+        h2o_mem_init_pool(&req.pool);
+        r = h2o_hpack_parse_headers(&req, &decode_table, (void *)(buf->bytes + 9), buf->size - 9, &pseudo_header_exists_map,
+                                    &content_length, NULL, &err_desc);
+        ok(r == 0);
+        ok(req.headers.size == 1);
+        ok(h2o_memis(req.headers.entries[0].value.base, req.headers.entries[0].value.len, H2O_STRLIT("h2o")));
+        ok((decode_table.num_entries != 0) == (round == 0));
+        h2o_mem_clear_pool(&req.pool);
+        h2o_buffer_consume(&buf, buf->size);
+    }
+    ok(decode_table.hpack_capacity == 0);
+
+    h2o_hpack_dispose_header_table(&encode_table);
+    h2o_hpack_dispose_header_table(&decode_table);
+    h2o_buffer_dispose(&buf);
+    h2o_mem_clear_pool(&pool);
+}
+
 static void test_hpack_dynamic_table(void)
 {
     h2o_hpack_header_table_t header_table;
@@ -547,6 +691,8 @@ void test_lib__http2__hpack(void)
 {
     subtest("hpack", test_hpack);
     subtest("hpack-push", test_hpack_push);
+    subtest("hpack-client", test_hpack_client);
+    subtest("hpack-header-table-size", test_hpack_header_table_size);
     subtest("hpack-dynamic-table", test_hpack_dynamic_table);
     subtest("token-wo-hpack-id", test_token_wo_hpack_id);
 }
@@ -157,9 +157,12 @@ int main(int argc, char **argv)
 #endif
 		subtest("lib/cache.c", test_lib__common__cache_c);
         subtest("lib/common/multithread.c", test_lib__common__multithread_c);
+        subtest("lib/common/dns.c", test_lib__common__dns_c);
+        subtest("lib/common/happy_eyeballs.c", test_lib__common__happy_eyeballs_c);
         subtest("lib/common/hostinfo.c", test_lib__common__hostinfo_c);
         subtest("lib/common/serverutil.c", test_lib__common__serverutil_c);
         subtest("lib/common/serverutil.c", test_lib__common__socket_c);
+        subtest("lib/common/socketpool.c", test_lib__common__socketpool_c);
         subtest("lib/common/string.c", test_lib__common__string_c);
         subtest("lib/common/url.c", test_lib__common__url_c);
         subtest("lib/common/time.c", test_lib__common__time_c);
@@ -49,10 +49,13 @@ extern h2o_loop_t *test_loop;
 char *sha1sum(const void *src, size_t len);
 
 void test_lib__common__cache_c(void);
+void test_lib__common__dns_c(void);
+void test_lib__common__happy_eyeballs_c(void);
 void test_lib__common__hostinfo_c(void);
 void test_lib__common__multithread_c(void);
 void test_lib__common__serverutil_c(void);
 void test_lib__common__socket_c(void);
+void test_lib__common__socketpool_c(void);
 void test_lib__common__string_c(void);
 void test_lib__common__time_c(void);
 void test_lib__common__url_c(void);
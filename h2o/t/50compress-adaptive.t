@@ -0,0 +1,47 @@
+use strict;
+use warnings;
+use Digest::MD5 qw(md5_hex);
+use JSON qw(decode_json);
+use List::Util qw(sum);
+use Test::More;
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $server = spawn_h2o(<< "EOT");
+hosts:
+  default:
+    paths:
+      /fixed:
+        file.dir: @{[DOC_ROOT]}
+        compress:
+          gzip: 6
+      /adaptive:
+        file.dir: @{[DOC_ROOT]}
+        compress:
+          gzip: [ 2, 8 ]
+      /s:
+        status: ON
+EOT
+
+my $expected = md5_file("@{[DOC_ROOT]}/alice.txt");
+
+for my $path (qw(fixed adaptive)) {
+    for (1..3) {
+        my $resp = run_prog("curl --silent -H accept-encoding:gzip http://127.0.0.1:$server->{port}/$path/alice.txt | gzip -cd");
+        is md5_hex($resp), $expected, $path;
+    }
+}
+
+subtest "status" => sub {
+    my $json = decode_json(`curl --silent http://127.0.0.1:$server->{port}/s/json?show=compress`);
+    my $hist = $json->{"compress.gzip.quality"};
+    is scalar(@$hist), 10, "one entry per level";
+    cmp_ok $hist->[6], '>=', 3, "fixed";
+    is sum(@$hist[2..8]), 6, "adaptive, within the range";
+    is sum(@$hist), 6, "total";
+    is scalar(@{$json->{"compress.br.quality"}}), 12, "br";
+};
+
+done_testing;
@@ -0,0 +1,48 @@
+use strict;
+use warnings;
+use Digest::MD5 qw(md5_hex);
+use JSON qw(decode_json);
+use Test::More;
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $server = spawn_h2o(<< "EOT");
+compress-cache-capacity: 1048576
+hosts:
+  default:
+    paths:
+      /etag:
+        file.dir: @{[DOC_ROOT]}
+        compress: [ gzip ]
+      /no-etag:
+        file.dir: @{[DOC_ROOT]}
+        file.etag: OFF
+        compress: [ gzip ]
+      /s:
+        status: ON
+EOT
+
+my $expected = md5_file("@{[DOC_ROOT]}/alice.txt");
+
+my $status = sub {
+    decode_json(`curl --silent http://127.0.0.1:$server->{port}/s/json?show=compress`);
+};
+
+for my $path (qw(etag no-etag)) {
+    subtest $path => sub {
+        my $before = $status->();
+        for (1..3) {
+            my $resp = run_prog("curl --silent -H accept-encoding:gzip http://127.0.0.1:$server->{port}/$path/alice.txt | gzip -cd");
+            is md5_hex($resp), $expected, "content";
+        }
+        my $after = $status->();
+        is $after->{"compress.cache-stores"} - $before->{"compress.cache-stores"}, 1, "stored once";
+        is $after->{"compress.cache-hits"} - $before->{"compress.cache-hits"}, 2, "hits";
+        my $resp = run_prog("curl --silent http://127.0.0.1:$server->{port}/$path/alice.txt");
+        is md5_hex($resp), $expected, "wo. accept-encoding";
+    };
+}
+
+done_testing;
@@ -0,0 +1,50 @@
+use strict;
+use warnings;
+use Digest::MD5 qw(md5_hex);
+use JSON qw(decode_json);
+use Test::More;
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $server = spawn_h2o(<< "EOT");
+num-compress-threads: 2
+hosts:
+  default:
+    paths:
+      /:
+        file.dir: @{[DOC_ROOT]}
+        compress: ON
+        compress-offload: ON
+        file.mime.settypes:
+          image/jpg:
+            extensions: [".jpg"]
+            is_compressible: YES
+      /s:
+        status: ON
+EOT
+
+my $offloads = sub {
+    decode_json(`curl --silent http://127.0.0.1:$server->{port}/s/json?show=compress`)->{"compress.offloads"};
+};
+
+run_with_curl($server, sub {
+    my ($proto, $port, $curl) = @_;
+    plan skip_all => 'curl issue #661'
+        if $curl =~ /--http2/;
+
+    for my $file (qw(alice.txt halfdome.jpg)) {
+        my $expected = md5_file("@{[DOC_ROOT]}/$file");
+        my $resp = run_prog("$curl --silent $proto://127.0.0.1:$port/$file");
+        is md5_hex($resp), $expected, "$file wo. accept-encoding";
+        my $before = $offloads->();
+        for (1..3) {
+            $resp = run_prog("$curl --silent -H accept-encoding:gzip $proto://127.0.0.1:$port/$file | gzip -cd");
+            is md5_hex($resp), $expected, "$file with accept-encoding";
+        }
+        cmp_ok $offloads->() - $before, '>=', 3, "$file compressed by the pool";
+    }
+});
+
+done_testing;
@@ -0,0 +1,111 @@
+use strict;
+use warnings;
+use File::Temp qw(tempdir);
+use IO::Socket::INET;
+use Net::EmptyPort qw(empty_port);
+use Test::More;
+use Time::HiRes qw(sleep time);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $tempdir = tempdir(CLEANUP => 1);
+
+# the upstream responds 0.5 seconds after receiving a request
+my $upstream_port = empty_port();
+my $upstream_listener = IO::Socket::INET->new(
+    LocalAddr => '127.0.0.1',
+    LocalPort => $upstream_port,
+    Listen    => 128,
+    ReuseAddr => 1,
+) or die "failed to listen to port $upstream_port:$!";
+my $upstream_pid = fork;
+die "fork failed:$!"
+    unless defined $upstream_pid;
+if ($upstream_pid == 0) {
+    $SIG{CHLD} = 'IGNORE';
+    while (my $conn = $upstream_listener->accept) {
+        my $child = fork;
+        die "fork failed:$!"
+            unless defined $child;
+        if ($child == 0) {
+            my $req = '';
+            while ($req !~ /\r\n\r\n/s) {
+                last unless $conn->sysread($req, 4096, length $req);
+            }
+            sleep 0.5;
+            $conn->syswrite("HTTP/1.1 200 OK\r\ncontent-length: 6\r\nconnection: close\r\n\r\nhello\n");
+            exit 0;
+        }
+        close $conn;
+    }
+    exit 0;
+}
+undef $upstream_listener;
+my $upstream_guard = Scope::Guard->new(sub {
+    kill 'KILL', $upstream_pid;
+    waitpid $upstream_pid, 0;
+});
+
+sub fetch_parallel {
+    my ($server, $path, $num_reqs) = @_;
+    my $start_at = time;
+    system("sh", "-c", join(" ", map {
+        "curl --silent --output /dev/null --write-out '%{http_code}' http://127.0.0.1:$server->{port}$path > $tempdir/$_ &"
+    } 1..$num_reqs) . " wait") == 0
+        or die "failed to run curl:$?";
+    my $elapsed = time - $start_at;
+    my @statuses = sort map {
+        open my $fh, "<", "$tempdir/$_"
+            or die "failed to open $tempdir/$_:$!";
+        do { local $/; <$fh> };
+    } 1..$num_reqs;
+    return ($elapsed, @statuses);
+}
+
+my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+proxy.timeout.keepalive: 0
+hosts:
+  default:
+    paths:
+      /queued:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port/
+        concurrency-limit.max-requests: 1
+      /rejected:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port/
+        concurrency-limit.max-requests: 1
+        concurrency-limit.max-queue-length: 1
+      /timeout:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port/
+        concurrency-limit.max-requests: 1
+        concurrency-limit.max-queue-wait: 200
+      /:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port/
+EOT
+
+subtest "unlimited" => sub {
+    my ($elapsed, @statuses) = fetch_parallel($server, "/", 4);
+    is_deeply \@statuses, [ (200) x 4 ], "statuses";
+    cmp_ok $elapsed, '<', 1.5, "requests are handled concurrently";
+};
+
+subtest "queued" => sub {
+    my ($elapsed, @statuses) = fetch_parallel($server, "/queued", 4);
+    is_deeply \@statuses, [ (200) x 4 ], "statuses";
+    cmp_ok $elapsed, '>=', 1.9, "requests are handled one by one";
+};
+
+subtest "queue length" => sub {
+    my ($elapsed, @statuses) = fetch_parallel($server, "/rejected", 4);
+    is_deeply \@statuses, [ 200, 200, 503, 503 ], "statuses";
+};
+
+subtest "queue wait" => sub {
+    my ($elapsed, @statuses) = fetch_parallel($server, "/timeout", 3);
+    is_deeply \@statuses, [ 200, 503, 503 ], "statuses";
+    cmp_ok $elapsed, '<', 0.9, "requests waiting too long are rejected";
+};
+
+done_testing();
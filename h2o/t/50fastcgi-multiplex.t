@@ -0,0 +1,189 @@
+use strict;
+use warnings;
+use File::Temp qw(tempdir);
+use IO::Select;
+use IO::Socket::INET;
+use List::Util qw(max);
+use Net::EmptyPort qw(empty_port);
+use Test::More;
+use Time::HiRes qw(time);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $tempdir = tempdir(CLEANUP => 1);
+
+# a FastCGI application that supports multiplexing; each response is sent 0.5 seconds after receiving the request, and contains the
+# serial number of the connection and the maximum number of requests that have been in flight on the connection
+sub spawn_fcgi {
+    my ($mpxs_conns, $max_reqs) = @_;
+    my $port = empty_port();
+    my $listener = IO::Socket::INET->new(
+        LocalAddr => '127.0.0.1',
+        LocalPort => $port,
+        Listen    => 128,
+        ReuseAddr => 1,
+    ) or die "failed to listen to port $port:$!";
+    my $pid = fork;
+    die "fork failed:$!"
+        unless defined $pid;
+    if ($pid == 0) {
+        $SIG{PIPE} = 'IGNORE';
+        run_fcgi($listener, $mpxs_conns, $max_reqs);
+        exit 0;
+    }
+    undef $listener;
+    return ($port, Scope::Guard->new(sub {
+        kill 'KILL', $pid;
+        waitpid $pid, 0;
+    }));
+}
+
+sub fcgi_record {
+    my ($type, $id, $content) = @_;
+    pack('CCnnCx', 1, $type, $id, length $content, 0) . $content;
+}
+
+sub run_fcgi {
+    my ($listener, $mpxs_conns, $max_reqs) = @_;
+    my $select = IO::Select->new($listener);
+    my (%conns, @timers, $num_conns);
+    while (1) {
+        for my $sock ($select->can_read(@timers ? max(0, $timers[0]->{at} - time) : undef)) {
+            if ($sock == $listener) {
+                my $newsock = $listener->accept
+                    or next;
+                $select->add($newsock);
+                $conns{fileno $newsock} = { sock => $newsock, serial => ++$num_conns, buf => '', inflight => 0, max_inflight => 0 };
+                next;
+            }
+            my $conn = $conns{fileno $sock};
+            if (!sysread($sock, $conn->{buf}, 65536, length $conn->{buf})) {
+                $select->remove($sock);
+                delete $conns{fileno $sock};
+                $conn->{closed} = 1;
+                close $sock;
+                next;
+            }
+            while (length $conn->{buf} >= 8) {
+                my ($type, $id, $content_length, $padding_length) = unpack 'xCnnC', $conn->{buf};
+                last if length $conn->{buf} < 8 + $content_length + $padding_length;
+                substr($conn->{buf}, 0, 8 + $content_length + $padding_length) = '';
+                if ($type == 9) {
+                    # FCGI_GET_VALUES
+                    my $values = join '', map { pack('CC', length $_->[0], length $_->[1]) . $_->[0] . $_->[1] }
+                        [ FCGI_MPXS_CONNS => $mpxs_conns ], [ FCGI_MAX_REQS => $max_reqs ];
+                    syswrite $sock, fcgi_record(10, 0, $values);
+                } elsif ($type == 5 && $content_length == 0) {
+                    # end of FCGI_STDIN
+                    ++$conn->{inflight};
+                    $conn->{max_inflight} = $conn->{inflight}
+                        if $conn->{max_inflight} < $conn->{inflight};
+                    push @timers, { at => time + 0.5, conn => $conn, id => $id };
+                }
+            }
+        }
+        while (@timers && $timers[0]->{at} <= time) {
+            my $timer = shift @timers;
+            my $conn = $timer->{conn};
+            next if $conn->{closed};
+            my $body = "conn:$conn->{serial},max-inflight:$conn->{max_inflight}\n";
+            syswrite $conn->{sock}, join '', fcgi_record(6, $timer->{id}, "content-type: text/plain\r\n\r\n$body"),
+                fcgi_record(6, $timer->{id}, ''), fcgi_record(3, $timer->{id}, pack('Nx4', 0));
+            --$conn->{inflight};
+        }
+    }
+}
+
+sub fetch_parallel {
+    my ($server, $num_reqs) = @_;
+    system("sh", "-c", join(" ", map {
+        "curl --silent --show-error --write-out '%{http_code}' http://127.0.0.1:$server->{port}/ > $tempdir/$_ &"
+    } 1..$num_reqs) . " wait") == 0
+        or die "failed to run curl:$?";
+    map {
+        open my $fh, "<", "$tempdir/$_"
+            or die "failed to open $tempdir/$_:$!";
+        my $resp = do { local $/; <$fh> };
+        $resp =~ m{^conn:([0-9]+),max-inflight:([0-9]+)\n200$}s ? +{ conn => $1, max_inflight => $2 } : +{ error => $resp };
+    } 1..$num_reqs;
+}
+
+sub doit {
+    my ($app_mpxs_conns, $app_max_reqs, $conf, $num_reqs, $cb) = @_;
+    my ($fcgi_port, $fcgi_guard) = spawn_fcgi($app_mpxs_conns, $app_max_reqs);
+    my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+fastcgi.multiplex: ON
+$conf
+hosts:
+  default:
+    paths:
+      /:
+        fastcgi.connect:
+          host: 127.0.0.1
+          port: $fcgi_port
+          type: tcp
+EOT
+    my @resps = fetch_parallel($server, $num_reqs);
+    is scalar(grep { $_->{error} } @resps), 0, "all requests succeed"
+        or diag explain \@resps;
+    my %conns = map { $_->{conn} => 1 } @resps;
+    $cb->(scalar keys %conns, max map { $_->{max_inflight} } @resps);
+}
+
+subtest "multiplex" => sub {
+    doit(1, 100, "fastcgi.timeout.keepalive: 5000", 10, sub {
+        my ($num_conns, $max_inflight) = @_;
+        is $num_conns, 1, "requests are sent over one connection";
+        cmp_ok $max_inflight, '>', 1, "requests are processed concurrently";
+    });
+};
+
+subtest "max-requests" => sub {
+    doit(1, 100, "fastcgi.multiplex.max-requests: 2", 6, sub {
+        my ($num_conns, $max_inflight) = @_;
+        cmp_ok $num_conns, '>=', 3, "connections are added";
+        cmp_ok $max_inflight, '<=', 2, "number of requests in flight is capped";
+    });
+};
+
+subtest "FCGI_MAX_REQS" => sub {
+    doit(1, 3, "", 6, sub {
+        my ($num_conns, $max_inflight) = @_;
+        cmp_ok $num_conns, '>=', 2, "connections are added";
+        cmp_ok $max_inflight, '<=', 3, "number of requests in flight obeys FCGI_MAX_REQS";
+    });
+};
+
+subtest "idle connection is reused without keepalive" => sub {
+    my ($fcgi_port, $fcgi_guard) = spawn_fcgi(1, 100);
+    my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+fastcgi.multiplex: ON
+hosts:
+  default:
+    paths:
+      /:
+        fastcgi.connect:
+          host: 127.0.0.1
+          port: $fcgi_port
+          type: tcp
+EOT
+    my @resps = fetch_parallel($server, 1);
+    sleep 1;
+    push @resps, fetch_parallel($server, 1);
+    is_deeply [ map { $_->{conn} } @resps ], [ 1, 1 ], "the connection stays open between the requests"
+        or diag explain \@resps;
+};
+
+subtest "no multiplex support" => sub {
+    doit(0, 100, "", 4, sub {
+        my ($num_conns, $max_inflight) = @_;
+        is $num_conns, 4, "one connection per request";
+        is $max_inflight, 1, "one request per connection";
+    });
+};
+
+done_testing();
@@ -0,0 +1,130 @@
+use strict;
+use warnings;
+use File::Temp qw(tempdir);
+use JSON qw(decode_json);
+use Test::More;
+use Time::HiRes qw(sleep time);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $tempdir = tempdir(CLEANUP => 1);
+
+# a CGI script that takes one second to respond
+open my $fh, ">", "$tempdir/sleep.cgi"
+    or die "failed to create file:$tempdir/sleep.cgi:$!";
+print $fh <<'EOT';
+#! /bin/sh
+sleep 1
+printf "content-type: text/plain\r\n\r\nhello\n"
+EOT
+close $fh;
+chmod 0755, "$tempdir/sleep.cgi"
+    or die "chmod failed:$!";
+
+sub doit {
+    my ($workers_conf, $cb) = @_;
+    my $server = spawn_h2o(<< "EOT");
+file.custom-handler:
+  extension: .cgi
+  fastcgi.spawn:
+    command: "exec \$H2O_ROOT/share/h2o/fastcgi-cgi"
+$workers_conf
+hosts:
+  default:
+    paths:
+      /:
+        file.dir: $tempdir
+      /s:
+        status: ON
+EOT
+    my $fetch_parallel = sub {
+        my $num_reqs = shift;
+        system("sh", "-c", join(" ", map {
+            "curl --silent --output /dev/null --write-out '%{http_code}' http://127.0.0.1:$server->{port}/sleep.cgi > $tempdir/resp$_ &"
+        } 1..$num_reqs) . " wait") == 0
+            or die "failed to run curl:$?";
+        map {
+            open my $fh, "<", "$tempdir/resp$_"
+                or die "failed to open $tempdir/resp$_:$!";
+            do { local $/; <$fh> };
+        } 1..$num_reqs;
+    };
+    my $status = sub {
+        my $json = decode_json(`curl --silent http://127.0.0.1:$server->{port}/s/json?show=fastcgi`);
+        $json->{'fastcgi-workers'}->[0];
+    };
+    $cb->($fetch_parallel, $status);
+}
+
+subtest "scale" => sub {
+    doit(<< 'EOT', sub {
+    min-workers: 1
+    max-workers: 3
+    idle-timeout: 1000
+EOT
+        my ($fetch_parallel, $status) = @_;
+        is $status->()->{workers}, 1, "min-workers are spawned";
+        my $start_at = time;
+        my @resps = $fetch_parallel->(6);
+        my $elapsed = time - $start_at;
+        is_deeply \@resps, [ ("200") x 6 ], "all requests succeed";
+        cmp_ok $elapsed, '>=', 2, "number of requests being processed concurrently is capped";
+        my $s = $status->();
+        is $s->{workers}, 3, "workers are spawned on demand";
+        is $s->{spawned}, 3, "spawned count";
+        is $s->{requests}, 6, "request count";
+        sleep 3;
+        $s = $status->();
+        is $s->{workers}, 1, "idle workers are terminated";
+        is $s->{terminated}, 2, "terminated count";
+    });
+};
+
+subtest "max-queued" => sub {
+    doit(<< 'EOT', sub {
+    max-workers: 1
+    max-queued: 1
+EOT
+        my ($fetch_parallel, $status) = @_;
+        my @resps = sort $fetch_parallel->(4);
+        is $resps[0], "200", "first request succeeds";
+        is $resps[-1], "503", "excess request is rejected";
+        cmp_ok $status->()->{'queue-rejected'}, '>=', 1, "rejection is counted";
+    });
+};
+
+subtest "queue-timeout" => sub {
+    doit(<< 'EOT', sub {
+    max-workers: 1
+    queue-timeout: 500
+EOT
+        my ($fetch_parallel, $status) = @_;
+        my @resps = sort $fetch_parallel->(2);
+        is_deeply \@resps, [ "200", "503" ], "request waiting too long is rejected";
+        is $status->()->{'queue-timeouts'}, 1, "timeout is counted";
+    });
+};
+
+subtest "respawn" => sub {
+    doit(<< 'EOT', sub {
+    min-workers: 1
+    max-workers: 1
+EOT
+        my ($fetch_parallel, $status) = @_;
+        is_deeply [ $fetch_parallel->(1) ], [ "200" ], "request succeeds";
+        # the process running the application (not the kill-on-close wrapper)
+        my @pids = map { /^\s*([0-9]+)\s/ ? $1 : () } grep { m{share/h2o/fastcgi-cgi} && !m{kill-on-close} } `ps -e -o pid= -o args=`;
+        is scalar(@pids), 1, "one worker is running";
+        kill 'KILL', @pids;
+        sleep 3;
+        my $s = $status->();
+        is $s->{workers}, 1, "worker is respawned";
+        is $s->{spawned}, 2, "spawned count";
+        is $s->{terminated}, 1, "terminated count";
+        is_deeply [ $fetch_parallel->(1) ], [ "200" ], "request succeeds after respawn";
+    });
+};
+
+done_testing();
@@ -0,0 +1,184 @@
+use strict;
+use warnings;
+use Digest::MD5 qw(md5_hex);
+use IO::Socket::INET;
+use Net::EmptyPort qw(empty_port);
+use Test::More;
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+# deterministic content of the large response
+my $large_body = join '', map { sprintf "%08d\n", $_ } 1..400000;
+
+sub fcgi_record {
+    my ($type, $id, $content, $padding) = @_;
+    $padding ||= 0;
+    pack('CCnnCx', 1, $type, $id, length $content, $padding) . $content . ("\0" x $padding);
+}
+
+# a FastCGI application that forks per connection; supports multiplexing (one request at a time) if $mpxs_conns is set
+sub spawn_fcgi {
+    my $mpxs_conns = shift;
+    my $port = empty_port();
+    my $listener = IO::Socket::INET->new(
+        LocalAddr => '127.0.0.1',
+        LocalPort => $port,
+        Listen    => 128,
+        ReuseAddr => 1,
+    ) or die "failed to listen to port $port:$!";
+    my $pid = fork;
+    die "fork failed:$!"
+        unless defined $pid;
+    if ($pid == 0) {
+        $SIG{PIPE} = 'IGNORE';
+        $SIG{CHLD} = 'IGNORE';
+        while (my $sock = $listener->accept) {
+            my $child = fork;
+            die "fork failed:$!"
+                unless defined $child;
+            if ($child == 0) {
+                undef $listener;
+                serve_fcgi($sock, $mpxs_conns);
+                exit 0;
+            }
+            close $sock;
+        }
+        exit 0;
+    }
+    undef $listener;
+    return ($port, Scope::Guard->new(sub {
+        kill 'KILL', $pid;
+        waitpid $pid, 0;
+    }));
+}
+
+sub serve_fcgi {
+    my ($sock, $mpxs_conns) = @_;
+    my $buf = '';
+    my %reqs;
+    while (1) {
+        while (length $buf < 8) {
+            return unless sysread $sock, $buf, 65536, length $buf;
+        }
+        my ($type, $id, $content_length, $padding_length) = unpack 'xCnnC', $buf;
+        while (length $buf < 8 + $content_length + $padding_length) {
+            return unless sysread $sock, $buf, 65536, length $buf;
+        }
+        my $content = substr $buf, 8, $content_length;
+        substr($buf, 0, 8 + $content_length + $padding_length) = '';
+        if ($type == 9) {
+            # FCGI_GET_VALUES
+            my $values = join '', map { pack('CC', length $_->[0], length $_->[1]) . $_->[0] . $_->[1] }
+                [ FCGI_MPXS_CONNS => $mpxs_conns ? 1 : 0 ], [ FCGI_MAX_REQS => 1 ];
+            syswrite $sock, fcgi_record(10, 0, $values);
+        } elsif ($type == 1) {
+            $reqs{$id} = { params => '', stdin => '' };
+        } elsif ($type == 4) {
+            $reqs{$id}->{params} .= $content;
+        } elsif ($type == 5 && $content_length != 0) {
+            $reqs{$id}->{stdin} .= $content;
+        } elsif ($type == 5) {
+            respond($sock, $id, delete $reqs{$id});
+        }
+    }
+}
+
+sub respond {
+    my ($sock, $id, $req) = @_;
+    my $path = $req->{params} =~ /REQUEST_URI(\/[a-z]+)/s ? $1 : '';
+    my $out = sub {
+        my $s = join '', map { fcgi_record(6, $id, $_, int rand 8) } @_;
+        syswrite($sock, $s) == length $s
+            or die "write failed:$!";
+    };
+    if ($path eq '/echo') {
+        $out->("content-type: text/plain\r\n\r\n" . length($req->{stdin}) . ":" . md5_hex($req->{stdin}));
+    } elsif ($path eq '/large') {
+        # send the body using records of random sizes
+        my @chunks = ("content-type: text/plain\r\n\r\n");
+        for (my $off = 0; $off < length $large_body;) {
+            my $len = 1 + int rand 30000;
+            push @chunks, substr $large_body, $off, $len;
+            $off += $len;
+        }
+        $out->(@chunks);
+    } elsif ($path eq '/partial') {
+        # the first record is sent partially, and the rest after one second
+        my $rec = fcgi_record(6, $id, "content-type: text/plain\r\n\r\nhello world");
+        syswrite $sock, substr($rec, 0, length($rec) - 6);
+        sleep 1;
+        syswrite $sock, substr($rec, length($rec) - 6);
+    } else {
+        $out->("status: 404\r\ncontent-type: text/plain\r\n\r\nnot found");
+    }
+    syswrite $sock, fcgi_record(6, $id, '') . fcgi_record(3, $id, pack('Nx4', 0));
+}
+
+sub doit {
+    my $multiplex = shift;
+    my ($fcgi_port, $fcgi_guard) = spawn_fcgi($multiplex);
+    my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+fastcgi.multiplex: @{[ $multiplex ? "ON" : "OFF" ]}
+fastcgi.timeout.keepalive: 5000
+hosts:
+  default:
+    paths:
+      /:
+        fastcgi.connect:
+          host: 127.0.0.1
+          port: $fcgi_port
+          type: tcp
+EOT
+    run_with_curl($server, sub {
+        my ($proto, $port, $curl) = @_;
+        subtest "upload" => sub {
+            for my $size (0, 1, 65535, 65536, 1000000, 3000000) {
+                my $fn = create_data_file($size);
+                my $resp = `$curl --silent --show-error --data-binary \@$fn $proto://127.0.0.1:$port/echo`;
+                is $resp, "$size:" . md5_file($fn), "size:$size";
+            }
+        };
+        subtest "large response" => sub {
+            for (1..3) {
+                my $resp = `$curl --silent --show-error $proto://127.0.0.1:$port/large`;
+                is length($resp), length($large_body), "length";
+                is md5_hex($resp), md5_hex($large_body), "md5";
+            }
+        };
+        subtest "slow client" => sub {
+            my $resp = `$curl --silent --show-error --limit-rate 1M $proto://127.0.0.1:$port/large`;
+            is md5_hex($resp), md5_hex($large_body), "md5";
+        };
+    });
+}
+
+subtest "single" => sub {
+    doit(0);
+};
+
+subtest "multiplex" => sub {
+    doit(1);
+};
+
+subtest "partial record" => sub {
+    my ($fcgi_port, $fcgi_guard) = spawn_fcgi(0);
+    my $server = spawn_h2o(<< "EOT");
+hosts:
+  default:
+    paths:
+      /:
+        fastcgi.connect:
+          host: 127.0.0.1
+          port: $fcgi_port
+          type: tcp
+EOT
+    my $resp = `curl --silent --show-error --write-out ':%{time_starttransfer}' http://127.0.0.1:$server->{port}/partial`;
+    like $resp, qr{^hello world:[0-9.]+$}, "response";
+    my ($ttfb) = $resp =~ /:([0-9.]+)$/;
+    cmp_ok $ttfb, '<', 0.9, "response is sent before the record is received in full";
+};
+
+done_testing();
@@ -0,0 +1,76 @@
+use strict;
+use warnings;
+use Digest::MD5 qw(md5_hex);
+use JSON qw(decode_json);
+use Test::More;
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $all_data = do {
+    open my $fh, "<", "@{[DOC_ROOT]}/halfdome.jpg"
+        or die "failed to open file:@{[DOC_ROOT]}/halfdome.jpg:$!";
+    local $/;
+    <$fh>;
+};
+
+my $server = spawn_h2o(<< "EOT");
+num-file-io-threads: 2
+file.io: async
+hosts:
+  default:
+    paths:
+      /:
+        file.dir: @{[ DOC_ROOT ]}
+        file.send-compressed: ON
+      /favicon.ico:
+        file.file: @{[DOC_ROOT]}/halfdome.jpg
+      /s:
+        status: ON
+EOT
+
+run_with_curl($server, sub {
+    my ($proto, $port, $curl_cmd) = @_;
+    $curl_cmd .= " --silent --show-error";
+
+    subtest "file" => sub {
+        for (1..3) {
+            my $resp = `$curl_cmd $proto://127.0.0.1:$port/halfdome.jpg`;
+            is md5_hex($resp), md5_hex($all_data), "md5";
+        }
+    };
+
+    subtest "file.file" => sub {
+        my $resp = `$curl_cmd $proto://127.0.0.1:$port/favicon.ico`;
+        is md5_hex($resp), md5_hex($all_data), "md5";
+    };
+
+    subtest "ranged" => sub {
+        my $resp = `$curl_cmd -r 100-499 $proto://127.0.0.1:$port/halfdome.jpg`;
+        is $resp, substr($all_data, 100, 400), "single";
+        $resp = `$curl_cmd -r 0-9,100-199 --dump-header /dev/stderr $proto://127.0.0.1:$port/halfdome.jpg 2>&1`;
+        like $resp, qr{^content-type:\s*multipart/byteranges}mi, "multi";
+    };
+
+    subtest "index" => sub {
+        my $resp = `$curl_cmd $proto://127.0.0.1:$port/`;
+        is md5_hex($resp), md5_file("@{[DOC_ROOT]}/index.txt"), "index.txt";
+        $resp = `$curl_cmd --header 'Accept-Encoding: gzip' $proto://127.0.0.1:$port/`;
+        is md5_hex($resp), md5_file("@{[DOC_ROOT]}/index.txt.gz"), "index.txt.gz";
+    };
+
+    subtest "not found" => sub {
+        my $resp = `$curl_cmd --dump-header /dev/stderr $proto://127.0.0.1:$port/nonexistent 2>&1 > /dev/null`;
+        like $resp, qr{^HTTP/[0-9\.]+ 404}is;
+    };
+
+    subtest "status" => sub {
+        my $json = decode_json(`$curl_cmd $proto://127.0.0.1:$port/s/json?show=fileio`);
+        cmp_ok $json->{"file-io.threads"}, '>=', 1, "threads";
+        cmp_ok $json->{"file-io.threads"}, '<=', 2, "threads are capped";
+        cmp_ok $json->{"file-io.completed"}, '>', 0, "completed";
+    };
+});
+
+done_testing;
@@ -0,0 +1,102 @@
+use strict;
+use warnings;
+use File::Temp qw(tempdir);
+use JSON qw(decode_json);
+use Test::More;
+use Time::HiRes qw(sleep);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $tempdir = tempdir(CLEANUP => 1);
+
+sub write_file {
+    my ($fn, $content) = @_;
+    open my $fh, ">", "$tempdir/$fn"
+        or die "failed to open $tempdir/$fn:$!";
+    print $fh $content;
+    close $fh;
+}
+
+sub doit {
+    my $conf = shift;
+
+    unlink "$tempdir/new.txt";
+    write_file("hello.txt", "hello\n");
+
+    my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+$conf
+hosts:
+  default:
+    paths:
+      /:
+        file.dir: $tempdir
+      /s:
+        status: ON
+EOT
+
+    my $fetch = sub {
+        my $path = shift;
+        my $resp = `curl --silent --dump-header /dev/stderr http://127.0.0.1:$server->{port}$path 2>&1`;
+        my ($status) = $resp =~ m{^HTTP/[0-9\.]+ ([0-9]+)};
+        my ($body) = $resp =~ m{\r\n\r\n(.*)$}s;
+        ($status, $body);
+    };
+
+    my $content_cache_hits = sub {
+        decode_json(`curl --silent http://127.0.0.1:$server->{port}/s/json?show=events`)->{'file.content-cache-hits'};
+    };
+
+    subtest "cached" => sub {
+        # files modified within the current second are not stored to the content cache
+        sleep 1.1;
+        my $hits = $content_cache_hits->();
+        is_deeply [ $fetch->("/hello.txt") ], [ 200, "hello\n" ];
+        is_deeply [ $fetch->("/hello.txt") ], [ 200, "hello\n" ];
+        is $content_cache_hits->() - $hits, $conf =~ /content/ ? 1 : 0, "hits of the content cache";
+    };
+
+    subtest "modified without changing the size" => sub {
+        write_file("hello.txt", "HELLO\n");
+        is_deeply [ $fetch->("/hello.txt") ], [ 200, "HELLO\n" ];
+    };
+
+    subtest "modified" => sub {
+        write_file("hello.txt", "hello world\n");
+        is_deeply [ $fetch->("/hello.txt") ], [ 200, "hello world\n" ];
+    };
+
+    subtest "replaced" => sub {
+        write_file("hello.txt.tmp", "good bye\n");
+        rename "$tempdir/hello.txt.tmp", "$tempdir/hello.txt"
+            or die "failed to rename file:$!";
+        is_deeply [ $fetch->("/hello.txt") ], [ 200, "good bye\n" ];
+    };
+
+    subtest "deleted" => sub {
+        unlink "$tempdir/hello.txt";
+        is +($fetch->("/hello.txt"))[0], 404;
+    };
+
+    subtest "created" => sub {
+        is +($fetch->("/new.txt"))[0], 404;
+        write_file("new.txt", "new\n");
+        is_deeply [ $fetch->("/new.txt") ], [ 200, "new\n" ];
+    };
+}
+
+subtest "ttl" => sub {
+    doit("filecache.ttl: 60");
+};
+
+subtest "content" => sub {
+    doit("filecache.content.capacity: 1048576");
+};
+
+subtest "ttl+content" => sub {
+    doit("filecache.ttl: 60\nfilecache.content.capacity: 1048576");
+};
+
+done_testing;
@@ -76,6 +76,7 @@ EOT
     my $orig_len = (stat 't/assets/doc_root/index.txt')[7];
     my $gz_len = (stat 't/assets/doc_root/index.txt.gz')[7];
     my $br_len = (stat 't/assets/doc_root/index.txt.br')[7];
+    my $zst_len = (stat 't/assets/doc_root/index.txt.zst')[7];
 
     $doit->(undef, "", $orig_len);
     $doit->(undef, q{--header "Accept-Encoding: gzip"}, $orig_len);
@@ -90,6 +91,9 @@ EOT
     $doit->("ON", q{--header "Accept-Encoding: br, gzip"}, $br_len);
     $doit->("ON", q{--header "Accept-Encoding: gzip, br"}, $br_len);
     $doit->("ON", q{--header "Accept-Encoding: br"}, $br_len);
+    $doit->("ON", q{--header "Accept-Encoding: zstd"}, $zst_len);
+    $doit->("ON", q{--header "Accept-Encoding: gzip, zstd"}, $zst_len);
+    $doit->("ON", q{--header "Accept-Encoding: zstd, br"}, $zst_len);
 
     subtest 'MSIE-workaround' => sub {
         my $server = spawn_h2o(<< "EOT");
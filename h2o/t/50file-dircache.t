@@ -0,0 +1,81 @@
+use strict;
+use warnings;
+use File::Temp qw(tempdir);
+use Test::More;
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $tempdir = tempdir(CLEANUP => 1);
+mkdir "$tempdir/listing";
+mkdir "$tempdir/index";
+
+my $create_file = sub {
+    my ($fn, $content) = @_;
+    open my $fh, ">", $fn
+        or die "failed to open file:$fn:$!";
+    print $fh $content;
+    close $fh;
+};
+# the entries are cached only if the directory has not been modified within the last second
+my $age_dir = sub {
+    my ($dir, $age) = @_;
+    my $t = time - ($age || 10);
+    utime $t, $t, $dir;
+};
+
+$create_file->("$tempdir/listing/alice.txt", "alice\n");
+$age_dir->("$tempdir/listing");
+$create_file->("$tempdir/index/index.txt", "index.txt\n");
+$create_file->("$tempdir/index/index.html", "index.html\n");
+$age_dir->("$tempdir/index");
+
+my $server = spawn_h2o(<< "EOT");
+filecache.dir.capacity: 1048576
+hosts:
+  default:
+    paths:
+      /:
+        file.dir: $tempdir
+        file.dirlisting: ON
+EOT
+
+my $fetch = sub {
+    my $path = shift;
+    my $resp = `curl --silent --dump-header /dev/stderr http://127.0.0.1:$server->{port}$path 2>&1`;
+    my ($headers, $body) = split /\r\n\r\n/, $resp, 2;
+    ($headers, $body);
+};
+
+subtest "listing" => sub {
+    for (1..3) {
+        my ($headers, $body) = $fetch->("/listing/");
+        like $headers, qr{^content-type:\s*text/html}mi, "content-type";
+        like $body, qr{alice\.txt}, "has alice.txt";
+    }
+    $create_file->("$tempdir/listing/bob.txt", "bob\n");
+    # use a different mtime than the first aging, which might have happened within the same second
+    $age_dir->("$tempdir/listing", 20);
+    my ($headers, $body) = $fetch->("/listing/");
+    like $body, qr{bob\.txt}, "file added to the directory";
+    $create_file->("$tempdir/listing/index.txt", "hello\n");
+    ($headers, $body) = $fetch->("/listing/");
+    is $body, "hello\n", "index file added to the directory";
+};
+
+subtest "index" => sub {
+    for (1..3) {
+        my ($headers, $body) = $fetch->("/index/");
+        is $body, "index.html\n", "index.html";
+    }
+    unlink "$tempdir/index/index.html";
+    my ($headers, $body) = $fetch->("/index/");
+    is $body, "index.txt\n", "index.html removed";
+    unlink "$tempdir/index/index.txt";
+    ($headers, $body) = $fetch->("/index/");
+    like $headers, qr{^content-type:\s*text/html}mi, "listing";
+    unlike $body, qr{index\.txt}, "index.txt removed";
+};
+
+done_testing;
@@ -0,0 +1,75 @@
+use strict;
+use warnings;
+use Digest::MD5 qw(md5_hex);
+use File::Temp qw(tempdir);
+use Test::More;
+use Time::HiRes qw(sleep);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $all_data = do {
+    open my $fh, "<", "@{[DOC_ROOT]}/halfdome.jpg"
+        or die "failed to open file:@{[DOC_ROOT]}/halfdome.jpg:$!";
+    local $/;
+    <$fh>;
+};
+
+my $tempdir = tempdir(CLEANUP => 1);
+
+my $server = spawn_h2o(<< "EOT");
+file.mmap: ON
+filecache.ttl: 60
+hosts:
+  default:
+    paths:
+      /:
+        file.dir: @{[ DOC_ROOT ]}
+      /tmp:
+        file.dir: $tempdir
+EOT
+
+run_with_curl($server, sub {
+    my ($proto, $port, $curl_cmd) = @_;
+    $curl_cmd .= " --silent --show-error";
+
+    subtest "file" => sub {
+        for (1..3) {
+            my $resp = `$curl_cmd $proto://127.0.0.1:$port/halfdome.jpg`;
+            is md5_hex($resp), md5_hex($all_data), "md5";
+        }
+    };
+
+    subtest "ranged" => sub {
+        my $resp = `$curl_cmd -r 100-499 $proto://127.0.0.1:$port/halfdome.jpg`;
+        is $resp, substr($all_data, 100, 400), "single";
+        $resp = `$curl_cmd -r 0-9,100-199 --dump-header /dev/stderr $proto://127.0.0.1:$port/halfdome.jpg 2>&1`;
+        like $resp, qr{^content-type:\s*multipart/byteranges}mi, "multi";
+        like $resp, qr{^content-range:\s*bytes 0-9/@{[length $all_data]}\r\n\r\n\Q@{[substr($all_data, 0, 10)]}\E\r\n}mi, "first part";
+        like $resp, qr{^content-range:\s*bytes 100-199/@{[length $all_data]}\r\n\r\n\Q@{[substr($all_data, 100, 100)]}\E\r\n--}mi,
+            "second part";
+    };
+
+    subtest "truncated while being sent" => sub {
+        my $fn = "$tempdir/large.bin";
+        open my $fh, ">", $fn
+            or die "failed to open file:$fn:$!";
+        print $fh '0' x (16 * 1024 * 1024);
+        close $fh;
+        open my $curl, "-|", "$curl_cmd --limit-rate 1M $proto://127.0.0.1:$port/tmp/large.bin | wc -c"
+            or die "failed to spawn curl:$!";
+        sleep 1;
+        truncate $fn, 1024;
+        my $received = <$curl>;
+        close $curl;
+        cmp_ok $received, '<', 16 * 1024 * 1024, "response is aborted";
+        $received = `$curl_cmd $proto://127.0.0.1:$port/tmp/large.bin | wc -c`;
+        is $received + 0, 1024, "file is mapped again";
+        my $resp = `$curl_cmd $proto://127.0.0.1:$port/halfdome.jpg`;
+        is md5_hex($resp), md5_hex($all_data), "server is alive";
+        unlink $fn;
+    };
+});
+
+done_testing;
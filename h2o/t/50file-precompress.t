@@ -0,0 +1,105 @@
+use strict;
+use warnings;
+use Digest::MD5 qw(md5_hex);
+use File::Temp qw(tempdir);
+use Test::More;
+use Time::HiRes qw(sleep);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $tempdir = tempdir(CLEANUP => 1);
+my $docdir = tempdir(CLEANUP => 1);
+
+my $server = spawn_h2o(<< "EOT");
+file.precompress.dir: $tempdir
+hosts:
+  default:
+    paths:
+      /:
+        file.dir: @{[DOC_ROOT]}
+        file.precompress: ON
+      /tmp:
+        file.dir: $docdir
+        file.precompress: ON
+EOT
+
+my $expected = md5_file("@{[DOC_ROOT]}/alice.txt");
+
+my $fetch = sub {
+    my $opts = shift;
+    my $resp = `curl --silent --dump-header /dev/stderr $opts http://127.0.0.1:$server->{port}/alice.txt 2>&1`;
+    my ($headers, $body) = split /\r\n\r\n/, $resp, 2;
+    ($headers, $body);
+};
+
+subtest "first request" => sub {
+    my ($headers, $body) = $fetch->("-H accept-encoding:gzip");
+    unlike $headers, qr{^content-encoding:}mi, "not compressed";
+    like $headers, qr{^vary:\s*accept-encoding}mi, "vary";
+    is md5_hex($body), $expected, "content";
+};
+
+subtest "compressed" => sub {
+    my $headers;
+    for (1..50) {
+        ($headers) = $fetch->("-H accept-encoding:gzip");
+        last if $headers =~ /^content-encoding:/mi;
+        sleep 0.1;
+    }
+    like $headers, qr{^content-encoding:\s*gzip}mi, "content-encoding";
+    my $resp = run_prog("curl --silent -H accept-encoding:gzip http://127.0.0.1:$server->{port}/alice.txt | gzip -cd");
+    is md5_hex($resp), $expected, "decompressed content";
+};
+
+subtest "revalidate" => sub {
+    my ($headers) = $fetch->("-H accept-encoding:gzip");
+    my ($etag) = $headers =~ /^etag:\s*(\S+)\r$/mi
+        or die "etag not found";
+    ($headers) = $fetch->("-H accept-encoding:gzip -H 'if-none-match: $etag'");
+    like $headers, qr{^HTTP/[0-9.]+ 304 }s, "304 for the etag of the compressed variant";
+    like $headers, qr{^etag:\s*\Q$etag\E\r$}mi, "etag";
+    ($headers) = $fetch->("");
+    my ($etag_identity) = $headers =~ /^etag:\s*(\S+)\r$/mi
+        or die "etag not found";
+    isnt $etag_identity, $etag, "etag of the original differs";
+    ($headers) = $fetch->("-H accept-encoding:gzip -H 'if-none-match: $etag_identity'");
+    like $headers, qr{^HTTP/[0-9.]+ 200 }s, "200 for the etag of the original";
+    like $headers, qr{^content-encoding:\s*gzip}mi, "compressed";
+};
+
+subtest "without accept-encoding" => sub {
+    my ($headers, $body) = $fetch->("");
+    unlike $headers, qr{^content-encoding:}mi, "not compressed";
+    is md5_hex($body), $expected, "content";
+};
+
+subtest "stale variants are removed" => sub {
+    my $write = sub {
+        open my $fh, ">", "$docdir/hello.txt"
+            or die "failed to open file:$docdir/hello.txt:$!";
+        print $fh $_[0] x 1000;
+        close $fh;
+    };
+    my $wait_compressed = sub {
+        for (1..50) {
+            my $headers = `curl --silent --dump-header /dev/stdout --output /dev/null -H accept-encoding:gzip http://127.0.0.1:$server->{port}/tmp/hello.txt`;
+            return 1 if $headers =~ /^content-encoding:/mi;
+            sleep 0.1;
+        }
+        0;
+    };
+    my %others = map { $_ => 1 } glob "$tempdir/*";
+    $write->("hello\n");
+    ok $wait_compressed->(), "compressed";
+    my @old = grep { !$others{$_} } glob "$tempdir/*";
+    ok @old != 0, "variants are stored";
+    $write->("hello world\n");
+    ok $wait_compressed->(), "compressed after modification";
+    ok !(grep { -e $_ } @old), "variants of the old version are removed";
+    ok +(grep { !$others{$_} } glob "$tempdir/*") != 0, "variants of the new version exist";
+    ok !(grep { !-e $_ } keys %others), "variants of other files are retained";
+};
+
+done_testing;
@@ -0,0 +1,116 @@
+use strict;
+use warnings;
+use IO::Select;
+use IO::Socket::INET;
+use JSON qw(decode_json);
+use Test::More;
+use Time::HiRes qw(sleep);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+overload-max-loop-lag: 10
+overload-retry-after: 7
+hosts:
+  default:
+    paths:
+      /:
+        file.dir: @{[ DOC_ROOT ]}
+      /s:
+        status: ON
+EOT
+
+sub connect_server {
+    my $sock = IO::Socket::INET->new(
+        PeerAddr => "127.0.0.1",
+        PeerPort => $server->{port},
+        Proto    => "tcp",
+    ) or die "failed to connect to server:$!";
+    $sock->autoflush(1);
+    $sock;
+}
+
+sub read_exact {
+    my ($sock, $len) = @_;
+    my $buf = '';
+    while (length($buf) < $len) {
+        die "timeout"
+            unless IO::Select->new($sock)->can_read(5);
+        my $rret = sysread $sock, $buf, $len - length($buf), length($buf);
+        die "connection closed"
+            unless $rret;
+    }
+    $buf;
+}
+
+# HTTP/1: sends a request and returns the response headers, using the given keep-alive connection
+sub h1_request {
+    my $sock = shift;
+    syswrite $sock, "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    my $resp = '';
+    $resp .= read_exact($sock, 1)
+        until $resp =~ /\r\n\r\n$/s;
+    my $content_length = $resp =~ /^content-length:\s*([0-9]+)/im ? $1 : 0;
+    read_exact($sock, $content_length);
+    $resp;
+}
+
+# HTTP/2 (prior knowledge): sends a GET request on the given stream, and returns the type and payload of the frame that answers it
+sub h2_frame {
+    my ($type, $flags, $stream_id, $payload) = @_;
+    substr(pack("N", length $payload), 1) . pack("CCN", $type, $flags, $stream_id) . $payload;
+}
+sub h2_request {
+    my ($sock, $stream_id) = @_;
+    # :method GET, :scheme http, :path /, :authority 127.0.0.1
+    my $headers = "\x82\x86\x84\x01\x09127.0.0.1";
+    syswrite $sock, h2_frame(1, 0x5, $stream_id, $headers);
+    while (1) {
+        my ($len_hi, $len_lo, $type, $flags, $frame_stream_id) = unpack "CnCCN", read_exact($sock, 9);
+        my $payload = read_exact($sock, ($len_hi << 16) | $len_lo);
+        # acknowledge the settings sent by the server
+        syswrite $sock, h2_frame(4, 0x1, 0, "")
+            if $type == 4 && ($flags & 0x1) == 0;
+        return ($type, $payload)
+            if $frame_stream_id == $stream_id && ($type == 1 || $type == 3);
+    }
+}
+
+# stop the server long enough for the timers to be delayed, so that the thread is considered overloaded once it resumes
+sub overload {
+    kill 'STOP', $server->{pid};
+    sleep 2;
+    kill 'CONT', $server->{pid};
+    sleep 0.3;
+}
+
+my $h1 = connect_server();
+like h1_request($h1), qr{^HTTP/1\.1 200 }s, "HTTP/1 request succeeds";
+
+my $h2 = connect_server();
+syswrite $h2, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" . h2_frame(4, 0, 0, "");
+is +(h2_request($h2, 1))[0], 1, "HTTP/2 request succeeds";
+
+overload();
+
+my $resp = h1_request($h1);
+like $resp, qr{^HTTP/1\.1 503 }s, "HTTP/1 request is shed";
+like $resp, qr{^retry-after:\s*7\r$}im, "retry-after";
+like $resp, qr{^connection:\s*close\r$}im, "connection is closed";
+
+my ($type, $payload) = h2_request($h2, 3);
+is $type, 3, "HTTP/2 stream is reset";
+is unpack("N", $payload), 7, "REFUSED_STREAM";
+
+# the thread accepts requests once the load goes away
+sleep 3;
+like `curl --silent --dump-header /dev/stdout --output /dev/null http://127.0.0.1:$server->{port}/`, qr{^HTTP/1\.1 200 }s,
+    "request succeeds after recovery";
+my $events = decode_json(`curl --silent http://127.0.0.1:$server->{port}/s/json?show=events`);
+is $events->{'overload.episodes'}, 1, "episode is counted";
+is $events->{'overload.shed-requests'}, 2, "shed requests are counted";
+
+done_testing();
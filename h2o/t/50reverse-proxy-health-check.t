@@ -0,0 +1,71 @@
+use strict;
+use warnings;
+use JSON;
+use Net::EmptyPort qw(check_port empty_port);
+use Test::More;
+use Time::HiRes qw(sleep);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+plan skip_all => 'plackup not found'
+    unless prog_exists('plackup');
+plan skip_all => 'Starlet not found'
+    unless system('perl -MStarlet /dev/null > /dev/null 2>&1') == 0;
+
+my $upstream_port = empty_port();
+
+sub spawn_upstream {
+    return spawn_server(
+        argv     => [
+            qw(plackup -s Starlet --access-log /dev/null -p), $upstream_port, ASSETS_DIR . "/upstream.psgi",
+        ],
+        is_ready => sub {
+            check_port($upstream_port);
+        },
+    );
+}
+
+my $server = spawn_h2o(<< "EOT");
+num-threads: 4
+hosts:
+  default:
+    paths:
+      /:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port
+        proxy.timeout.io: 1000
+        proxy.health-check.path: /index.txt
+        proxy.health-check.interval: 200
+        proxy.health-check.slow-start: 0
+      /s:
+        status: ON
+EOT
+
+sub fetch_status {
+    my $resp = `curl --silent http://127.0.0.1:$server->{port}/s/json?show=upstreams`;
+    my $upstreams = decode_json($resp)->{upstreams};
+    return $upstreams->[0];
+}
+
+sub fetch_code {
+    return `curl --max-time 5 --silent -o /dev/null -w '%{http_code}' http://127.0.0.1:$server->{port}/index.txt`;
+}
+
+my $upstream = spawn_upstream();
+sleep 1;
+is fetch_status()->{state}, "healthy", "healthy while the upstream is running";
+is fetch_code(), "200", "request is forwarded";
+
+undef $upstream;
+sleep 1;
+my $status = fetch_status();
+is $status->{state}, "unhealthy", "marked down once the upstream is gone";
+cmp_ok $status->{'probe-failures'}, '>=', 1, "probe failures are counted";
+is fetch_code(), "503", "503 while the upstream is down";
+
+$upstream = spawn_upstream();
+sleep 1;
+is fetch_status()->{state}, "healthy", "re-admitted once the upstream is back";
+is fetch_code(), "200", "request is forwarded again";
+
+done_testing();
@@ -0,0 +1,123 @@
+use strict;
+use warnings;
+use Digest::MD5 qw(md5_hex);
+use File::Temp qw(tempdir);
+use Net::EmptyPort qw(check_port empty_port);
+use Test::More;
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+my $tempdir = tempdir(CLEANUP => 1);
+
+# h2o is used as the upstream, since it accepts HTTP/2 over cleartext TCP (prior knowledge) as well as over TLS
+my $echo_conf = server_features()->{mruby} ? << 'EOT' : "";
+      "/echo":
+        mruby.handler: |
+          Proc.new do |env|
+            [200, {}, [env["rack.input"] ? env["rack.input"].read : ""]]
+          end
+EOT
+my $upstream = spawn_h2o(<< "EOT");
+access-log:
+  path: $tempdir/upstream-access.log
+  format: "%H %U"
+hosts:
+  default:
+    paths:
+$echo_conf
+      "/":
+        file.dir: @{[ DOC_ROOT ]}
+EOT
+
+sub read_upstream_log {
+    open my $fh, "<", "$tempdir/upstream-access.log"
+        or die "failed to open $tempdir/upstream-access.log:$!";
+    my @lines = <$fh>;
+    truncate "$tempdir/upstream-access.log", 0;
+    return @lines;
+}
+
+sub doit {
+    my $upstream_url = shift;
+    my $server = spawn_h2o(<< "EOT");
+hosts:
+  default:
+    paths:
+      "/":
+        proxy.reverse.url: $upstream_url
+        proxy.http2: ON
+        proxy.ssl.verify-peer: OFF
+EOT
+    run_with_curl($server, sub {
+        my ($proto, $port, $curl) = @_;
+        subtest "single" => sub {
+            my $resp = `$curl --silent --dump-header /dev/stderr $proto://127.0.0.1:$port/index.txt 2>&1`;
+            like $resp, qr{^HTTP/[^ ]* 200\s}is;
+            like $resp, qr{^content-length:\s*6\r$}im;
+            like $resp, qr{\r\n\r\nhello\n$}s;
+        };
+        subtest "large file" => sub {
+            my $resp = `$curl --silent $proto://127.0.0.1:$port/halfdome.jpg`;
+            is md5_hex($resp), md5_file(DOC_ROOT . "/halfdome.jpg");
+        };
+        subtest "multiplexed" => sub {
+            my $resp = `$curl --silent @{[ join " ", map { "$proto://127.0.0.1:$port/index.txt" } 1..10 ]}`;
+            is $resp, "hello\n" x 10;
+        };
+        subtest "not found" => sub {
+            my $resp = `$curl --silent --dump-header /dev/stdout $proto://127.0.0.1:$port/nonexistent`;
+            like $resp, qr{^HTTP/[^ ]* 404\s}is;
+        };
+        subtest "post" => sub {
+            plan skip_all => "mruby support is off"
+                unless server_features()->{mruby};
+            my $resp = `$curl --silent --data-binary \@@{[ DOC_ROOT ]}/alice.txt $proto://127.0.0.1:$port/echo`;
+            is md5_hex($resp), md5_file(DOC_ROOT . "/alice.txt");
+        };
+        my @log = read_upstream_log();
+        ok @log != 0, "upstream received requests";
+        is scalar(grep { !m{^HTTP/2 } } @log), 0, "all requests were forwarded using HTTP/2";
+    });
+}
+
+subtest "h2c" => sub {
+    doit("h2c://127.0.0.1:$upstream->{port}");
+};
+
+subtest "https" => sub {
+    plan skip_all => "openssl does not support ALPN"
+        unless openssl_can_negotiate();
+    doit("https://127.0.0.1:$upstream->{tls_port}");
+};
+
+subtest "upstream without HTTP/2" => sub {
+    plan skip_all => 'plackup not found'
+        unless prog_exists('plackup');
+    my $upstream_port = empty_port();
+    my $upstream_h1 = spawn_server(
+        argv => [
+            qw(
+                plackup -s Standalone --ssl=1 --ssl-key-file=examples/h2o/server.key --ssl-cert-file=examples/h2o/server.crt --port
+            ),
+            $upstream_port, ASSETS_DIR . "/upstream.psgi"
+        ],
+        is_ready => sub {
+            check_port($upstream_port);
+        },
+    );
+    my $server = spawn_h2o(<< "EOT");
+hosts:
+  default:
+    paths:
+      "/":
+        proxy.reverse.url: https://127.0.0.1:$upstream_port
+        proxy.http2: ON
+        proxy.ssl.verify-peer: OFF
+EOT
+    my $resp = `curl --silent --dump-header /dev/stdout http://127.0.0.1:$server->{port}/index.txt`;
+    like $resp, qr{^HTTP/1\.1 502\s}is, "502 if ALPN does not select h2";
+};
+
+done_testing();
@@ -0,0 +1,83 @@
+use strict;
+use warnings;
+use IO::Socket::INET;
+use Net::EmptyPort qw(empty_port);
+use Test::More;
+use Time::HiRes qw(sleep);
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+# the upstream only accepts the connections, so that the number of connections being established can be observed
+my $upstream_port = empty_port();
+my $upstream = IO::Socket::INET->new(
+    LocalAddr => '127.0.0.1',
+    LocalPort => $upstream_port,
+    Listen    => 128,
+    ReuseAddr => 1,
+) or die "failed to listen to port $upstream_port:$!";
+$upstream->blocking(0);
+
+sub count_accepts {
+    my $conns = shift;
+    while (my $sock = $upstream->accept) {
+        push @$conns, $sock;
+    }
+    return scalar @$conns;
+}
+
+subtest "connections are established without requests" => sub {
+    my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+hosts:
+  default:
+    paths:
+      /:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port
+        proxy.timeout.keepalive: 10000
+        proxy.prewarm.min-idle: 3
+EOT
+    my @conns;
+    sleep 1;
+    is count_accepts(\@conns), 3, "min-idle connections are established";
+    sleep 1;
+    is count_accepts(\@conns), 3, "no more connections while they are idle";
+};
+
+subtest "rate limit" => sub {
+    my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+hosts:
+  default:
+    paths:
+      /:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port
+        proxy.timeout.keepalive: 10000
+        proxy.prewarm.min-idle: 20
+        proxy.prewarm.connect-rate: 5
+EOT
+    my @conns;
+    sleep 0.5;
+    cmp_ok count_accepts(\@conns), '<=', 8, "connections are established gradually";
+    sleep 3;
+    is count_accepts(\@conns), 20, "all the connections are eventually established";
+};
+
+subtest "recycled before timeout" => sub {
+    my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+hosts:
+  default:
+    paths:
+      /:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port
+        proxy.timeout.keepalive: 2000
+        proxy.prewarm.min-idle: 1
+EOT
+    my @conns;
+    sleep 3.2;
+    cmp_ok count_accepts(\@conns), '>=', 2, "the idle connection is replaced";
+};
+
+done_testing();
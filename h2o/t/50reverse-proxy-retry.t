@@ -0,0 +1,98 @@
+use strict;
+use warnings;
+use IO::Socket::INET;
+use JSON qw(decode_json);
+use Net::EmptyPort qw(empty_port);
+use Test::More;
+use t::Util;
+
+plan skip_all => 'curl not found'
+    unless prog_exists('curl');
+
+# the upstream closes the connection without sending a response when it receives the second request on a connection, emulating
+# a race between the upstream closing an idle keep-alive connection and the proxy reusing it
+my $upstream_port = empty_port();
+my $upstream_listener = IO::Socket::INET->new(
+    LocalAddr => '127.0.0.1',
+    LocalPort => $upstream_port,
+    Listen    => 128,
+    ReuseAddr => 1,
+) or die "failed to listen to port $upstream_port:$!";
+my $upstream_pid = fork;
+die "fork failed:$!"
+    unless defined $upstream_pid;
+if ($upstream_pid == 0) {
+    while (my $conn = $upstream_listener->accept) {
+        for (my $num_reqs = 1; ; ++$num_reqs) {
+            my $req = '';
+            while ($req !~ /\r\n\r\n/s) {
+                last unless $conn->sysread($req, 4096, length $req);
+            }
+            last unless $req =~ /\r\n\r\n/s;
+            if ($req =~ /^content-length:\s*(\d+)\r$/im) {
+                my $body_len = $1 - (length($req) - index($req, "\r\n\r\n") - 4);
+                while ($body_len > 0) {
+                    my $n = $conn->sysread(my $buf, $body_len);
+                    last unless $n;
+                    $body_len -= $n;
+                }
+            }
+            last if $num_reqs == 2;
+            $conn->syswrite("HTTP/1.1 200 OK\r\ncontent-length: 6\r\nconnection: keep-alive\r\n\r\nhello\n");
+        }
+        $conn->close;
+    }
+    exit 0;
+}
+undef $upstream_listener;
+my $upstream_guard = Scope::Guard->new(sub {
+    kill 'KILL', $upstream_pid;
+    waitpid $upstream_pid, 0;
+});
+
+sub doit {
+    my ($retry, $cb) = @_;
+    my $server = spawn_h2o(<< "EOT");
+num-threads: 1
+hosts:
+  default:
+    paths:
+      /:
+        proxy.reverse.url: http://127.0.0.1:$upstream_port
+        proxy.timeout.keepalive: 10000
+        proxy.retry: @{[ $retry ? "ON" : "OFF" ]}
+      /s:
+        status: ON
+EOT
+    my $fetch = sub {
+        my $opts = shift || '';
+        my $resp = `curl --silent --dump-header /dev/stdout $opts http://127.0.0.1:$server->{port}/`;
+        $resp =~ m{^HTTP/[0-9.]+ ([0-9]+)}s ? $1 : 0;
+    };
+    my $events = sub {
+        decode_json(`curl --silent http://127.0.0.1:$server->{port}/s/json?show=events`);
+    };
+    $cb->($fetch, $events);
+}
+
+subtest "retry" => sub {
+    doit(1, sub {
+        my ($fetch, $events) = @_;
+        is $fetch->(), 200, "first request";
+        is $fetch->(), 200, "request using the closed connection is resent";
+        is $events->()->{'proxy.retries'}, 1, "retry is counted";
+        is $fetch->("--data hello"), 502, "non-idempotent request is not resent";
+        is $events->()->{'proxy.retries'}, 1, "no more retries";
+    });
+};
+
+subtest "no retry" => sub {
+    doit(0, sub {
+        my ($fetch, $events) = @_;
+        is $fetch->(), 200, "first request";
+        is $fetch->(), 502, "request using the closed connection fails";
+        is $events->()->{'proxy.retries'}, 0, "no retries";
+    });
+};
+
+done_testing();